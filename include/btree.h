@@ -38,6 +38,8 @@ typedef struct BTree
 	uint32 degree;
 	/** 每个键的字节数 */
 	uint32 keyLen;
+	/** 键的比较函数：创建时按keyLen选择（getKeyCompare） */
+	KeyCompare keyCompare;
 	/** 每个值的字节数 */
 	uint32 valueLen;
 	/** 目前树的深度 */
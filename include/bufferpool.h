@@ -0,0 +1,181 @@
+/*****************************************************************************
+ * Copyright (c) 2018, rectcircle. All rights reserved.
+ *
+ * 固定帧数的缓冲池：每一帧存放一个页（value），记录固定计数（pin）、脏标志和CLOCK访问位
+ *
+ * 与LRUCache的区别：
+ * 被固定（pinCount>0）或脏的帧不会被淘汰，调用者持有的页在unpin之前一直有效
+ * 淘汰采用CLOCK算法：时钟指针扫过访问位为1的帧时清零，淘汰第一个访问位为0、未固定、不脏的帧
+ * 帧的元数据存放在连续数组中，命中只需一次hash查找，不移动链表节点
+ *
+ * 内存管理方式为：
+ * key拷贝存放在帧中；value交由调用者管理，淘汰、删除时返回value由调用者释放
+ *
+ * 帧数固定不变：所有帧都被固定或为脏时放入失败（fullCnt计数），调用者需要等待其他使用者解除固定，
+ * 或者在放入之前保证有足够的可用帧（availableBufferPool，例如脏帧达到上限时持久化）
+ *
+ * 该结构不是线程安全的，由调用者加锁
+ *
+ * @filename: bufferpool.h
+ * @description: 缓冲池结构与函数声明
+ * @author: Rectcircle
+ * @version: 1.0
+ * @date: 2026-10-17
+ ******************************************************************************/
+#pragma once
+#ifndef __BUFFERPOOL_H__
+#define __BUFFERPOOL_H__
+
+#include "global.h"
+#include "util.h"
+
+/*****************************************************************************
+ * 宏定义
+ ******************************************************************************/
+
+/** 表示不存在的帧号（空闲链表、hash链的结尾） */
+#define BUFFER_POOL_NIL 0xffffffffu
+
+/*****************************************************************************
+ * 结构定义
+ ******************************************************************************/
+
+/** 缓冲池的一帧 */
+typedef struct BufferFrame
+{
+	/** 帧中存放的页，NULL表示空闲帧 */
+	void *value;
+	/** 固定计数，大于0时不会被淘汰 */
+	uint32 pinCount;
+	/** hash链（空闲时为空闲链表）的下一帧 */
+	uint32 after;
+	/** 脏标志，为1时不会被淘汰 */
+	uint8 dirty;
+	/** CLOCK访问位 */
+	uint8 reference;
+} BufferFrame;
+
+/** 缓冲池定义 */
+typedef struct BufferPool
+{
+	/** 帧的数目 */
+	uint32 capacity;
+	/** 已使用的帧数目 */
+	uint32 size;
+	/** 每个键的字节数 */
+	uint32 keyLen;
+	/** hashtable桶数组的长度，值为2^n，且大于等于capacity */
+	uint32 bucketCapacity;
+	/** hashtable的桶数组，存放帧号 */
+	uint32 *table;
+	/** 帧数组 */
+	BufferFrame *frames;
+	/** 帧的key，第i帧的key在keys+i*keyLen */
+	uint8 *keys;
+	/** 空闲帧链表的头 */
+	uint32 freeHead;
+	/** CLOCK时钟指针 */
+	uint32 hand;
+	/** 固定计数大于0的帧数目 */
+	uint32 pinnedCnt;
+	/** 脏帧数目 */
+	uint32 dirtyCnt;
+	/** 被固定或为脏（不能淘汰）的帧数目 */
+	uint32 blockedCnt;
+	/** 因所有帧被固定或为脏而放入失败的次数 */
+	uint32 fullCnt;
+} BufferPool;
+
+/*****************************************************************************
+ * 类型定义
+ ******************************************************************************/
+
+/** 遍历函数，返回非NULL时停止遍历 */
+typedef void *(*ForeachBufferPoolFunction)(uint32 frame, uint8 *key, void *value, void *args);
+
+/*****************************************************************************
+ * 公开API
+ ******************************************************************************/
+
+/**
+ * 创建一个缓冲池
+ * @param capacity 帧的数目
+ * @param keyLen   key的字节数
+ * @return {BufferPool*} 一个可用的缓冲池，capacity为0时返回NULL
+ */
+BufferPool *makeBufferPool(uint32 capacity, uint32 keyLen);
+
+/**
+ * 释放缓冲池，不会释放帧中的value
+ */
+void freeBufferPool(BufferPool *pool);
+
+/**
+ * 查找key所在的帧，找到时固定该帧（pinCount+1）并设置访问位
+ * @param pool 缓冲池
+ * @param key 键
+ * @param frame 输出：帧号，可以为NULL
+ * @return {void*} 帧中的value，不存在返回NULL
+ */
+void *pinBufferPool(BufferPool *pool, uint8 *key, uint32 *frame);
+
+/**
+ * 将一个不在缓冲池中的key放入一帧，该帧被固定一次
+ * 没有空闲帧时使用CLOCK淘汰一个未固定、不脏的帧，所有帧都被固定或为脏时不放入
+ * @param pool 缓冲池
+ * @param key 键
+ * @param value 值
+ * @param frame 输出：帧号，没有可用的帧时为BUFFER_POOL_NIL，可以为NULL
+ * @return {void*} 被淘汰的value（由调用者释放）或者NULL
+ */
+void *putBufferPool(BufferPool *pool, uint8 *key, void *value, uint32 *frame);
+
+/**
+ * 解除一次固定
+ * @param pool 缓冲池
+ * @param frame 帧号
+ */
+void unpinBufferPool(BufferPool *pool, uint32 frame);
+
+/**
+ * 设置帧的脏标志
+ * @param pool 缓冲池
+ * @param frame 帧号
+ * @param dirty 1 脏，0 与磁盘一致
+ */
+void setDirtyBufferPool(BufferPool *pool, uint32 frame, int8 dirty);
+
+/**
+ * 替换一帧的value，例如先放入占位的value，读入完成后替换为真正的value
+ * @param pool 缓冲池
+ * @param frame 帧号
+ * @param value 新的值
+ */
+void setValueBufferPool(BufferPool *pool, uint32 frame, void *value);
+
+/**
+ * 从缓冲池中删除key所在的帧，被固定的帧不能删除（持有者之后还会解除固定）
+ * @param pool 缓冲池
+ * @param key 键
+ * @return {void*} 被删除的value，不存在或者被固定时返回NULL
+ */
+void *removeBufferPool(BufferPool *pool, uint8 *key);
+
+/**
+ * 可以用于放入新key的帧数目：空闲帧和未固定、不脏的帧
+ * @param pool 缓冲池
+ * @return {uint32} 可用的帧数目
+ */
+uint32 availableBufferPool(BufferPool *pool);
+
+/**
+ * 遍历所有使用中的帧，遍历期间不能插入，允许删除当前帧
+ * 当func返回非NULL时停止并返回该值
+ * @param pool 缓冲池
+ * @param func 执行函数
+ * @param args 外部参数（代替闭包）
+ * @return func的返回值或者NULL
+ */
+void *foreachBufferPool(BufferPool *pool, ForeachBufferPoolFunction func, void *args);
+
+#endif
@@ -0,0 +1,64 @@
+/*****************************************************************************
+ * Copyright (c) 2018, rectcircle. All rights reserved.
+ *
+ * 实现一个无外部依赖的LZ类块压缩算法，用于压缩存储引擎中的记录
+ *
+ * 压缩格式（与LZ4块格式类似）：
+ * 由若干序列组成，每个序列为：
+ *   token:1 高4位为字面量长度，低4位为匹配长度-4，值为15时后面跟随扩展长度（若干个255和一个小于255的字节）
+ *   字面量
+ *   offset:2 匹配位置到当前位置的距离（小端序），最后一个序列只有字面量，没有offset和匹配
+ *
+ * @filename: compress.h
+ * @description: 块压缩API
+ * @author: Rectcircle
+ * @version: 1.0
+ * @date: 2026-10-17
+ ******************************************************************************/
+#pragma once
+#ifndef __COMPRESS_H__
+#define __COMPRESS_H__
+
+#include "global.h"
+
+/*****************************************************************************
+ * 宏定义
+ ******************************************************************************/
+
+/** 最短匹配长度 */
+#define LZ_MIN_MATCH 4
+/** 最大匹配距离 */
+#define LZ_MAX_OFFSET 65535
+
+/*****************************************************************************
+ * 公开API
+ ******************************************************************************/
+
+/**
+ * 压缩srcLen字节的数据在最坏情况下的输出长度
+ * @param srcLen 原数据长度
+ * @return {uint32} 最大压缩后长度
+ */
+uint32 lzCompressBound(uint32 srcLen);
+
+/**
+ * 压缩一个数据块
+ * @param src 原数据
+ * @param srcLen 原数据长度
+ * @param dest 输出缓冲区
+ * @param destCap 输出缓冲区长度
+ * @return {uint32} 压缩后的长度，输出缓冲区不足时返回0（调用者可以据此判断数据不可压缩）
+ */
+uint32 lzCompress(const uint8 *src, uint32 srcLen, uint8 *dest, uint32 destCap);
+
+/**
+ * 解压一个数据块
+ * @param src 压缩数据
+ * @param srcLen 压缩数据长度
+ * @param dest 输出缓冲区
+ * @param destCap 输出缓冲区长度
+ * @return {int32} 解压后的长度，数据损坏或输出缓冲区不足时返回-1
+ */
+int32 lzDecompress(const uint8 *src, uint32 srcLen, uint8 *dest, uint32 destCap);
+
+#endif
@@ -0,0 +1,249 @@
+/*****************************************************************************
+ * Copyright (c) 2018, rectcircle. All rights reserved.
+ *
+ * Hash引擎的磁盘索引：key -> (position, size, blobSize)，存放在文件中，用于key的数目超过内存的表
+ *
+ * 采用线性哈希：桶数目每次增加一个（分裂splitIndex指向的桶），不需要目录，
+ * 每个桶是一个页（DISK_INDEX_PAGE_SIZE字节），装不下时链接溢出页；
+ * 条目的总字节数超过桶容量的0.75时分裂一个桶，分裂时重新整理该桶的溢出链
+ *
+ * 页号的分配（与Berkeley DB的hash访问方法相同）：
+ * 桶按照2的幂分组，第0组为桶0，第g组为桶[2^(g-1), 2^g)，每组的桶页连续存放，
+ * 某一组期间分配的溢出页放在该组全部桶页（包括还没有创建的桶）之后，
+ * 因此桶b的页号为 1 + b + (第b所在组之前分配的溢出页数目)，只需要在头部记录每组的溢出页数目
+ * 空闲的溢出页组成链表，分配时优先重用
+ *
+ * 页通过LRU缓存访问，修改过的页在淘汰或syncDiskIndex时写回，内存占用由缓存容量决定
+ *
+ * 崩溃一致性：第一次写回页之前将头部标记为未同步并fdatasync，syncDiskIndex写回所有页并同步之后再清除标记，
+ * 加载时头部带有未同步标记说明上次写回页的过程中崩溃，索引结构可能不完整，loadDiskIndex返回NULL，由调用者重建
+ *
+ * 文件格式（数值为网络字节序）：
+ * 页0为头部：magic:4, version:4, dirty:4, pageSize:4, level:4, splitIndex:4, freeHead:4, checksum:4,
+ *   count:8, usedBytes:8, userData:8*DISK_INDEX_USER_DATA_COUNT, overflowCounts:4*(DISK_INDEX_MAX_LEVEL+1)
+ * 桶页和溢出页：next:4（溢出链中下一页的页号，0表示没有）, count:2, used:2, 条目
+ *   条目：hash:4, keyLen:2, position:8, size:4, blobSize:4, key:keyLen
+ * 空闲页的前4字节为空闲链表中下一页的页号
+ *
+ * 该结构不是线程安全的，由调用者加锁
+ *
+ * @filename: diskindex.h
+ * @description: Hash引擎磁盘索引结构与函数声明
+ * @author: Rectcircle
+ * @version: 1.0
+ * @date: 2026-10-17
+ ******************************************************************************/
+#pragma once
+#ifndef __DISKINDEX_H__
+#define __DISKINDEX_H__
+#include "global.h"
+#include "lrucache.h"
+
+/*****************************************************************************
+ * 宏定义
+ ******************************************************************************/
+
+/** 页大小 */
+#define DISK_INDEX_PAGE_SIZE 4096
+/** 页头部（next+count+used）长度 */
+#define DISK_INDEX_PAGE_HEADER_SIZE 8
+/** 条目头部（hash+keyLen+position+size+blobSize）长度 */
+#define DISK_INDEX_ENTRY_HEADER_SIZE 22
+/** key的最大长度，保证一页至少可以存放3个条目 */
+#define DISK_INDEX_MAX_KEY_SIZE 1024
+/** 头部中由使用者定义的数值个数 */
+#define DISK_INDEX_USER_DATA_COUNT 4
+/** 最大的分裂轮数，桶数目不超过2^DISK_INDEX_MAX_LEVEL */
+#define DISK_INDEX_MAX_LEVEL 31
+
+/*****************************************************************************
+ * 结构定义
+ ******************************************************************************/
+
+/**
+ * 索引中保存的值：记录在数据文件中的位置
+ */
+typedef struct DiskIndexValue
+{
+	/** 文件偏移量 */
+	uint64 position;
+	/** 记录在文件中占用的字节数 */
+	uint32 size;
+	/** value存放在blob文件中时为value的字节数，否则为0 */
+	uint32 blobSize;
+} DiskIndexValue;
+
+/**
+ * 缓存中的一个页
+ */
+typedef struct DiskIndexPage
+{
+	/** 页号 */
+	uint32 pageNo;
+	/** 是否被修改过（需要写回） */
+	int32 dirty;
+	/** 页内容 */
+	uint8 data[DISK_INDEX_PAGE_SIZE];
+} DiskIndexPage;
+
+/** 磁盘索引定义 */
+typedef struct DiskIndex
+{
+	/** 索引文件位置 */
+	char *filename;
+	/** 索引文件描述符 */
+	int fd;
+	/** 索引中key的数目 */
+	uint64 count;
+	/** 所有条目占用的字节数，用于决定何时分裂 */
+	uint64 usedBytes;
+	/** 分裂轮数：桶数目为2^level + splitIndex */
+	uint32 level;
+	/** 下一个要分裂的桶 */
+	uint32 splitIndex;
+	/** 空闲溢出页链表头，0表示没有 */
+	uint32 freeHead;
+	/** 每一组期间分配的溢出页数目 */
+	uint32 overflowCounts[DISK_INDEX_MAX_LEVEL + 1];
+	/** 由使用者定义的数值，在syncDiskIndex时与索引一起持久化 */
+	uint64 userData[DISK_INDEX_USER_DATA_COUNT];
+	/** 磁盘上的头部是否带有未同步标记 */
+	int32 dirty;
+	/** 缓存中被修改过的页数目 */
+	uint32 dirtyPages;
+	/** 上次同步之后头部中的字段是否被修改过 */
+	int32 headerChanged;
+	/** 页缓存 <页号, DiskIndexPage> */
+	LRUCache *pages;
+	/** 从文件中读取的页数 */
+	uint64 pageReads;
+	/** 写回文件的页数 */
+	uint64 pageWrites;
+	/** 修改时读写页失败后置1：内存中的索引可能不完整，syncDiskIndex不再清除磁盘上的未同步标记 */
+	int32 failed;
+} DiskIndex;
+
+/*****************************************************************************
+ * 类型定义
+ ******************************************************************************/
+
+/** 遍历函数，返回非NULL时停止遍历 */
+typedef void *(*ForeachDiskIndexFunction)(uint32 keyLen, uint8 *key, DiskIndexValue *value, void *args);
+
+/*****************************************************************************
+ * 公开API
+ ******************************************************************************/
+
+/**
+ * 创建一个空的磁盘索引，同名文件存在时覆盖
+ * @param filename 索引文件位置
+ * @param cacheCap 页缓存的页数（至少为4）
+ * @return {DiskIndex*} 磁盘索引，创建文件失败返回NULL
+ */
+DiskIndex *makeDiskIndex(const char *filename, uint32 cacheCap);
+
+/**
+ * 加载一个磁盘索引
+ * @param filename 索引文件位置
+ * @param cacheCap 页缓存的页数（至少为4）
+ * @return {DiskIndex*} 磁盘索引，文件不存在、损坏或者上次没有同步完成时返回NULL
+ */
+DiskIndex *loadDiskIndex(const char *filename, uint32 cacheCap);
+
+/**
+ * 释放磁盘索引，不写回修改过的页（需要保留修改时先调用syncDiskIndex）
+ */
+void freeDiskIndex(DiskIndex *index);
+
+/**
+ * 查找key
+ * @param index 磁盘索引
+ * @param keyLen 键的长度
+ * @param key 键
+ * @param value 用于存放找到的值
+ * @return 1 找到，0 不存在，-1 读取页失败
+ */
+int32 getDiskIndex(DiskIndex *index, uint32 keyLen, uint8 *key, DiskIndexValue *value);
+
+/**
+ * 插入或更新一个key
+ * @param index 磁盘索引
+ * @param keyLen 键的长度，不能超过DISK_INDEX_MAX_KEY_SIZE
+ * @param key 键
+ * @param value 值
+ * @return 1 新插入，0 更新已有的key，-1 key过长或者读写页失败（之后索引不再同步）
+ */
+int32 putDiskIndex(DiskIndex *index, uint32 keyLen, uint8 *key, DiskIndexValue *value);
+
+/**
+ * 删除一个key
+ * @param index 磁盘索引
+ * @param keyLen 键的长度
+ * @param key 键
+ * @return 1 删除成功，0 不存在，-1 读写页失败（之后索引不再同步）
+ */
+int32 removeDiskIndex(DiskIndex *index, uint32 keyLen, uint8 *key);
+
+/**
+ * 按桶的顺序遍历磁盘索引，遍历期间不能修改，当func返回非NULL时停止并返回该值，读取页失败时停止并返回NULL
+ * @param index 磁盘索引
+ * @param func 执行函数
+ * @param args 外部参数（代替闭包）
+ * @return func的返回值或者NULL
+ */
+void *foreachDiskIndex(DiskIndex *index, ForeachDiskIndexFunction func, void *args);
+
+/**
+ * 将磁盘上的头部标记为未同步并fdatasync，此后崩溃时loadDiskIndex返回NULL，直到下一次syncDiskIndex
+ * 写回页之前自动调用，调用者也可以用来使磁盘上的索引失效（例如切换对应的数据文件之前）
+ * @param index 磁盘索引
+ * @return 1 成功，0 写入失败
+ */
+int32 markDirtyDiskIndex(DiskIndex *index);
+
+/**
+ * 写回所有修改过的页并同步，然后写入头部（包括userData）并清除未同步标记
+ * 没有任何修改时不进行I/O；之前的修改读写页失败时直接返回0，崩溃或关闭后加载时返回NULL（需要重建）
+ * @param index 磁盘索引
+ * @param userData 与索引一起持久化的DISK_INDEX_USER_DATA_COUNT个数值，为NULL时保持不变
+ * @return 1 成功，0 写入失败
+ */
+int32 syncDiskIndex(DiskIndex *index, uint64 *userData);
+
+/**
+ * 查找key需要、但不在页缓存中的第一个页，用于在调用者的锁之外读取页：
+ * 持有锁时调用missingDiskIndexPage并记录pageWrites，释放锁后调用readDiskIndexPage，再持有锁调用cacheDiskIndexPage
+ * @param index 磁盘索引
+ * @param keyLen 键的长度
+ * @param key 键
+ * @return 页号，key所在桶的页都已经缓存或者在缓存的页中找到了key时返回0
+ */
+uint32 missingDiskIndexPage(DiskIndex *index, uint32 keyLen, uint8 *key);
+
+/**
+ * 从文件读取一个页，不访问页缓存和其他字段，可以与索引的其他操作并发调用（调用者保证期间不释放索引）
+ * @param index 磁盘索引
+ * @param pageNo 页号
+ * @param page 用于存放页内容
+ * @return 1 成功，0 读取失败
+ */
+int32 readDiskIndexPage(DiskIndex *index, uint32 pageNo, DiskIndexPage *page);
+
+/**
+ * 将readDiskIndexPage读取的页（malloc分配）加入页缓存
+ * 页已经在缓存中、或者读取期间有页被写回（读到的内容可能已经过期）时丢弃
+ * @param index 磁盘索引
+ * @param page 读取的页，不再由调用者管理
+ * @param pageWrites 调用missingDiskIndexPage时的pageWrites
+ * @return 1 加入缓存，0 丢弃或者被淘汰的页写回失败
+ */
+int32 cacheDiskIndexPage(DiskIndex *index, DiskIndexPage *page, uint64 pageWrites);
+
+/**
+ * 桶的数目
+ * @param index 磁盘索引
+ * @return {uint32} 桶的数目
+ */
+uint32 getDiskIndexBucketCount(DiskIndex *index);
+
+#endif
@@ -4,8 +4,11 @@
  * 实现一个基于Hash的存储引擎，支持如下内容：
  * 创建或加载一个Hash引擎
  * 对数据进行增删改查
- * 启动故障检测数据恢复
+ * 启动故障检测数据恢复（重做日志重放）
  * 支持读写分离
+ * 支持按key分区，各分区并行写入
+ * 大value存放在blob文件中，支持按范围读取value
+ * 可选的磁盘索引，key的数目可以超过内存容量
  * 
  * 一些限制：
  * 
@@ -27,12 +30,35 @@
 #include "util.h"
 #include "lrucache.h"
 #include "hashmap.h"
+#include "keyindex.h"
+#include "diskindex.h"
 #include "redolog.h"
 
 /*****************************************************************************
  * 宏定义
  ******************************************************************************/
 
+/** 数据文件头部（魔数+版本号）长度 */
+#define HASH_FILE_HEADER_SIZE 8
+/** 一条记录的头部（版本号+keyLen+valueLen）长度 */
+#define HASH_RECORD_HEADER_SIZE 16
+/** 提示文件一个检查点块的头部（entriesBytes+count+dataEnd+checksum）长度 */
+#define HASH_HINT_BLOCK_HEADER_SIZE 20
+/** 提示文件一个条目的头部（version+position+size+blobSize+keyLen）长度 */
+#define HASH_HINT_ENTRY_HEADER_SIZE 28
+/** 记录头部valueLen字段的最高位：value经过压缩，低31位为存储的字节数（原长度4字节+压缩数据） */
+#define HASH_VALUE_COMPRESSED 0x80000000u
+/** 开启压缩时，小于该长度的value不压缩 */
+#define HASH_COMPRESSION_MIN_SIZE 64
+/** 记录头部valueLen字段的次高位：value存放在blob文件中，记录中只存放引用，低30位为引用的字节数 */
+#define HASH_VALUE_BLOB 0x40000000u
+/** value的最大长度：valueLen字段的最高两位为压缩和blob标记，长度只能使用低30位，超过时插入失败 */
+#define HASH_VALUE_MAX_SIZE 0x3fffffffu
+/** blob引用（value在blob文件中的位置8字节+value长度4字节）的长度 */
+#define HASH_BLOB_REF_SIZE 12
+/** 重做日志中一条记录的头部（type+keyLen+valueLen）长度，记录之后是4字节校验和 */
+#define HASH_REDO_RECORD_HEADER_SIZE 9
+
 /*****************************************************************************
  * 枚举定义
  ******************************************************************************/
@@ -46,30 +72,32 @@ enum HashEnginePersistenceStatus
 	/** 持久化线程正在进行持久化 */
 	Doing,
 	/** 持久化之后的清理工作 */
-	After
+	After,
+	/** 正在进行碎片整理（此时冻结写缓存为空） */
+	Compacting
+};
+
+/** 持久化时数据文件的同步策略 */
+enum HashEngineDurability
+{
+	/** 不主动同步，由操作系统决定何时落盘 */
+	NoSync,
+	/** 每个检查点（一次持久化）结束时同步一次，默认策略 */
+	SyncPerCheckpoint,
+	/** 每写入一个批次同步一次 */
+	SyncPerBatch
 };
 
 /*****************************************************************************
  * 结构定义
  ******************************************************************************/
 
-/**
- * 记录的位置
- */
-typedef struct RecordLocation
-{
-	/** 文件偏移量 */
-	uint64 position;
-	/** 在内存cache中的id */
-	uint64 id;
-} RecordLocation;
-
 /**
  * 记录内容
  */
 typedef struct Record
 {
-	/** 记录版本号：从1开始，0保留 */
+	/** 记录版本号：从1开始，0保留（deleteHashEngine写入的墓碑不读取旧记录，版本号为0） */
 	uint64 version;
 	/** keyLen */
 	uint32 keyLen;
@@ -81,23 +109,140 @@ typedef struct Record
 	uint8 *value;
 } Record;
 
+/**
+ * 数据文件空间使用统计
+ */
+typedef struct HashEngineSpaceStats
+{
+	/** 数据文件总字节数 */
+	uint64 fileSize;
+	/** 有效记录（每个key的最新版本）占用的字节数 */
+	uint64 liveSize;
+	/** 有效记录数目 */
+	uint64 liveCount;
+	/** 空间放大倍数 fileSize/(liveSize+文件头) */
+	double spaceAmplification;
+	/** 已经完成的碎片整理次数 */
+	uint64 compactionCount;
+	/** blob文件总字节数 */
+	uint64 blobFileSize;
+	/** 有效记录引用的blob字节数 */
+	uint64 blobLiveSize;
+	/** 检查点写入或同步失败（之后重试）的次数 */
+	uint64 flushErrorCount;
+} HashEngineSpaceStats;
+
+/**
+ * 数据文件的只读内存映射，使用引用计数管理生命周期：
+ * 引擎持有当前映射的一个引用，每个未释放的视图持有一个引用，
+ * 文件增长超出映射范围或碎片整理切换文件后，引擎改为持有新的映射，旧映射在最后一个视图释放时解除
+ */
+typedef struct HashEngineMapping
+{
+	/** 映射起始地址 */
+	uint8 *base;
+	/** 映射长度，可以超过文件尺寸（为文件增长预留） */
+	uint64 size;
+	/** 引用计数 */
+	uint32 refCount;
+	/** 所属的引擎（分区引擎中为某个分区），引用计数在其statusMutex中修改 */
+	struct HashEngine *engine;
+} HashEngineMapping;
+
+/**
+ * 借用的value视图，使用完毕后必须调用releaseHashEngineView
+ */
+typedef struct HashEngineView
+{
+	/** value起始地址，不能修改 */
+	uint8 *value;
+	/** value长度，为0表示不存在 */
+	uint32 length;
+	/** value所在的映射，为NULL时value为堆上的拷贝（记录在写缓存中或未开启映射读） */
+	HashEngineMapping *mapping;
+} HashEngineView;
+
 /**
  * 索引文件
  */
 typedef struct HashEngine
 {
-	/** 索引文件位置 */
+	/** 索引文件位置（分区引擎中为清单文件位置） */
 	char *filename;
-	/** 数据文件描述符，用于写，没有进行碎片整理时指向filename, 进行碎片整理时指向newFilename */
+	/** 分区数目，为0表示普通引擎；大于0时本结构只负责按key路由，其他字段不使用 */
+	uint32 partitionCount;
+	/** 分区，每个分区是一个独立的引擎：${filename}.p<i> */
+	struct HashEngine **partitions;
+	/** 碎片整理时的新文件位置：${filename}.compact */
+	char *newFilename;
+	/** 数据文件描述符，用于写，指向filename，读写都使用pread/pwrite，与rfd是同一个描述符 */
 	int wfd;
-	/** 数据文件描述符，用于读，指向filename */
+	/** 数据文件描述符，用于读，指向filename，多个线程可以同时pread */
 	int rfd;
-	/** 数据文件描述符，用于读，指向newFilename */
+	/** 数据文件描述符，碎片整理时用于写入有效记录，指向newFilename，不整理时为-1 */
 	int newrfd;
+	/** 提示文件位置：${filename}.hint，记录每个检查点写入的(key, version, position, size) */
+	char *hintFilename;
+	/** 提示文件描述符，用于追加 */
+	int hintFd;
+	/** 提示文件中的条目数目，超过有效key数目的一定倍数时在检查点结束时根据内存索引重写 */
+	uint64 hintEntryCount;
+	/** 数据文件当前尺寸 */
+	uint64 fileSize;
+	/** 数据文件中已经写入完成的尺寸（持久化时fileSize先于写入增加），在statusMutex中访问 */
+	uint64 persistedSize;
+	/** 有效记录占用的字节数 */
+	uint64 liveSize;
+	/** 自动碎片整理的阈值：空间放大倍数超过该值时整理，0表示不自动整理 */
+	double compactionThreshold;
+	/** 数据文件小于该尺寸时不进行自动碎片整理 */
+	uint64 compactionMinSize;
+	/** 已经完成的碎片整理次数 */
+	uint64 compactionCount;
+	/** 检查点写入或同步失败的次数，失败时保留冻结写缓存并重试，在statusMutex中访问 */
+	uint64 flushErrorCount;
+	/** 未关闭的游标数目，大于0时不进行碎片整理（游标依赖记录的位置不变） */
+	uint32 cursorCount;
+	/** 持久化时数据文件的同步策略 */
+	enum HashEngineDurability durability;
+	/** 持久化时一个批次的最大字节数，序列化到一个连续缓冲区后一次写入 */
+	uint32 flushBatchSize;
+	/** 持久化时是否压缩value，每条记录单独标记，已有的记录不受影响 */
+	int32 compression;
+	/** blob文件位置：${filename}.blob，存放超过阈值的value */
+	char *blobFilename;
+	/** 碎片整理时的新blob文件位置：${filename}.blob.compact */
+	char *newBlobFilename;
+	/** blob文件描述符，第一次写入blob时创建，读写都使用pread/pwrite，没有blob文件时为-1 */
+	int blobFd;
+	/** blob文件当前尺寸 */
+	uint64 blobFileSize;
+	/** 有效记录引用的blob字节数 */
+	uint64 blobLiveSize;
+	/** 不小于该长度的value持久化时存放到blob文件中，0表示不使用blob文件 */
+	uint32 blobThreshold;
+	/** 是否开启内存映射读：开启后磁盘上的记录直接从映射区读取，不经过读缓存 */
+	int32 mmapRead;
+	/** 数据文件当前的内存映射，未开启或尚未映射时为NULL，在statusMutex中访问 */
+	HashEngineMapping *mapping;
+	/** 文件切换读写锁：读数据文件持读锁，碎片整理切换文件时持写锁 */
+	pthread_rwlock_t fileLock;
 	/** id种子 */
 	uint64 idSeed;
-	/** filename的索引 <key, RecordLocation> */
-	struct HashMap *hashMap;
+	/** filename的索引 <key, RecordLocation>，墓碑持久化后删除的RecordLocation其他线程可能仍持有指针，持有指针的操作都结束之后回收 */
+	struct KeyIndex *keyIndex;
+	/** 位置的回收周期（0或1）：可能持有RecordLocation指针的操作开始时计入当前周期，检查点开始时推进，在statusMutex中访问 */
+	uint32 locationEpoch;
+	/** 两个回收周期中未结束的操作数目，在statusMutex中访问 */
+	uint32 locationUsers[2];
+	/** 磁盘索引 <key, 位置>，为NULL时所有key常驻内存索引；否则内存索引只保留最近访问和未持久化的key，在statusMutex中访问 */
+	struct DiskIndex *diskIndex;
+	/** 磁盘索引文件位置：${filename}.index，使用磁盘索引时代替提示文件 */
+	char *indexFilename;
+	/** 碎片整理时的新磁盘索引文件位置：${filename}.index.compact */
+	char *newIndexFilename;
+	/** 使用磁盘索引时内存索引中key数目的上限，超过时进行一次检查点，检查点开始时移出没有缓存的key */
+	uint64 residentLimit;
 	/** 读缓存 <RecordLocation.id, Record> */
 	struct LRUCache *readCache;
 	/** 写缓存（工作中） <RecordLocation.id, Record>*/
@@ -112,12 +257,14 @@ typedef struct HashEngine
 	enum RedoFlushStrategy flushStrategy;
 	/** 重做日志相关配置：重做日志刷新策略参数 */
 	uint64 flushStrategyArg;
-	/** 重做日志版本号 */
+	/** 重做日志版本号，日志文件为${filename}_0x<版本号>.redolog */
 	uint64 redoVersion;
-	/** 工作中的RedoLog */
+	/** 工作中的RedoLog，记录对写缓存的修改，没有开启重做日志时为NULL */
 	struct RedoLog *redoLogWork;
-	/** 冻结的RedoLog */
+	/** 冻结的RedoLog，与冻结写缓存对应，检查点的数据同步之后删除 */
 	struct RedoLog *redoLogFreeze;
+	/** 是否开启重做日志，切换写缓存时据此创建新的日志 */
+	int32 redoLogEnabled;
 	/** 条件变量，用于控制并发 */
 	pthread_cond_t statusCond;
 	/** 用于互斥更改状态 */
@@ -126,8 +273,51 @@ typedef struct HashEngine
 	pthread_mutexattr_t statusAttr;
 	/** 持久化线程 */
 	pthread_t persistenceThread;
+	/** 持久化线程是否启动过，启动下一个持久化线程之前需要回收上一个 */
+	int32 persistenceThreadStarted;
 } HashEngine;
 
+/**
+ * 顺序扫描游标：
+ * 先返回打开时还未持久化的记录（写缓存中），再按文件顺序扫描打开时已经写入的数据文件，
+ * 使用固定大小的预读缓冲区，跳过已被新版本覆盖或已删除的记录，内存占用与数据量无关
+ */
+typedef struct HashEngineCursor
+{
+	/** 所属的引擎 */
+	struct HashEngine *engine;
+	/** 分区引擎中当前分区的游标，普通引擎为NULL */
+	struct HashEngineCursor *partitionCursor;
+	/** 分区引擎中当前分区的下标 */
+	uint32 partitionIndex;
+	/** 打开时还未持久化的key List<Array*>，首先返回 */
+	List *pendingKeys;
+	/** 扫描的结束位置：打开时已经写入完成的数据文件尺寸 */
+	uint64 end;
+	/** 预读缓冲区 */
+	uint8 *buffer;
+	/** 缓冲区容量 */
+	uint32 bufferCap;
+	/** 缓冲区中有效的字节数 */
+	uint32 bufferLen;
+	/** 缓冲区中下一条记录的偏移 */
+	uint32 offset;
+	/** 缓冲区起始字节在文件中的位置 */
+	uint64 bufferPosition;
+	/** 当前记录的key，在下一次调用nextHashEngineCursor之前有效 */
+	uint8 *key;
+	/** 当前记录的keyLen */
+	uint32 keyLen;
+	/** 当前记录的value，在下一次调用nextHashEngineCursor之前有效 */
+	uint8 *value;
+	/** 当前记录的valueLen */
+	uint32 valueLen;
+	/** 当前key是否由游标分配（未持久化的key），移动游标时释放 */
+	int32 ownKey;
+	/** 当前value是否由游标分配（未持久化记录的拷贝或解压结果），移动游标时释放 */
+	int32 ownValue;
+} HashEngineCursor;
+
 /*****************************************************************************
  * 公开API
  ******************************************************************************/
@@ -156,6 +346,39 @@ HashEngine *loadHashEngine(const char *filename, uint32 hashMapCap, uint64 cache
 						   enum RedoFlushStrategy flushStrategy,
 						   uint64 flushStrategyArg);
 
+/**
+ * 创建一个分区的Hash引擎，key按哈希值分布到partitionCount个分区
+ * 每个分区有独立的缓存、锁、数据文件和持久化线程，不同分区的写入可以并行
+ * filename为清单文件，记录分区数目，分区数据文件为${filename}.p<i>
+ * 创建后使用与普通引擎相同的API访问，loadHashEngine根据清单文件自动加载所有分区
+ * @param filename 文件名
+ * @param partitionCount 分区数目，不大于1时创建普通引擎
+ * @param hashMapCap 内存索引尺寸（所有分区合计）
+ * @param cacheCap 缓存容量（所有分区合计）
+ * @return {HashEngine *} 一个HashEngine结构
+ */
+HashEngine *makePartitionedHashEngine(const char *filename, uint32 partitionCount,
+									  uint32 hashMapCap, uint64 cacheCap,
+									  uint64 operateListMaxSize,
+									  enum RedoFlushStrategy flushStrategy,
+									  uint64 flushStrategyArg);
+
+/**
+ * 创建一个使用磁盘索引的Hash引擎：key的位置存放在${filename}.index中（线性哈希，页通过LRU缓存访问），
+ * 内存索引只保留最近访问和未持久化的key，内存占用由缓存容量决定，与key的数目无关
+ * 每个检查点将写入的位置更新到磁盘索引并同步，加载时只扫描磁盘索引同步之后写入的数据文件尾部
+ * loadHashEngine根据索引文件是否存在自动选择模式，此时其hashMapCap参数为磁盘索引的页缓存容量
+ * key的长度不能超过DISK_INDEX_MAX_KEY_SIZE
+ * @param filename 文件名
+ * @param indexCacheCap 磁盘索引的页缓存容量（页数）
+ * @param cacheCap 缓存容量
+ * @return {HashEngine *} 一个HashEngine结构
+ */
+HashEngine *makeDiskIndexHashEngine(const char *filename, uint32 indexCacheCap, uint64 cacheCap,
+									uint64 operateListMaxSize,
+									enum RedoFlushStrategy flushStrategy,
+									uint64 flushStrategyArg);
+
 /**
  * 释放HashEngine
  */
@@ -174,32 +397,195 @@ void freeHashEngine(HashEngine* engine);
 Array getHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key);
 
 /**
- * 从Hash引擎中获取全部的数据
+ * 读取key对应的value中的一段[offset, offset+length)，超出value长度的部分被截掉
+ * 记录在缓存中时从缓存中拷贝；否则只读取需要的字节（blob文件或数据文件中），不放入读缓存
+ * 因此读取大value中的小字段不会读取整个value
+ * @param engine HashEngine
+ * @param key 要查找的key
+ * @param offset 起始偏移
+ * @param length 最多读取的字节数
+ * @return {Array} 读到的字节（需要调用者释放array），key不存在或offset超出value长度时长度为0
+ */
+Array getRangeHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key, uint32 offset, uint32 length);
+
+/**
+ * 从Hash引擎中查找key对应的value，返回借用的视图而不是拷贝
+ * 开启内存映射读时，磁盘上的记录直接指向映射区，没有堆分配和拷贝
+ * 视图在releaseHashEngineView之前一直有效（即使期间发生了持久化或碎片整理）
+ * @param engine HashEngine
+ * @param key 要查找的key
+ * @return {HashEngineView} value视图
+ */
+HashEngineView getViewHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key);
+
+/**
+ * 释放getViewHashEngine返回的视图，必须在freeHashEngine之前调用
+ * @param engine HashEngine
+ * @param view 视图
+ */
+void releaseHashEngineView(HashEngine *engine, HashEngineView *view);
+
+/**
+ * 开启或关闭数据文件的内存映射读
+ * @param engine HashEngine
+ * @param enable 1 开启，0 关闭
+ */
+void setHashEngineMmapRead(HashEngine *engine, int32 enable);
+
+/**
+ * 从Hash引擎中获取全部的数据（使用游标扫描）
  */
 List* getAllHashEngine(HashEngine *engine);
 
+/**
+ * 打开一个顺序扫描游标
+ * 游标打开期间不进行碎片整理，打开时没有被修改过的key恰好返回一次，扫描期间修改的key可能不返回
+ * @param engine HashEngine
+ * @return {HashEngineCursor *} 游标，位于第一条记录之前
+ */
+HashEngineCursor *openHashEngineCursor(HashEngine *engine);
+
+/**
+ * 移动到下一条有效记录，通过cursor->key、cursor->value访问
+ * @param cursor 游标
+ * @return 1 有记录，0 扫描结束
+ */
+int32 nextHashEngineCursor(HashEngineCursor *cursor);
+
+/**
+ * 关闭并释放游标，必须在freeHashEngine之前调用
+ * @param cursor 游标
+ */
+void closeHashEngineCursor(HashEngineCursor *cursor);
+
 /**
  * 从Hash引擎中查找key对应的value，只可能有一个
  * @param engine HashEngine
  * @param key 要查找的key
- * @return 成功数目
+ * @return 成功数目，开启重做日志时日志写入失败返回0
  */
 int32 putHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key, uint32 valueLen, uint8 *value);
 
 /**
- * 从Hash引擎中删除一个key
+ * 从Hash引擎中删除一个key，并返回被删除的value（需要读取旧记录）
  * @param engine HashEngine
  * @param key 要查找的key
  * @return {Array} value 被删除的value
  */
 Array removeHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key);
 
+/**
+ * 从Hash引擎中删除一个key，不读取旧记录
+ * 写入一条墓碑记录（valueLen为0），墓碑持久化后将key从内存索引中删除
+ * @param engine HashEngine
+ * @param key 要删除的key
+ * @return 1 key存在，0 key不存在或者重做日志写入失败
+ */
+int32 deleteHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key);
+
+/**
+ * 批量查找，整个批次只加锁一次，需要读磁盘的key按文件位置排序后依次读取
+ * @param engine HashEngine
+ * @param count key的数目
+ * @param keyLens 每个key的长度
+ * @param keys 要查找的key
+ * @param values 调用者提供的长度为count的数组，用于存放结果（需要调用者释放array），不存在的key长度为0
+ * @return 找到的key的数目
+ */
+int32 getBatchHashEngine(HashEngine *engine, uint32 count, uint32 *keyLens, uint8 **keys, Array *values);
+
+/**
+ * 批量插入或更新，整个批次只加锁一次，需要读取旧版本号的key按文件位置排序后依次读取
+ * 写缓存满时，剩余的key逐个插入（会触发持久化）
+ * @param engine HashEngine
+ * @param count key的数目
+ * @return 成功数目，开启重做日志时日志写入失败返回0
+ */
+int32 putBatchHashEngine(HashEngine *engine, uint32 count, uint32 *keyLens, uint8 **keys, uint32 *valueLens, uint8 **values);
+
 /**
  * 持久化函数，在持久化线程执行
  * @param engine HashEngine
  */
 void flushHashEngine(HashEngine *engine);
 
+/**
+ * 设置持久化的批次大小和同步策略
+ * 持久化线程将冻结写缓存中的记录序列化到连续缓冲区，每满flushBatchSize字节调用一次pwrite
+ * @param engine HashEngine
+ * @param durability 同步策略
+ * @param flushBatchSize 批次字节数，为0时使用默认值（4MB）
+ */
+void setHashEngineFlushPolicy(HashEngine *engine, enum HashEngineDurability durability, uint32 flushBatchSize);
+
+/**
+ * 开启或关闭value压缩，之后持久化的记录生效；设置保存在数据文件头中，加载时恢复
+ * 每条记录在头部标记是否压缩，压缩和未压缩的记录可以在同一个文件中
+ * 压缩后不能节省空间的value按原样存储
+ * @param engine HashEngine
+ * @param enable 1 开启，0 关闭
+ */
+void setHashEngineCompression(HashEngine *engine, int32 enable);
+
+/**
+ * 设置blob阈值，之后持久化的记录生效
+ * 不小于阈值的value追加到blob文件${filename}.blob中（不压缩，以便按范围读取），
+ * 数据文件中的记录只保存引用，更新和碎片整理时拷贝的数据文件内容都很小
+ * blob文件中的垃圾在碎片整理时回收（只拷贝有效记录引用的blob）
+ * @param engine HashEngine
+ * @param threshold 阈值，0表示不使用blob文件
+ */
+void setHashEngineBlobThreshold(HashEngine *engine, uint32 threshold);
+
+/**
+ * 开启或关闭重做日志（预写日志）
+ * 开启后每次修改写缓存时同一临界区内追加一条日志，立即写入策略（synchronize）下
+ * 等待日志同步后返回，并发写入的线程共享一次fdatasync（组提交）；数据文件的写入在检查点异步进行
+ * 每个检查点切换一个日志文件，检查点的数据同步之后删除对应的日志
+ * loadHashEngine时自动重放残留的日志（与是否开启无关），持久化之后删除
+ * 关闭时进行一次检查点，然后删除日志
+ * @param engine HashEngine
+ * @param enable 1 开启，0 关闭
+ * @return 1 成功，0 创建日志文件失败
+ */
+int32 setHashEngineRedoLog(HashEngine *engine, int32 enable);
+
+/**
+ * 设置使用磁盘索引时内存索引中key数目的上限，不使用磁盘索引时无效
+ * 超过上限时进行一次检查点，检查点开始时将没有缓存的key移出内存索引
+ * @param engine HashEngine
+ * @param limit 上限
+ */
+void setHashEngineResidentLimit(HashEngine *engine, uint64 limit);
+
+/*****************************************************************************
+ * 碎片整理
+ ******************************************************************************/
+
+/**
+ * 设置自动碎片整理的触发条件，每次持久化完成后检查
+ * @param engine HashEngine
+ * @param threshold 空间放大倍数阈值，0表示不自动整理
+ * @param minFileSize 数据文件小于该尺寸时不整理
+ */
+void setHashEngineCompaction(HashEngine *engine, double threshold, uint64 minFileSize);
+
+/**
+ * 获取数据文件的空间使用统计
+ * @param engine HashEngine
+ * @return {HashEngineSpaceStats} 统计信息
+ */
+HashEngineSpaceStats getHashEngineSpaceStats(HashEngine *engine);
+
+/**
+ * 立即进行一次在线碎片整理：
+ * 将每个key的有效记录拷贝到新文件，然后原子的替换数据文件
+ * 整理期间读写可以继续进行（写缓存满时写操作将等待整理完成）
+ * @param engine HashEngine
+ * @return 1 成功，0 失败
+ */
+int32 compactHashEngine(HashEngine *engine);
+
 #ifdef PROFILE_TEST
 
 #endif
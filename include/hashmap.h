@@ -1,10 +1,13 @@
 /*****************************************************************************
  * Copyright (c) 2018, rectcircle. All rights reserved.
  * 
- * 一个桶大小固定的HashMap
+ * 一个可以自动扩容、缩容的HashMap
  * 
  * 实现创建、删除、清空HashMap，支持插入查询
  * 
+ * 扩容缩容采用渐进式rehash：创建新的桶数组后，每次插入、删除操作迁移少量桶，
+ * 迁移期间查找同时检查新旧两个桶数组，避免单次操作停顿
+ * 
  * 内存管理方式为：
  * key自动管理：插入操作将创建key的副本，删除，清空，淘汰等操作会释放key的内存
  * value交由调用者管理：不会创建副本，直接赋值，或设为NULL
@@ -34,7 +37,7 @@ typedef void* (*ForeachMapFunction)(struct Entry * entry, void* args);
  * 结构定义
  ******************************************************************************/
 
-/** LRU缓存定义 */
+/** HashMap定义 */
 typedef struct HashMap
 {
 	/** hashtable桶数组的长度，值为2^n，且大于等于capacity/0.75 */
@@ -43,7 +46,14 @@ typedef struct HashMap
 	uint32 size;
 	/** hashtable的桶数组 */
 	struct Entry **table;
-
+	/** 创建时的桶数组长度，自动缩容不会小于该值 */
+	uint32 minBucketCapacity;
+	/** rehash的目标桶数组，不在rehash时为NULL */
+	struct Entry **rehashTable;
+	/** rehash目标桶数组的长度 */
+	uint32 rehashCapacity;
+	/** table中下一个待迁移的桶下标，小于该下标的桶已经迁移完成 */
+	uint32 rehashIndex;
 } HashMap;
 
 /** HashMap一个节点 */
@@ -66,8 +76,9 @@ typedef struct Entry
  ******************************************************************************/
 
 /**
- * 创建一个桶大小固定的HashMap
- * @param capacity 预估的最大容量，实际容量大于该容量，HashMap的性能将下降
+ * 创建一个HashMap
+ * 负载因子超过0.75时自动扩容为2倍，低于0.1时自动缩容（不小于初始容量）
+ * @param capacity 预估的容量，决定初始桶数组长度
  * @return {HashMap*} 一个可用HashMap，当不满足创建条件返回NULL
  */
 HashMap *makeHashMap(uint32 capacity);
@@ -120,6 +131,20 @@ void *getHashMap(HashMap *map, uint32 keyLen, uint8 *key);
  */
 void *removeHashMap(HashMap *map, uint32 keyLen, uint8 *key);
 
+/**
+ * 将桶数组缩小到能以0.75负载因子容纳当前数据的最小长度（渐进式完成）
+ * 用于大量删除之后释放内存，缩容的下限为1而不是初始容量
+ * @param map 待操作的HashMap
+ */
+void shrinkHashMap(HashMap *map);
+
+/**
+ * 是否正在进行渐进式rehash
+ * @param map HashMap
+ * @return 1 正在rehash，0 没有
+ */
+int32 isRehashingHashMap(HashMap *map);
+
 /*****************************************************************************
  * 私有且需要测试或在测试中要使用的函数
  ******************************************************************************/
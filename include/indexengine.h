@@ -6,6 +6,11 @@
  * 对数据进行增删改查
  * 启动故障检测数据恢复
  * 支持读写分离
+ * 支持多线程并发访问：查询与不改变树结构的增删可以并行，分裂、合并时独占
+ * 支持带上下界、可反向、可限制数目的范围游标
+ * 支持顺序扫描时在后台预读之后的叶子节点
+ * 支持变长key：槽页存储，按实际长度比较
+ * 按key长度选择专用的比较函数，节点内无分支二分查找
  * 
  * 一些限制：
  * key和value固定大小，内部储存无类型信息，类型信息需有调用者维护
@@ -29,6 +34,7 @@
 #include "global.h"
 #include "util.h"
 #include "lrucache.h"
+#include "bufferpool.h"
 #include "redolog.h"
 #include <fcntl.h>
 #include <unistd.h>
@@ -62,6 +68,16 @@
 #define IS_CREATING(flag) ((flag >> 3) & 1)
 #define SET_CREATING(flag) (flag |= (1 << 3))
 #define CLR_CREATING(flag) (flag &= ~(1 << 3))
+/** 取标志isKeyCompression的值，表示数据页中的key是否压缩存储 */
+#define IS_KEY_COMPRESSION(flag) ((flag >> 4) & 1)
+#define SET_KEY_COMPRESSION(flag) (flag |= (1 << 4))
+#define CLR_KEY_COMPRESSION(flag) (flag &= ~(1 << 4))
+/** 取标志isVariableKey的值，表示key是否变长（去掉末尾的0之后的长度）存储和比较 */
+#define IS_VARIABLE_KEY(flag) ((flag >> 5) & 1)
+#define SET_VARIABLE_KEY(flag) (flag |= (1 << 5))
+#define CLR_VARIABLE_KEY(flag) (flag &= ~(1 << 5))
+/** 数据页是否为编码格式（压缩key或变长key）：按编码后的字节数分裂，使用最短的分隔key */
+#define IS_ENCODED_PAGE(flag) (IS_KEY_COMPRESSION(flag) || IS_VARIABLE_KEY(flag))
 
 /** 
  * IndexTreeNode和IndexTreLeaf取标志的宏
@@ -101,6 +117,36 @@
 /** 即将被删除 */
 #define NODE_STATUS_REMOVE 3
 
+/**
+ * 批量构建相关宏
+ */
+/** 默认的节点填充率（百分比），留出少量空间给之后的插入，避免立即分裂 */
+#define INDEX_BUILDER_DEFAULT_FILL_FACTOR 90
+/** 批量构建的最大树深度，链接节点至少2个孩子，足够容纳2^64条数据 */
+#define INDEX_BUILDER_MAX_DEPTH 64
+
+/**
+ * 缓冲池相关宏
+ */
+/** 缓冲池和冻结的脏页至少容纳的节点数目，其中1/3为脏页的上限 */
+#define INDEX_BUFFER_POOL_MIN_FRAMES 9
+/** 缓冲池至少能完成该深度的树的一次独占模式的增删（每层约3帧），已有的树更深时按实际深度计算 */
+#define INDEX_BUFFER_POOL_MIN_DEPTH 9
+
+/**
+ * 预读相关宏
+ */
+/** 沿叶子链表连续前进该步数视为顺序扫描，开始预读 */
+#define INDEX_READ_AHEAD_TRIGGER 2
+/** 默认每次预读的叶子节点数 */
+#define INDEX_READ_AHEAD_PAGES 8
+
+/**
+ * key压缩相关宏
+ */
+/** 压缩后节点的度最多为不压缩时的倍数，限制节点在内存中（解压后）的大小 */
+#define INDEX_COMPRESSION_DEGREE_RATIO 4
+
 /*****************************************************************************
  * 结构定义
  ******************************************************************************/
@@ -132,16 +178,23 @@ typedef struct IndexTreeMeta
 
 /** 需要用到的缓存和状态 */
 typedef struct IndexCache{
-	/** 存放从磁盘中读取的页，这些页的数据没有发生修改 */
-	struct LRUCache *unchangeCache;
-	/** 存放与磁盘不一致的页 */
-	struct LRUCache *changeCacheWork;
+	/**
+	 * 缓冲池：存放工作中的树的节点，帧数由maxHeapSize决定
+	 * 与磁盘一致的帧可以淘汰，与磁盘不一致的页为脏帧，持久化开始时移入changeCacheFreeze
+	 */
+	struct BufferPool *bufferPool;
+	/** 脏帧数目达到该值时进行持久化 */
+	uint32 dirtyLimit;
+	/** 缓存可以使用的最大堆内存 */
+	uint64 maxHeapSize;
 	/** 存放与磁盘不一致的页用于持久化 */
 	struct LRUCache *changeCacheFreeze;
 	/** 废弃的影子页：不为NULL从里取页号，为从engine->nextPageId变量分配 */
 	struct List* abandonedPageWork;
-	/** 废弃的影子页：废弃影子页插入，当每次持久化结束后交换加入abandonedPageWork，清空 */
+	/** 废弃的影子页：废弃影子页插入，冻结脏页时移入abandonedPagePersistence，清空 */
 	struct List *abandonedPageFreeze;
+	/** 持久化中的废弃页：持久化完成后磁盘上的树不再引用这些页，加入abandonedPageWork */
+	struct List *abandonedPagePersistence;
 	/** 工作中的RedoLog */
 	struct RedoLog *redoLogWork;
 	/** 冻结的RedoLog */
@@ -156,6 +209,39 @@ typedef struct IndexCache{
 	pthread_mutexattr_t* statusAttr;
 	/** 持久化线程 */
 	pthread_t* persistenceThread;
+	/**
+	 * 索引树锁：查询和只修改一个叶子节点的增删以共享模式持有，
+	 * 会改变树结构（分裂、合并、更换根节点）的增删和冻结脏页以独占模式持有
+	 */
+	pthread_rwlock_t* treeLock;
+	/** 缓冲池互斥锁：共享模式下保护缓冲池的查找、固定和淘汰 */
+	pthread_mutex_t* poolMutex;
+	/** 共享模式下所有帧都被固定或为脏时，等待其他线程解除固定 */
+	pthread_cond_t* poolCond;
+	/** 等待poolCond的线程数，由poolMutex保护 */
+	uint32 poolWaiters;
+	/** 是否以独占模式持有treeLock：独占模式下没有其他线程解除固定，不能等待 */
+	int8 treeExclusive;
+	/** 树结构版本：以独占模式修改树时增加，版本不变时叶子节点的页号和叶子链表不变 */
+	uint64 structureVersion;
+	/** 定长key的比较函数：按keyLen在初始化缓存时选择（getKeyCompare） */
+	KeyCompare keyCompare;
+	/** 每次预读的叶子节点数，0 表示不预读 */
+	uint32 readAheadPages;
+	/** 预读线程：第一次请求预读时创建，为NULL表示尚未创建 */
+	pthread_t *readAheadThread;
+	/** 保护预读请求 */
+	pthread_mutex_t *readAheadMutex;
+	/** 通知预读线程有新的请求 */
+	pthread_cond_t *readAheadCond;
+	/** 预读请求：从该叶子节点开始预读，0 表示没有请求，新的请求覆盖尚未处理的请求 */
+	volatile uint64 readAheadPageId;
+	/** 预读请求：是否沿prev方向预读 */
+	int8 readAheadReverse;
+	/** 通知预读线程退出 */
+	volatile int8 readAheadStop;
+	/** 预读过的叶子节点数（统计用） */
+	volatile uint64 readAheadCnt;
 } IndexCache;
 
 /**
@@ -164,7 +250,7 @@ typedef struct IndexCache{
 typedef struct IndexEngine {
 	/** 索引文件位置 */
 	char* filename;
-	/** 索引文件描述符，用于写 */
+	/** 索引文件描述符，用于写，读写都使用pread/pwrite，与rfd是同一个描述符 */
 	int wfd;
 	/** 索引文件描述符，用于读 */
 	int rfd;
@@ -227,24 +313,135 @@ typedef struct IndexTreeNode
 	uint64 nodeVersion;
 	/** 节点状态：参见NODE_STATUS_XXX 宏 */
 	int32 status;
-	/** 
-	 * key的数组
-	 * 数组的长度为：(BTree.degree+1)，多余的一个空间用于节点分裂使用
-	 * 每个元素的长度为：(keyLen)字节
-	 */
-	uint8 **keys;
-	/** 
-	 * 指向孩子的页的数组
-	 * 数组的长度为：BTree.degree+1
+	/** 每个条目的字节数：叶子节点为keyLen+valueLen，链接节点为keyLen+8，变长key时再加上2字节的key长度 */
+	uint32 entryLen;
+	/**
+	 * 节点的页镜像，格式与数据页相同，与节点结构在同一块内存中：
+	 * 前NODE_META_SIZE字节为节点元数据（只在读写文件时填充），之后为条目数组
+	 * 从文件读取时直接读入，写文件时直接写出，不需要逐个拷贝key和value
+	 * 长度为pageSize加一个条目，多余的一个条目用于节点分裂
 	 */
-	uint64 *children;
-	/** 
-	 * 指向孩子的页的数组
-	 * 数组的长度为：BTree.degree+1
+	uint8 *page;
+	/**
+	 * 条目数组（指向page中元数据之后），条目连续存放：
+	 * 叶子节点每个条目为 key:keyLen, value:valueLen
+	 * 链接节点每个条目为 key:keyLen, child:8（孩子的页号，网络字节序）
+	 * 变长key时每个条目之后为 keyLen:2（去掉末尾0之后的长度，主机字节序），key仍然补0到keyLen
 	 */
-	uint8 **values;
+	uint8 *entries;
+	/** 节点在缓冲池中的帧号，不在缓冲池中为BUFFER_POOL_NIL */
+	uint32 frame;
+	/** 节点闩锁：共享模式下读叶子节点加读锁，修改叶子节点加写锁 */
+	pthread_rwlock_t latch;
 } IndexTreeNode;
 
+/**
+ * 批量构建时某一层正在填充的节点
+ */
+typedef struct IndexBuilderLevel
+{
+	/** 正在填充的节点的页号 */
+	uint64 pageId;
+	/** 本层前一个节点的页号（只有叶子节点有效） */
+	uint64 prev;
+	/** 节点中已经填充的条目数 */
+	uint32 size;
+	/** 本层已经写入文件的节点数 */
+	uint64 written;
+	/** 页缓冲，条目按照数据页格式直接写入，写文件时再填充节点元数据（压缩key或变长key时为节点中的条目格式） */
+	char *buffer;
+	/** 压缩key或变长key时：节点编码后的长度 */
+	uint32 encodedLen;
+	/** 压缩key时：节点的公共前缀长度 */
+	uint32 prefixLen;
+	/** 压缩key或变长key时：本层前一个节点的最后一个key，用于生成截断的分隔key */
+	uint8 *prevLastKey;
+} IndexBuilderLevel;
+
+/**
+ * 索引批量构建器：按key有序地接收数据，自底向上直接写出满的数据页
+ * 每一层只保留一个正在填充的节点，节点满时写入文件并将其第一个key和页号加入上一层，
+ * 所以内存占用为 树深度*pageSize，所有层在一次遍历中完成
+ */
+typedef struct IndexEngineBuilder
+{
+	/** 要构建的索引引擎（必须为空） */
+	IndexEngine *engine;
+	/** 每个叶子节点填充的条目数 */
+	uint32 leafCapacity;
+	/** 每个链接节点填充的孩子数 */
+	uint32 linkCapacity;
+	/** 压缩key或变长key时：节点编码后填充的字节数 */
+	uint32 encodedCapacity;
+	/** 压缩key或变长key时：写文件使用的页缓冲 */
+	char *pageBuffer;
+	/** 已经使用的层数，第0层为叶子节点 */
+	uint32 depth;
+	/** 每一层正在填充的节点 */
+	IndexBuilderLevel levels[INDEX_BUILDER_MAX_DEPTH];
+	/** 上一个加入的key，用于检查顺序 */
+	uint8 *lastKey;
+	/** 已经加入的条目数 */
+	uint64 count;
+	/** 第一个叶子节点的页号 */
+	uint64 sqt;
+	/** 写入文件的页数 */
+	uint64 pageCnt;
+	/** 开始构建时的nextPageId，放弃构建时恢复 */
+	uint64 nextPageId;
+	/** 磁盘中的标志 */
+	uint32 diskFlag;
+	/** 是否出现了顺序错误 */
+	int32 error;
+} IndexEngineBuilder;
+
+/**
+ * 范围游标：沿叶子链表按需读取 lower ~ upper 范围内的记录
+ * 每次读入一个叶子节点（及跨越到下一个叶子节点的相等key）的记录到缓冲区，两次读入之间不固定节点、不持有锁，
+ * 树结构没有变化时直接从上次停下的叶子节点继续，否则从根节点重新定位到上次读入的key之后
+ */
+typedef struct IndexEngineCursor
+{
+	/** 所属的引擎 */
+	IndexEngine *engine;
+	/** 下界，NULL表示没有下界 */
+	uint8 *lower;
+	/** 是否包含等于下界的key */
+	int32 lowerInclusive;
+	/** 上界，NULL表示没有上界 */
+	uint8 *upper;
+	/** 是否包含等于上界的key */
+	int32 upperInclusive;
+	/** 是否按key从大到小返回 */
+	int32 reverse;
+	/** 最多返回的记录数，0 表示不限制 */
+	uint64 limit;
+	/** 已经返回的记录数 */
+	uint64 count;
+	/** 读入的条目：key + value */
+	uint8 *buffer;
+	/** 缓冲区可以存放的条目数 */
+	uint32 capacity;
+	/** 缓冲区中的条目数 */
+	uint32 size;
+	/** 下一个要返回的条目在缓冲区中的下标 */
+	uint32 offset;
+	/** 下一次读入开始的叶子节点页号，0 表示已经读完 */
+	uint64 pageId;
+	/** 读入时树结构的版本 */
+	uint64 structureVersion;
+	/** 最后读入的key，下一次读入从它之后（反向时之前）开始 */
+	uint8 *lastKey;
+	/** 是否已经读入过 */
+	int32 started;
+	/** 沿叶子链表连续前进的步数，用于检测顺序扫描并触发预读 */
+	int32 sequence;
+	/** 当前记录的key，在下一次调用nextIndexEngineCursor之前有效 */
+	uint8 *key;
+	/** 当前记录的value，在下一次调用nextIndexEngineCursor之前有效 */
+	uint8 *value;
+} IndexEngineCursor;
+
 /*****************************************************************************
  * 公开API
  ******************************************************************************/
@@ -277,6 +474,34 @@ List *searchConditionIndexEngine(IndexEngine *engine, uint8 *key, uint8 relOp);
  */
 List *searchAllIndexEngine(IndexEngine *engine, uint8 *key);
 
+/**
+ * 打开一个范围游标，按需从叶子链表读取，代价为 O(log n + k)
+ * 游标打开期间其他线程可以修改索引，已经读入缓冲区的记录不受影响
+ * @param engine IndexEngine
+ * @param lower 下界，NULL表示没有下界，游标保存一份拷贝
+ * @param lowerInclusive 是否包含等于下界的key
+ * @param upper 上界，NULL表示没有上界，游标保存一份拷贝
+ * @param upperInclusive 是否包含等于上界的key
+ * @param reverse 0 按key从小到大返回，否则从大到小
+ * @param limit 最多返回的记录数，0 表示不限制
+ * @return {IndexEngineCursor *} 游标，位于第一条记录之前
+ */
+IndexEngineCursor *openIndexEngineCursor(IndexEngine *engine,
+	uint8 *lower, int32 lowerInclusive, uint8 *upper, int32 upperInclusive, int32 reverse, uint64 limit);
+
+/**
+ * 移动到下一条记录，通过cursor->key、cursor->value访问
+ * @param cursor 游标
+ * @return 1 有记录，0 扫描结束
+ */
+int32 nextIndexEngineCursor(IndexEngineCursor *cursor);
+
+/**
+ * 关闭并释放游标，必须在freeIndexEngine之前调用
+ * @param cursor 游标
+ */
+void closeIndexEngineCursor(IndexEngineCursor *cursor);
+
 /**
  * 向BTree添加添加一条记录
  * 注意：不会进行重复判断，直接插入
@@ -284,7 +509,7 @@ List *searchAllIndexEngine(IndexEngine *engine, uint8 *key);
  * @param engine IndexEngine
  * @param key 要插入的key
  * @param value 要插入的value
- * @return {int32} -1 插入失败，1 表示插入成功
+ * @return {int32} -1 插入失败（违反唯一约束，或者树的深度增长到缓冲池容纳不下一次分裂涉及的节点），1 表示插入成功
  */
 int32 insertIndexEngine(IndexEngine *engine, uint8 *key, uint8 *value);
 
@@ -293,10 +518,41 @@ int32 insertIndexEngine(IndexEngine *engine, uint8 *key, uint8 *value);
  * @param engine IndexEngine
  * @param key 要删除的key
  * @param value 要删除的value可为NULL，为NULL表示删除所有满足key的记录
- * @return {int32} 表示删除的记录数目
+ * @return {int32} 表示删除的记录数目，-1 表示缓冲池容纳不下一次合并涉及的节点（树的深度过大），没有删除
  */
 int32 removeIndexEngine(IndexEngine *engine, uint8 *key, uint8 *value);
 
+/*****************************************************************************
+ * 批量构建
+ ******************************************************************************/
+
+/**
+ * 创建一个批量构建器，用于从有序的数据一次性构建空的索引
+ * 构建过程不写重做日志、不经过缓存，完成时按照持久化的流程切换元数据，中途断电索引保持为空
+ * 构建期间不能对该索引进行其他操作
+ * @param engine 要构建的索引引擎，必须为空且没有未持久化的修改
+ * @param fillFactor 节点填充率（百分比，1~100），0 表示INDEX_BUILDER_DEFAULT_FILL_FACTOR
+ * @return {IndexEngineBuilder*} 构建器，索引不为空或正在持久化时返回NULL
+ */
+IndexEngineBuilder *makeIndexEngineBuilder(IndexEngine *engine, uint32 fillFactor);
+
+/**
+ * 向构建器添加一条记录，key必须不小于上一条记录的key（唯一索引必须严格递增）
+ * @param builder 构建器
+ * @param key 要插入的key
+ * @param value 要插入的value
+ * @return {int32} 1 成功，-1 顺序错误（之后的添加都会失败，finish时放弃构建）
+ */
+int32 addIndexEngineBuilder(IndexEngineBuilder *builder, uint8 *key, uint8 *value);
+
+/**
+ * 完成构建：写出每一层剩余的节点，切换元数据并刷磁盘，然后释放构建器
+ * 完成后丢弃旧的重做日志（空索引上的操作已经没有意义）
+ * @param builder 构建器
+ * @return {int32} 1 成功，-1 出现过顺序错误，索引保持为空
+ */
+int32 finishIndexEngineBuilder(IndexEngineBuilder *builder);
+
 /*****************************************************************************
  * 文件操作
  ******************************************************************************/
@@ -309,7 +565,7 @@ int32 removeIndexEngine(IndexEngine *engine, uint8 *key, uint8 *value);
  * @param isUnique 是否唯一
  * @param keyLen 键字节数
  * @param valueLen 值字节数
- * @param maxHeapSize 最大堆内存大小 0 表示96M，仅仅是个建议可能超过
+ * @param maxHeapSize 最大堆内存大小 0 表示96M，过小时缓冲池至少能完成一次增删（见INDEX_BUFFER_POOL_MIN_DEPTH）
  * @param operateListMaxSize 内存最大持久尺寸：超过这个尺寸将阻塞主线程
  * @param flushStrategy 重做日志刷磁盘策略
  * @param flushStrategyArg 重做日志刷磁盘策略的参数
@@ -330,7 +586,7 @@ IndexEngine *makeIndexEngine(
  * 从文件系统加载一个索引引擎，文件不存在返回NULL
  * 会进行启动检查，恢复状态
  * @param filename 文件路径
- * @param maxHeapSize 最大堆内存大小 0 表示96M，仅仅是个建议可能超过
+ * @param maxHeapSize 最大堆内存大小 0 表示96M，过小时缓冲池至少能完成一次增删（见INDEX_BUFFER_POOL_MIN_DEPTH）
  * @param operateListMaxSize 内存最大持久尺寸：超过这个尺寸将阻塞主线程
  * @param flushStrategy 刷磁盘策略
  * @param flushStrategyArg 刷磁盘策略的参数
@@ -341,6 +597,36 @@ IndexEngine *loadIndexEngine(char *filename, uint64 maxHeapSize,
 							enum RedoFlushStrategy flushStrategy,
 							uint64 flushStrategyArg);
 
+/**
+ * 设置数据页中的key是否压缩存储，只能在索引为空时设置（会写入元数据）
+ * 压缩时叶子节点消除公共前缀，所有节点截断key末尾的0，分裂叶子节点时使用最短的分隔key，
+ * 节点按压缩后的字节数分裂，扇出随key的实际长度增加
+ * @param engine IndexEngine
+ * @param isCompression 是否压缩
+ * @return {int32} 1 成功，0 索引不为空或页太小无法压缩
+ */
+int32 setIndexEngineKeyCompression(IndexEngine *engine, int8 isCompression);
+
+/**
+ * 设置key是否变长，只能在索引为空时设置（会写入元数据），与key压缩二选一
+ * 变长时keyLen为key的最大长度，key的长度为去掉末尾的0之后的长度：
+ * 数据页为槽页，每个条目只存放key的实际长度；节点中的每个条目记录key的长度，比较时只比较实际长度，
+ * 节点按槽页的字节数分裂，短key的扇出更高
+ * @param engine IndexEngine
+ * @param isVariableKey 是否变长
+ * @return {int32} 1 成功，0 索引不为空、已经压缩key或页大小不合适
+ */
+int32 setIndexEngineVariableKey(IndexEngine *engine, int8 isVariableKey);
+
+/**
+ * 设置顺序扫描时的预读页数，默认为INDEX_READ_AHEAD_PAGES
+ * 沿叶子链表连续前进时，后台线程沿链表读取之后叶子节点的元数据，
+ * 对不在缓冲池中的页调用posix_fadvise，扫描到达时页已经在操作系统的页缓存中
+ * @param engine IndexEngine
+ * @param pages 每次预读的叶子节点数，0 表示关闭预读
+ */
+void setIndexEngineReadAhead(IndexEngine *engine, uint32 pages);
+
 /**
  * 释放一个IndexEngine的内存
  * @param engine 创建来的是一个备份，最后会free掉
@@ -395,8 +681,9 @@ void metaToBuffer(IndexEngine* engine, char* buffer);
  * @param node IndexTreeNode
  * @param nodeType 可选值为TYPE_XXX宏
  * @param buffer 被填充的字节数组
+ * @return {uint32} 页的有效长度
  */
-void nodeToBuffer(
+uint32 nodeToBuffer(
 	IndexEngine *engine, 
 	IndexTreeNode *node, 
 	int32 nodeType, 
@@ -507,6 +794,7 @@ void traverseIndexFileByPage(
 /**
  * 从缓存或磁盘中读取一个节点
  * 此函数非常重要
+ * 返回的节点在缓冲池中被固定，使用完后必须调用unpinTreeNode
  * @param engine IndexEngine
  * @param pageId 页号
  * @param nodeType 节点类型
@@ -514,6 +802,13 @@ void traverseIndexFileByPage(
  */
 IndexTreeNode *getTreeNodeByPageId(IndexEngine *engine, uint64 pageId, int32 nodeType);
 
+/**
+ * 解除节点在缓冲池中的一次固定，node可以为NULL
+ * @param engine IndexEngine
+ * @param node getTreeNodeByPageId返回的节点
+ */
+void unpinTreeNode(IndexEngine *engine, IndexTreeNode *node);
+
 /**
  * 持久化断电测试用变量
  */
@@ -0,0 +1,209 @@
+/*****************************************************************************
+ * Copyright (c) 2018, rectcircle. All rights reserved.
+ *
+ * Hash引擎的内存索引：key -> RecordLocation
+ *
+ * 与通用的HashMap相比，针对大量的小key做了内存紧凑的设计：
+ * 槽数组为开放寻址（线性探测），每个槽只有8字节：hash值和条目下标，探测时不需要访问条目
+ * 条目（位置信息+key）分块连续存放，短key直接存放在条目中，长key存放在一个连续的arena中
+ * 条目按块分配，不会移动，RecordLocation指针在删除之后、被回收之前一直有效
+ *
+ * 扩容缩容采用渐进式rehash：创建新的槽数组后，每次插入、删除操作迁移少量槽，
+ * 已迁移的旧槽标记为已迁移（查找时跳过但不终止探测），迁移期间查找同时检查新旧两个槽数组
+ *
+ * 内存管理方式为：
+ * key自动管理：插入操作将key拷贝到条目或arena中
+ * RecordLocation由索引分配，删除后进入待回收链表，reclaimKeyIndex或两次reclaimPreviousKeyIndex之后才能被重用
+ *
+ * @filename: keyindex.h
+ * @description: Hash引擎内存索引结构与函数声明
+ * @author: Rectcircle
+ * @version: 1.0
+ * @date: 2026-10-17
+ ******************************************************************************/
+#pragma once
+#ifndef __KEYINDEX_H__
+#define __KEYINDEX_H__
+#include "global.h"
+
+/*****************************************************************************
+ * 宏定义
+ ******************************************************************************/
+
+/** 不超过该长度的key直接存放在条目中 */
+#define KEY_INDEX_INLINE_KEY_SIZE 12
+/** 每个条目块包含2^KEY_INDEX_CHUNK_SHIFT个条目 */
+#define KEY_INDEX_CHUNK_SHIFT 10
+
+/*****************************************************************************
+ * 结构定义
+ ******************************************************************************/
+
+/**
+ * 记录的位置
+ */
+typedef struct RecordLocation
+{
+	/** 文件偏移量 */
+	uint64 position;
+	/** 在内存cache中的id */
+	uint64 id;
+	/** 记录在文件中占用的字节数，position为0时无效 */
+	uint32 size;
+	/** value存放在blob文件中时为value的字节数，否则为0（占用结构体的对齐填充，不增加内存） */
+	uint32 blobSize;
+} RecordLocation;
+
+/**
+ * 索引条目，location必须是第一个字段（RecordLocation指针即条目指针）
+ */
+typedef struct KeyIndexEntry
+{
+	/** 记录的位置 */
+	RecordLocation location;
+	/** 键长度；条目空闲或待回收时保存链表中下一个条目的下标+1 */
+	uint32 keyLen;
+	/** 短key直接存放；长key存放arena中的偏移（前8字节） */
+	uint8 key[KEY_INDEX_INLINE_KEY_SIZE];
+} KeyIndexEntry;
+
+/**
+ * 槽：hash值和条目下标+1（0表示空槽）
+ */
+typedef struct KeyIndexSlot
+{
+	/** key的hash值 */
+	uint32 hash;
+	/** 条目下标+1 */
+	uint32 entry;
+} KeyIndexSlot;
+
+/** 内存索引定义 */
+typedef struct KeyIndex
+{
+	/** 目前索引中key的数目 */
+	uint32 size;
+	/** 槽数组，rehash期间为新槽数组 */
+	KeyIndexSlot *slots;
+	/** 槽数组长度，值为2^n */
+	uint32 slotCapacity;
+	/** 创建时的槽数组长度，自动缩容不会小于该值 */
+	uint32 minSlotCapacity;
+	/** rehash期间的旧槽数组，不在rehash时为NULL */
+	KeyIndexSlot *oldSlots;
+	/** 旧槽数组长度 */
+	uint32 oldSlotCapacity;
+	/** 旧槽数组中还未迁移的key数目 */
+	uint32 oldSize;
+	/** 旧槽数组中下一个待迁移的槽下标 */
+	uint32 rehashIndex;
+	/** 条目块 */
+	KeyIndexEntry **chunks;
+	/** 条目块数目 */
+	uint32 chunkCount;
+	/** 已经使用过的条目数目（包括空闲的） */
+	uint32 entryCount;
+	/** 空闲条目链表头（下标+1） */
+	uint32 freeHead;
+	/** 待回收条目链表头（下标+1） */
+	uint32 retiredHead;
+	/** 上一次reclaimPreviousKeyIndex之前删除、等待下一次调用时回收的条目链表头（下标+1） */
+	uint32 pendingHead;
+	/** 长key存放区 */
+	uint8 *arena;
+	/** arena已使用的字节数 */
+	uint64 arenaSize;
+	/** arena容量 */
+	uint64 arenaCapacity;
+	/** arena中已删除的key占用的字节数 */
+	uint64 arenaGarbage;
+} KeyIndex;
+
+/*****************************************************************************
+ * 类型定义
+ ******************************************************************************/
+
+/** 遍历函数，返回非NULL时停止遍历 */
+typedef void *(*ForeachKeyIndexFunction)(uint32 keyLen, uint8 *key, RecordLocation *location, void *args);
+
+/*****************************************************************************
+ * 公开API
+ ******************************************************************************/
+
+/**
+ * 创建一个内存索引
+ * 负载因子超过0.75时自动扩容为2倍，低于0.1时自动缩容（不小于初始容量）
+ * @param capacity 预估的容量，决定初始槽数组长度
+ * @return {KeyIndex*} 一个可用的内存索引
+ */
+KeyIndex *makeKeyIndex(uint32 capacity);
+
+/**
+ * 释放内存索引，包括所有的RecordLocation
+ */
+void freeKeyIndex(KeyIndex *index);
+
+/**
+ * 查找key对应的位置
+ * @param index 内存索引
+ * @param keyLen 键的长度
+ * @param key 键
+ * @return {RecordLocation *} 位置，不存在返回NULL
+ */
+RecordLocation *getKeyIndex(KeyIndex *index, uint32 keyLen, uint8 *key);
+
+/**
+ * 插入一个key，返回其位置；key不存在时新建的位置所有字段为0，已存在时返回已有的位置
+ * @param index 内存索引
+ * @param keyLen 键的长度
+ * @param key 键
+ * @return {RecordLocation *} 位置
+ */
+RecordLocation *putKeyIndex(KeyIndex *index, uint32 keyLen, uint8 *key);
+
+/**
+ * 删除一个key，被删除的位置进入待回收链表，在reclaimKeyIndex之前仍然可以访问
+ * @param index 内存索引
+ * @param keyLen 键的长度
+ * @param key 键
+ * @return {RecordLocation *} 被删除的位置，不存在返回NULL
+ */
+RecordLocation *removeKeyIndex(KeyIndex *index, uint32 keyLen, uint8 *key);
+
+/**
+ * 回收所有已删除的位置，调用者需要保证已经没有线程持有这些位置
+ * @param index 内存索引
+ */
+void reclaimKeyIndex(KeyIndex *index);
+
+/**
+ * 回收上一次调用本函数之前删除的位置，之后删除的位置留到下一次调用时回收
+ * 调用者需要保证上一次调用之前开始的、可能持有位置的操作都已经结束
+ * @param index 内存索引
+ */
+void reclaimPreviousKeyIndex(KeyIndex *index);
+
+/**
+ * 遍历内存索引，遍历期间不能插入或删除，当func返回非NULL时停止并返回该值
+ * @param index 内存索引
+ * @param func 执行函数
+ * @param args 外部参数（代替闭包）
+ * @return func的返回值或者NULL
+ */
+void *foreachKeyIndex(KeyIndex *index, ForeachKeyIndexFunction func, void *args);
+
+/**
+ * 内存索引占用的字节数（槽数组、条目块、arena）
+ * @param index 内存索引
+ * @return {uint64} 字节数
+ */
+uint64 getKeyIndexMemory(KeyIndex *index);
+
+/**
+ * 是否正在进行渐进式rehash
+ * @param index 内存索引
+ * @return 1 正在rehash，0 没有
+ */
+int32 isRehashingKeyIndex(KeyIndex *index);
+
+#endif
@@ -13,6 +13,12 @@
  * 
  * 该结构可以当做不支持扩容的HashMap使用（将LRUCache.capacity）设为max_int即可
  * 
+ * 支持两种淘汰策略（见LRUCachePolicy）：
+ * LRUPolicy：经典的LRU，一次全表扫描就会把热点数据全部挤出缓存
+ * TwoQueuePolicy：2Q算法，新数据先进入容量为1/4的FIFO试用队列（A1in），在试用队列中命中不会提升；
+ * 从试用队列淘汰的key记录在幽灵队列（A1out，只保存key）中，再次插入时才进入主LRU队列（Am）；
+ * 只被访问一次的扫描数据最多占用试用队列的空间，不会冲掉主队列中的热点数据
+ * 
  * @filename: lrucache.h 
  * @description: LRU缓存结构与函数声明
  * @author: Rectcircle
@@ -26,6 +32,19 @@
 #include "global.h"
 #include "util.h"
 
+/*****************************************************************************
+ * 枚举定义
+ ******************************************************************************/
+
+/** 缓存的淘汰策略 */
+enum LRUCachePolicy
+{
+	/** 经典LRU，默认策略 */
+	LRUPolicy,
+	/** 2Q：试用FIFO队列 + 幽灵队列 + 主LRU队列，抗扫描 */
+	TwoQueuePolicy
+};
+
 /*****************************************************************************
  * 结构定义
  ******************************************************************************/
@@ -43,9 +62,18 @@ typedef struct LRUCache
 	uint32 keyLen;
 	/** hashtable的桶数组 */
 	struct LRUNode **table;
-	/** 双向循环链表的头指针 */
+	/** 双向循环链表的头指针（2Q策略下为主队列Am） */
 	struct LRUNode *head;
-
+	/** 淘汰策略 */
+	enum LRUCachePolicy policy;
+	/** 2Q试用队列A1in的头指针，LRU策略下为NULL */
+	struct LRUNode *probationHead;
+	/** 试用队列中的节点数目 */
+	uint32 probationSize;
+	/** 试用队列的目标容量Kin，超过后优先从试用队列淘汰 */
+	uint32 probationCapacity;
+	/** 2Q幽灵队列A1out：只保存从试用队列淘汰的key，value为NULL，LRU策略下为NULL */
+	struct LRUCache *ghost;
 } LRUCache;
 
 /** LRU数据节点，同时是一个双向链表的节点和单链表的节点 */
@@ -61,8 +89,17 @@ typedef struct LRUNode
 	struct LRUNode *next;
 	/** 单链表的后继指针 */
 	struct LRUNode *after;
+	/** 是否位于2Q的试用队列中 */
+	uint8 probation;
 } LRUNode;
 
+/*****************************************************************************
+ * 类型定义
+ ******************************************************************************/
+
+/** 遍历函数，返回非NULL时停止遍历 */
+typedef void *(*ForeachLRUCacheFunction)(uint32 keyLen, uint8 *key, void *value, void *args);
+
 /*****************************************************************************
  * 公开API
  ******************************************************************************/
@@ -75,6 +112,16 @@ typedef struct LRUNode
  */
 LRUCache *makeLRUCache(uint32 capacity, uint32 keyLen);
 
+/**
+ * 创建一个使用指定淘汰策略的缓存
+ * 2Q策略下试用队列容量为capacity/4，幽灵队列容量为capacity/2
+ * @param capacity 缓存的容量
+ * @param keyLen   key的字节数
+ * @param policy   淘汰策略
+ * @return {LRUCache*} 一个可用缓存，当不满足创建条件返回NULL
+ */
+LRUCache *makeLRUCacheWithPolicy(uint32 capacity, uint32 keyLen, enum LRUCachePolicy policy);
+
 /**
  * 清空一个LRU，并释放其占用内存
  */
@@ -136,6 +183,23 @@ void *removeLRUCache(LRUCache *cache, uint8 *key);
  */
 void clearLRUCache(LRUCache *cache);
 
+/**
+ * 返回缓存满时插入一个新key将会淘汰的key，缓存未满返回NULL
+ * @param cache 待操作的LRU缓存对象
+ * @return {uint8 *} 将被淘汰的key（由缓存管理，不能修改或释放）或者NULL
+ */
+uint8 *evictionCandidateLRUCache(LRUCache *cache);
+
+/**
+ * 遍历缓存中的所有数据（包括2Q的试用队列），遍历期间不能插入或删除，允许释放value
+ * 当func返回非NULL时停止并返回该值
+ * @param cache 待操作的LRU缓存对象
+ * @param func 执行函数
+ * @param args 外部参数（代替闭包）
+ * @return func的返回值或者NULL
+ */
+void *foreachLRUCache(LRUCache *cache, ForeachLRUCacheFunction func, void *args);
+
 /*****************************************************************************
  * 私有且需要测试或在测试中要使用的函数
  ******************************************************************************/
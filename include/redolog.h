@@ -8,6 +8,9 @@
  * 2. 定时写入
  * 3. 阈值写入
  * 
+ * 组提交：持久化线程每次取走队列中的全部操作作为一组，一组只调用一次write（和fdatasync），
+ * 立即写入策略下追加操作的线程等待其所在的组写入完成后返回，并发追加的线程共享一次同步
+ * 
  * OperateTuple内存管理方式：make创建，内部释放
  * OperateTuple的参数：外部创建，内部释放
  * RedoLog内存管理方式：make创建，内部释放，内部自制
@@ -123,6 +126,24 @@ typedef struct RedoLog
 	pthread_mutexattr_t statusAttr;
 	/** 持久化线程 */
 	pthread_t persistenceThread;
+	/** 已追加的最后一个操作的序号，从1开始 */
+	uint64 appendSeq;
+	/** 已经写入文件（开启同步时已经同步）的最后一个操作的序号 */
+	uint64 durableSeq;
+	/** 已追加但还没有调用waitRedoLog的线程数目，释放前需要等待其归零 */
+	uint32 waiters;
+	/** 已经持久化的组数 */
+	uint64 flushCount;
+	/** 每组写入后是否调用fdatasync，默认为0 */
+	int32 syncOnPersistence;
+	/** 写入或同步失败后置1：文件尾部可能是不完整的记录，之后的操作不再写入，等待者返回失败 */
+	int32 failed;
+	/** 一组操作的序列化缓冲区，由persistenceFunction通过reserveRedoLogBuffer写入 */
+	uint8 *buffer;
+	/** 缓冲区中已经写入的字节数 */
+	uint32 bufferLen;
+	/** 缓冲区容量 */
+	uint32 bufferCap;
 } RedoLog;
 
 /*****************************************************************************
@@ -169,8 +190,37 @@ RedoLog *loadRedoLog(
  * 想重做日志中添加一个操作
  * @param redoLog 一个可用的重做日志
  * @param ops 一个操作
+ * @return 与waitRedoLog相同
+ */
+int32 appendRedoLog(RedoLog *redoLog, OperateTuple* ops);
+
+/**
+ * 向重做日志中添加一个操作，不等待写入完成
+ * 之后必须以返回的序号调用一次waitRedoLog，在此之前重做日志不会被释放
+ * 定时和阈值策略下，内存中的操作达到operateListMaxSize时阻塞
+ * @param redoLog 一个可用的重做日志
+ * @param ops 一个操作
+ * @return {uint64} 操作的序号
+ */
+uint64 appendRedoLogAsync(RedoLog *redoLog, OperateTuple *ops);
+
+/**
+ * 立即写入策略下等待序号不大于seq的操作全部写入完成，其他策略直接返回
+ * 日志写入或同步失败后，之后的操作都不会被写入
+ * @param redoLog 一个可用的重做日志
+ * @param seq appendRedoLogAsync返回的序号
+ * @return 1 操作已经写入（其他策略下为日志没有失败），0 日志写入失败，操作没有写入
+ */
+int32 waitRedoLog(RedoLog *redoLog, uint64 seq);
+
+/**
+ * 在persistenceFunction中调用：从组缓冲区中分配len字节用于序列化一个操作
+ * 一组操作全部序列化之后一次写入文件
+ * @param redoLog 一个可用的重做日志
+ * @param len 字节数
+ * @return {uint8 *} 可写入的位置，在本组写入之前有效
  */
-void appendRedoLog(RedoLog *redoLog, OperateTuple* ops);
+uint8 *reserveRedoLogBuffer(RedoLog *redoLog, uint32 len);
 
 /**
  * 等待重做日志刷磁盘线程完毕，释放内存
@@ -179,13 +229,13 @@ void appendRedoLog(RedoLog *redoLog, OperateTuple* ops);
 void freeRedoLog(RedoLog *redoLog);
 
 /**
- * 强制释放RedoLog（不等待刷磁盘线程完成）
+ * 强制释放RedoLog（取消刷磁盘线程，尚未写入的操作被丢弃）
  * @param redoLog 一个可用的重做日志
  */
 void forceFreeRedoLog(RedoLog* redoLog);
 
 /**
- * 强制释放RedoLog（不等待刷磁盘线程完成），并删除文件
+ * 强制释放RedoLog（取消刷磁盘线程，尚未写入的操作被丢弃），并删除文件
  * @param redoLog 一个可用的重做日志
  */
 void forceFreeRedoLogAndUnlink(RedoLog *redoLog);
@@ -53,6 +53,29 @@ typedef struct List
  */
 int32 byteArrayCompare(uint32 len, uint8 *a, uint8 *b);
 
+/** key比较函数，参数与返回值的符号同byteArrayCompare */
+typedef int32 (*KeyCompare)(uint32 len, uint8 *a, uint8 *b);
+
+/** 能否按大端无符号整数整字读取的key长度 */
+#define IS_WORD_KEY_LEN(len) ((len)==1 || (len)==2 || (len)==4 || (len)==8)
+
+/**
+ * 按key长度选择专用的比较函数，在创建索引时选择一次，之后每次比较直接调用
+ * 1/2/4/8字节的key按大端无符号整数整字比较，其他长度使用memcmp（libc中为SIMD实现）
+ * 只保证返回值的符号与byteArrayCompare相同
+ * @param len key的字节数
+ * @return 比较函数
+ */
+KeyCompare getKeyCompare(uint32 len);
+
+/**
+ * 将1/2/4/8字节的key按大端无符号整数读出，数值的大小关系与按字节比较相同
+ * @param len key的字节数，必须满足IS_WORD_KEY_LEN
+ * @param key key字节数组，不要求对齐
+ * @return 主机字节序的整数
+ */
+uint64 loadKeyWord(uint32 len, uint8 *key);
+
 /**
  * 批量拷贝：
  * 对二级及指针的操作为浅拷贝
@@ -16,29 +16,34 @@
  * 通用私有辅助函数
  ******************************************************************************/
 
-private int32 binarySearch(BTreeNode* root, uint8* key, uint32 keyLen){
+/**
+ * 在keys中做二分查找，compare为按keyLen选择的比较函数
+ * 先找到第一个不小于key的元素：每轮固定折半，比较结果只用于选择下一轮的起点，循环中没有依赖比较结果的分支
+ * 与key相等时返回该下标，否则返回前一个下标
+ */
+static int32 searchNodeKeys(KeyCompare compare, BTreeNode* root, uint8* key, uint32 keyLen){
 	if(root->size==0){
 		return -1;
 	}
-	int32 left = 0, right = root->size-1, mid;
-	int32 result;
-	while(left<right){
-		mid = (left+right)>>1;
-		result = byteArrayCompare(keyLen, root->keys[mid], key);
-		if(result==0){ //keys[mid]==key
-			right=mid;
-		} else if(result<0){ //keys[mid]<key
-			left=mid+1;
-		} else { //keys[mid]>key
-			right=mid-1;
-		}
+	int32 base = 0, n = root->size;
+	while(n>1){
+		int32 half = n>>1;
+		base = compare(keyLen, root->keys[base + half], key) < 0 ? base + half : base;
+		n -= half;
 	}
-	result = byteArrayCompare(keyLen, root->keys[left], key);
-	if (result>0){
-		return left-1;
+	base += compare(keyLen, root->keys[base], key) < 0;
+	if(base<root->size && compare(keyLen, root->keys[base], key)==0){
+		return base;
 	}
-	return left;
+	return base-1;
+}
+
+#ifdef PROFILE_TEST
+/** 测试用：按keyLen选择比较函数后查找 */
+int32 binarySearch(BTreeNode* root, uint8* key, uint32 keyLen){
+	return searchNodeKeys(getKeyCompare(keyLen), root, key, keyLen);
 }
+#endif
 
 private BTreeNode *makeBTreeNode(BTree *config, uint64 pageId, int8 isLeaf){
 	//分配内存
@@ -81,6 +86,7 @@ BTree *makeBTree(uint32 degree, uint32 keyLen, uint32 valueLen, int8 isUnique){
 	config->depth = 1;
 	config->degree = degree;
 	config->keyLen = keyLen;
+	config->keyCompare = getKeyCompare(keyLen);
 	config->valueLen = valueLen;
 	config->isUnique = isUnique;
 	BTreeNode* root = makeBTreeNode(config, 0, 1);
@@ -96,18 +102,18 @@ uint8 *searchBTree(BTree *config, uint8 *key, BTreeNode** outNode, int32* outInd
 	BTreeNode* root = config->root;
 	int32 level = 1;
 	while(level<config->depth){ //一直查找到叶子节点
-		int32 index = binarySearch(root, key, config->keyLen);
+		int32 index = searchNodeKeys(config->keyCompare, root, key, config->keyLen);
 		if(index<0){
 			return NULL;
 		}
 		root = root->children[index];
 		level++;
 	}
-	int32 idx = binarySearch(root, key, config->keyLen);
+	int32 idx = searchNodeKeys(config->keyCompare, root, key, config->keyLen);
 	if(idx==-1){
 		return NULL;
 	}
-	if(0==byteArrayCompare(config->keyLen, root->keys[idx] , key)){
+	if(0==config->keyCompare(config->keyLen, root->keys[idx] , key)){
 		if(outNode!=NULL && outIndex!=NULL){
 			*outNode = root;
 			*outIndex = idx;
@@ -145,7 +151,7 @@ static BTreeNode *splitBTreeNode(BTree *config, BTreeNode *nowNode, int8 isLeaf)
  * 递归进行插入及树重建
  */
 static BTreeNode* insertTo(BTree *config, BTreeNode* now, uint8 *key, uint8 *value, int32 level){
-	int32 index = binarySearch(now, key, config->keyLen);
+	int32 index = searchNodeKeys(config->keyCompare, now, key, config->keyLen);
 	//是叶子节点
 	if(level == config->depth){
 		insertToArray((void **)now->keys, config->degree+1, index+1, (void *)key);
@@ -279,7 +285,7 @@ static void balanceBTreeNode(BTree *config, BTreeNode *nowNode, int32 index, int
  */
 static int32 removeFrom(BTree* config, BTreeNode* now, uint8 *key, uint8 *value, int32 level){
 	int32 removeCnt=0;
-	for(int32 index = binarySearch(now, key, config->keyLen); index<now->size; index++){
+	for(int32 index = searchNodeKeys(config->keyCompare, now, key, config->keyLen); index<now->size; index++){
 		//不存在该节点直接返回
 		if (index == -1) return removeCnt;
 		//是叶子节点
@@ -290,7 +296,7 @@ static int32 removeFrom(BTree* config, BTreeNode* now, uint8 *key, uint8 *value,
 				return removeCnt;
 			}
 			//找不到该元素
-			if(byteArrayCompare(config->keyLen, now->keys[index], key)!=0){
+			if(config->keyCompare(config->keyLen, now->keys[index], key)!=0){
 				return removeCnt;
 			}
 			//存在value只删除kv严格相等的数据
@@ -307,7 +313,7 @@ static int32 removeFrom(BTree* config, BTreeNode* now, uint8 *key, uint8 *value,
 			continue;
 		}
 		//非叶子节点
-		if(byteArrayCompare(config->keyLen, key, now->keys[index])<0){
+		if(config->keyCompare(config->keyLen, key, now->keys[index])<0){
 			// key < keys[index] 说明 key对应数据不在index这个孩子下，直接返回
 			return removeCnt;
 		}
@@ -376,7 +382,7 @@ int32 updateBTree(BTree *config, uint8 *key, uint8 *oldValue, uint8 *newValue){
 	int i = outIndex;
 	while (outNode!=NULL){
 		for(; i<outNode->size; i++){
-			if(byteArrayCompare(config->keyLen,outNode->keys[i],key)!=0){
+			if(config->keyCompare(config->keyLen,outNode->keys[i],key)!=0){
 				return 0;
 			}
 			if(byteArrayCompare(config->valueLen, outNode->values[i], oldValue)==0){
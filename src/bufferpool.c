@@ -0,0 +1,228 @@
+/*****************************************************************************
+ * Copyright (c) 2018, rectcircle. All rights reserved.
+ *
+ * @filename: bufferpool.c
+ * @description: 缓冲池函数实现
+ * @author: Rectcircle
+ * @version: 1.0
+ * @date: 2026-10-17
+ ******************************************************************************/
+#include <malloc.h>
+#include <stdlib.h>
+#include <string.h>
+#include "bufferpool.h"
+
+/*****************************************************************************
+ * 私有辅助函数
+ ******************************************************************************/
+
+/** 计算key的hash值 */
+static uint32 hashCode(uint8 *key, uint32 keyLen){
+	//改进的32位FNV算法1
+	static uint32 p = 16777619;
+	uint32 hash = 2166136261;
+	for (int i = 0; i < keyLen; i++)
+		hash = (hash ^ key[i]) * p;
+	hash += hash << 13;
+	hash ^= hash >> 7;
+	hash += hash << 3;
+	hash ^= hash >> 17;
+	hash += hash << 5;
+	return hash;
+}
+
+static uint8 *frameKey(BufferPool *pool, uint32 frame){
+	return pool->keys + (uint64)frame * pool->keyLen;
+}
+
+/** 将所有帧加入空闲链表 */
+static void initFreeFrames(BufferPool *pool){
+	for(uint32 i = pool->capacity; i > 0; i--){
+		BufferFrame *frame = &pool->frames[i - 1];
+		memset(frame, 0, sizeof(BufferFrame));
+		frame->after = pool->freeHead;
+		pool->freeHead = i - 1;
+	}
+}
+
+/** 按容量创建空的桶数组 */
+static void initTable(BufferPool *pool){
+	uint32 bucketCapacity = 1;
+	while(bucketCapacity < pool->capacity)
+		bucketCapacity <<= 1;
+	pool->bucketCapacity = bucketCapacity;
+	pool->table = (uint32 *)malloc(sizeof(uint32) * bucketCapacity);
+	memset(pool->table, 0xff, sizeof(uint32) * bucketCapacity);
+}
+
+static int isBlocked(BufferFrame *f){
+	return f->pinCount > 0 || f->dirty;
+}
+
+/** 从hash表中查找key所在的帧 */
+static uint32 findFrame(BufferPool *pool, uint8 *key){
+	uint32 frame = pool->table[hashCode(key, pool->keyLen) & (pool->bucketCapacity - 1)];
+	while(frame != BUFFER_POOL_NIL){
+		if(byteArrayCompare(pool->keyLen, key, frameKey(pool, frame)) == 0){
+			return frame;
+		}
+		frame = pool->frames[frame].after;
+	}
+	return BUFFER_POOL_NIL;
+}
+
+/** 从hash表中摘除一帧，并放入空闲链表，返回其value */
+static void *releaseFrame(BufferPool *pool, uint32 frame){
+	uint32 *p = &pool->table[hashCode(frameKey(pool, frame), pool->keyLen) & (pool->bucketCapacity - 1)];
+	while(*p != frame){
+		p = &pool->frames[*p].after;
+	}
+	*p = pool->frames[frame].after;
+	BufferFrame *f = &pool->frames[frame];
+	void *value = f->value;
+	if(f->pinCount > 0) pool->pinnedCnt--;
+	if(f->dirty) pool->dirtyCnt--;
+	if(isBlocked(f)) pool->blockedCnt--;
+	memset(f, 0, sizeof(BufferFrame));
+	f->after = pool->freeHead;
+	pool->freeHead = frame;
+	pool->size--;
+	return value;
+}
+
+/** CLOCK：选择一个未固定、不脏的帧，转一圈半仍然找不到返回BUFFER_POOL_NIL */
+static uint32 selectVictim(BufferPool *pool){
+	//第一圈清除访问位，第二圈必然能找到访问位为0的候选
+	for(uint64 i = 0; i < 2 * (uint64)pool->capacity; i++){
+		uint32 frame = pool->hand;
+		BufferFrame *f = &pool->frames[frame];
+		pool->hand = (pool->hand + 1) % pool->capacity;
+		if(f->value == NULL || f->pinCount > 0 || f->dirty){
+			continue;
+		}
+		if(f->reference){
+			f->reference = 0;
+			continue;
+		}
+		return frame;
+	}
+	return BUFFER_POOL_NIL;
+}
+
+/*****************************************************************************
+ * 公有函数
+ ******************************************************************************/
+BufferPool *makeBufferPool(uint32 capacity, uint32 keyLen){
+	if(capacity == 0 || capacity > 0x7fffffffu){
+		return NULL;
+	}
+	BufferPool *pool = (BufferPool *)calloc(1, sizeof(BufferPool));
+	pool->capacity = capacity;
+	pool->keyLen = keyLen;
+	pool->frames = (BufferFrame *)malloc(sizeof(BufferFrame) * capacity);
+	pool->keys = (uint8 *)malloc((uint64)capacity * keyLen);
+	pool->freeHead = BUFFER_POOL_NIL;
+	initFreeFrames(pool);
+	initTable(pool);
+	return pool;
+}
+
+void freeBufferPool(BufferPool *pool){
+	if(pool == NULL){
+		return;
+	}
+	free(pool->table);
+	free(pool->frames);
+	free(pool->keys);
+	free(pool);
+}
+
+void *pinBufferPool(BufferPool *pool, uint8 *key, uint32 *frame){
+	uint32 found = findFrame(pool, key);
+	if(found == BUFFER_POOL_NIL){
+		return NULL;
+	}
+	BufferFrame *f = &pool->frames[found];
+	if(!isBlocked(f)) pool->blockedCnt++;
+	if(f->pinCount++ == 0) pool->pinnedCnt++;
+	f->reference = 1;
+	if(frame != NULL) *frame = found;
+	return f->value;
+}
+
+void *putBufferPool(BufferPool *pool, uint8 *key, void *value, uint32 *frame){
+	void *result = NULL;
+	if(pool->freeHead == BUFFER_POOL_NIL){
+		uint32 victim = selectVictim(pool);
+		if(victim == BUFFER_POOL_NIL){
+			pool->fullCnt++;
+			if(frame != NULL) *frame = BUFFER_POOL_NIL;
+			return NULL;
+		}
+		result = releaseFrame(pool, victim);
+	}
+	uint32 target = pool->freeHead;
+	BufferFrame *f = &pool->frames[target];
+	pool->freeHead = f->after;
+	memcpy(frameKey(pool, target), key, pool->keyLen);
+	uint32 index = hashCode(key, pool->keyLen) & (pool->bucketCapacity - 1);
+	f->value = value;
+	f->pinCount = 1;
+	f->dirty = 0;
+	f->reference = 1;
+	f->after = pool->table[index];
+	pool->table[index] = target;
+	pool->size++;
+	pool->pinnedCnt++;
+	pool->blockedCnt++;
+	if(frame != NULL) *frame = target;
+	return result;
+}
+
+void unpinBufferPool(BufferPool *pool, uint32 frame){
+	BufferFrame *f = &pool->frames[frame];
+	if(f->pinCount > 0 && --f->pinCount == 0){
+		pool->pinnedCnt--;
+		if(!f->dirty) pool->blockedCnt--;
+	}
+}
+
+void setDirtyBufferPool(BufferPool *pool, uint32 frame, int8 dirty){
+	BufferFrame *f = &pool->frames[frame];
+	if(f->dirty != (dirty != 0)){
+		int blocked = isBlocked(f);
+		f->dirty = dirty != 0;
+		if(dirty) pool->dirtyCnt++;
+		else pool->dirtyCnt--;
+		pool->blockedCnt += isBlocked(f) - blocked;
+	}
+}
+
+void setValueBufferPool(BufferPool *pool, uint32 frame, void *value){
+	pool->frames[frame].value = value;
+}
+
+void *removeBufferPool(BufferPool *pool, uint8 *key){
+	uint32 frame = findFrame(pool, key);
+	if(frame == BUFFER_POOL_NIL || pool->frames[frame].pinCount > 0){
+		return NULL;
+	}
+	return releaseFrame(pool, frame);
+}
+
+uint32 availableBufferPool(BufferPool *pool){
+	return pool->capacity - pool->blockedCnt;
+}
+
+void *foreachBufferPool(BufferPool *pool, ForeachBufferPoolFunction func, void *args){
+	for(uint32 i = 0; i < pool->capacity; i++){
+		if(pool->frames[i].value == NULL){
+			continue;
+		}
+		void *result = func(i, frameKey(pool, i), pool->frames[i].value, args);
+		if(result != NULL){
+			return result;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,181 @@
+/*****************************************************************************
+ * Copyright (c) 2018, rectcircle. All rights reserved.
+ *
+ * @filename: compress.c
+ * @description: 块压缩API实现
+ * @author: Rectcircle
+ * @version: 1.0
+ * @date: 2026-10-17
+ ******************************************************************************/
+
+#include "compress.h"
+
+#include <string.h>
+
+//哈希表的位数：4096项，用于查找最近出现的4字节序列
+#define LZ_HASH_BITS 12
+#define LZ_HASH_SIZE (1 << LZ_HASH_BITS)
+//连续未匹配时加大步长，加快处理不可压缩的数据
+#define LZ_SKIP_TRIGGER 6
+
+/*****************************************************************************
+ * 私有函数
+ ******************************************************************************/
+
+static uint32 read32(const uint8 *p){
+	uint32 value;
+	memcpy(&value, p, 4);
+	return value;
+}
+
+static uint32 hashSequence(uint32 sequence){
+	return (sequence * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+//写入扩展长度，返回写入后的位置，空间不足返回0
+static uint32 writeLength(uint8 *dest, uint32 op, uint32 destCap, uint32 len){
+	while(len >= 255){
+		if(op >= destCap){
+			return 0;
+		}
+		dest[op++] = 255;
+		len -= 255;
+	}
+	if(op >= destCap){
+		return 0;
+	}
+	dest[op++] = (uint8)len;
+	return op;
+}
+
+//写入一个序列，matchLen为0表示最后一个只有字面量的序列，返回写入后的位置，空间不足返回0
+static uint32 writeSequence(uint8 *dest, uint32 op, uint32 destCap,
+							const uint8 *literals, uint32 literalLen, uint32 offset, uint32 matchLen){
+	if(op >= destCap){
+		return 0;
+	}
+	uint32 matchCode = matchLen == 0 ? 0 : matchLen - LZ_MIN_MATCH;
+	uint32 tokenPos = op++;
+	dest[tokenPos] = (uint8)(((literalLen < 15 ? literalLen : 15) << 4) | (matchCode < 15 ? matchCode : 15));
+	if(literalLen >= 15 && (op = writeLength(dest, op, destCap, literalLen - 15)) == 0){
+		return 0;
+	}
+	if(op + literalLen > destCap){
+		return 0;
+	}
+	memcpy(dest + op, literals, literalLen);
+	op += literalLen;
+	if(matchLen == 0){
+		return op;
+	}
+	if(op + 2 > destCap){
+		return 0;
+	}
+	dest[op++] = (uint8)(offset & 0xff);
+	dest[op++] = (uint8)(offset >> 8);
+	if(matchCode >= 15 && (op = writeLength(dest, op, destCap, matchCode - 15)) == 0){
+		return 0;
+	}
+	return op;
+}
+
+//读取扩展长度，出错返回0
+static int readLength(const uint8 *src, uint32 srcLen, uint32 *ip, uint32 *len){
+	uint8 byte;
+	do {
+		if(*ip >= srcLen){
+			return 0;
+		}
+		byte = src[(*ip)++];
+		*len += byte;
+	} while(byte == 255);
+	return 1;
+}
+
+/*****************************************************************************
+ * 公开API
+ ******************************************************************************/
+
+uint32 lzCompressBound(uint32 srcLen){
+	//最坏情况：全部为字面量，一个token加扩展长度
+	return srcLen + srcLen / 255 + 16;
+}
+
+uint32 lzCompress(const uint8 *src, uint32 srcLen, uint8 *dest, uint32 destCap){
+	uint32 table[LZ_HASH_SIZE];
+	memset(table, 0, sizeof(table));
+	uint32 ip = 0, anchor = 0, op = 0;
+	uint32 misses = 0;
+	while(ip + LZ_MIN_MATCH <= srcLen){
+		uint32 sequence = read32(src + ip);
+		uint32 h = hashSequence(sequence);
+		uint32 ref = table[h];
+		table[h] = ip;
+		if(ref < ip && ip - ref <= LZ_MAX_OFFSET && read32(src + ref) == sequence){
+			uint32 matchLen = LZ_MIN_MATCH;
+			while(ip + matchLen < srcLen && src[ref + matchLen] == src[ip + matchLen]){
+				matchLen++;
+			}
+			op = writeSequence(dest, op, destCap, src + anchor, ip - anchor, ip - ref, matchLen);
+			if(op == 0){
+				return 0;
+			}
+			ip += matchLen;
+			anchor = ip;
+			misses = 0;
+			//匹配结束位置之前的序列也加入哈希表，提高后续的匹配率
+			if(ip >= 2 && ip + 2 <= srcLen){
+				table[hashSequence(read32(src + ip - 2))] = ip - 2;
+			}
+		} else {
+			ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+		}
+	}
+	return writeSequence(dest, op, destCap, src + anchor, srcLen - anchor, 0, 0);
+}
+
+int32 lzDecompress(const uint8 *src, uint32 srcLen, uint8 *dest, uint32 destCap){
+	uint32 ip = 0, op = 0;
+	while(ip < srcLen){
+		uint8 token = src[ip++];
+		uint32 literalLen = token >> 4;
+		if(literalLen == 15 && !readLength(src, srcLen, &ip, &literalLen)){
+			return -1;
+		}
+		if(ip + literalLen > srcLen || op + literalLen > destCap){
+			return -1;
+		}
+		memcpy(dest + op, src + ip, literalLen);
+		ip += literalLen;
+		op += literalLen;
+		if(ip == srcLen){
+			//最后一个序列
+			break;
+		}
+		if(ip + 2 > srcLen){
+			return -1;
+		}
+		uint32 offset = src[ip] | ((uint32)src[ip + 1] << 8);
+		ip += 2;
+		uint32 matchLen = token & 0x0f;
+		if(matchLen == 15 && !readLength(src, srcLen, &ip, &matchLen)){
+			return -1;
+		}
+		matchLen += LZ_MIN_MATCH;
+		if(offset == 0 || offset > op || op + matchLen > destCap){
+			return -1;
+		}
+		//匹配可能与输出重叠（offset小于matchLen），逐字节拷贝
+		uint8 *from = dest + op - offset;
+		uint8 *to = dest + op;
+		if(offset >= matchLen){
+			memcpy(to, from, matchLen);
+		} else {
+			for(uint32 i = 0; i < matchLen; i++){
+				to[i] = from[i];
+			}
+		}
+		op += matchLen;
+	}
+	return (int32)op;
+}
@@ -0,0 +1,659 @@
+/*****************************************************************************
+ * Copyright (c) 2018, rectcircle. All rights reserved.
+ *
+ * @filename: diskindex.c
+ * @description: Hash引擎磁盘索引函数实现
+ * @author: Rectcircle
+ * @version: 1.0
+ * @date: 2026-10-17
+ ******************************************************************************/
+#include "diskindex.h"
+#include "util.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+//索引文件魔数
+static const uint32 DISK_INDEX_MAGIC_NUMBER = 0x960729adu;
+//索引文件版本号
+static const uint32 DISK_INDEX_VERSION = 1;
+//头部的字节数
+static const uint32 DISK_INDEX_HEADER_SIZE = 80 + 4 * (DISK_INDEX_MAX_LEVEL + 1);
+//条目总字节数超过桶容量的该比例时分裂
+static const double SPLIT_LOAD_FACTOR = 0.75;
+//页缓存的最小页数：分裂时同时访问的页不会超过该值
+static const uint32 MIN_CACHE_PAGES = 4;
+
+/*****************************************************************************
+ * 私有函数
+ ******************************************************************************/
+
+/** 计算key的hash值（与HashMap相同的改进FNV算法） */
+static uint32 hashKey(uint8 *key, uint32 keyLen){
+	static uint32 p = 16777619;
+	uint32 hash = 2166136261;
+	for (uint32 i = 0; i < keyLen; i++)
+		hash = (hash ^ key[i]) * p;
+	hash += hash << 13;
+	hash ^= hash >> 7;
+	hash += hash << 3;
+	hash ^= hash >> 17;
+	hash += hash << 5;
+	return hash;
+}
+
+static uint32 headerChecksum(uint8 *data, uint32 len){
+	uint32 hash = 2166136261u;
+	for(uint32 i = 0; i < len; i++){
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static int pwriteFully(int fd, uint8 *buffer, uint64 len, uint64 position){
+	while(len > 0){
+		ssize_t n = pwrite(fd, buffer, len, position);
+		if(n <= 0){
+			return 0;
+		}
+		buffer += n;
+		len -= n;
+		position += n;
+	}
+	return 1;
+}
+
+static uint32 bucketCountOf(DiskIndex *index){
+	return (1u << index->level) + index->splitIndex;
+}
+
+/** 线性哈希的寻址：先按下一轮的位数取桶，该桶还没有分裂出来时按本轮的位数取桶 */
+static uint32 bucketOf(DiskIndex *index, uint32 hash){
+	uint32 bucket = hash & (uint32)((2ull << index->level) - 1);
+	if(bucket >= bucketCountOf(index)){
+		bucket = hash & (uint32)((1ull << index->level) - 1);
+	}
+	return bucket;
+}
+
+/** 桶所在的组：第0组为桶0，第g组为桶[2^(g-1), 2^g) */
+static uint32 groupOf(uint32 bucket){
+	return bucket == 0 ? 0 : 32 - __builtin_clz(bucket);
+}
+
+/** 第group组之前分配的溢出页数目 */
+static uint32 overflowBefore(DiskIndex *index, uint32 group){
+	uint32 count = 0;
+	for(uint32 g = 0; g < group; g++){
+		count += index->overflowCounts[g];
+	}
+	return count;
+}
+
+static uint32 bucketPageNo(DiskIndex *index, uint32 bucket){
+	return 1 + bucket + overflowBefore(index, groupOf(bucket));
+}
+
+static uint32 pageNext(uint8 *data){
+	return ntohl(*(uint32 *)data);
+}
+
+static void setPageNext(uint8 *data, uint32 next){
+	*(uint32 *)data = htonl(next);
+}
+
+static uint32 pageUsed(uint8 *data){
+	return ntohs(*(uint16 *)(data + 6));
+}
+
+static uint32 entryKeyLen(uint8 *entry){
+	return ntohs(*(uint16 *)(entry + 4));
+}
+
+static void readEntryValue(uint8 *entry, DiskIndexValue *value){
+	value->position = ntohll(*(uint64 *)(entry + 6));
+	value->size = ntohl(*(uint32 *)(entry + 14));
+	value->blobSize = ntohl(*(uint32 *)(entry + 18));
+}
+
+static void writeEntryValue(uint8 *entry, DiskIndexValue *value){
+	*(uint64 *)(entry + 6) = htonll(value->position);
+	*(uint32 *)(entry + 14) = htonl(value->size);
+	*(uint32 *)(entry + 18) = htonl(value->blobSize);
+}
+
+/** 在页中查找key，返回条目在页中的偏移，不存在返回0 */
+static uint32 findInPage(uint8 *data, uint32 hash, uint32 keyLen, uint8 *key){
+	uint32 offset = DISK_INDEX_PAGE_HEADER_SIZE;
+	uint32 end = DISK_INDEX_PAGE_HEADER_SIZE + pageUsed(data);
+	while(offset < end){
+		uint8 *entry = data + offset;
+		uint32 len = entryKeyLen(entry);
+		if(ntohl(*(uint32 *)entry) == hash && len == keyLen &&
+		   memcmp(entry + DISK_INDEX_ENTRY_HEADER_SIZE, key, keyLen) == 0){
+			return offset;
+		}
+		offset += DISK_INDEX_ENTRY_HEADER_SIZE + len;
+	}
+	return 0;
+}
+
+/** 将一个完整的条目追加到页中，调用者保证空间足够 */
+static void appendToPage(uint8 *data, uint8 *entry, uint32 entrySize){
+	uint32 used = pageUsed(data);
+	memcpy(data + DISK_INDEX_PAGE_HEADER_SIZE + used, entry, entrySize);
+	*(uint16 *)(data + 4) = htons(ntohs(*(uint16 *)(data + 4)) + 1);
+	*(uint16 *)(data + 6) = htons(used + entrySize);
+}
+
+static int writeHeader(DiskIndex *index, int32 dirty){
+	uint8 header[DISK_INDEX_HEADER_SIZE];
+	*(uint32 *)header = htonl(DISK_INDEX_MAGIC_NUMBER);
+	*(uint32 *)(header + 4) = htonl(DISK_INDEX_VERSION);
+	*(uint32 *)(header + 8) = htonl(dirty);
+	*(uint32 *)(header + 12) = htonl(DISK_INDEX_PAGE_SIZE);
+	*(uint32 *)(header + 16) = htonl(index->level);
+	*(uint32 *)(header + 20) = htonl(index->splitIndex);
+	*(uint32 *)(header + 24) = htonl(index->freeHead);
+	*(uint32 *)(header + 28) = 0;
+	*(uint64 *)(header + 32) = htonll(index->count);
+	*(uint64 *)(header + 40) = htonll(index->usedBytes);
+	for(uint32 i = 0; i < DISK_INDEX_USER_DATA_COUNT; i++){
+		*(uint64 *)(header + 48 + i * 8) = htonll(index->userData[i]);
+	}
+	for(uint32 g = 0; g <= DISK_INDEX_MAX_LEVEL; g++){
+		*(uint32 *)(header + 80 + g * 4) = htonl(index->overflowCounts[g]);
+	}
+	*(uint32 *)(header + 28) = htonl(headerChecksum(header, DISK_INDEX_HEADER_SIZE));
+	return pwriteFully(index->fd, header, DISK_INDEX_HEADER_SIZE, 0);
+}
+
+static int writePage(DiskIndex *index, DiskIndexPage *page){
+	//写回页之前必须先在磁盘上标记未同步，崩溃时加载方才能发现不完整的修改
+	if(!index->dirty && !markDirtyDiskIndex(index)){
+		return 0;
+	}
+	if(!pwriteFully(index->fd, page->data, DISK_INDEX_PAGE_SIZE, (uint64)page->pageNo * DISK_INDEX_PAGE_SIZE)){
+		return 0;
+	}
+	page->dirty = 0;
+	index->dirtyPages--;
+	index->pageWrites++;
+	return 1;
+}
+
+static void markPageDirty(DiskIndex *index, DiskIndexPage *page){
+	if(!page->dirty){
+		page->dirty = 1;
+		index->dirtyPages++;
+	}
+}
+
+/** 从文件读取一个页，文件末尾之后的部分为全0（尚未写入的页即空页），读取失败返回0 */
+static int readPage(DiskIndex *index, uint32 pageNo, DiskIndexPage *page){
+	page->pageNo = pageNo;
+	page->dirty = 0;
+	uint64 done = 0;
+	while(done < DISK_INDEX_PAGE_SIZE){
+		ssize_t n = pread(index->fd, page->data + done, DISK_INDEX_PAGE_SIZE - done, (uint64)pageNo * DISK_INDEX_PAGE_SIZE + done);
+		if(n < 0){
+			return 0;
+		}
+		if(n == 0){
+			break;
+		}
+		done += n;
+	}
+	memset(page->data + done, 0, DISK_INDEX_PAGE_SIZE - done);
+	return 1;
+}
+
+/** 将读取的页加入缓存，缓存满时先写回将被淘汰的页，写回失败时该页保留在缓存中，释放新页并返回NULL */
+static DiskIndexPage *cachePage(DiskIndex *index, DiskIndexPage *page){
+	uint8 *victimKey = evictionCandidateLRUCache(index->pages);
+	if(victimKey != NULL){
+		DiskIndexPage *victim = (DiskIndexPage *)getLRUCacheNoChange(index->pages, victimKey);
+		if(victim->dirty && !writePage(index, victim)){
+			free(page);
+			return NULL;
+		}
+	}
+	uint64 key = page->pageNo;
+	index->pageReads++;
+	DiskIndexPage *evicted = (DiskIndexPage *)putLRUCache(index->pages, (uint8 *)&key, page);
+	if(evicted != NULL){
+		free(evicted);
+	}
+	return page;
+}
+
+/** 获取一个页，不在缓存中时从文件读取，读取失败或者被淘汰的页写回失败时返回NULL */
+static DiskIndexPage *fetchPage(DiskIndex *index, uint32 pageNo){
+	uint64 key = pageNo;
+	DiskIndexPage *page = (DiskIndexPage *)getLRUCache(index->pages, (uint8 *)&key);
+	if(page != NULL){
+		return page;
+	}
+	page = (DiskIndexPage *)malloc(sizeof(DiskIndexPage));
+	if(!readPage(index, pageNo, page)){
+		free(page);
+		return NULL;
+	}
+	return cachePage(index, page);
+}
+
+/** 分配一个溢出页（优先重用空闲页），返回页号，页内容已经清空，读写页失败时返回0（不修改索引） */
+static uint32 allocOverflowPage(DiskIndex *index){
+	uint32 pageNo;
+	DiskIndexPage *page;
+	if(index->freeHead != 0){
+		pageNo = index->freeHead;
+		page = fetchPage(index, pageNo);
+		if(page == NULL){
+			return 0;
+		}
+		index->freeHead = pageNext(page->data);
+	} else {
+		//放在当前组全部桶页之后
+		uint32 group = groupOf(bucketCountOf(index) - 1);
+		pageNo = 1 + (1u << group) + overflowBefore(index, group) + index->overflowCounts[group];
+		page = fetchPage(index, pageNo);
+		if(page == NULL){
+			return 0;
+		}
+		index->overflowCounts[group]++;
+	}
+	memset(page->data, 0, DISK_INDEX_PAGE_SIZE);
+	markPageDirty(index, page);
+	index->headerChanged = 1;
+	return pageNo;
+}
+
+/** 将溢出页加入空闲链表，读写页失败返回0 */
+static int freeOverflowPage(DiskIndex *index, uint32 pageNo){
+	DiskIndexPage *page = fetchPage(index, pageNo);
+	if(page == NULL){
+		return 0;
+	}
+	memset(page->data, 0, DISK_INDEX_PAGE_SIZE);
+	setPageNext(page->data, index->freeHead);
+	markPageDirty(index, page);
+	index->freeHead = pageNo;
+	index->headerChanged = 1;
+	return 1;
+}
+
+/** 将一个完整的条目放入桶中第一个有足够空间的页，都没有空间时链接一个新的溢出页，读写页失败返回0 */
+static int appendToBucket(DiskIndex *index, uint32 bucket, uint8 *entry, uint32 entrySize){
+	uint32 pageNo = bucketPageNo(index, bucket);
+	uint32 lastPageNo = 0;
+	while(pageNo != 0){
+		DiskIndexPage *page = fetchPage(index, pageNo);
+		if(page == NULL){
+			return 0;
+		}
+		if(DISK_INDEX_PAGE_SIZE - DISK_INDEX_PAGE_HEADER_SIZE - pageUsed(page->data) >= entrySize){
+			appendToPage(page->data, entry, entrySize);
+			markPageDirty(index, page);
+			return 1;
+		}
+		lastPageNo = pageNo;
+		pageNo = pageNext(page->data);
+	}
+	//不持有页的指针跨越fetchPage（可能被淘汰），每次重新获取
+	uint32 newPageNo = allocOverflowPage(index);
+	if(newPageNo == 0){
+		return 0;
+	}
+	DiskIndexPage *last = fetchPage(index, lastPageNo);
+	if(last == NULL){
+		return 0;
+	}
+	setPageNext(last->data, newPageNo);
+	markPageDirty(index, last);
+	DiskIndexPage *page = fetchPage(index, newPageNo);
+	if(page == NULL){
+		return 0;
+	}
+	appendToPage(page->data, entry, entrySize);
+	markPageDirty(index, page);
+	return 1;
+}
+
+/** 分裂splitIndex指向的桶：取出整个溢出链中的条目，推进分裂指针后重新分配到原桶和新桶，读写页失败返回0 */
+static int splitBucket(DiskIndex *index){
+	uint32 source = index->splitIndex;
+	uint32 target = source + (1u << index->level);
+	uint8 *entries = NULL;
+	uint64 len = 0;
+	uint32 first = bucketPageNo(index, source);
+	uint32 pageNo = first;
+	while(pageNo != 0){
+		DiskIndexPage *page = fetchPage(index, pageNo);
+		if(page == NULL){
+			free(entries);
+			return 0;
+		}
+		uint32 used = pageUsed(page->data);
+		uint32 next = pageNext(page->data);
+		entries = (uint8 *)realloc(entries, len + used + 1);
+		memcpy(entries + len, page->data + DISK_INDEX_PAGE_HEADER_SIZE, used);
+		len += used;
+		if(pageNo == first){
+			memset(page->data, 0, DISK_INDEX_PAGE_HEADER_SIZE);
+			markPageDirty(index, page);
+		} else if(!freeOverflowPage(index, pageNo)){
+			free(entries);
+			return 0;
+		}
+		pageNo = next;
+	}
+	index->splitIndex++;
+	if(index->splitIndex == (1u << index->level)){
+		index->level++;
+		index->splitIndex = 0;
+	}
+	index->headerChanged = 1;
+	//新桶的页可能是文件中尚未写入的区域，显式初始化
+	DiskIndexPage *page = fetchPage(index, bucketPageNo(index, target));
+	int ok = page != NULL;
+	if(ok){
+		memset(page->data, 0, DISK_INDEX_PAGE_SIZE);
+		markPageDirty(index, page);
+	}
+	uint64 offset = 0;
+	while(ok && offset < len){
+		uint8 *entry = entries + offset;
+		uint32 entrySize = DISK_INDEX_ENTRY_HEADER_SIZE + entryKeyLen(entry);
+		ok = appendToBucket(index, bucketOf(index, ntohl(*(uint32 *)entry)), entry, entrySize);
+		offset += entrySize;
+	}
+	free(entries);
+	return ok;
+}
+
+static void *writeBackPage(uint32 keyLen, uint8 *key, void *value, void *args){
+	DiskIndexPage *page = (DiskIndexPage *)value;
+	if(page->dirty && !writePage((DiskIndex *)args, page)){
+		return page;
+	}
+	return NULL;
+}
+
+static void *freePage(uint32 keyLen, uint8 *key, void *value, void *args){
+	free(value);
+	return NULL;
+}
+
+static DiskIndex *makeDiskIndexStruct(const char *filename, int fd, uint32 cacheCap){
+	DiskIndex *index = (DiskIndex *)calloc(1, sizeof(DiskIndex));
+	index->filename = (char *)malloc(strlen(filename) + 1);
+	strcpy(index->filename, filename);
+	index->fd = fd;
+	index->pages = makeLRUCache(cacheCap > MIN_CACHE_PAGES ? cacheCap : MIN_CACHE_PAGES, 8);
+	return index;
+}
+
+/*****************************************************************************
+ * 公开API
+ ******************************************************************************/
+
+DiskIndex *makeDiskIndex(const char *filename, uint32 cacheCap){
+	unlink(filename);
+	int fd = open(filename, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if(fd == -1){
+		return NULL;
+	}
+	DiskIndex *index = makeDiskIndexStruct(filename, fd, cacheCap);
+	//只有桶0，其页为文件中尚未写入的区域（空页）
+	if(!writeHeader(index, 0) || fdatasync(fd) != 0){
+		freeDiskIndex(index);
+		unlink(filename);
+		return NULL;
+	}
+	return index;
+}
+
+DiskIndex *loadDiskIndex(const char *filename, uint32 cacheCap){
+	int fd = open(filename, O_RDWR);
+	if(fd == -1){
+		return NULL;
+	}
+	uint8 header[DISK_INDEX_HEADER_SIZE];
+	if(pread(fd, header, DISK_INDEX_HEADER_SIZE, 0) != DISK_INDEX_HEADER_SIZE){
+		close(fd);
+		return NULL;
+	}
+	uint32 checksum = ntohl(*(uint32 *)(header + 28));
+	*(uint32 *)(header + 28) = 0;
+	if(ntohl(*(uint32 *)header) != DISK_INDEX_MAGIC_NUMBER || ntohl(*(uint32 *)(header + 4)) != DISK_INDEX_VERSION ||
+	   ntohl(*(uint32 *)(header + 12)) != DISK_INDEX_PAGE_SIZE || headerChecksum(header, DISK_INDEX_HEADER_SIZE) != checksum ||
+	   ntohl(*(uint32 *)(header + 8)) != 0 || ntohl(*(uint32 *)(header + 16)) > DISK_INDEX_MAX_LEVEL){
+		//损坏或者上次写回页的过程中崩溃
+		close(fd);
+		return NULL;
+	}
+	DiskIndex *index = makeDiskIndexStruct(filename, fd, cacheCap);
+	index->level = ntohl(*(uint32 *)(header + 16));
+	index->splitIndex = ntohl(*(uint32 *)(header + 20));
+	index->freeHead = ntohl(*(uint32 *)(header + 24));
+	index->count = ntohll(*(uint64 *)(header + 32));
+	index->usedBytes = ntohll(*(uint64 *)(header + 40));
+	for(uint32 i = 0; i < DISK_INDEX_USER_DATA_COUNT; i++){
+		index->userData[i] = ntohll(*(uint64 *)(header + 48 + i * 8));
+	}
+	for(uint32 g = 0; g <= DISK_INDEX_MAX_LEVEL; g++){
+		index->overflowCounts[g] = ntohl(*(uint32 *)(header + 80 + g * 4));
+	}
+	return index;
+}
+
+void freeDiskIndex(DiskIndex *index){
+	foreachLRUCache(index->pages, freePage, NULL);
+	freeLRUCache(index->pages);
+	close(index->fd);
+	free(index->filename);
+	free(index);
+}
+
+int32 getDiskIndex(DiskIndex *index, uint32 keyLen, uint8 *key, DiskIndexValue *value){
+	if(keyLen > DISK_INDEX_MAX_KEY_SIZE){
+		return 0;
+	}
+	uint32 hash = hashKey(key, keyLen);
+	uint32 pageNo = bucketPageNo(index, bucketOf(index, hash));
+	while(pageNo != 0){
+		DiskIndexPage *page = fetchPage(index, pageNo);
+		if(page == NULL){
+			return -1;
+		}
+		uint32 offset = findInPage(page->data, hash, keyLen, key);
+		if(offset != 0){
+			readEntryValue(page->data + offset, value);
+			return 1;
+		}
+		pageNo = pageNext(page->data);
+	}
+	return 0;
+}
+
+int32 putDiskIndex(DiskIndex *index, uint32 keyLen, uint8 *key, DiskIndexValue *value){
+	if(keyLen > DISK_INDEX_MAX_KEY_SIZE){
+		return -1;
+	}
+	uint32 hash = hashKey(key, keyLen);
+	uint32 bucket = bucketOf(index, hash);
+	uint32 pageNo = bucketPageNo(index, bucket);
+	while(pageNo != 0){
+		DiskIndexPage *page = fetchPage(index, pageNo);
+		if(page == NULL){
+			index->failed = 1;
+			return -1;
+		}
+		uint32 offset = findInPage(page->data, hash, keyLen, key);
+		if(offset != 0){
+			writeEntryValue(page->data + offset, value);
+			markPageDirty(index, page);
+			return 0;
+		}
+		pageNo = pageNext(page->data);
+	}
+	uint8 entry[DISK_INDEX_ENTRY_HEADER_SIZE + DISK_INDEX_MAX_KEY_SIZE];
+	uint32 entrySize = DISK_INDEX_ENTRY_HEADER_SIZE + keyLen;
+	*(uint32 *)entry = htonl(hash);
+	*(uint16 *)(entry + 4) = htons(keyLen);
+	writeEntryValue(entry, value);
+	memcpy(entry + DISK_INDEX_ENTRY_HEADER_SIZE, key, keyLen);
+	if(!appendToBucket(index, bucket, entry, entrySize)){
+		index->failed = 1;
+		return -1;
+	}
+	index->count++;
+	index->usedBytes += entrySize;
+	index->headerChanged = 1;
+	//负载超过阈值时分裂，每次插入通常只分裂一个桶
+	while(index->level < DISK_INDEX_MAX_LEVEL &&
+		  index->usedBytes > (double)bucketCountOf(index) * (DISK_INDEX_PAGE_SIZE - DISK_INDEX_PAGE_HEADER_SIZE) * SPLIT_LOAD_FACTOR){
+		if(!splitBucket(index)){
+			//分裂到一半的桶可能丢失了条目
+			index->failed = 1;
+			return -1;
+		}
+	}
+	return 1;
+}
+
+int32 removeDiskIndex(DiskIndex *index, uint32 keyLen, uint8 *key){
+	if(keyLen > DISK_INDEX_MAX_KEY_SIZE){
+		return 0;
+	}
+	uint32 hash = hashKey(key, keyLen);
+	uint32 pageNo = bucketPageNo(index, bucketOf(index, hash));
+	while(pageNo != 0){
+		DiskIndexPage *page = fetchPage(index, pageNo);
+		if(page == NULL){
+			//无法确认key已经删除，磁盘上的索引可能仍然指向旧记录
+			index->failed = 1;
+			return -1;
+		}
+		uint32 offset = findInPage(page->data, hash, keyLen, key);
+		if(offset != 0){
+			//后面的条目前移，空出的溢出页在下次分裂该桶时回收
+			uint32 entrySize = DISK_INDEX_ENTRY_HEADER_SIZE + keyLen;
+			uint32 end = DISK_INDEX_PAGE_HEADER_SIZE + pageUsed(page->data);
+			memmove(page->data + offset, page->data + offset + entrySize, end - offset - entrySize);
+			*(uint16 *)(page->data + 4) = htons(ntohs(*(uint16 *)(page->data + 4)) - 1);
+			*(uint16 *)(page->data + 6) = htons(end - DISK_INDEX_PAGE_HEADER_SIZE - entrySize);
+			markPageDirty(index, page);
+			index->count--;
+			index->usedBytes -= entrySize;
+			index->headerChanged = 1;
+			return 1;
+		}
+		pageNo = pageNext(page->data);
+	}
+	return 0;
+}
+
+void *foreachDiskIndex(DiskIndex *index, ForeachDiskIndexFunction func, void *args){
+	uint32 bucketCount = bucketCountOf(index);
+	for(uint32 bucket = 0; bucket < bucketCount; bucket++){
+		uint32 pageNo = bucketPageNo(index, bucket);
+		while(pageNo != 0){
+			DiskIndexPage *page = fetchPage(index, pageNo);
+			if(page == NULL){
+				return NULL;
+			}
+			uint32 offset = DISK_INDEX_PAGE_HEADER_SIZE;
+			uint32 end = DISK_INDEX_PAGE_HEADER_SIZE + pageUsed(page->data);
+			while(offset < end){
+				uint8 *entry = page->data + offset;
+				uint32 keyLen = entryKeyLen(entry);
+				DiskIndexValue value;
+				readEntryValue(entry, &value);
+				void *result = func(keyLen, entry + DISK_INDEX_ENTRY_HEADER_SIZE, &value, args);
+				if(result != NULL){
+					return result;
+				}
+				offset += DISK_INDEX_ENTRY_HEADER_SIZE + keyLen;
+			}
+			pageNo = pageNext(page->data);
+		}
+	}
+	return NULL;
+}
+
+int32 markDirtyDiskIndex(DiskIndex *index){
+	if(!writeHeader(index, 1) || fdatasync(index->fd) != 0){
+		return 0;
+	}
+	index->dirty = 1;
+	return 1;
+}
+
+int32 syncDiskIndex(DiskIndex *index, uint64 *userData){
+	if(index->failed){
+		//内存中的索引可能不完整，保留磁盘上的未同步标记（或者上次同步的状态），加载时从数据文件重建
+		return 0;
+	}
+	if(userData != NULL && memcmp(userData, index->userData, sizeof(index->userData)) != 0){
+		memcpy(index->userData, userData, sizeof(index->userData));
+		index->headerChanged = 1;
+	}
+	if(index->dirtyPages == 0 && !index->headerChanged && !index->dirty){
+		return 1;
+	}
+	//先写回并同步所有页，再写入没有未同步标记的头部
+	if(index->dirtyPages > 0){
+		if(foreachLRUCache(index->pages, writeBackPage, index) != NULL || fdatasync(index->fd) != 0){
+			return 0;
+		}
+	}
+	if(!writeHeader(index, 0) || fdatasync(index->fd) != 0){
+		return 0;
+	}
+	index->dirty = 0;
+	index->headerChanged = 0;
+	return 1;
+}
+
+uint32 missingDiskIndexPage(DiskIndex *index, uint32 keyLen, uint8 *key){
+	if(keyLen > DISK_INDEX_MAX_KEY_SIZE){
+		return 0;
+	}
+	uint32 hash = hashKey(key, keyLen);
+	uint32 pageNo = bucketPageNo(index, bucketOf(index, hash));
+	while(pageNo != 0){
+		uint64 cacheKey = pageNo;
+		DiskIndexPage *page = (DiskIndexPage *)getLRUCacheNoChange(index->pages, (uint8 *)&cacheKey);
+		if(page == NULL){
+			return pageNo;
+		}
+		if(findInPage(page->data, hash, keyLen, key) != 0){
+			return 0;
+		}
+		pageNo = pageNext(page->data);
+	}
+	return 0;
+}
+
+int32 readDiskIndexPage(DiskIndex *index, uint32 pageNo, DiskIndexPage *page){
+	return readPage(index, pageNo, page);
+}
+
+int32 cacheDiskIndexPage(DiskIndex *index, DiskIndexPage *page, uint64 pageWrites){
+	uint64 key = page->pageNo;
+	if(index->pageWrites != pageWrites || getLRUCacheNoChange(index->pages, (uint8 *)&key) != NULL){
+		free(page);
+		return 0;
+	}
+	return cachePage(index, page) != NULL;
+}
+
+uint32 getDiskIndexBucketCount(DiskIndex *index){
+	return bucketCountOf(index);
+}
@@ -14,15 +14,58 @@
 #include "util.h"
 #include "global.h"
 #include "redolog.h"
+#include "compress.h"
+#include "diskindex.h"
 
 #include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <dirent.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <errno.h>
 
 //魔数
 static const uint32 MAGIC_NUMBER = 0x960729abu;
+//数据文件版本号，占文件头第二个字段的低16位，高16位为引擎设置的标记
+static const uint32 HASH_FILE_VERSION = 1;
+//文件头标记：开启了value压缩，加载时恢复
+static const uint32 HASH_FILE_FLAG_COMPRESSION = 1u << 16;
+//分区引擎清单文件的版本号（数据文件为1）
+static const uint32 PARTITION_MANIFEST_VERSION = 2;
+//提示文件魔数
+static const uint32 HINT_MAGIC_NUMBER = 0x960729acu;
+//提示文件版本号：版本2的条目中增加了blobSize，旧版本的提示文件加载时忽略并重新生成
+static const uint32 HINT_VERSION = 2;
+//提示文件一个块的最大字节数（加载时一次读入内存）
+static const uint32 HINT_BLOCK_MAX_SIZE = 1024 * 1024;
+//提示文件的条目数超过有效key数目的该倍数时，检查点结束时根据内存索引重写提示文件
+static const uint64 HINT_REWRITE_RATIO = 2;
+//提示文件的条目数不超过该值时不重写
+static const uint64 HINT_REWRITE_MIN_ENTRIES = 4096;
+//默认持久化批次大小：4MB
+static const uint32 DEFAULT_FLUSH_BATCH_SIZE = 4 * 1024 * 1024;
+//默认自动碎片整理阈值：空间放大2倍
+static const double DEFAULT_COMPACTION_THRESHOLD = 2.0;
+//默认自动碎片整理的最小文件尺寸：64MB
+static const uint64 DEFAULT_COMPACTION_MIN_SIZE = 64ull * 1024 * 1024;
+//检查点写入失败后第一次重试的等待时间（微秒），之后每次加倍
+static const uint32 FLUSH_RETRY_MIN_INTERVAL = 100 * 1000;
+//检查点写入失败后重试的最长等待时间（微秒）
+static const uint32 FLUSH_RETRY_MAX_INTERVAL = 5 * 1000 * 1000;
+//碎片整理时拷贝缓冲区大小
+static const uint32 COMPACTION_BUFFER_SIZE = 1024 * 1024;
+//游标预读缓冲区大小
+static const uint32 CURSOR_BUFFER_SIZE = 1024 * 1024;
+//内存映射的最小长度：映射长度超过文件尺寸，为文件增长预留，避免每次持久化后都重新映射
+static const uint64 MMAP_MIN_SIZE = 16ull * 1024 * 1024;
+//使用磁盘索引时内存索引的初始容量，也是常驻key数目上限中与缓存容量无关的部分
+static const uint32 DISK_INDEX_RESIDENT_CAPACITY = 1024;
+//在statusMutex之外预读磁盘索引页时，查找一个key最多读取的页数（溢出链通常只有一两页）
+static const uint32 DISK_INDEX_PREFETCH_PAGES = 8;
 
 /*****************************************************************************
  * 私有函数：文件操作、序列化、反序列化、线程启动函数、日志处理回调函数
@@ -38,57 +81,348 @@ static int openHashFile(const char *filename)
 	return open(filename, O_RDWR);
 }
 
-static void writeMetadata(int wfd){
-	uint32 magic = htonl(MAGIC_NUMBER);
-	uint32 version = htonl(1);
-	lseek(wfd, 0, SEEK_SET);
-	write(wfd, (void *)&magic, 4);
-	write(wfd, (void *)&version, 4);
-	fsync(wfd);
+//写入文件头并同步，flags为HASH_FILE_FLAG_*的组合，返回是否成功
+static int writeMetadata(int wfd, uint32 flags){
+	uint32 header[2] = {htonl(MAGIC_NUMBER), htonl(HASH_FILE_VERSION | flags)};
+	return pwrite(wfd, header, HASH_FILE_HEADER_SIZE, 0) == HASH_FILE_HEADER_SIZE && fsync(wfd) == 0;
 }
 
-static int verifyMetadata(int rfd){
-	uint32 magic ,version;
-	lseek(rfd, 0, SEEK_SET);
-	read(rfd, &magic, 4);
-	read(rfd, &version, 4);
-	return ntohl(magic)==MAGIC_NUMBER && ntohl(version) == 1;
+//验证文件头，通过flags返回文件头中的标记；存在未知标记的文件不能加载
+static int verifyMetadata(int rfd, uint32 *flags){
+	uint32 header[2];
+	if(pread(rfd, header, HASH_FILE_HEADER_SIZE, 0) != HASH_FILE_HEADER_SIZE){
+		return 0;
+	}
+	uint32 version = ntohl(header[1]);
+	*flags = version & ~0xffffu;
+	return ntohl(header[0])==MAGIC_NUMBER && (version & 0xffffu) == HASH_FILE_VERSION &&
+		   (*flags & ~HASH_FILE_FLAG_COMPRESSION) == 0;
+}
+
+//引擎当前设置对应的文件头标记，需要在statusMutex中调用
+static uint32 fileFlagsOf(HashEngine *engine){
+	return engine->compression ? HASH_FILE_FLAG_COMPRESSION : 0;
+}
+
+//记录序列化后最多占用的字节数
+static uint32 recordMaxSize(Record *record){
+	return HASH_RECORD_HEADER_SIZE + record->keyLen + record->valueLen;
+}
+
+//将记录序列化到buffer中（至少recordMaxSize字节），返回占用的字节数
+//compress为1时尝试压缩value，压缩后不能节省空间则按原样存储
+static uint32 serializeRecord(uint8 *buffer, Record* record, int compress){
+	uint8 *valueField = buffer + HASH_RECORD_HEADER_SIZE + record->keyLen;
+	uint32 stored = 0;
+	if(compress && record->valueLen >= HASH_COMPRESSION_MIN_SIZE){
+		//输出空间限制为原长度，超出说明不值得压缩
+		uint32 compressedLen = lzCompress(record->value, record->valueLen, valueField + 4, record->valueLen - 4);
+		if(compressedLen != 0){
+			*(uint32 *)valueField = htonl(record->valueLen);
+			stored = compressedLen + 4;
+		}
+	}
+	*(uint64 *)buffer = htonll(record->version);
+	*(uint32 *)(buffer + 8) = htonl(record->keyLen);
+	memcpy(buffer + HASH_RECORD_HEADER_SIZE, record->key, record->keyLen);
+	if(stored != 0){
+		*(uint32 *)(buffer + 12) = htonl(stored | HASH_VALUE_COMPRESSED);
+		return HASH_RECORD_HEADER_SIZE + record->keyLen + stored;
+	}
+	*(uint32 *)(buffer + 12) = htonl(record->valueLen);
+	memcpy(valueField, record->value, record->valueLen);
+	return HASH_RECORD_HEADER_SIZE + record->keyLen + record->valueLen;
+}
+
+//将value存放在blob文件中的记录序列化到buffer中，记录中只保存引用，返回占用的字节数
+static uint32 serializeBlobRecord(uint8 *buffer, Record *record, uint64 blobPosition){
+	uint8 *ref = buffer + HASH_RECORD_HEADER_SIZE + record->keyLen;
+	*(uint64 *)buffer = htonll(record->version);
+	*(uint32 *)(buffer + 8) = htonl(record->keyLen);
+	*(uint32 *)(buffer + 12) = htonl(HASH_BLOB_REF_SIZE | HASH_VALUE_BLOB);
+	memcpy(buffer + HASH_RECORD_HEADER_SIZE, record->key, record->keyLen);
+	*(uint64 *)ref = htonll(blobPosition);
+	*(uint32 *)(ref + 8) = htonl(record->valueLen);
+	return HASH_RECORD_HEADER_SIZE + record->keyLen + HASH_BLOB_REF_SIZE;
+}
+
+//value在文件中存储的字节数，valueField为头部中的valueLen字段
+static uint32 storedValueLen(uint32 valueField){
+	return valueField & ~(HASH_VALUE_COMPRESSED | HASH_VALUE_BLOB);
+}
+
+//读取blob文件中value的一段到dest，ref为记录中的blob引用，读取不完整返回0
+//需要持有fileLock读锁或statusMutex（碎片整理切换blob文件时两者都持有），或者有未关闭的游标
+static int readBlob(HashEngine *engine, uint8 *ref, uint32 offset, uint32 len, uint8 *dest){
+	uint64 position = ntohll(*(uint64 *)ref) + offset;
+	while(len > 0){
+		ssize_t n = pread(engine->blobFd, dest, len, position);
+		if(n <= 0){
+			return 0;
+		}
+		dest += n;
+		len -= n;
+		position += n;
+	}
+	return 1;
+}
+
+//将文件中存储的value解码为原始value（新分配的内存），数据损坏时返回NULL
+//value存放在blob文件中时从blob文件读取，调用条件与readBlob相同
+static uint8 *decodeValue(HashEngine *engine, uint32 valueField, uint8 *stored, uint32 *valueLen){
+	uint8 *value = NULL;
+	if(valueField & HASH_VALUE_BLOB){
+		if(storedValueLen(valueField) != HASH_BLOB_REF_SIZE){
+			return NULL;
+		}
+		*valueLen = ntohl(*(uint32 *)(stored + 8));
+		value = (uint8 *)malloc(*valueLen + 1);
+		if(!readBlob(engine, stored, 0, *valueLen, value)){
+			free(value);
+			return NULL;
+		}
+		return value;
+	}
+	if(!(valueField & HASH_VALUE_COMPRESSED)){
+		*valueLen = valueField;
+		newAndCopyByteArray(&value, stored, valueField);
+		return value;
+	}
+	uint32 storedLen = storedValueLen(valueField);
+	if(storedLen < 4){
+		return NULL;
+	}
+	*valueLen = ntohl(*(uint32 *)stored);
+	value = (uint8 *)malloc(*valueLen + 1);
+	if(lzDecompress(stored + 4, storedLen - 4, value, *valueLen) != (int32)*valueLen){
+		free(value);
+		return NULL;
+	}
+	return value;
 }
 
-static uint64 writeRecord(int wfd, Record* record){
-	uint64 position = lseek(wfd, 0, SEEK_CUR);
-	uint64 version = htonll(record->version);
-	uint32 keyLen = htonl(record->keyLen);
-	uint32 valueLen = htonl(record->valueLen);
-	write(wfd, (void*)&version, 8);
-	write(wfd, (void *)&keyLen, 4);
-	write(wfd, (void *)&valueLen, 4);
-	write(wfd, record->key, record->keyLen);
-	write(wfd, record->value,record->valueLen);
-	fsync(wfd);
-	return position;
+//在指定位置写入整个缓冲区
+static int pwriteFully(int fd, uint8 *buffer, uint64 len, uint64 position){
+	while(len > 0){
+		ssize_t n = pwrite(fd, buffer, len, position);
+		if(n <= 0){
+			return 0;
+		}
+		buffer += n;
+		len -= n;
+		position += n;
+	}
+	return 1;
 }
 
-static Record *loadRecord(int rfd, uint64 position, int skipValue){
+//使用pread读取，不修改文件偏移，多个线程可以同时读同一个文件描述符
+//diskSize不为NULL时返回记录在文件中占用的字节数；skipValue时valueLen为存储的字节数
+//blobSize不为NULL时返回存放在blob文件中的value的字节数（不在blob文件中为0）
+static Record *loadRecord(HashEngine *engine, uint64 position, int skipValue, uint32 *diskSize, uint32 *blobSize){
+	int rfd = engine->rfd;
 	Record *record = (Record *)malloc(sizeof(Record));
-	lseek(rfd, position, SEEK_SET);
-	read(rfd, &record->version, 8);
-	read(rfd, &record->keyLen, 4);
-	read(rfd, &record->valueLen, 4);
-	record->version = ntohll(record->version);
-	record->keyLen = ntohl(record->keyLen);
-	record->valueLen = ntohl(record->valueLen);
+	uint8 header[HASH_RECORD_HEADER_SIZE];
+	pread(rfd, header, HASH_RECORD_HEADER_SIZE, position);
+	record->version = ntohll(*(uint64 *)header);
+	record->keyLen = ntohl(*(uint32 *)(header + 8));
+	uint32 valueField = ntohl(*(uint32 *)(header + 12));
+	record->valueLen = storedValueLen(valueField);
+	if(diskSize != NULL){
+		*diskSize = HASH_RECORD_HEADER_SIZE + record->keyLen + record->valueLen;
+	}
 	record->key = (uint8*) malloc(record->keyLen);
-	read(rfd, record->key, record->keyLen);
+	if(blobSize != NULL){
+		*blobSize = 0;
+		if(valueField & HASH_VALUE_BLOB){
+			pread(rfd, blobSize, 4, position + HASH_RECORD_HEADER_SIZE + record->keyLen + 8);
+			*blobSize = ntohl(*blobSize);
+		}
+	}
 	if (skipValue){
 		record->value = NULL;
+		pread(rfd, record->key, record->keyLen, position + HASH_RECORD_HEADER_SIZE);
 	} else {
+		//key和value一次读出
 		record->value = (uint8 *)malloc(record->valueLen);
-		read(rfd, record->value, record->valueLen);
+		struct iovec iov[2] = {
+			{record->key, record->keyLen},
+			{record->value, record->valueLen}};
+		preadv(rfd, iov, 2, position + HASH_RECORD_HEADER_SIZE);
+		if(valueField & (HASH_VALUE_COMPRESSED | HASH_VALUE_BLOB)){
+			uint8 *stored = record->value;
+			record->value = decodeValue(engine, valueField, stored, &record->valueLen);
+			free(stored);
+			if(record->value == NULL){
+				//数据损坏，按不存在处理
+				record->valueLen = 0;
+			}
+		}
 	}
 	return record;
 }
 
+//释放映射的一个引用，最后一个引用释放时解除映射，需要在statusMutex中调用
+static void releaseMapping(HashEngineMapping *mapping){
+	if(--mapping->refCount == 0){
+		munmap(mapping->base, mapping->size);
+		free(mapping);
+	}
+}
+
+//获取覆盖数据文件[0, end)的映射并增加一个引用，需要在statusMutex中调用，映射失败返回NULL
+//MAP_SHARED映射超出文件尾部的部分在文件增长后即可访问，因此按文件尺寸的2倍预留
+static HashEngineMapping *acquireMapping(HashEngine *engine, uint64 end){
+	if(engine->mapping == NULL || engine->mapping->size < end){
+		uint64 size = engine->fileSize * 2;
+		if(size < end){
+			size = end;
+		}
+		if(size < MMAP_MIN_SIZE){
+			size = MMAP_MIN_SIZE;
+		}
+		void *base = mmap(NULL, size, PROT_READ, MAP_SHARED, engine->rfd, 0);
+		if(base == MAP_FAILED){
+			return NULL;
+		}
+		//旧映射可能仍被视图引用，由引用计数决定何时解除
+		if(engine->mapping != NULL){
+			releaseMapping(engine->mapping);
+		}
+		engine->mapping = (HashEngineMapping *)malloc(sizeof(HashEngineMapping));
+		engine->mapping->base = (uint8 *)base;
+		engine->mapping->size = size;
+		engine->mapping->refCount = 1;
+		engine->mapping->engine = engine;
+	}
+	engine->mapping->refCount++;
+	return engine->mapping;
+}
+
+/*
+ * 提示文件：${filename}.hint
+ * 文件头：magic:4, version:4
+ * 之后为若干块，每个检查点追加一个或多个块：
+ *   entriesBytes:4, count:4, dataEnd:8, checksum:4, entries:entriesBytes
+ *   entry: version:8, position:8, size:4, blobSize:4, keyLen:4, key:keyLen
+ * dataEnd表示该块之前的数据文件内容都已经记录在提示文件中，加载时只需扫描dataEnd之后的数据
+ */
+
+//提示文件块的写入器，将条目缓存在内存中
+//autoWrite为0时，所有块缓存到finish时一次写入，用于保证数据文件先于提示文件持久化
+typedef struct HintWriter
+{
+	int fd;
+	int autoWrite;
+	uint8 *buffer;
+	uint64 capacity;
+	/** 缓冲区已用字节数 */
+	uint64 used;
+	/** 当前块在缓冲区中的起始位置，之前的块已经封装完成 */
+	uint64 blockStart;
+	uint32 count;
+	uint64 dataEnd;
+} HintWriter;
+
+static uint32 hintChecksum(uint8 *data, uint32 len){
+	uint32 hash = 2166136261u;
+	for(uint32 i = 0; i < len; i++){
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+static int createHintFile(const char *filename){
+	unlink(filename);
+	int fd = open(filename, O_RDWR | O_APPEND | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+	if(fd == -1){
+		return -1;
+	}
+	uint32 header[2] = {htonl(HINT_MAGIC_NUMBER), htonl(HINT_VERSION)};
+	write(fd, header, 8);
+	return fd;
+}
+
+static void initHintWriter(HintWriter *writer, int fd, uint64 dataEnd, int autoWrite){
+	writer->fd = fd;
+	writer->autoWrite = autoWrite;
+	writer->capacity = HINT_BLOCK_MAX_SIZE;
+	writer->buffer = (uint8 *)malloc(writer->capacity);
+	writer->blockStart = 0;
+	writer->used = HASH_HINT_BLOCK_HEADER_SIZE;
+	writer->count = 0;
+	writer->dataEnd = dataEnd;
+}
+
+//封装当前块：填写块头部，并在其后开始一个新块
+static void sealHintBlock(HintWriter *writer){
+	if(writer->count == 0){
+		return;
+	}
+	uint8 *block = writer->buffer + writer->blockStart;
+	uint32 entriesBytes = writer->used - writer->blockStart - HASH_HINT_BLOCK_HEADER_SIZE;
+	uint32 checksum = hintChecksum(block + HASH_HINT_BLOCK_HEADER_SIZE, entriesBytes);
+	*(uint32 *)(block) = htonl(entriesBytes);
+	*(uint32 *)(block + 4) = htonl(writer->count);
+	*(uint64 *)(block + 8) = htonll(writer->dataEnd);
+	*(uint32 *)(block + 16) = htonl(checksum);
+	writer->blockStart = writer->used;
+	writer->used += HASH_HINT_BLOCK_HEADER_SIZE;
+	writer->count = 0;
+}
+
+//将已经封装的块写入提示文件
+static void writeSealedHintBlocks(HintWriter *writer){
+	if(writer->blockStart == 0){
+		return;
+	}
+	//提示文件以O_APPEND打开，write总是追加到末尾
+	write(writer->fd, writer->buffer, writer->blockStart);
+	memmove(writer->buffer, writer->buffer + writer->blockStart, writer->used - writer->blockStart);
+	writer->used -= writer->blockStart;
+	writer->blockStart = 0;
+}
+
+static void appendHintEntry(HintWriter *writer, uint64 version, uint64 position, uint32 size, uint32 blobSize, uint32 keyLen, uint8 *key){
+	uint32 entrySize = HASH_HINT_ENTRY_HEADER_SIZE + keyLen;
+	if(writer->used - writer->blockStart + entrySize > HINT_BLOCK_MAX_SIZE){
+		sealHintBlock(writer);
+		if(writer->autoWrite){
+			writeSealedHintBlocks(writer);
+		}
+	}
+	if(writer->used + entrySize > writer->capacity){
+		//缓冲区不足（缓存多个块或key过长），扩大缓冲区
+		while(writer->used + entrySize > writer->capacity){
+			writer->capacity *= 2;
+		}
+		writer->buffer = (uint8 *)realloc(writer->buffer, writer->capacity);
+	}
+	uint8 *p = writer->buffer + writer->used;
+	*(uint64 *)p = htonll(version);
+	*(uint64 *)(p + 8) = htonll(position);
+	*(uint32 *)(p + 16) = htonl(size);
+	*(uint32 *)(p + 20) = htonl(blobSize);
+	*(uint32 *)(p + 24) = htonl(keyLen);
+	memcpy(p + HASH_HINT_ENTRY_HEADER_SIZE, key, keyLen);
+	writer->used += entrySize;
+	writer->count++;
+	if(position + size > writer->dataEnd){
+		writer->dataEnd = position + size;
+	}
+}
+
+//写入剩余的块，sync非0时持久化提示文件
+static void finishHintWriter(HintWriter *writer, int sync){
+	sealHintBlock(writer);
+	writeSealedHintBlocks(writer);
+	if(sync){
+		fsync(writer->fd);
+	}
+	free(writer->buffer);
+	writer->buffer = NULL;
+}
+
 static RedoLog* createHashEngineRedoLog(HashEngine* engine);
 static void startPersistenceThread(HashEngine* engine){
 	//启动持久化线程
@@ -97,15 +431,20 @@ static void startPersistenceThread(HashEngine* engine){
 	while(engine->persistenceStatus!=None){
 		pthread_cond_wait(&engine->statusCond, &engine->statusMutex);
 	}
+	//状态为None时上一个持久化线程已经完成工作，回收其资源
+	if(engine->persistenceThreadStarted){
+		pthread_join(engine->persistenceThread, NULL);
+	}
+	engine->persistenceThreadStarted = 1;
 	//切换写缓存
 	LRUCache * tmp = engine->writeCache;
 	engine->writeCache = engine->freezeWriteCache;
 	engine->freezeWriteCache = tmp;
-	// //切换并创建新的重做日志
-	// if(engine->redoLogWork !=NULL){
-	// 	engine->redoLogFreeze = engine->redoLogWork;
-	// 	engine->redoLogWork = createHashEngineRedoLog(engine);
-	// }
+	//切换重做日志：冻结的日志只包含冻结写缓存的修改，在本次检查点的数据同步之后删除
+	if(engine->redoLogWork != NULL){
+		engine->redoLogFreeze = engine->redoLogWork;
+		engine->redoLogWork = engine->redoLogEnabled ? createHashEngineRedoLog(engine) : NULL;
+	}
 	engine->persistenceStatus = Doing;
 	pthread_mutex_unlock(&engine->statusMutex);
 	pthread_cleanup_pop(0);
@@ -113,27 +452,21 @@ static void startPersistenceThread(HashEngine* engine){
 }
 
 
-//写一条日志到文件中
+//序列化一条日志到组缓冲区：type:1, keyLen:4, valueLen:4, key, value, checksum:4（前面所有字节）
 static void hashEngineRedoLogPersistenceFunction(RedoLog* redoLog, OperateTuple *op){
-	// 如果操作对象长度不为2出错
-	if (op->objects->length!=2){
-		return;
-	}
-	// 写入操作类型
-	write(redoLog->fd, (void*)&op->type, 1);
-	// 获取并kv
 	Array* key = (Array*)op->objects->head->value;
-	Array* value = (Array*)op->objects->head->next->value;
-	Array* objects[2] = {key, value};
-	for(int i = 0; i<2; i++){
-		if(i==1&& op->type==2){ //对于删除不需要写
-			break;
-		}
-		Array* arr = objects[i];
-		uint32 arrLen = htonl(arr->length);
-		write(redoLog->fd, (uint8*)&arrLen, 4);
-		write(redoLog->fd, arr->array, arr->length);
+	Array* value = op->type == 1 ? (Array*)op->objects->head->next->value : NULL;
+	uint32 valueLen = value == NULL ? 0 : value->length;
+	uint32 size = HASH_REDO_RECORD_HEADER_SIZE + key->length + valueLen;
+	uint8 *p = reserveRedoLogBuffer(redoLog, size + 4);
+	p[0] = op->type;
+	*(uint32 *)(p + 1) = htonl(key->length);
+	*(uint32 *)(p + 5) = htonl(valueLen);
+	memcpy(p + HASH_REDO_RECORD_HEADER_SIZE, key->array, key->length);
+	if(valueLen > 0){
+		memcpy(p + HASH_REDO_RECORD_HEADER_SIZE + key->length, value->array, valueLen);
 	}
+	*(uint32 *)(p + size) = htonl(hintChecksum(p, size));
 }
 
 /*****************************************************************************
@@ -179,91 +512,164 @@ static void freeHashEngineOperateTuple(OperateTuple *op){
 static RedoLog* createHashEngineRedoLog(HashEngine* engine){
 	char *filename = malloc(strlen(engine->filename)+30);
 	sprintf(filename, "%s_0x%016llx.redolog", engine->filename, engine->redoVersion++);
-	return makeRedoLog(filename, (void *)engine, engine->operateListMaxSize,
+	RedoLog *redoLog = makeRedoLog(filename, (void *)engine, engine->operateListMaxSize,
 					   hashEngineRedoLogPersistenceFunction,
 					   freeHashEngineOperateTuple,
 					   engine->flushStrategy, engine->flushStrategyArg);
+	free(filename);
+	if(redoLog != NULL){
+		//预写日志：每组同步一次
+		redoLog->syncOnPersistence = 1;
+	}
+	return redoLog;
 }
 
-//从当前hash引擎所在路径中搜索Hash重做日志文件加载并删除
-static RedoLog *loadHashEngineRedoLog(HashEngine *engine){
-
+static int compareFilename(const void *a, const void *b){
+	return strcmp(*(char **)a, *(char **)b);
+}
 
+//搜索当前Hash引擎的重做日志文件${filename}_0x<16位版本号>.redolog，按版本号从小到大返回List<char*>
+static List *listHashEngineRedoLogs(HashEngine *engine){
+	List *result = makeList();
+	//拆分目录和文件名
+	const char *slash = strrchr(engine->filename, '/');
 	char *pathname = NULL;
-	char *redoLogFilename = NULL;
-	char *filename = NULL;
-
-	if (engine->filename[0]=='/'){
-		//绝对目录
-		pathname = malloc(strlen(engine->filename) + 1);
-		filename = malloc(strlen(engine->filename) + 1);
-		strcpy(pathname, engine->filename);
-		strcpy(filename, engine->filename);
-		for (int i = strlen(pathname) - 1; i >= 0; i--)
-		{
-			if (pathname[i] == '/')
-			{
-				pathname[i] = '\0';
-				break;
-			}
+	const char *basename = engine->filename;
+	if(slash != NULL){
+		uint32 len = slash - engine->filename;
+		pathname = (char *)malloc(len + 2);
+		memcpy(pathname, engine->filename, len);
+		pathname[len] = '\0';
+		if(len == 0){
+			strcpy(pathname, "/");
 		}
-	} else {
-		pathname = getcwd(NULL, 0);
-		filename = malloc(strlen(pathname) + 1 + strlen(engine->filename) + 1);
-		sprintf(filename, "%s/%s", pathname, engine->filename);
+		basename = slash + 1;
 	}
-
-	DIR *dir;
+	DIR *dir = opendir(pathname == NULL ? "." : pathname);
+	if(dir == NULL){
+		free(pathname);
+		return result;
+	}
+	uint32 baseLen = strlen(basename);
+	uint32 count = 0, capacity = 8;
+	char **names = (char **)malloc(capacity * sizeof(char *));
 	struct dirent *ptr;
-	dir = opendir(pathname);
-
-	while ((ptr=readdir(dir)) != NULL)
-	{
-		if(strcmp(ptr->d_name,".")==0 || strcmp(ptr->d_name,"..")==0) {    ///current dir OR parrent dir
+	while((ptr = readdir(dir)) != NULL){
+		const char *name = ptr->d_name;
+		//版本号为16位十六进制，文件名按字符串比较即按版本号比较
+		if(strlen(name) != baseLen + 27 || strncmp(name, basename, baseLen) != 0 ||
+		   strncmp(name + baseLen, "_0x", 3) != 0 || strcmp(name + baseLen + 19, ".redolog") != 0){
 			continue;
-		} else if (ptr->d_type == 8) { ///file
-			char *nowFilename = malloc(strlen(filename) + 30);
-			sprintf(nowFilename, "%s/%s", pathname, ptr->d_name);
-			if (strlen(nowFilename) <= strlen(filename) || strncmp(filename, nowFilename, strlen(filename)) !=0){
-				continue;
-			}
-			if (redoLogFilename==NULL){
-				redoLogFilename = nowFilename;
-				continue;
-			}
-			if(strcmp(nowFilename, redoLogFilename)>0){
-				unlink(redoLogFilename);
-				free(redoLogFilename);
-				redoLogFilename = nowFilename;
-				continue;
-			}
-			free(nowFilename);
 		}
+		if(count == capacity){
+			capacity *= 2;
+			names = (char **)realloc(names, capacity * sizeof(char *));
+		}
+		names[count] = (char *)malloc(strlen(engine->filename) + 30);
+		sprintf(names[count], "%s_0x%s", engine->filename, name + baseLen + 3);
+		count++;
 	}
-	if(redoLogFilename==NULL){
-		return NULL;
+	closedir(dir);
+	qsort(names, count, sizeof(char *), compareFilename);
+	for(uint32 i = 0; i < count; i++){
+		addList(result, names[i]);
 	}
-	return loadRedoLog(redoLogFilename, (void *)engine, engine->operateListMaxSize,
-					   hashEngineRedoLogPersistenceFunction,
-					   freeHashEngineOperateTuple,
-					   engine->flushStrategy, engine->flushStrategyArg);
+	free(names);
+	free(pathname);
+	return result;
 }
 
-	static RecordLocation *makeRecordLocation(uint64 id, uint64 position)
-{
-	RecordLocation *location = (RecordLocation *)malloc(sizeof(RecordLocation));
-	location->id = id;
-	location->position = position;
-	return location;
+static void unlinkAndFreeFilename(void *value, void *args){
+	unlink((char *)value);
+	free(value);
 }
 
-static void freeRecordLocation(RecordLocation* location){
-	free(location);
+//删除当前Hash引擎的所有重做日志文件
+static void removeHashEngineRedoLogs(HashEngine *engine){
+	List *logs = listHashEngineRedoLogs(engine);
+	foreachList(logs, unlinkAndFreeFilename, NULL);
+	freeList(logs);
 }
 
-static void* freeHashMapRecordLocation(struct Entry * entry, void* args){
-	freeRecordLocation((RecordLocation*) entry->value);
-	return NULL;
+//初始化重做日志相关字段，默认不开启
+static void initHashEngineRedoLog(HashEngine *engine, uint64 operateListMaxSize,
+								  enum RedoFlushStrategy flushStrategy, uint64 flushStrategyArg){
+	engine->operateListMaxSize = operateListMaxSize;
+	engine->flushStrategy = flushStrategy;
+	engine->flushStrategyArg = flushStrategyArg;
+	engine->redoVersion = 1;
+	engine->redoLogWork = NULL;
+	engine->redoLogFreeze = NULL;
+	engine->redoLogEnabled = 0;
+}
+
+//在statusMutex中调用：与写缓存的修改在同一个临界区中追加日志，保证日志与写缓存同时切换
+//返回日志序号，之后必须在临界区之外调用waitHashEngineRedoLog；没有开启重做日志时redoLog为NULL
+static uint64 appendHashEngineRedoLog(HashEngine *engine, Record *record, RedoLog **redoLog){
+	*redoLog = engine->redoLogWork;
+	if(*redoLog == NULL){
+		return 0;
+	}
+	uint8 type = record->valueLen == 0 ? 2 : 1;
+	return appendRedoLogAsync(*redoLog, makeHashEngineOperateTuple(engine, type, record->keyLen, record->key, record->valueLen, record->value));
+}
+
+//组提交：等待日志同步（立即写入策略），不能持有statusMutex，返回0表示日志写入失败（修改只在内存中）
+static int32 waitHashEngineRedoLog(RedoLog *redoLog, uint64 seq){
+	return redoLog == NULL || waitRedoLog(redoLog, seq);
+}
+
+//检查点的数据已经同步，删除冻结的重做日志，在After阶段调用
+static void retireHashEngineRedoLog(HashEngine *engine){
+	RedoLog *redoLog = engine->redoLogFreeze;
+	if(redoLog == NULL){
+		return;
+	}
+	engine->redoLogFreeze = NULL;
+	unlink(redoLog->filename);
+	freeRedoLog(redoLog);
+}
+
+/*
+ * 位置的回收：
+ * 读写操作在statusMutex之外仍然使用从内存索引中取得的RecordLocation指针（读盘、等待写缓存），
+ * 期间位置可能被删除（墓碑持久化）或移出（磁盘索引），被回收重用后会读到其他key的记录
+ * 可能持有位置的操作开始时计入当前周期（enterLocationEpoch），结束时减去（leaveLocationEpoch）；
+ * 检查点开始时，若另一个周期中已经没有未结束的操作，则回收上一次推进之前删除的位置并推进周期：
+ * 这些位置删除时还在进行的操作属于推进之前的周期，它们都已经结束
+ */
+
+//开始一个可能持有RecordLocation指针的操作，返回其所属的周期，结束时调用leaveLocationEpoch
+static uint32 enterLocationEpoch(HashEngine *engine){
+	uint32 epoch = 0;
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	epoch = engine->locationEpoch;
+	engine->locationUsers[epoch]++;
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	return epoch;
+}
+
+static void leaveLocationEpoch(HashEngine *engine, uint32 epoch){
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	engine->locationUsers[epoch]--;
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+}
+
+//检查点开始时调用：上一个周期的操作都已经结束时，回收上一次推进之前删除的位置并推进周期，否则等到下一个检查点
+static void freeRetiredLocations(HashEngine *engine){
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	uint32 next = engine->locationEpoch ^ 1;
+	if(engine->locationUsers[next] == 0){
+		reclaimPreviousKeyIndex(engine->keyIndex);
+		engine->locationEpoch = next;
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
 }
 
 static Record *makeRecord(uint64 version, uint32 keyLen, uint32 valueLen, uint8 *key, uint8 *value){
@@ -289,12 +695,108 @@ static void freeRecord(Record *record){
 	free(record);
 }
 
+static void *freeCachedRecord(uint32 keyLen, uint8 *key, void *value, void *args){
+	freeRecord((Record *)value);
+	return NULL;
+}
+
 static void freeLRUCacheRecords(LRUCache* cache){
-	LRUNode* node = cache->head;
-	while ((node = node->next) != cache->head){
-		Record *record = (Record *)node->value;
-		freeRecord(record);
+	foreachLRUCache(cache, freeCachedRecord, NULL);
+}
+
+//初始化碎片整理相关字段
+static void initHashEngineCompaction(HashEngine *engine){
+	engine->newFilename = (char *)malloc(strlen(engine->filename) + 10);
+	sprintf(engine->newFilename, "%s.compact", engine->filename);
+	engine->newrfd = -1;
+	engine->hintFilename = (char *)malloc(strlen(engine->filename) + 10);
+	sprintf(engine->hintFilename, "%s.hint", engine->filename);
+	engine->hintFd = -1;
+	engine->hintEntryCount = 0;
+	engine->flushErrorCount = 0;
+	engine->locationEpoch = 0;
+	engine->locationUsers[0] = 0;
+	engine->locationUsers[1] = 0;
+	engine->blobFilename = (char *)malloc(strlen(engine->filename) + 10);
+	sprintf(engine->blobFilename, "%s.blob", engine->filename);
+	engine->newBlobFilename = (char *)malloc(strlen(engine->filename) + 20);
+	sprintf(engine->newBlobFilename, "%s.blob.compact", engine->filename);
+	engine->blobFd = -1;
+	engine->blobFileSize = 0;
+	engine->blobLiveSize = 0;
+	engine->blobThreshold = 0;
+	engine->indexFilename = (char *)malloc(strlen(engine->filename) + 10);
+	sprintf(engine->indexFilename, "%s.index", engine->filename);
+	engine->newIndexFilename = (char *)malloc(strlen(engine->filename) + 20);
+	sprintf(engine->newIndexFilename, "%s.index.compact", engine->filename);
+	engine->diskIndex = NULL;
+	engine->residentLimit = 0;
+	engine->compactionThreshold = DEFAULT_COMPACTION_THRESHOLD;
+	engine->compactionMinSize = DEFAULT_COMPACTION_MIN_SIZE;
+	engine->compactionCount = 0;
+	engine->cursorCount = 0;
+	engine->durability = SyncPerCheckpoint;
+	engine->flushBatchSize = DEFAULT_FLUSH_BATCH_SIZE;
+	engine->compression = 0;
+	engine->mmapRead = 0;
+	engine->mapping = NULL;
+	engine->persistenceThreadStarted = 0;
+	engine->partitionCount = 0;
+	engine->partitions = NULL;
+	pthread_rwlock_init(&engine->fileLock, NULL);
+}
+
+/*
+ * 分区：
+ * 清单文件 magic:4, version:4（值为2）, partitionCount:4
+ * key使用FNV-1a哈希后取高位选择分区，与分区内存索引使用低位选择槽互不相关
+ */
+
+static char *partitionFilename(const char *filename, uint32 i){
+	char *name = (char *)malloc(strlen(filename) + 16);
+	sprintf(name, "%s.p%u", filename, i);
+	return name;
+}
+
+static HashEngine *partitionOf(HashEngine *engine, uint32 keyLen, uint8 *key){
+	uint32 hash = hintChecksum(key, keyLen);
+	return engine->partitions[((uint64)hash * engine->partitionCount) >> 32];
+}
+
+//读取清单文件中的分区数目，不是分区引擎返回0
+static uint32 readPartitionCount(const char *filename){
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1){
+		return 0;
+	}
+	uint32 manifest[3];
+	uint32 count = 0;
+	if(pread(fd, manifest, sizeof(manifest), 0) == sizeof(manifest) &&
+	   ntohl(manifest[0]) == MAGIC_NUMBER && ntohl(manifest[1]) == PARTITION_MANIFEST_VERSION){
+		count = ntohl(manifest[2]);
+	}
+	close(fd);
+	return count;
+}
+
+static HashEngine *makePartitionRouter(const char *filename, uint32 partitionCount){
+	HashEngine *engine = (HashEngine *)calloc(1, sizeof(HashEngine));
+	engine->filename = (char *)malloc(sizeof(char) * (strlen(filename) + 1));
+	strcpy(engine->filename, filename);
+	engine->partitionCount = partitionCount;
+	engine->partitions = (HashEngine **)calloc(partitionCount, sizeof(HashEngine *));
+	return engine;
+}
+
+static void freePartitionRouter(HashEngine *engine){
+	for(uint32 i = 0; i < engine->partitionCount; i++){
+		if(engine->partitions[i] != NULL){
+			freeHashEngine(engine->partitions[i]);
+		}
 	}
+	free(engine->partitions);
+	free(engine->filename);
+	free(engine);
 }
 
 HashEngine *makeHashEngine(const char *filename, uint32 hashMapCap, uint64 cacheCap,
@@ -302,15 +804,15 @@ HashEngine *makeHashEngine(const char *filename, uint32 hashMapCap, uint64 cache
 						   enum RedoFlushStrategy flushStrategy,
 						   uint64 flushStrategyArg)
 {
-	//创建文件并打开文件描述符
-	int wfd = createHashFile(filename);
-	int rfd = openHashFile(filename);
-	if (wfd == -1 || rfd == -1)
+	//创建文件并打开文件描述符，读写都使用pread/pwrite，只需要一个描述符
+	int fd = createHashFile(filename);
+	if (fd == -1)
 	{
 		return NULL;
 	}
+	int wfd = fd, rfd = fd;
 	//写入元数据
-	writeMetadata(wfd);
+	writeMetadata(wfd, 0);
 	//创建对象
 	HashEngine* engine = (HashEngine*)malloc(sizeof(HashEngine));
 	engine->filename = (char *)malloc(sizeof(char) * (strlen(filename) + 1));
@@ -318,18 +820,25 @@ HashEngine *makeHashEngine(const char *filename, uint32 hashMapCap, uint64 cache
 	engine->wfd = wfd;
 	engine->rfd = rfd;
 	engine->idSeed = 1; //不能以0为起点
-	engine->hashMap = makeHashMap(hashMapCap);
-	engine->readCache = makeLRUCache(cacheCap, 8); //每一个KEY对应一个唯一ID，从1开始
+	engine->keyIndex = makeKeyIndex(hashMapCap);
+	engine->readCache = makeLRUCacheWithPolicy(cacheCap, 8, TwoQueuePolicy); //每一个KEY对应一个唯一ID，从1开始；使用2Q策略，避免扫描冲掉热点记录
 	engine->writeCache = makeLRUCache(cacheCap, 8);
 	engine->freezeWriteCache = makeLRUCache(cacheCap, 8);
 	engine->persistenceStatus = None; //没有进行持久化
-	// //重做日志内容
-	// engine->operateListMaxSize = operateListMaxSize;
-	// engine->flushStrategy = flushStrategy;
-	// engine->flushStrategyArg = flushStrategyArg;
-	// engine->redoVersion = 1;
-	// engine->redoLogWork = createHashEngineRedoLog(engine);
-	// engine->redoLogFreeze = NULL;
+	initHashEngineCompaction(engine);
+	engine->fileSize = HASH_FILE_HEADER_SIZE;
+	engine->persistedSize = engine->fileSize;
+	engine->liveSize = 0;
+	engine->hintFd = createHintFile(engine->hintFilename);
+	//同名引擎残留的blob文件对新的数据文件无效，第一次写入blob时重新创建
+	unlink(engine->newBlobFilename);
+	unlink(engine->blobFilename);
+	//同名引擎残留的磁盘索引同样无效，加载时据此判断是否使用磁盘索引
+	unlink(engine->newIndexFilename);
+	unlink(engine->indexFilename);
+	//重做日志内容：同名引擎残留的日志对新的数据文件无效
+	initHashEngineRedoLog(engine, operateListMaxSize, flushStrategy, flushStrategyArg);
+	removeHashEngineRedoLogs(engine);
 	//初始化线程相关内容
 	pthread_cond_init(&engine->statusCond, NULL);
 	pthread_mutexattr_init(&engine->statusAttr);
@@ -338,350 +847,2706 @@ HashEngine *makeHashEngine(const char *filename, uint32 hashMapCap, uint64 cache
 	return engine;
 }
 
-static void* setRecordLocationIdAs0(struct Entry * entry, void* args){
-	((RecordLocation*) entry->value)->id = 0;
-	return NULL;
-}
-
-static int exceHashEngineRedoLog(HashEngine* engine, RedoLog *redoLog){
-	uint8 type = 0;
-	lseek(redoLog->fd, 0, SEEK_SET);
-	while (read(redoLog->fd, &type, 1) > 0)
-	{
-		uint32 keyLen;
-		read(redoLog->fd, &keyLen, 4);
-		keyLen = ntohl(keyLen);
-		uint8* key = malloc(keyLen);
-		read(redoLog->fd, key, keyLen);
-		if(type==2){
-			removeHashEngine(engine, keyLen, key);
-			free(key);
-		} else if(type==1){
-			uint32 valueLen;
-			read(redoLog->fd, &valueLen, 4);
-			valueLen = ntohl(valueLen);
-			uint8 *value = malloc(valueLen);
-			read(redoLog->fd, value, valueLen);
-			putHashEngine(engine, keyLen, key, valueLen, value);
-			free(key);
-			free(value);
-		} else {
-			return 0;
-		}
+//同步磁盘索引，同时记录对应的数据文件尺寸和空间统计，需要在statusMutex中调用
+static void syncHashEngineDiskIndex(HashEngine *engine){
+	uint64 userData[DISK_INDEX_USER_DATA_COUNT] = {engine->persistedSize, engine->liveSize, engine->blobLiveSize, 0};
+	if(!syncDiskIndex(engine->diskIndex, userData)){
+		printf("磁盘索引%s同步失败，下次加载时从数据文件重建\n", engine->indexFilename);
 	}
-	return 1;
 }
 
-HashEngine *loadHashEngine(const char *filename, uint32 hashMapCap, uint64 cacheCap,
-						   uint64 operateListMaxSize,
-						   enum RedoFlushStrategy flushStrategy,
-						   uint64 flushStrategyArg)
+HashEngine *makeDiskIndexHashEngine(const char *filename, uint32 indexCacheCap, uint64 cacheCap,
+									uint64 operateListMaxSize,
+									enum RedoFlushStrategy flushStrategy,
+									uint64 flushStrategyArg)
 {
-	//创建文件并打开文件描述符
-	int wfd = openHashFile(filename);
-	int rfd = openHashFile(filename);
-	if (wfd == -1 || rfd == -1)
-	{
+	HashEngine *engine = makeHashEngine(filename, DISK_INDEX_RESIDENT_CAPACITY, cacheCap,
+										operateListMaxSize, flushStrategy, flushStrategyArg);
+	if(engine == NULL){
 		return NULL;
 	}
-	//验证元数据
-	if (!verifyMetadata(wfd))
-	{
+	//磁盘索引代替提示文件
+	close(engine->hintFd);
+	engine->hintFd = -1;
+	unlink(engine->hintFilename);
+	engine->diskIndex = makeDiskIndex(engine->indexFilename, indexCacheCap);
+	if(engine->diskIndex == NULL){
+		freeHashEngine(engine);
+		unlink(filename);
 		return NULL;
 	}
-	//创建对象
-	HashEngine *engine = (HashEngine *)malloc(sizeof(HashEngine));
-	engine->filename = (char *)malloc(sizeof(char) * (strlen(filename) + 1));
-	strcpy(engine->filename, filename);
-	engine->wfd = wfd;
-	engine->rfd = rfd;
-	engine->idSeed = 1; //不能以0为起点
-	engine->hashMap = makeHashMap(hashMapCap);
-	engine->readCache = makeLRUCache(cacheCap, 8); //每一个KEY对应一个唯一ID，从1开始
-	engine->writeCache = makeLRUCache(cacheCap, 8);
-	engine->freezeWriteCache = makeLRUCache(cacheCap, 8);
-	engine->persistenceStatus = None; //没有进行持久化
-	// //重做日志内容
-	// engine->operateListMaxSize = operateListMaxSize;
-	// engine->flushStrategy = flushStrategy;
-	// engine->flushStrategyArg = flushStrategyArg;
-	// engine->redoVersion = 1;
-	// engine->redoLogWork = NULL;
-	// engine->redoLogFreeze = NULL;
-	//初始化线程相关内容
-	pthread_cond_init(&engine->statusCond, NULL);
-	pthread_mutexattr_init(&engine->statusAttr);
-	pthread_mutexattr_settype(&engine->statusAttr, PTHREAD_MUTEX_RECURSIVE_NP);
-	pthread_mutex_init(&engine->statusMutex, &engine->statusAttr);
-	//读取数据文件，创建内存索引
-	uint64 position = 8; //初始化为第一个数据段的位置
-	uint64 fileSize = lseek(rfd, 0, SEEK_END);
-	while(position<fileSize){
-		Record* record = loadRecord(rfd, position, 1);
-		RecordLocation* loaction = getHashMap(engine->hashMap, record->keyLen, record->key);
-		if(loaction==NULL){
-			loaction = makeRecordLocation(record->version, position); //先用id存放版本号
-			putHashMap(engine->hashMap, record->keyLen, record->key, loaction);
-		} else {
-			if(loaction->id < record->version){
-				loaction->position = position;
-				loaction->id = record->version;
-			}
-		}
-		freeRecord(record);
-		position += 8 + 4 + 4 + record->keyLen + record->valueLen;
-	}
-	//恢复HashMap中的id为0
-	foreachHashMap(engine->hashMap, setRecordLocationIdAs0, NULL);
-	// //执行重做日志
-	// RedoLog* redoLog = loadHashEngineRedoLog(engine);
-	// if(redoLog!=NULL){
-	// 	if (!exceHashEngineRedoLog(engine, redoLog)){
-	// 		//TODO 内存泄露
-	// 		return NULL;
-	// 	}
-	// 	forceFreeRedoLogAndUnlink(redoLog);
-	// }
-	// //创建新的重做日志
-	// engine->redoLogWork = createHashEngineRedoLog(engine);
+	engine->residentLimit = 4 * cacheCap + DISK_INDEX_RESIDENT_CAPACITY;
+	syncHashEngineDiskIndex(engine);
 	return engine;
 }
 
-void freeHashEngine(HashEngine* engine){
-	startPersistenceThread(engine);
-	pthread_join(engine->persistenceThread, NULL);
-	// forceFreeRedoLogAndUnlink(engine->redoLogWork);
-	free(engine->filename);
-	close(engine->wfd);
-	close(engine->rfd);
-	foreachHashMap(engine->hashMap, freeHashMapRecordLocation, NULL);
-	freeHashMap(engine->hashMap);
-	freeLRUCacheRecords(engine->writeCache);
-	freeLRUCache(engine->writeCache);
-	freeLRUCacheRecords(engine->freezeWriteCache);
-	freeLRUCache(engine->freezeWriteCache);
-	free(engine);
+static void *setRecordLocationIdAs0(uint32 keyLen, uint8 *key, RecordLocation *location, void *args){
+	location->id = 0;
+	return NULL;
 }
 
-/*****************************************************************************
- *通用函数：一些操作封装
- ******************************************************************************/
-
-static void putToReadCache(HashEngine* engine, uint64 id, Record* record){
-	Record* oldRecord = (Record*)putLRUCache(engine->readCache, (uint8*)&id, record);
-	if(oldRecord!=NULL){
-		//对淘汰的Record，将id清零
-		RecordLocation* location = (RecordLocation*)getHashMap(engine->hashMap, oldRecord->keyLen, oldRecord->key);
-		location->id = 0;
+//加载时将一条记录加入内存索引，id暂时存放版本号
+//数据文件只追加，位置靠后的记录更新（删除后重新插入的key版本号从1重新开始，不能按版本号比较）
+//墓碑（valueLen为0）将key从内存索引中删除
+static void indexLoadedRecordToDisk(HashEngine *engine, uint64 position, uint32 size, uint32 blobSize, uint32 keyLen, uint8 *key);
+static void indexLoadedRecord(HashEngine *engine, uint64 version, uint64 position, uint32 size, uint32 blobSize, uint32 keyLen, uint8 *key){
+	if(engine->diskIndex != NULL){
+		indexLoadedRecordToDisk(engine, position, size, blobSize, keyLen, key);
+		return;
+	}
+	RecordLocation* loaction = getKeyIndex(engine->keyIndex, keyLen, key);
+	if(size == HASH_RECORD_HEADER_SIZE + keyLen){
+		if(loaction!=NULL && loaction->position < position){
+			engine->liveSize -= loaction->size;
+			engine->blobLiveSize -= loaction->blobSize;
+			removeKeyIndex(engine->keyIndex, keyLen, key);
+		}
+		return;
+	}
+	if(loaction==NULL){
+		loaction = putKeyIndex(engine->keyIndex, keyLen, key);
+		loaction->id = version;
+		loaction->position = position;
+		loaction->size = size;
+		loaction->blobSize = blobSize;
+		engine->liveSize += size;
+		engine->blobLiveSize += blobSize;
+	} else if(loaction->position < position){
+		engine->liveSize += (uint64)size - loaction->size;
+		engine->blobLiveSize += (uint64)blobSize - loaction->blobSize;
+		loaction->position = position;
+		loaction->id = version;
+		loaction->size = size;
+		loaction->blobSize = blobSize;
 	}
 }
 
-static void putToWriteCache(HashEngine* engine, uint64 id, Record* record){
-	if(engine->writeCache->size>=engine->writeCache->capacity){
-		startPersistenceThread(engine);
+//使用磁盘索引时加载一条记录：与indexLoadedRecord相同，位置靠后的记录更新，墓碑将key删除
+static void indexLoadedRecordToDisk(HashEngine *engine, uint64 position, uint32 size, uint32 blobSize, uint32 keyLen, uint8 *key){
+	DiskIndexValue old;
+	int found = getDiskIndex(engine->diskIndex, keyLen, key, &old) == 1;
+	if(found && old.position >= position){
+		return;
+	}
+	if(found){
+		engine->liveSize -= old.size;
+		engine->blobLiveSize -= old.blobSize;
 	}
-	putLRUCache(engine->writeCache, (uint8*)&id, record);
+	if(size == HASH_RECORD_HEADER_SIZE + keyLen){
+		if(found){
+			removeDiskIndex(engine->diskIndex, keyLen, key);
+		}
+		return;
+	}
+	DiskIndexValue value = {position, size, blobSize};
+	putDiskIndex(engine->diskIndex, keyLen, key, &value);
+	engine->liveSize += size;
+	engine->blobLiveSize += blobSize;
 }
 
-/*****************************************************************************
- *主要函数：增删改查
- ******************************************************************************/
-
-int32 putHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key, uint32 valueLen, uint8 *value){
-	// //添加到重做日志
-	// if(engine->redoLogWork!=NULL && valueLen==0){
-	// 	appendRedoLog(engine->redoLogWork, makeHashEngineOperateTuple(engine, 1, keyLen, key, valueLen, value));
-	// }
-	RecordLocation* location = (RecordLocation*) getHashMap(engine->hashMap, keyLen, key);
-	Record* record = NULL;
-	//不存在这个记录：创建
-	if(location == NULL){
-		//创建这个记录的位置
-		location = makeRecordLocation(engine->idSeed++, 0);
-		putHashMap(engine->hashMap, keyLen, key, location);
-		//创建这个记录的内容
-		record = makeRecord(1, keyLen, valueLen, key, value);
+//加载磁盘索引，返回需要继续扫描的数据文件起始位置（上次同步时的数据文件尺寸）
+//索引不可用（同步之前崩溃、损坏或者数据文件被截断）时重新创建，从文件头之后全量扫描
+static uint64 loadHashEngineDiskIndex(HashEngine *engine, uint32 indexCacheCap, uint64 fileSize){
+	DiskIndex *index = loadDiskIndex(engine->indexFilename, indexCacheCap);
+	if(index != NULL && index->userData[0] >= HASH_FILE_HEADER_SIZE && index->userData[0] <= fileSize){
+		engine->diskIndex = index;
+		engine->liveSize = index->userData[1];
+		engine->blobLiveSize = index->userData[2];
+		return index->userData[0];
 	}
-	//存在这个记录：修改
-	uint8 *copyValue = NULL;
-	if (record == NULL){
-		newAndCopyByteArray(&copyValue, value, valueLen);
+	if(index != NULL){
+		freeDiskIndex(index);
 	}
-	//缓存中没有
-	if(record == NULL && location->id==0 && location->position!=0){
-		//从文件中读
-		record = loadRecord(engine->rfd, location->position, 1);
-		//修改其version和value
-		record->version++;
-		record->valueLen = valueLen;
-		record->value = copyValue;
-		//更新id
-		location->id = engine->idSeed++;
+	engine->diskIndex = makeDiskIndex(engine->indexFilename, indexCacheCap);
+	return HASH_FILE_HEADER_SIZE;
+}
+
+//读取提示文件建立内存索引，返回需要继续扫描的数据文件起始位置
+//遇到损坏或不完整的块时停止，并截断提示文件；提示文件不可用时返回文件头之后的位置
+static uint64 loadHintFile(HashEngine *engine, uint64 fileSize){
+	uint64 dataEnd = HASH_FILE_HEADER_SIZE;
+	int fd = open(engine->hintFilename, O_RDWR | O_APPEND);
+	if(fd == -1){
+		return dataEnd;
 	}
-	//读缓存中有
-	if (record==NULL && (record = (Record *)removeLRUCache(engine->readCache, (uint8*)&location->id)) != NULL)
-	{
-		free(record->value);
-		//修改其version和value
-		record->version++;
-		record->valueLen = valueLen;
-		record->value = copyValue;
+	uint32 header[2];
+	if(pread(fd, header, 8, 0) != 8 || ntohl(header[0]) != HINT_MAGIC_NUMBER || ntohl(header[1]) != HINT_VERSION){
+		close(fd);
+		return dataEnd;
+	}
+	uint64 offset = 8;
+	uint8 blockHeader[HASH_HINT_BLOCK_HEADER_SIZE];
+	uint8 *buffer = NULL;
+	while(pread(fd, blockHeader, HASH_HINT_BLOCK_HEADER_SIZE, offset) == HASH_HINT_BLOCK_HEADER_SIZE){
+		uint32 entriesBytes = ntohl(*(uint32 *)blockHeader);
+		uint32 count = ntohl(*(uint32 *)(blockHeader + 4));
+		uint64 blockDataEnd = ntohll(*(uint64 *)(blockHeader + 8));
+		uint32 checksum = ntohl(*(uint32 *)(blockHeader + 16));
+		if(blockDataEnd > fileSize){
+			break;
+		}
+		buffer = (uint8 *)realloc(buffer, entriesBytes + 1);
+		if(pread(fd, buffer, entriesBytes, offset + HASH_HINT_BLOCK_HEADER_SIZE) != entriesBytes ||
+		   hintChecksum(buffer, entriesBytes) != checksum){
+			break;
+		}
+		uint8 *p = buffer;
+		for(uint32 i = 0; i < count; i++){
+			uint64 version = ntohll(*(uint64 *)p);
+			uint64 position = ntohll(*(uint64 *)(p + 8));
+			uint32 size = ntohl(*(uint32 *)(p + 16));
+			uint32 blobSize = ntohl(*(uint32 *)(p + 20));
+			uint32 keyLen = ntohl(*(uint32 *)(p + 24));
+			indexLoadedRecord(engine, version, position, size, blobSize, keyLen, p + HASH_HINT_ENTRY_HEADER_SIZE);
+			p += HASH_HINT_ENTRY_HEADER_SIZE + keyLen;
+		}
+		engine->hintEntryCount += count;
+		offset += HASH_HINT_BLOCK_HEADER_SIZE + entriesBytes;
+		dataEnd = blockDataEnd;
+	}
+	free(buffer);
+	//丢弃不完整的块，后续检查点继续追加
+	ftruncate(fd, offset);
+	engine->hintFd = fd;
+	return dataEnd;
+}
+
+static void *writeLoadedLocationToHint(uint32 keyLen, uint8 *key, RecordLocation *location, void *args){
+	appendHintEntry((HintWriter *)args, location->id, location->position, location->size, location->blobSize, keyLen, key);
+	return NULL;
+}
+
+//根据加载完成的内存索引重写整个提示文件，需要在id恢复为0之前调用（此时id为版本号）
+static void rewriteHintFile(HashEngine *engine){
+	char *tmpFilename = (char *)malloc(strlen(engine->hintFilename) + 10);
+	sprintf(tmpFilename, "%s.compact", engine->hintFilename);
+	int fd = createHintFile(tmpFilename);
+	if(fd != -1){
+		HintWriter writer;
+		initHintWriter(&writer, fd, engine->fileSize, 1);
+		foreachKeyIndex(engine->keyIndex, writeLoadedLocationToHint, &writer);
+		finishHintWriter(&writer, 1);
+		if(rename(tmpFilename, engine->hintFilename) == 0){
+			if(engine->hintFd != -1){
+				close(engine->hintFd);
+			}
+			engine->hintFd = fd;
+			engine->hintEntryCount = engine->keyIndex->size;
+		} else {
+			close(fd);
+			unlink(tmpFilename);
+		}
+	}
+	free(tmpFilename);
+}
+
+static void *writeLiveLocationToHint(uint32 keyLen, uint8 *key, RecordLocation *location, void *args){
+	//position为0说明只在写缓存中，下一个检查点追加到提示文件
+	if(location->position != 0){
+		appendHintEntry((HintWriter *)args, 0, location->position, location->size, location->blobSize, keyLen, key);
+	}
+	return NULL;
+}
+
+//提示文件只追加，条目数随写入量增长：超过有效key数目的HINT_REWRITE_RATIO倍时根据内存索引重写，在持久化线程中调用
+//在statusMutex中将内存索引序列化到缓冲区，之后写入临时文件、同步并改名替换，崩溃时旧提示文件仍然完整
+//内存索引中没有版本号，重写的条目版本号为0（加载时按位置判断新旧，版本号以数据文件中的记录为准）
+static void compactHintFile(HashEngine *engine){
+	if(engine->hintFd == -1 || engine->hintEntryCount <= HINT_REWRITE_MIN_ENTRIES ||
+	   engine->hintEntryCount <= HINT_REWRITE_RATIO * engine->keyIndex->size){
+		return;
+	}
+	char *tmpFilename = (char *)malloc(strlen(engine->hintFilename) + 10);
+	sprintf(tmpFilename, "%s.compact", engine->hintFilename);
+	int fd = createHintFile(tmpFilename);
+	if(fd != -1){
+		HintWriter writer;
+		uint64 count = 0;
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		initHintWriter(&writer, fd, engine->persistedSize, 0);
+		foreachKeyIndex(engine->keyIndex, writeLiveLocationToHint, &writer);
+		count = engine->keyIndex->size;
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+		finishHintWriter(&writer, 1);
+		if(rename(tmpFilename, engine->hintFilename) == 0){
+			close(engine->hintFd);
+			engine->hintFd = fd;
+			engine->hintEntryCount = count;
+		} else {
+			close(fd);
+			unlink(tmpFilename);
+		}
+	}
+	free(tmpFilename);
+}
+
+//重放一个重做日志文件，遇到不完整或校验和错误的记录（写入日志时崩溃）停止，返回重放的操作数目
+static uint64 replayHashEngineRedoLog(HashEngine* engine, const char *filename){
+	int fd = open(filename, O_RDONLY);
+	if(fd == -1){
+		return 0;
+	}
+	struct stat st;
+	fstat(fd, &st);
+	uint64 len = st.st_size;
+	uint8 *data = (uint8 *)malloc(len + 1);
+	uint64 readLen = 0;
+	while(readLen < len){
+		ssize_t n = pread(fd, data + readLen, len - readLen, readLen);
+		if(n <= 0){
+			break;
+		}
+		readLen += n;
+	}
+	close(fd);
+	uint64 position = 0, count = 0;
+	while(position + HASH_REDO_RECORD_HEADER_SIZE + 4 <= readLen){
+		uint8 *p = data + position;
+		uint8 type = p[0];
+		uint32 keyLen = ntohl(*(uint32 *)(p + 1));
+		uint32 valueLen = ntohl(*(uint32 *)(p + 5));
+		uint64 size = (uint64)HASH_REDO_RECORD_HEADER_SIZE + keyLen + valueLen;
+		if((type != 1 && type != 2) || position + size + 4 > readLen ||
+		   ntohl(*(uint32 *)(p + size)) != hintChecksum(p, size)){
+			break;
+		}
+		uint8 *key = p + HASH_REDO_RECORD_HEADER_SIZE;
+		if(type == 1){
+			putHashEngine(engine, keyLen, key, valueLen, key + keyLen);
+		} else {
+			deleteHashEngine(engine, keyLen, key);
+		}
+		position += size + 4;
+		count++;
+	}
+	free(data);
+	return count;
+}
+
+//同步进行一次检查点：持久化当前写缓存并等待完成
+static void checkpointHashEngine(HashEngine *engine){
+	startPersistenceThread(engine);
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	while(engine->persistenceStatus != None){
+		pthread_cond_wait(&engine->statusCond, &engine->statusMutex);
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+}
+
+static void replayRedoLogFile(void *value, void *args){
+	uint64 count = replayHashEngineRedoLog((HashEngine *)args, (char *)value);
+	printf("重放重做日志%s：%llu条操作\n", (char *)value, count);
+}
+
+//加载时重放上次没有正常关闭残留的重做日志（按版本号从旧到新），持久化并同步之后删除
+static void recoverHashEngine(HashEngine *engine){
+	List *logs = listHashEngineRedoLogs(engine);
+	if(logs->length > 0){
+		foreachList(logs, replayRedoLogFile, engine);
+		//新的日志版本号接在残留的日志之后
+		sscanf((char *)logs->tail->value + strlen(engine->filename), "_0x%llx", &engine->redoVersion);
+		engine->redoVersion++;
+		//重放的修改在写缓存中，检查点同步之后才能删除日志
+		checkpointHashEngine(engine);
+		foreachList(logs, unlinkAndFreeFilename, NULL);
+	}
+	freeList(logs);
+}
+
+HashEngine *makePartitionedHashEngine(const char *filename, uint32 partitionCount,
+									  uint32 hashMapCap, uint64 cacheCap,
+									  uint64 operateListMaxSize,
+									  enum RedoFlushStrategy flushStrategy,
+									  uint64 flushStrategyArg)
+{
+	if(partitionCount <= 1){
+		return makeHashEngine(filename, hashMapCap, cacheCap, operateListMaxSize, flushStrategy, flushStrategyArg);
+	}
+	//写入清单文件
+	int fd = createHashFile(filename);
+	if (fd == -1)
+	{
+		return NULL;
+	}
+	uint32 manifest[3] = {htonl(MAGIC_NUMBER), htonl(PARTITION_MANIFEST_VERSION), htonl(partitionCount)};
+	int ok = pwriteFully(fd, (uint8 *)manifest, sizeof(manifest), 0) && fsync(fd) == 0;
+	close(fd);
+	//创建各个分区，内存索引和缓存容量平均分配
+	HashEngine *engine = makePartitionRouter(filename, partitionCount);
+	uint32 partitionMapCap = hashMapCap / partitionCount > 0 ? hashMapCap / partitionCount : 1;
+	uint64 partitionCacheCap = cacheCap / partitionCount > 0 ? cacheCap / partitionCount : 1;
+	for(uint32 i = 0; i < partitionCount && ok; i++){
+		char *name = partitionFilename(filename, i);
+		engine->partitions[i] = makeHashEngine(name, partitionMapCap, partitionCacheCap,
+											   operateListMaxSize, flushStrategy, flushStrategyArg);
+		ok = engine->partitions[i] != NULL;
+		free(name);
+	}
+	if(!ok){
+		freePartitionRouter(engine);
+		unlink(filename);
+		return NULL;
+	}
+	return engine;
+}
+
+static HashEngine *loadPartitionedHashEngine(const char *filename, uint32 partitionCount,
+											 uint32 hashMapCap, uint64 cacheCap,
+											 uint64 operateListMaxSize,
+											 enum RedoFlushStrategy flushStrategy,
+											 uint64 flushStrategyArg)
+{
+	HashEngine *engine = makePartitionRouter(filename, partitionCount);
+	uint32 partitionMapCap = hashMapCap / partitionCount > 0 ? hashMapCap / partitionCount : 1;
+	uint64 partitionCacheCap = cacheCap / partitionCount > 0 ? cacheCap / partitionCount : 1;
+	for(uint32 i = 0; i < partitionCount; i++){
+		char *name = partitionFilename(filename, i);
+		engine->partitions[i] = loadHashEngine(name, partitionMapCap, partitionCacheCap,
+											   operateListMaxSize, flushStrategy, flushStrategyArg);
+		free(name);
+		if(engine->partitions[i] == NULL){
+			freePartitionRouter(engine);
+			return NULL;
+		}
+	}
+	return engine;
+}
+
+HashEngine *loadHashEngine(const char *filename, uint32 hashMapCap, uint64 cacheCap,
+						   uint64 operateListMaxSize,
+						   enum RedoFlushStrategy flushStrategy,
+						   uint64 flushStrategyArg)
+{
+	uint32 partitionCount = readPartitionCount(filename);
+	if(partitionCount > 0){
+		return loadPartitionedHashEngine(filename, partitionCount, hashMapCap, cacheCap,
+										 operateListMaxSize, flushStrategy, flushStrategyArg);
+	}
+	//打开文件描述符，读写都使用pread/pwrite，只需要一个描述符
+	int fd = openHashFile(filename);
+	if (fd == -1)
+	{
+		return NULL;
+	}
+	int wfd = fd, rfd = fd;
+	//验证元数据
+	uint32 fileFlags = 0;
+	if (!verifyMetadata(fd, &fileFlags))
+	{
+		close(fd);
+		return NULL;
+	}
+	//创建对象
+	HashEngine *engine = (HashEngine *)malloc(sizeof(HashEngine));
+	engine->filename = (char *)malloc(sizeof(char) * (strlen(filename) + 1));
+	strcpy(engine->filename, filename);
+	engine->wfd = wfd;
+	engine->rfd = rfd;
+	engine->idSeed = 1; //不能以0为起点
+	engine->keyIndex = makeKeyIndex(hashMapCap);
+	engine->readCache = makeLRUCacheWithPolicy(cacheCap, 8, TwoQueuePolicy); //每一个KEY对应一个唯一ID，从1开始；使用2Q策略，避免扫描冲掉热点记录
+	engine->writeCache = makeLRUCache(cacheCap, 8);
+	engine->freezeWriteCache = makeLRUCache(cacheCap, 8);
+	engine->persistenceStatus = None; //没有进行持久化
+	initHashEngineCompaction(engine);
+	engine->compression = (fileFlags & HASH_FILE_FLAG_COMPRESSION) != 0;
+	//重做日志内容
+	initHashEngineRedoLog(engine, operateListMaxSize, flushStrategy, flushStrategyArg);
+	//初始化线程相关内容
+	pthread_cond_init(&engine->statusCond, NULL);
+	pthread_mutexattr_init(&engine->statusAttr);
+	pthread_mutexattr_settype(&engine->statusAttr, PTHREAD_MUTEX_RECURSIVE_NP);
+	pthread_mutex_init(&engine->statusMutex, &engine->statusAttr);
+	//上次碎片整理未完成：新数据文件还在说明切换前崩溃，删除残留的新文件（先删除blob文件）；
+	//否则数据文件已经切换，若新blob文件还在则完成blob文件的切换
+	if(access(engine->newFilename, F_OK) == 0){
+		unlink(engine->newBlobFilename);
+		unlink(engine->newIndexFilename);
+		unlink(engine->newFilename);
+	} else {
+		rename(engine->newBlobFilename, engine->blobFilename);
+		rename(engine->newIndexFilename, engine->indexFilename);
+	}
+	engine->blobFd = open(engine->blobFilename, O_RDWR);
+	if(engine->blobFd != -1){
+		struct stat blobStat;
+		fstat(engine->blobFd, &blobStat);
+		engine->blobFileSize = blobStat.st_size;
+	}
+	//读取提示文件（使用磁盘索引时为磁盘索引）创建索引，然后只扫描其之后写入的数据文件尾部
+	struct stat st;
+	fstat(rfd, &st);
+	uint64 fileSize = st.st_size;
+	engine->liveSize = 0;
+	uint64 tailStart = HASH_FILE_HEADER_SIZE;
+	if(access(engine->indexFilename, F_OK) == 0){
+		//此时hashMapCap为磁盘索引的页缓存容量
+		tailStart = loadHashEngineDiskIndex(engine, hashMapCap, fileSize);
+		engine->residentLimit = 4 * cacheCap + DISK_INDEX_RESIDENT_CAPACITY;
+	}
+	if(engine->diskIndex == NULL){
+		tailStart = loadHintFile(engine, fileSize);
+	}
+	uint64 position = tailStart;
+	while(position + HASH_RECORD_HEADER_SIZE <= fileSize){
+		uint32 size = 0, blobSize = 0;
+		Record* record = loadRecord(engine, position, 1, &size, &blobSize);
+		if(position + size > fileSize){
+			//最后一条记录没有写完整（写入时崩溃），丢弃
+			freeRecord(record);
+			break;
+		}
+		indexLoadedRecord(engine, record->version, position, size, blobSize, record->keyLen, record->key);
+		position += size;
+		freeRecord(record);
+	}
+	//截断不完整的尾部，并将写位置定位到文件末尾
+	if(position < fileSize){
+		ftruncate(wfd, position);
+	}
+	engine->fileSize = position;
+	engine->persistedSize = position;
+	//提示文件不存在或者落后于数据文件：重写提示文件，下次启动无需扫描
+	if(engine->diskIndex != NULL){
+		syncHashEngineDiskIndex(engine);
+	} else if(engine->hintFd == -1 || position > tailStart){
+		rewriteHintFile(engine);
+	}
+	//恢复内存索引中的id为0，加载时删除的位置没有其他线程持有，直接回收
+	foreachKeyIndex(engine->keyIndex, setRecordLocationIdAs0, NULL);
+	reclaimKeyIndex(engine->keyIndex);
+	//执行重做日志
+	recoverHashEngine(engine);
+	return engine;
+}
+
+void freeHashEngine(HashEngine* engine){
+	if(engine->partitions != NULL){
+		freePartitionRouter(engine);
+		return;
+	}
+	//最后一次检查点不再创建新的重做日志，工作中的日志在检查点之后删除
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	engine->redoLogEnabled = 0;
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	startPersistenceThread(engine);
+	pthread_join(engine->persistenceThread, NULL);
+	free(engine->filename);
+	free(engine->newFilename);
+	free(engine->hintFilename);
+	free(engine->blobFilename);
+	free(engine->newBlobFilename);
+	free(engine->indexFilename);
+	free(engine->newIndexFilename);
+	if(engine->diskIndex != NULL){
+		freeDiskIndex(engine->diskIndex);
+	}
+	close(engine->wfd);
+	if(engine->rfd != engine->wfd){
+		close(engine->rfd);
+	}
+	if(engine->hintFd != -1){
+		close(engine->hintFd);
+	}
+	if(engine->blobFd != -1){
+		close(engine->blobFd);
+	}
+	pthread_rwlock_destroy(&engine->fileLock);
+	if(engine->mapping != NULL){
+		releaseMapping(engine->mapping);
+	}
+	freeKeyIndex(engine->keyIndex);
+	freeLRUCacheRecords(engine->readCache);
+	freeLRUCache(engine->readCache);
+	freeLRUCacheRecords(engine->writeCache);
+	freeLRUCache(engine->writeCache);
+	freeLRUCacheRecords(engine->freezeWriteCache);
+	freeLRUCache(engine->freezeWriteCache);
+	free(engine);
+}
+
+/*****************************************************************************
+ *通用函数：一些操作封装
+ ******************************************************************************/
+
+/*
+ * 磁盘索引：
+ * 内存索引中的key是磁盘索引的一个子集（最近访问的key和未持久化的key），内存索引中的位置总是最新的
+ * 不在内存索引中的key从磁盘索引读出位置后加入内存索引（id为0），之后与全内存模式相同地访问
+ * 磁盘索引在检查点的After阶段更新并同步，检查点开始时移出id为0的key（位置已经在磁盘索引中），
+ * 被移出的位置与删除的key一样在下一个检查点回收；持有位置的线程在安装id之前检查其是否仍在内存索引中
+ */
+
+//使用磁盘索引时，在statusMutex之外将查找key需要的页读入页缓存，之后在statusMutex中查找时通常不需要读盘
+//读盘只持有fileLock读锁（碎片整理切换磁盘索引时持有写锁），读取期间索引被切换或有页被写回时丢弃读到的页
+//缓存容量不足时页可能在查找之前被淘汰，此时查找仍在statusMutex中读盘，结果同样正确
+static void prefetchLocation(HashEngine *engine, uint32 keyLen, uint8 *key){
+	if(engine->diskIndex == NULL){
+		return;
+	}
+	for(uint32 i = 0; i < DISK_INDEX_PREFETCH_PAGES; i++){
+		uint32 pageNo = 0;
+		uint64 pageWrites = 0, compactionCount = 0;
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		if(getKeyIndex(engine->keyIndex, keyLen, key) == NULL){
+			pageNo = missingDiskIndexPage(engine->diskIndex, keyLen, key);
+			pageWrites = engine->diskIndex->pageWrites;
+			compactionCount = engine->compactionCount;
+		}
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+		if(pageNo == 0){
+			return;
+		}
+
+		DiskIndexPage *page = (DiskIndexPage *)malloc(sizeof(DiskIndexPage));
+		int ok = 0;
+		pthread_cleanup_push((void *)pthread_rwlock_unlock, &engine->fileLock);
+		pthread_rwlock_rdlock(&engine->fileLock);
+		ok = engine->compactionCount == compactionCount && readDiskIndexPage(engine->diskIndex, pageNo, page);
+		pthread_rwlock_unlock(&engine->fileLock);
+		pthread_cleanup_pop(0);
+		if(!ok){
+			free(page);
+			return;
+		}
+
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		if(engine->compactionCount == compactionCount){
+			cacheDiskIndexPage(engine->diskIndex, page, pageWrites);
+		} else {
+			free(page);
+		}
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+	}
+}
+
+//查找key的位置，使用磁盘索引时不在内存索引中的key从磁盘索引加载，需要在statusMutex中调用
+//调用者应该先在statusMutex之外调用prefetchLocation，避免持有statusMutex读盘
+static RecordLocation *lookupLocation(HashEngine *engine, uint32 keyLen, uint8 *key){
+	RecordLocation *location = getKeyIndex(engine->keyIndex, keyLen, key);
+	DiskIndexValue value;
+	if(location == NULL && engine->diskIndex != NULL && getDiskIndex(engine->diskIndex, keyLen, key, &value) == 1){
+		location = putKeyIndex(engine->keyIndex, keyLen, key);
+		location->position = value.position;
+		location->size = value.size;
+		location->blobSize = value.blobSize;
+	}
+	return location;
+}
+
+//查找key的位置的拷贝，不加入内存索引，需要在statusMutex中调用
+static int peekLocation(HashEngine *engine, uint32 keyLen, uint8 *key, RecordLocation *copy){
+	RecordLocation *location = getKeyIndex(engine->keyIndex, keyLen, key);
+	DiskIndexValue value;
+	if(location != NULL){
+		*copy = *location;
+		return 1;
+	}
+	if(engine->diskIndex != NULL && getDiskIndex(engine->diskIndex, keyLen, key, &value) == 1){
+		copy->position = value.position;
+		copy->id = 0;
+		copy->size = value.size;
+		copy->blobSize = value.blobSize;
+		return 1;
+	}
+	return 0;
+}
+
+//使用磁盘索引时，内存索引中的key超过上限则进行一次检查点（检查点开始时移出没有缓存的key）
+static void limitResidentLocations(HashEngine *engine){
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	if(engine->diskIndex != NULL && engine->keyIndex->size > engine->residentLimit &&
+	   engine->persistenceStatus == None){
+		startPersistenceThread(engine);
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+}
+
+static void *collectColdKey(uint32 keyLen, uint8 *key, RecordLocation *location, void *args){
+	if(location->id == 0 && location->position != 0){
+		Array *copy = (Array *)malloc(sizeof(Array));
+		newAndCopyByteArray((uint8 **)&copy->array, key, keyLen);
+		copy->length = keyLen;
+		addList((List *)args, copy);
+	}
+	return NULL;
+}
+
+//将内存索引中没有缓存的key移出，在检查点开始时调用，此时磁盘索引已经包含它们的位置
+static void evictColdLocations(HashEngine *engine){
+	List *keys = makeList();
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	//磁盘索引的修改失败之后其中的位置可能已经过期，内存索引中的位置不再移出
+	if(engine->diskIndex != NULL && !engine->diskIndex->failed && engine->keyIndex->size > engine->residentLimit / 2){
+		foreachKeyIndex(engine->keyIndex, collectColdKey, keys);
+		for(ListNode *node = keys->head; node != NULL; node = node->next){
+			Array *key = (Array *)node->value;
+			removeKeyIndex(engine->keyIndex, key->length, (uint8 *)key->array);
+			free(key->array);
+			free(key);
+		}
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	freeList(keys);
+}
+
+//位置是否仍在内存索引中（没有被删除或移出），需要在statusMutex中调用
+static int isResidentLocation(HashEngine *engine, RecordLocation *location, uint32 keyLen, uint8 *key){
+	return getKeyIndex(engine->keyIndex, keyLen, key) == location;
+}
+
+//内存索引插入时会进行渐进式rehash，与持久化线程的查找并发时需要加锁
+static RecordLocation *getLocation(HashEngine *engine, uint32 keyLen, uint8 *key){
+	RecordLocation *location = NULL;
+	prefetchLocation(engine, keyLen, key);
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	location = lookupLocation(engine, keyLen, key);
+	limitResidentLocations(engine);
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	return location;
+}
+
+//将key加入内存索引并设置id，返回其位置（key已经存在时返回已有的位置）
+static RecordLocation *putLocation(HashEngine *engine, uint32 keyLen, uint8 *key, uint64 id){
+	RecordLocation *location = NULL;
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	location = putKeyIndex(engine->keyIndex, keyLen, key);
+	location->id = id;
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	return location;
+}
+
+static uint64 nextRecordId(HashEngine *engine){
+	uint64 id;
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	id = engine->idSeed++;
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	return id;
+}
+
+//需要在statusMutex中调用
+static void putToReadCache(HashEngine* engine, uint64 id, Record* record){
+	//缓存已满时将淘汰一条记录，先记下其id
+	uint64 evictedId = 0;
+	LRUCache *cache = engine->readCache;
+	uint8 *evictedKey = evictionCandidateLRUCache(cache);
+	if(evictedKey != NULL){
+		evictedId = *(uint64 *)evictedKey;
+	}
+	Record* oldRecord = (Record*)putLRUCache(cache, (uint8*)&id, record);
+	if(oldRecord!=NULL){
+		//对淘汰的Record，将id清零（id已经变化说明该key有更新的副本，不能清零）
+		RecordLocation* location = getKeyIndex(engine->keyIndex, oldRecord->keyLen, oldRecord->key);
+		if(location!=NULL && location->id == evictedId){
+			location->id = 0;
+		}
+		freeRecord(oldRecord);
+	}
+}
+
+//放入写缓存并等待重做日志，返回日志是否写入成功
+static int32 putToWriteCache(HashEngine* engine, uint64 id, Record* record){
+	//检查容量和插入在同一个临界区中，多个写线程同时插入时写缓存不会溢出（溢出会淘汰未持久化的记录）
+	int done = 0;
+	RedoLog *redoLog = NULL;
+	uint64 seq = 0;
+	while(!done){
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		if(engine->writeCache->size < engine->writeCache->capacity){
+			putLRUCache(engine->writeCache, (uint8*)&id, record);
+			seq = appendHashEngineRedoLog(engine, record, &redoLog);
+			done = 1;
+		}
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+		if(!done){
+			startPersistenceThread(engine);
+		}
+	}
+	return waitHashEngineRedoLog(redoLog, seq);
+}
+
+/*****************************************************************************
+ *主要函数：增删改查
+ ******************************************************************************/
+
+//插入或更新一条记录，调用者需要已经计入位置的回收周期
+static int32 putRecord(HashEngine *engine, uint32 keyLen, uint8 *key, uint32 valueLen, uint8 *value){
+	RecordLocation* location = getLocation(engine, keyLen, key);
+	Record* record = NULL;
+	//不存在这个记录：创建
+	if(location == NULL){
+		//创建这个记录的位置
+		location = putLocation(engine, keyLen, key, nextRecordId(engine));
+		//创建这个记录的内容
+		record = makeRecord(1, keyLen, valueLen, key, value);
+	}
+	//存在这个记录：修改
+	uint8 *copyValue = NULL;
+	if (record == NULL){
+		newAndCopyByteArray(&copyValue, value, valueLen);
+	}
+	//缓存中没有
+	if(record == NULL && location->id==0 && location->position!=0){
+		int stale = 0;
+		//从文件中读，持有读锁防止碎片整理切换文件
+		pthread_cleanup_push((void *)pthread_rwlock_unlock, &engine->fileLock);
+		pthread_rwlock_rdlock(&engine->fileLock);
+		record = loadRecord(engine, location->position, 1, NULL, NULL);
+		pthread_rwlock_unlock(&engine->fileLock);
+		pthread_cleanup_pop(0);
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		if(location->id==0 && !isResidentLocation(engine, location, keyLen, key)){
+			//读盘期间位置被移出内存索引，重新查找
+			stale = 1;
+		} else if(location->id==0){
+			//修改其version和value
+			record->version++;
+			record->valueLen = valueLen;
+			record->value = copyValue;
+			//更新id
+			location->id = engine->idSeed++;
+		} else {
+			//读盘期间被读线程放入了读缓存，从读缓存中修改
+			freeRecord(record);
+			record = NULL;
+		}
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+		if(stale){
+			freeRecord(record);
+			free(copyValue);
+			return putRecord(engine, keyLen, key, valueLen, value);
+		}
+	}
+	//读缓存中有
+	if(record==NULL){
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		if ((record = (Record *)removeLRUCache(engine->readCache, (uint8*)&location->id)) != NULL)
+		{
+			free(record->value);
+			//修改其version和value
+			record->version++;
+			record->valueLen = valueLen;
+			record->value = copyValue;
+		}
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+	}
+	//写缓存中有
+	//防止出现在写writeCache时发生写缓存切换
+	if(record==NULL){
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		if ((record = (Record *)removeLRUCache(engine->writeCache, (uint8 *)&location->id)) != NULL)
+		{
+			free(record->value);
+			record->version++;
+			record->valueLen = valueLen;
+			record->value = copyValue;
+		}
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+	}
+	//读缓存、写缓存都没有，说明在freezewritecache中
+	if(record==NULL){
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		if(engine->persistenceStatus == None || engine->persistenceStatus == Compacting){
+			//不加锁读取location->id期间持久化已经完成（或者进入了碎片整理），释放锁后重新查找
+		} else if(engine->persistenceStatus == Doing){
+			//另外的进程正在进行持久化
+			if ((record = (Record *)getLRUCacheNoChange(engine->freezeWriteCache, (uint8 *)&location->id)) != NULL)
+			{
+				//重新创建一个记录
+				record = makeRecord(record->version+1, record->keyLen, valueLen, record->key, value);
+				free(copyValue);
+				//更新id
+				location->id = engine->idSeed++;
+			}
+		} else if(engine->persistenceStatus == After){
+			//另外的线程正在进行清理内存，wait
+			pthread_cond_wait(&engine->statusCond, &engine->statusMutex);
+		}
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+	}
+	//将这个记录写入writecache
+	if(record!=NULL){
+		return putToWriteCache(engine, location->id, record);
+	}
+	//说明持久化线程已经完成，递归调用
+	free(copyValue);
+	return putRecord(engine, keyLen, key, valueLen, value);
+}
+
+int32 putHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key, uint32 valueLen, uint8 *value){
+	if(engine->partitions != NULL){
+		return putHashEngine(partitionOf(engine, keyLen, key), keyLen, key, valueLen, value);
+	}
+	if(engine->diskIndex != NULL && keyLen > DISK_INDEX_MAX_KEY_SIZE){
+		return 0;
+	}
+	//value的长度只能使用记录头部valueLen字段中标记位之外的低位
+	if(valueLen > HASH_VALUE_MAX_SIZE){
+		return 0;
+	}
+	uint32 epoch = enterLocationEpoch(engine);
+	int32 result = putRecord(engine, keyLen, key, valueLen, value);
+	leaveLocationEpoch(engine, epoch);
+	return result;
+}
+
+//从各级缓存中查找记录，需要在statusMutex中调用
+static Record *getCachedRecord(HashEngine *engine, uint64 id){
+	Record *record = (Record *)getLRUCache(engine->readCache, (uint8*)&id);
+	if(record==NULL){
+		record = (Record *)getLRUCache(engine->writeCache, (uint8*)&id);
+	}
+	if(record==NULL && engine->persistenceStatus == Doing){
+		record = (Record *)getLRUCacheNoChange(engine->freezeWriteCache, (uint8 *)&id);
+	}
+	return record;
+}
+
+/*
+ * 多个读线程可以并发调用：
+ * 缓存的访问在statusMutex中进行，磁盘读只持有fileLock读锁（防止碎片整理切换文件），
+ * 使用pread不依赖文件偏移，因此多个线程可以同时读同一个文件描述符
+ */
+static Array getRecordByLocation(HashEngine *engine, RecordLocation *location){
+	Array arr;
+	arr.array = NULL;
+	arr.length = 0;
+
+	if(location==NULL){
+		return arr;
+	}
+
+	while(1){
+		int found = 0;
+		uint64 id = 0;
+		//从内存中读
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		id = location->id;
+		if(id!=0){
+			Record *record = getCachedRecord(engine, id);
+			//拷贝也需要在临界区内，防止来自freezeWriteCache的record被释放
+			if(record!=NULL){
+				newAndCopyByteArray((uint8**)&arr.array, record->value, record->valueLen);
+				arr.length = record->valueLen;
+				found = 1;
+			} else if(engine->persistenceStatus == After){
+				//另外的线程正在进行清理资源，wait
+				pthread_cond_wait(&engine->statusCond, &engine->statusMutex);
+			}
+		}
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+		if(found){
+			return arr;
+		}
+		if(id!=0){
+			continue;
+		}
+
+		//不在内存中：从磁盘中读，不持有statusMutex
+		Record *record = NULL;
+		uint64 position = 0;
+		pthread_cleanup_push((void *)pthread_rwlock_unlock, &engine->fileLock);
+		pthread_rwlock_rdlock(&engine->fileLock);
+		position = location->position;
+		record = loadRecord(engine, position, 0, NULL, NULL);
+		pthread_rwlock_unlock(&engine->fileLock);
+		pthread_cleanup_pop(0);
+
+		//放入读缓存，若读盘期间记录已经被其他线程缓存或修改，丢弃读到的记录重试
+		//位置已经被移出内存索引时（内容仍然有效）直接返回，不放入读缓存
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		if(location->id==0 && location->position==position){
+			newAndCopyByteArray((uint8**)&arr.array, record->value, record->valueLen);
+			arr.length = record->valueLen;
+			if(isResidentLocation(engine, location, record->keyLen, record->key)){
+				location->id = engine->idSeed++;
+				putToReadCache(engine, location->id, record);
+				record = NULL;
+			}
+			found = 1;
+		}
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+		if(record != NULL){
+			freeRecord(record);
+		}
+		if(found){
+			return arr;
+		}
+	}
+}
+
+/*
+ * 内存映射读：
+ * 记录在写缓存中时，磁盘上的内容已经过时，返回value的拷贝；
+ * 否则（不在缓存中或在读缓存中）磁盘上的内容是最新的，直接返回指向映射区的视图
+ * 视图持有映射的引用，因此持久化导致重新映射、碎片整理切换文件都不影响已借出的视图
+ */
+static HashEngineView getViewByLocation(HashEngine *engine, RecordLocation *location){
+	HashEngineView view;
+	view.value = NULL;
+	view.length = 0;
+	view.mapping = NULL;
+	if(location==NULL){
+		return view;
+	}
+	int done = 0;
+	uint64 position = 0;
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	while(!done && engine->mmapRead){
+		uint64 id = location->id;
+		if(id!=0){
+			Record *record = (Record *)getLRUCache(engine->writeCache, (uint8 *)&id);
+			if(record==NULL && engine->persistenceStatus == Doing){
+				record = (Record *)getLRUCacheNoChange(engine->freezeWriteCache, (uint8 *)&id);
+			}
+			if(record!=NULL){
+				if(record->valueLen!=0){
+					newAndCopyByteArray(&view.value, record->value, record->valueLen);
+					view.length = record->valueLen;
+				}
+				done = 1;
+				break;
+			}
+			if(getLRUCache(engine->readCache, (uint8 *)&id)==NULL && engine->persistenceStatus == After){
+				//另外的线程正在进行清理资源，wait
+				pthread_cond_wait(&engine->statusCond, &engine->statusMutex);
+				continue;
+			}
+		}
+		//磁盘上的记录是最新的
+		position = location->position;
+		if(position==0){
+			done = 1;
+			break;
+		}
+		HashEngineMapping *mapping = acquireMapping(engine, position + location->size);
+		if(mapping==NULL){
+			break;
+		}
+		uint8 *data = mapping->base + position;
+		uint32 keyLen = ntohl(*(uint32 *)(data + 8));
+		uint32 valueField = ntohl(*(uint32 *)(data + 12));
+		if(valueField & (HASH_VALUE_COMPRESSED | HASH_VALUE_BLOB)){
+			//压缩的记录不能直接借用，解压到堆上；value在blob文件中时读取到堆上
+			view.value = decodeValue(engine, valueField, data + HASH_RECORD_HEADER_SIZE + keyLen, &view.length);
+			if(view.value == NULL){
+				view.length = 0;
+			}
+			releaseMapping(mapping);
+		} else if(valueField!=0){
+			view.length = valueField;
+			view.value = data + HASH_RECORD_HEADER_SIZE + keyLen;
+			view.mapping = mapping;
+		} else {
+			releaseMapping(mapping);
+		}
+		done = 1;
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	if(!done){
+		//未开启映射读或映射失败：返回拷贝
+		Array arr = getRecordByLocation(engine, location);
+		view.value = (uint8 *)arr.array;
+		view.length = arr.length;
+	}
+	return view;
+}
+
+//按位置获取value的拷贝，开启内存映射读时直接从映射区拷贝，不经过读缓存
+static Array getValueByLocation(HashEngine *engine, RecordLocation *location){
+	if(!engine->mmapRead){
+		return getRecordByLocation(engine, location);
+	}
+	HashEngineView view = getViewByLocation(engine, location);
+	Array arr;
+	arr.array = view.value;
+	arr.length = view.length;
+	if(view.mapping!=NULL){
+		newAndCopyByteArray((uint8 **)&arr.array, view.value, view.length);
+		releaseHashEngineView(engine, &view);
+	}
+	return arr;
+}
+
+Array getHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key){
+	if(engine->partitions != NULL){
+		return getHashEngine(partitionOf(engine, keyLen, key), keyLen, key);
+	}
+	uint32 epoch = enterLocationEpoch(engine);
+	RecordLocation *location = getLocation(engine, keyLen, key);
+	Array arr = getValueByLocation(engine, location);
+	leaveLocationEpoch(engine, epoch);
+	return arr;
+}
+
+//拷贝value中的一段[offset, offset+length)，超出value长度的部分截掉
+static Array copyValueRange(uint8 *value, uint32 valueLen, uint32 offset, uint32 length){
+	Array arr;
+	arr.array = NULL;
+	arr.length = 0;
+	if(offset < valueLen){
+		arr.length = valueLen - offset < length ? valueLen - offset : length;
+		newAndCopyByteArray((uint8 **)&arr.array, value + offset, arr.length);
+	}
+	return arr;
+}
+
+//从磁盘上的记录中读取value的一段，只读取需要的字节（压缩的记录需要整体解压），需要持有fileLock读锁
+static Array loadValueRange(HashEngine *engine, uint64 position, uint32 offset, uint32 length){
+	Array arr;
+	arr.array = NULL;
+	arr.length = 0;
+	uint8 header[HASH_RECORD_HEADER_SIZE + HASH_BLOB_REF_SIZE];
+	if(pread(engine->rfd, header, HASH_RECORD_HEADER_SIZE, position) != HASH_RECORD_HEADER_SIZE){
+		return arr;
+	}
+	uint32 keyLen = ntohl(*(uint32 *)(header + 8));
+	uint32 valueField = ntohl(*(uint32 *)(header + 12));
+	uint64 valuePosition = position + HASH_RECORD_HEADER_SIZE + keyLen;
+	if(valueField & HASH_VALUE_COMPRESSED){
+		Record *record = loadRecord(engine, position, 0, NULL, NULL);
+		arr = copyValueRange(record->value, record->valueLen, offset, length);
+		freeRecord(record);
+		return arr;
+	}
+	uint32 valueLen = valueField;
+	uint8 *ref = header + HASH_RECORD_HEADER_SIZE;
+	if(valueField & HASH_VALUE_BLOB){
+		if(pread(engine->rfd, ref, HASH_BLOB_REF_SIZE, valuePosition) != HASH_BLOB_REF_SIZE){
+			return arr;
+		}
+		valueLen = ntohl(*(uint32 *)(ref + 8));
+	}
+	if(offset >= valueLen){
+		return arr;
+	}
+	uint32 len = valueLen - offset < length ? valueLen - offset : length;
+	arr.array = malloc(len + 1);
+	int ok = 0;
+	if(valueField & HASH_VALUE_BLOB){
+		ok = readBlob(engine, ref, offset, len, (uint8 *)arr.array);
+	} else {
+		ok = pread(engine->rfd, arr.array, len, valuePosition + offset) == len;
+	}
+	if(!ok){
+		//数据损坏，按不存在处理
+		free(arr.array);
+		arr.array = NULL;
+		len = 0;
+	}
+	arr.length = len;
+	return arr;
+}
+
+//按位置读取value的一段：记录在缓存中时从缓存中拷贝，否则只读取需要的字节，不放入读缓存
+static Array getRangeByLocation(HashEngine *engine, RecordLocation *location, uint32 offset, uint32 length){
+	Array arr;
+	arr.array = NULL;
+	arr.length = 0;
+	if(location==NULL){
+		return arr;
+	}
+	while(1){
+		int found = 0;
+		uint64 id = 0;
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		id = location->id;
+		if(id!=0){
+			Record *record = getCachedRecord(engine, id);
+			if(record!=NULL){
+				arr = copyValueRange(record->value, record->valueLen, offset, length);
+				found = 1;
+			} else if(engine->persistenceStatus == After){
+				//另外的线程正在进行清理资源，wait
+				pthread_cond_wait(&engine->statusCond, &engine->statusMutex);
+			}
+		}
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+		if(found){
+			return arr;
+		}
+		if(id!=0){
+			continue;
+		}
+
+		//不在内存中：从磁盘中读，不持有statusMutex
+		uint64 position = 0;
+		pthread_cleanup_push((void *)pthread_rwlock_unlock, &engine->fileLock);
+		pthread_rwlock_rdlock(&engine->fileLock);
+		position = location->position;
+		if(position!=0){
+			arr = loadValueRange(engine, position, offset, length);
+		}
+		pthread_rwlock_unlock(&engine->fileLock);
+		pthread_cleanup_pop(0);
+
+		//读盘期间记录被修改（新版本的位置可能还没有写入），丢弃读到的内容重试
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		found = location->id==0 && location->position==position;
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+		if(found){
+			return arr;
+		}
+		free(arr.array);
+		arr.array = NULL;
+		arr.length = 0;
+	}
+}
+
+Array getRangeHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key, uint32 offset, uint32 length){
+	if(engine->partitions != NULL){
+		return getRangeHashEngine(partitionOf(engine, keyLen, key), keyLen, key, offset, length);
+	}
+	uint32 epoch = enterLocationEpoch(engine);
+	RecordLocation *location = getLocation(engine, keyLen, key);
+	Array arr = getRangeByLocation(engine, location, offset, length);
+	leaveLocationEpoch(engine, epoch);
+	return arr;
+}
+
+HashEngineView getViewHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key){
+	if(engine->partitions != NULL){
+		return getViewHashEngine(partitionOf(engine, keyLen, key), keyLen, key);
+	}
+	uint32 epoch = enterLocationEpoch(engine);
+	RecordLocation *location = getLocation(engine, keyLen, key);
+	HashEngineView view = getViewByLocation(engine, location);
+	leaveLocationEpoch(engine, epoch);
+	return view;
+}
+
+void releaseHashEngineView(HashEngine *engine, HashEngineView *view){
+	if(view->mapping!=NULL){
+		//分区引擎中映射属于某个分区
+		engine = view->mapping->engine;
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		releaseMapping(view->mapping);
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+	} else {
+		free(view->value);
+	}
+	view->value = NULL;
+	view->length = 0;
+	view->mapping = NULL;
+}
+
+void setHashEngineMmapRead(HashEngine *engine, int32 enable){
+	if(engine->partitions != NULL){
+		for(uint32 i = 0; i < engine->partitionCount; i++){
+			setHashEngineMmapRead(engine->partitions[i], enable);
+		}
+		return;
+	}
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	engine->mmapRead = enable;
+	if(!enable && engine->mapping != NULL){
+		releaseMapping(engine->mapping);
+		engine->mapping = NULL;
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+}
+
+/*
+ * 游标：
+ * 1、打开时在锁中记录扫描的结束位置（已经写入完成的尺寸），并收集写缓存中未持久化的key，
+ *    这些key的最新版本不在扫描范围内，首先逐个通过getValueByLocation返回
+ * 2、然后按文件顺序扫描[文件头, end)，一条记录有效当且仅当：
+ *    key仍在内存索引中、位置就是这条记录、且没有未持久化的新版本（新版本已经在第1步返回，或者是扫描期间的修改）
+ * 游标打开期间不进行碎片整理，记录的位置不会改变；持久化只在end之后追加，不影响扫描
+ */
+
+//id对应的记录是否是未持久化的新版本，需要在statusMutex中调用
+static int isUnpersistedRecord(HashEngine *engine, uint64 id){
+	if(id == 0){
+		return 0;
+	}
+	if(getLRUCacheNoChange(engine->writeCache, (uint8 *)&id) != NULL){
+		return 1;
+	}
+	//After阶段冻结写缓存中的记录已经写入
+	return engine->persistenceStatus == Doing &&
+		   getLRUCacheNoChange(engine->freezeWriteCache, (uint8 *)&id) != NULL;
+}
+
+//收集缓存中未持久化的key，需要在statusMutex中调用
+static void collectUnpersistedKeys(HashEngine *engine, LRUCache *cache, List *keys){
+	LRUNode *node = cache->head;
+	while ((node = node->next) != cache->head){
+		Record *record = (Record *)node->value;
+		RecordLocation *location = getKeyIndex(engine->keyIndex, record->keyLen, record->key);
+		//墓碑和已经被更新的旧副本不返回
+		if(record->valueLen == 0 || location == NULL || location->id != *(uint64 *)node->key){
+			continue;
+		}
+		Array *key = (Array *)malloc(sizeof(Array));
+		newAndCopyByteArray((uint8 **)&key->array, record->key, record->keyLen);
+		key->length = record->keyLen;
+		addList(keys, key);
+	}
+}
+
+//释放当前记录中由游标分配的内存
+static void releaseCursorRecord(HashEngineCursor *cursor){
+	if(cursor->ownKey){
+		free(cursor->key);
+	}
+	if(cursor->ownValue){
+		free(cursor->value);
+	}
+	cursor->key = NULL;
+	cursor->keyLen = 0;
+	cursor->value = NULL;
+	cursor->valueLen = 0;
+	cursor->ownKey = 0;
+	cursor->ownValue = 0;
+}
+
+//保证缓冲区中从offset开始至少有need字节，超出结束位置或读取失败返回0
+static int fillCursorBuffer(HashEngineCursor *cursor, uint32 need){
+	if(cursor->bufferLen - cursor->offset >= need){
+		return 1;
+	}
+	uint64 position = cursor->bufferPosition + cursor->offset;
+	if(position + need > cursor->end){
+		return 0;
+	}
+	//剩余的不完整记录移到缓冲区头部
+	uint32 remain = cursor->bufferLen - cursor->offset;
+	memmove(cursor->buffer, cursor->buffer + cursor->offset, remain);
+	cursor->bufferPosition = position;
+	cursor->bufferLen = remain;
+	cursor->offset = 0;
+	if(need > cursor->bufferCap){
+		//超大记录，扩大缓冲区
+		cursor->bufferCap = need;
+		cursor->buffer = (uint8 *)realloc(cursor->buffer, cursor->bufferCap);
+	}
+	uint64 toRead = cursor->end - (position + remain);
+	if(toRead > cursor->bufferCap - remain){
+		toRead = cursor->bufferCap - remain;
+	}
+	while(toRead > 0){
+		ssize_t n = pread(cursor->engine->rfd, cursor->buffer + cursor->bufferLen, toRead, position + cursor->bufferLen);
+		if(n <= 0){
+			break;
+		}
+		cursor->bufferLen += n;
+		toRead -= n;
+	}
+	return cursor->bufferLen >= need;
+}
+
+//返回打开时未持久化的下一条记录
+static int32 nextUnpersistedRecord(HashEngineCursor *cursor){
+	HashEngine *engine = cursor->engine;
+	while(cursor->pendingKeys->length > 0){
+		Array *key = (Array *)removeHeadList(cursor->pendingKeys);
+		uint32 epoch = enterLocationEpoch(engine);
+		Array value = getValueByLocation(engine, getLocation(engine, key->length, key->array));
+		leaveLocationEpoch(engine, epoch);
+		if(value.length == 0){
+			//扫描期间被删除
+			free(key->array);
+			free(key);
+			continue;
+		}
+		cursor->key = (uint8 *)key->array;
+		cursor->keyLen = key->length;
+		cursor->value = (uint8 *)value.array;
+		cursor->valueLen = value.length;
+		cursor->ownKey = 1;
+		cursor->ownValue = 1;
+		free(key);
+		return 1;
+	}
+	return 0;
+}
+
+//按文件顺序返回下一条有效记录
+static int32 nextPersistedRecord(HashEngineCursor *cursor){
+	HashEngine *engine = cursor->engine;
+	while(fillCursorBuffer(cursor, HASH_RECORD_HEADER_SIZE)){
+		uint8 *header = cursor->buffer + cursor->offset;
+		uint32 keyLen = ntohl(*(uint32 *)(header + 8));
+		uint32 valueField = ntohl(*(uint32 *)(header + 12));
+		uint32 size = HASH_RECORD_HEADER_SIZE + keyLen + storedValueLen(valueField);
+		if(!fillCursorBuffer(cursor, size)){
+			break;
+		}
+		header = cursor->buffer + cursor->offset;
+		uint64 position = cursor->bufferPosition + cursor->offset;
+		cursor->offset += size;
+		if(storedValueLen(valueField) == 0){
+			//墓碑
+			continue;
+		}
+		uint8 *key = header + HASH_RECORD_HEADER_SIZE;
+		int live = 0;
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		//使用磁盘索引时不在内存索引中的key从磁盘索引查找，不加入内存索引
+		RecordLocation location;
+		live = peekLocation(engine, keyLen, key, &location) && location.position == position &&
+			   !isUnpersistedRecord(engine, location.id);
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+		if(!live){
+			continue;
+		}
+		uint8 *stored = key + keyLen;
+		cursor->key = key;
+		cursor->keyLen = keyLen;
+		if(valueField & (HASH_VALUE_COMPRESSED | HASH_VALUE_BLOB)){
+			//游标打开期间不进行碎片整理，blob文件不会切换
+			cursor->value = decodeValue(engine, valueField, stored, &cursor->valueLen);
+			if(cursor->value == NULL){
+				//数据损坏，跳过
+				cursor->valueLen = 0;
+				continue;
+			}
+			cursor->ownValue = 1;
+		} else {
+			//直接指向预读缓冲区
+			cursor->value = stored;
+			cursor->valueLen = valueField;
+		}
+		return 1;
+	}
+	return 0;
+}
+
+HashEngineCursor *openHashEngineCursor(HashEngine *engine){
+	HashEngineCursor *cursor = (HashEngineCursor *)calloc(1, sizeof(HashEngineCursor));
+	cursor->engine = engine;
+	if(engine->partitions != NULL){
+		//逐个分区扫描，下一个分区的游标在当前分区结束后打开
+		cursor->partitionIndex = 0;
+		cursor->partitionCursor = openHashEngineCursor(engine->partitions[0]);
+		return cursor;
+	}
+	cursor->pendingKeys = makeList();
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	//碎片整理会改变记录的位置，等待其完成；之后游标未关闭时不会再开始整理
+	while(engine->persistenceStatus == Compacting){
+		pthread_cond_wait(&engine->statusCond, &engine->statusMutex);
+	}
+	engine->cursorCount++;
+	cursor->end = engine->persistedSize;
+	collectUnpersistedKeys(engine, engine->writeCache, cursor->pendingKeys);
+	if(engine->persistenceStatus == Doing){
+		collectUnpersistedKeys(engine, engine->freezeWriteCache, cursor->pendingKeys);
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	cursor->bufferCap = CURSOR_BUFFER_SIZE;
+	cursor->buffer = (uint8 *)malloc(cursor->bufferCap);
+	cursor->bufferPosition = HASH_FILE_HEADER_SIZE;
+	return cursor;
+}
+
+int32 nextHashEngineCursor(HashEngineCursor *cursor){
+	releaseCursorRecord(cursor);
+	if(cursor->engine->partitions != NULL){
+		HashEngine *engine = cursor->engine;
+		while(cursor->partitionCursor != NULL){
+			HashEngineCursor *current = cursor->partitionCursor;
+			if(nextHashEngineCursor(current)){
+				//借用分区游标的记录，不转移所有权
+				cursor->key = current->key;
+				cursor->keyLen = current->keyLen;
+				cursor->value = current->value;
+				cursor->valueLen = current->valueLen;
+				return 1;
+			}
+			closeHashEngineCursor(current);
+			cursor->partitionCursor = NULL;
+			if(++cursor->partitionIndex < engine->partitionCount){
+				cursor->partitionCursor = openHashEngineCursor(engine->partitions[cursor->partitionIndex]);
+			}
+		}
+		return 0;
+	}
+	return nextUnpersistedRecord(cursor) || nextPersistedRecord(cursor);
+}
+
+void closeHashEngineCursor(HashEngineCursor *cursor){
+	HashEngine *engine = cursor->engine;
+	if(engine->partitions != NULL){
+		if(cursor->partitionCursor != NULL){
+			closeHashEngineCursor(cursor->partitionCursor);
+		}
+		free(cursor);
+		return;
+	}
+	releaseCursorRecord(cursor);
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	engine->cursorCount--;
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	for(ListNode *node = cursor->pendingKeys->head; node != NULL; node = node->next){
+		Array *key = (Array *)node->value;
+		free(key->array);
+		free(key);
+	}
+	freeList(cursor->pendingKeys);
+	free(cursor->buffer);
+	free(cursor);
+}
+
+List *getAllHashEngine(HashEngine *engine){
+	List* result = makeList();
+	HashEngineCursor *cursor = openHashEngineCursor(engine);
+	while(nextHashEngineCursor(cursor)){
+		Array* copy = malloc(sizeof(Array));
+		newAndCopyByteArray((uint8 **)&copy->array, cursor->value, cursor->valueLen);
+		copy->length = cursor->valueLen;
+		addList(result, copy);
+	}
+	closeHashEngineCursor(cursor);
+	return result;
+}
+
+Array removeHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key){
+	Array arr = getHashEngine(engine, keyLen, key);
+	if (arr.length!=0){
+		deleteHashEngine(engine, keyLen, key);
+	}
+	return arr;
+}
+
+/*
+ * 删除不读取旧记录：
+ * 读缓存中的副本直接丢弃，写缓存中的副本原地改为墓碑，否则在写缓存中创建一条墓碑
+ * 墓碑和普通记录一样持久化，持久化完成后在After阶段将key从内存索引中删除
+ */
+int32 deleteHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key){
+	if(engine->partitions != NULL){
+		return deleteHashEngine(partitionOf(engine, keyLen, key), keyLen, key);
+	}
+	uint32 epoch = enterLocationEpoch(engine);
+	RecordLocation *location = getLocation(engine, keyLen, key);
+	if(location==NULL){
+		leaveLocationEpoch(engine, epoch);
+		return 0;
+	}
+	int32 result = 1;
+	uint64 id = 0;
+	int needTombstone = 0;
+	RedoLog *redoLog = NULL;
+	uint64 seq = 0;
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	while(1){
+		id = location->id;
+		Record *record = NULL;
+		if(id==0 && !isResidentLocation(engine, location, keyLen, key)){
+			//位置已经被移出内存索引，重新查找
+			location = lookupLocation(engine, keyLen, key);
+			if(location == NULL){
+				result = 0;
+				break;
+			}
+			continue;
+		} else if(id==0){
+			//只在磁盘中
+			id = location->id = engine->idSeed++;
+			needTombstone = 1;
+		} else if((record = (Record *)removeLRUCache(engine->readCache, (uint8 *)&id)) != NULL){
+			//读缓存中的副本与磁盘一致，丢弃后沿用其id
+			freeRecord(record);
+			needTombstone = 1;
+		} else if((record = (Record *)getLRUCacheNoChange(engine->writeCache, (uint8 *)&id)) != NULL){
+			//写缓存中的副本原地改为墓碑
+			if(record->valueLen==0){
+				result = 0;
+			} else {
+				free(record->value);
+				record->value = NULL;
+				record->valueLen = 0;
+				record->version++;
+				seq = appendHashEngineRedoLog(engine, record, &redoLog);
+			}
+		} else if(engine->persistenceStatus == After){
+			//另外的线程正在进行清理资源，wait
+			pthread_cond_wait(&engine->statusCond, &engine->statusMutex);
+			continue;
+		} else {
+			//在冻结写缓存中，正在持久化，墓碑使用新的id
+			id = location->id = engine->idSeed++;
+			needTombstone = 1;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	if(!waitHashEngineRedoLog(redoLog, seq)){
+		result = 0;
+	}
+	if(needTombstone && !putToWriteCache(engine, id, makeRecord(0, keyLen, 0, key, NULL))){
+		result = 0;
+	}
+	leaveLocationEpoch(engine, epoch);
+	return result;
+}
+
+/*****************************************************************************
+ *批量操作：一个批次只加锁一次，磁盘读按文件位置排序
+ ******************************************************************************/
+
+//批量操作中需要访问磁盘的一项
+typedef struct BatchMiss
+{
+	/** 在批次中的下标 */
+	uint32 index;
+	RecordLocation *location;
+	uint64 position;
+	/** 读到的记录（批量查找）或版本号（批量插入） */
+	Record *record;
+	uint64 version;
+} BatchMiss;
+
+static int compareBatchMiss(const void *a, const void *b){
+	uint64 pa = ((const BatchMiss *)a)->position;
+	uint64 pb = ((const BatchMiss *)b)->position;
+	return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
+
+//分区引擎：按分区拆分批次，分别调用各分区的批量操作
+static int32 batchByPartition(HashEngine *engine, uint32 count, uint32 *keyLens, uint8 **keys,
+							  uint32 *valueLens, uint8 **values, Array *results){
+	uint32 *partitionIndexes = (uint32 *)malloc(sizeof(uint32) * (count + 1));
+	uint32 *indexes = (uint32 *)malloc(sizeof(uint32) * (count + 1));
+	uint32 *subKeyLens = (uint32 *)malloc(sizeof(uint32) * (count + 1));
+	uint8 **subKeys = (uint8 **)malloc(sizeof(uint8 *) * (count + 1));
+	uint32 *subValueLens = (uint32 *)malloc(sizeof(uint32) * (count + 1));
+	uint8 **subValues = (uint8 **)malloc(sizeof(uint8 *) * (count + 1));
+	Array *subResults = (Array *)malloc(sizeof(Array) * (count + 1));
+	for(uint32 i = 0; i < count; i++){
+		uint32 hash = hintChecksum(keys[i], keyLens[i]);
+		partitionIndexes[i] = ((uint64)hash * engine->partitionCount) >> 32;
+	}
+	int32 result = 0;
+	for(uint32 p = 0; p < engine->partitionCount; p++){
+		uint32 n = 0;
+		for(uint32 i = 0; i < count; i++){
+			if(partitionIndexes[i] != p){
+				continue;
+			}
+			indexes[n] = i;
+			subKeyLens[n] = keyLens[i];
+			subKeys[n] = keys[i];
+			if(values != NULL){
+				subValueLens[n] = valueLens[i];
+				subValues[n] = values[i];
+			}
+			n++;
+		}
+		if(n == 0){
+			continue;
+		}
+		if(results != NULL){
+			result += getBatchHashEngine(engine->partitions[p], n, subKeyLens, subKeys, subResults);
+			for(uint32 j = 0; j < n; j++){
+				results[indexes[j]] = subResults[j];
+			}
+		} else {
+			result += putBatchHashEngine(engine->partitions[p], n, subKeyLens, subKeys, subValueLens, subValues);
+		}
+	}
+	free(partitionIndexes);
+	free(indexes);
+	free(subKeyLens);
+	free(subKeys);
+	free(subValueLens);
+	free(subValues);
+	free(subResults);
+	return result;
+}
+
+/*
+ * 批量查找：
+ * 1、加锁一次，从各级缓存中查找，记下需要读磁盘的项
+ * 2、不持有statusMutex，按位置排序后依次读磁盘（开启映射读时从映射区拷贝）
+ * 3、加锁一次，将读到的记录放入读缓存；读盘期间被修改的项退化为单个查找
+ */
+int32 getBatchHashEngine(HashEngine *engine, uint32 count, uint32 *keyLens, uint8 **keys, Array *values){
+	if(engine->partitions != NULL){
+		return batchByPartition(engine, count, keyLens, keys, NULL, NULL, values);
+	}
+	uint32 epoch = enterLocationEpoch(engine);
+	BatchMiss *misses = (BatchMiss *)malloc(sizeof(BatchMiss) * (count + 1));
+	RecordLocation **locations = (RecordLocation **)malloc(sizeof(RecordLocation *) * (count + 1));
+	uint8 *retry = (uint8 *)calloc(count + 1, 1);
+	uint32 missCount = 0;
+	int32 found = 0;
+	HashEngineMapping *mapping = NULL;
+	uint64 mapEnd = 0;
+	for(uint32 i = 0; i < count; i++){
+		prefetchLocation(engine, keyLens[i], keys[i]);
+	}
+
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	for(uint32 i = 0; i < count; i++){
+		values[i].array = NULL;
+		values[i].length = 0;
+		RecordLocation *location = lookupLocation(engine, keyLens[i], keys[i]);
+		locations[i] = location;
+		if(location == NULL){
+			continue;
+		}
+		Record *record = NULL;
+		if(location->id != 0 && (record = getCachedRecord(engine, location->id)) != NULL){
+			newAndCopyByteArray((uint8 **)&values[i].array, record->value, record->valueLen);
+			values[i].length = record->valueLen;
+		} else if(location->id == 0 && location->position != 0){
+			misses[missCount].index = i;
+			misses[missCount].location = location;
+			misses[missCount].position = location->position;
+			misses[missCount].record = NULL;
+			missCount++;
+			if(location->position + location->size > mapEnd){
+				mapEnd = location->position + location->size;
+			}
+		} else if(location->id != 0){
+			//正在进行持久化的清理工作
+			retry[i] = 1;
+		}
+	}
+	if(engine->mmapRead && missCount > 0){
+		mapping = acquireMapping(engine, mapEnd);
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+
+	qsort(misses, missCount, sizeof(BatchMiss), compareBatchMiss);
+	if(mapping != NULL){
+		//映射区中的记录不会被修改，直接拷贝，不放入读缓存
+		for(uint32 m = 0; m < missCount; m++){
+			uint8 *data = mapping->base + misses[m].position;
+			uint32 keyLen = ntohl(*(uint32 *)(data + 8));
+			uint32 valueField = ntohl(*(uint32 *)(data + 12));
+			if(valueField & HASH_VALUE_BLOB){
+				//映射可能属于碎片整理之前的文件，其中的blob引用不一定对应当前的blob文件，单独查找
+				retry[misses[m].index] = 1;
+				continue;
+			}
+			uint32 valueLen = 0;
+			Array *value = &values[misses[m].index];
+			value->array = decodeValue(engine, valueField, data + HASH_RECORD_HEADER_SIZE + keyLen, &valueLen);
+			value->length = value->array == NULL ? 0 : valueLen;
+		}
+	} else if(missCount > 0){
+		pthread_cleanup_push((void *)pthread_rwlock_unlock, &engine->fileLock);
+		pthread_rwlock_rdlock(&engine->fileLock);
+		for(uint32 m = 0; m < missCount; m++){
+			//位置可能被碎片整理修改，在读锁中重新获取
+			misses[m].position = misses[m].location->position;
+			misses[m].record = loadRecord(engine, misses[m].position, 0, NULL, NULL);
+		}
+		pthread_rwlock_unlock(&engine->fileLock);
+		pthread_cleanup_pop(0);
+	}
+
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	for(uint32 m = 0; m < missCount && mapping == NULL; m++){
+		RecordLocation *location = misses[m].location;
+		Record *record = misses[m].record;
+		if(location->id == 0 && location->position == misses[m].position){
+			Array *value = &values[misses[m].index];
+			newAndCopyByteArray((uint8 **)&value->array, record->value, record->valueLen);
+			value->length = record->valueLen;
+			if(isResidentLocation(engine, location, record->keyLen, record->key)){
+				location->id = engine->idSeed++;
+				putToReadCache(engine, location->id, record);
+			} else {
+				freeRecord(record);
+			}
+		} else {
+			freeRecord(record);
+			retry[misses[m].index] = 1;
+		}
+	}
+	if(mapping != NULL){
+		releaseMapping(mapping);
+	}
+	limitResidentLocations(engine);
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+
+	for(uint32 i = 0; i < count; i++){
+		if(retry[i]){
+			values[i] = getValueByLocation(engine, locations[i]);
+		}
+		found += values[i].length != 0;
+	}
+	free(misses);
+	free(locations);
+	free(retry);
+	leaveLocationEpoch(engine, epoch);
+	return found;
+}
+
+//读取磁盘上记录的版本号
+static uint64 loadRecordVersion(int rfd, uint64 position){
+	uint64 version = 0;
+	pread(rfd, &version, 8, position);
+	return ntohll(version);
+}
+
+/*
+ * 批量插入或更新：
+ * 1、加锁一次，找出只在磁盘中的项，不持有statusMutex按位置排序读取其版本号
+ * 2、加锁一次，按顺序处理每一项，与putHashEngine相同地修改各级缓存
+ * 3、写缓存满或者状态不允许时，剩余的项依次调用putHashEngine（保持同一个key的先后顺序）
+ */
+int32 putBatchHashEngine(HashEngine *engine, uint32 count, uint32 *keyLens, uint8 **keys, uint32 *valueLens, uint8 **values){
+	if(engine->partitions != NULL){
+		return batchByPartition(engine, count, keyLens, keys, valueLens, values, NULL);
+	}
+	uint32 epoch = enterLocationEpoch(engine);
+	BatchMiss *misses = (BatchMiss *)malloc(sizeof(BatchMiss) * (count + 1));
+	uint32 missCount = 0;
+	for(uint32 i = 0; i < count; i++){
+		prefetchLocation(engine, keyLens[i], keys[i]);
+	}
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	for(uint32 i = 0; i < count; i++){
+		RecordLocation *location = lookupLocation(engine, keyLens[i], keys[i]);
+		if(location != NULL && location->id == 0 && location->position != 0){
+			misses[missCount].index = i;
+			misses[missCount].location = location;
+			misses[missCount].position = location->position;
+			missCount++;
+		}
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+
+	qsort(misses, missCount, sizeof(BatchMiss), compareBatchMiss);
+	pthread_cleanup_push((void *)pthread_rwlock_unlock, &engine->fileLock);
+	pthread_rwlock_rdlock(&engine->fileLock);
+	for(uint32 m = 0; m < missCount; m++){
+		misses[m].position = misses[m].location->position;
+		misses[m].version = loadRecordVersion(engine->rfd, misses[m].position);
+	}
+	pthread_rwlock_unlock(&engine->fileLock);
+	pthread_cleanup_pop(0);
+	//恢复为批次中的顺序，便于按下标查找
+	uint64 *diskVersions = (uint64 *)calloc(count + 1, sizeof(uint64));
+	uint64 *diskPositions = (uint64 *)calloc(count + 1, sizeof(uint64));
+	for(uint32 m = 0; m < missCount; m++){
+		diskVersions[misses[m].index] = misses[m].version;
+		diskPositions[misses[m].index] = misses[m].position;
+	}
+	free(misses);
+
+	uint32 done = 0;
+	RedoLog *redoLog = NULL;
+	uint64 seq = 0;
+	uint32 logged = 0;
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	for(; done < count; done++){
+		uint32 keyLen = keyLens[done];
+		uint8 *key = keys[done];
+		if(engine->writeCache->size >= engine->writeCache->capacity ||
+		   (engine->diskIndex != NULL && keyLen > DISK_INDEX_MAX_KEY_SIZE) || valueLens[done] > HASH_VALUE_MAX_SIZE){
+			break;
+		}
+		//读取版本号期间位置可能被移出内存索引，重新查找
+		RecordLocation *location = lookupLocation(engine, keyLen, key);
+		Record *record = NULL;
+		if(location == NULL){
+			location = putKeyIndex(engine->keyIndex, keyLen, key);
+			location->id = engine->idSeed++;
+			record = makeRecord(1, keyLen, valueLens[done], key, values[done]);
+			putLRUCache(engine->writeCache, (uint8 *)&location->id, record);
+		} else if(location->id == 0){
+			if(location->position == 0 || location->position != diskPositions[done]){
+				//读取版本号之后记录被持久化或移动，没有读取到对应的版本号
+				break;
+			}
+			location->id = engine->idSeed++;
+			record = makeRecord(diskVersions[done] + 1, keyLen, valueLens[done], key, values[done]);
+			putLRUCache(engine->writeCache, (uint8 *)&location->id, record);
+		} else if((record = (Record *)removeLRUCache(engine->readCache, (uint8 *)&location->id)) != NULL){
+			free(record->value);
+			newAndCopyByteArray(&record->value, values[done], valueLens[done]);
+			record->valueLen = valueLens[done];
+			record->version++;
+			putLRUCache(engine->writeCache, (uint8 *)&location->id, record);
+		} else if((record = (Record *)getLRUCacheNoChange(engine->writeCache, (uint8 *)&location->id)) != NULL){
+			free(record->value);
+			newAndCopyByteArray(&record->value, values[done], valueLens[done]);
+			record->valueLen = valueLens[done];
+			record->version++;
+		} else if(engine->persistenceStatus == Doing &&
+				  (record = (Record *)getLRUCacheNoChange(engine->freezeWriteCache, (uint8 *)&location->id)) != NULL){
+			location->id = engine->idSeed++;
+			record = makeRecord(record->version + 1, keyLen, valueLens[done], key, values[done]);
+			putLRUCache(engine->writeCache, (uint8 *)&location->id, record);
+		} else {
+			//正在进行持久化的清理工作
+			break;
+		}
+		seq = appendHashEngineRedoLog(engine, record, &redoLog);
+		logged++;
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	free(diskVersions);
+	free(diskPositions);
+	//整个批次等待一次日志同步（每次追加都需要对应一次waitRedoLog），日志写入失败时这些修改都不计入成功数目
+	int32 durable = 1;
+	for(uint32 i = 0; i < logged; i++){
+		durable = waitHashEngineRedoLog(redoLog, seq) && durable;
+	}
+	limitResidentLocations(engine);
+	leaveLocationEpoch(engine, epoch);
+
+	int32 result = durable ? done : 0;
+	for(; done < count; done++){
+		result += putHashEngine(engine, keyLens[done], keys[done], valueLens[done], values[done]);
+	}
+	return result;
+}
+
+/*****************************************************************************
+ *碎片整理：拷贝有效记录到新文件，原子替换
+ ******************************************************************************/
+
+//碎片整理时一条有效记录的快照
+typedef struct CompactionItem
+{
+	RecordLocation *location;
+	uint64 position;
+	uint32 size;
+	uint32 blobSize;
+} CompactionItem;
+
+static void *collectCompactionItem(uint32 keyLen, uint8 *key, RecordLocation *location, void *args){
+	List *items = (List *)args;
+	//position为0说明只在写缓存中，下次持久化时写入新文件
+	if(location->position==0){
+		return NULL;
+	}
+	CompactionItem *item = (CompactionItem *)malloc(sizeof(CompactionItem));
+	item->location = location;
+	item->position = location->position;
+	item->size = location->size;
+	item->blobSize = location->blobSize;
+	addList(items, item);
+	return NULL;
+}
+
+static int compareCompactionItem(const void *a, const void *b){
+	uint64 pa = (*(CompactionItem **)a)->position;
+	uint64 pb = (*(CompactionItem **)b)->position;
+	return pa < pb ? -1 : (pa > pb ? 1 : 0);
+}
+
+//碎片整理时将记录引用的blob拷贝到新blob文件的newBlobPosition处，并修改记录中的引用
+static int copyBlob(HashEngine *engine, uint8 *record, int newBlobFd, uint64 *newBlobPosition, uint8 *buffer){
+	uint8 *ref = record + HASH_RECORD_HEADER_SIZE + ntohl(*(uint32 *)(record + 8));
+	uint64 position = ntohll(*(uint64 *)ref);
+	uint32 len = ntohl(*(uint32 *)(ref + 8));
+	for(uint32 done = 0; done < len;){
+		uint32 n = len - done < COMPACTION_BUFFER_SIZE ? len - done : COMPACTION_BUFFER_SIZE;
+		if(pread(engine->blobFd, buffer, n, position + done) != n ||
+		   !pwriteFully(newBlobFd, buffer, n, *newBlobPosition + done)){
+			return 0;
+		}
+		done += n;
+	}
+	*(uint64 *)ref = htonll(*newBlobPosition);
+	*newBlobPosition += len;
+	return 1;
+}
+
+//空间放大倍数（数据文件和blob文件合计），需要在statusMutex中调用
+static double spaceAmplificationOf(HashEngine *engine){
+	return (double)(engine->fileSize + engine->blobFileSize) /
+		   (double)(engine->liveSize + engine->blobLiveSize + HASH_FILE_HEADER_SIZE);
+}
+
+//是否需要自动碎片整理，需要在statusMutex中调用
+static int shouldCompactHashEngine(HashEngine *engine){
+	return engine->compactionThreshold > 0 &&
+		   engine->cursorCount == 0 &&
+		   engine->fileSize + engine->blobFileSize >= engine->compactionMinSize &&
+		   spaceAmplificationOf(engine) >= engine->compactionThreshold;
+}
+
+//创建碎片整理的新文件：先创建数据文件，再创建blob文件（有blob文件时），加载时据此判断上次切换是否完成
+static int createCompactionFiles(HashEngine *engine, int *newBlobFd){
+	unlink(engine->newBlobFilename);
+	unlink(engine->newIndexFilename);
+	unlink(engine->newFilename);
+	*newBlobFd = -1;
+	engine->newrfd = createHashFile(engine->newFilename);
+	if(engine->newrfd == -1){
+		return 0;
+	}
+	writeMetadata(engine->newrfd, fileFlagsOf(engine));
+	//有blob文件时，有效记录引用的blob拷贝到新blob文件，旧blob文件中的垃圾随之回收
+	if(engine->blobFd != -1){
+		*newBlobFd = createHashFile(engine->newBlobFilename);
+		if(*newBlobFd == -1){
+			close(engine->newrfd);
+			engine->newrfd = -1;
+			unlink(engine->newFilename);
+			return 0;
+		}
+	}
+	return 1;
+}
+
+//删除碎片整理的新文件：先删除blob文件和磁盘索引，保证它们存在时新数据文件一定存在或已经切换
+static void abortCompaction(HashEngine *engine, int newBlobFd){
+	if(newBlobFd != -1){
+		close(newBlobFd);
+		unlink(engine->newBlobFilename);
+	}
+	unlink(engine->newIndexFilename);
+	close(engine->newrfd);
+	engine->newrfd = -1;
+	unlink(engine->newFilename);
+}
+
+//数据文件重命名之后切换到新文件，需要持有statusMutex和fileLock写锁
+static void switchCompactionFiles(HashEngine *engine, int newBlobFd, uint64 newFileSize, uint64 newBlobFileSize){
+	close(engine->wfd);
+	if(engine->rfd != engine->wfd){
+		close(engine->rfd);
 	}
-	//写缓存中有
-	//防止出现在写writeCache时发生写缓存切换
-	if(record==NULL){
+	//当前映射指向旧文件，已借出的视图仍可访问旧文件内容，之后的读取重新映射新文件
+	if(engine->mapping != NULL){
+		releaseMapping(engine->mapping);
+		engine->mapping = NULL;
+	}
+	engine->wfd = engine->newrfd;
+	engine->rfd = engine->newrfd;
+	engine->newrfd = -1;
+	engine->fileSize = newFileSize;
+	engine->persistedSize = newFileSize;
+	engine->liveSize = newFileSize - HASH_FILE_HEADER_SIZE;
+	if(newBlobFd != -1){
+		//数据文件已经切换，blob文件重命名之前崩溃时，加载时完成重命名
+		rename(engine->newBlobFilename, engine->blobFilename);
+		close(engine->blobFd);
+		engine->blobFd = newBlobFd;
+		engine->blobFileSize = newBlobFileSize;
+		engine->blobLiveSize = newBlobFileSize;
+	}
+	engine->compactionCount++;
+}
+
+//切换磁盘索引后修正内存索引中的位置，新文件中没有的key（位置指向墓碑）改为只在写缓存中
+static void *relocateResidentLocation(uint32 keyLen, uint8 *key, RecordLocation *location, void *args){
+	DiskIndexValue value;
+	if(location->position == 0){
+		return NULL;
+	}
+	if(getDiskIndex((DiskIndex *)args, keyLen, key, &value) == 1){
+		location->position = value.position;
+		location->size = value.size;
+		location->blobSize = value.blobSize;
+	} else {
+		location->position = 0;
+		location->size = 0;
+		location->blobSize = 0;
+	}
+	return NULL;
+}
+
+/*
+ * 使用磁盘索引时的碎片整理：内存索引中只有部分key，不能对有效记录的位置做快照，
+ * 而是使用游标的预读缓冲区按文件顺序扫描旧数据文件，在statusMutex中确认每条记录是否有效，
+ * 有效记录拷贝到新文件并插入新的磁盘索引${filename}.index.compact，与新文件一起同步后切换
+ */
+static int32 doDiskIndexCompaction(HashEngine *engine){
+	int newBlobFd = -1;
+	if(!createCompactionFiles(engine, &newBlobFd)){
+		return 0;
+	}
+	DiskIndex *newIndex = makeDiskIndex(engine->newIndexFilename, engine->diskIndex->pages->capacity);
+	if(newIndex == NULL){
+		abortCompaction(engine, newBlobFd);
+		return 0;
+	}
+	HashEngineCursor scan;
+	memset(&scan, 0, sizeof(scan));
+	scan.engine = engine;
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	scan.end = engine->persistedSize;
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	scan.bufferCap = CURSOR_BUFFER_SIZE;
+	scan.buffer = (uint8 *)malloc(scan.bufferCap);
+	scan.bufferPosition = HASH_FILE_HEADER_SIZE;
+
+	uint8 *buffer = (uint8 *)malloc(COMPACTION_BUFFER_SIZE);
+	uint8 *blobBuffer = newBlobFd == -1 ? NULL : (uint8 *)malloc(COMPACTION_BUFFER_SIZE);
+	uint64 used = 0;
+	uint64 newPosition = HASH_FILE_HEADER_SIZE;
+	uint64 newBlobPosition = 0;
+	int ok = 1;
+	while(ok && fillCursorBuffer(&scan, HASH_RECORD_HEADER_SIZE)){
+		uint8 *header = scan.buffer + scan.offset;
+		uint32 keyLen = ntohl(*(uint32 *)(header + 8));
+		uint32 valueField = ntohl(*(uint32 *)(header + 12));
+		uint32 size = HASH_RECORD_HEADER_SIZE + keyLen + storedValueLen(valueField);
+		if(!fillCursorBuffer(&scan, size)){
+			//已经写入完成的范围内不应该有不完整的记录
+			ok = 0;
+			break;
+		}
+		header = scan.buffer + scan.offset;
+		uint64 position = scan.bufferPosition + scan.offset;
+		scan.offset += size;
+		if(storedValueLen(valueField) == 0){
+			//墓碑：key已经从磁盘索引中删除，不需要拷贝
+			continue;
+		}
+		uint8 *key = header + HASH_RECORD_HEADER_SIZE;
+		int live = 0;
+		RecordLocation location;
 		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
 		pthread_mutex_lock(&engine->statusMutex);
-		if ((record = (Record *)removeLRUCache(engine->writeCache, (uint8 *)&location->id)) != NULL)
-		{
-			free(record->value);
-			record->version++;
-			record->valueLen = valueLen;
-			record->value = copyValue;
-		}
+		live = peekLocation(engine, keyLen, key, &location) && location.position == position;
 		pthread_mutex_unlock(&engine->statusMutex);
 		pthread_cleanup_pop(0);
+		if(!live){
+			continue;
+		}
+		if(used + size > COMPACTION_BUFFER_SIZE){
+			ok = pwriteFully(engine->newrfd, buffer, used, newPosition - used);
+			used = 0;
+		}
+		uint8 *data = NULL;
+		if(size > COMPACTION_BUFFER_SIZE){
+			//超大记录单独拷贝
+			data = (uint8 *)malloc(size);
+		} else {
+			data = buffer + used;
+			used += size;
+		}
+		memcpy(data, header, size);
+		if(ok && location.blobSize > 0){
+			ok = copyBlob(engine, data, newBlobFd, &newBlobPosition, blobBuffer);
+		}
+		if(size > COMPACTION_BUFFER_SIZE){
+			ok = ok && pwriteFully(engine->newrfd, data, size, newPosition);
+			free(data);
+		}
+		DiskIndexValue value = {newPosition, size, location.blobSize};
+		putDiskIndex(newIndex, keyLen, key, &value);
+		newPosition += size;
 	}
-	//读缓存、写缓存都没有，说明在freezewritecache中
-	if(record==NULL){
+	ok = ok && pwriteFully(engine->newrfd, buffer, used, newPosition - used);
+	ok = ok && (newBlobFd == -1 || fsync(newBlobFd) == 0);
+	ok = ok && fsync(engine->newrfd) == 0;
+	uint64 userData[DISK_INDEX_USER_DATA_COUNT] = {newPosition, newPosition - HASH_FILE_HEADER_SIZE, newBlobPosition, 0};
+	ok = ok && syncDiskIndex(newIndex, userData);
+	free(scan.buffer);
+	free(buffer);
+	free(blobBuffer);
+
+	//切换文件：持有写锁，保证没有线程正在读旧文件
+	if(ok){
 		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
 		pthread_mutex_lock(&engine->statusMutex);
-		if(engine->persistenceStatus == None){
-			//出错
-			return 0;
-		} else if(engine->persistenceStatus == Doing){
-			//另外的进程正在进行持久化
-			if ((record = (Record *)getLRUCacheNoChange(engine->freezeWriteCache, (uint8 *)&location->id)) != NULL)
-			{
-				//重新创建一个记录
-				record = makeRecord(record->version+1, record->keyLen, valueLen, record->key, value);
-				//更新id
-				location->id = engine->idSeed++;
-			}
-		} else if(engine->persistenceStatus == After){
-			//另外的线程正在进行清理内存，wait
-			pthread_cond_wait(&engine->statusCond, &engine->statusMutex);
+		pthread_rwlock_wrlock(&engine->fileLock);
+		//旧磁盘索引指向旧数据文件的位置，先标记为未同步；数据文件切换之后崩溃时，加载时完成磁盘索引的重命名
+		//压缩设置可能在碎片整理期间被修改，切换之前按当前设置重写新文件的文件头
+		ok = writeMetadata(engine->newrfd, fileFlagsOf(engine)) &&
+			 markDirtyDiskIndex(engine->diskIndex) && rename(engine->newFilename, engine->filename) == 0;
+		if(ok){
+			rename(engine->newIndexFilename, engine->indexFilename);
+			foreachKeyIndex(engine->keyIndex, relocateResidentLocation, newIndex);
+			freeDiskIndex(engine->diskIndex);
+			engine->diskIndex = newIndex;
+			newIndex = NULL;
+			switchCompactionFiles(engine, newBlobFd, newPosition, newBlobPosition);
+			newBlobFd = -1;
 		}
+		pthread_rwlock_unlock(&engine->fileLock);
 		pthread_mutex_unlock(&engine->statusMutex);
 		pthread_cleanup_pop(0);
 	}
-	//将这个记录写入writecache
-	if(record!=NULL){
-		putToWriteCache(engine, location->id, record);
-		return 1;
+	if(newIndex != NULL){
+		freeDiskIndex(newIndex);
 	}
-	//说明持久化线程已经完成，递归调用
-	return putHashEngine(engine, keyLen, key, valueLen, value);
+	if(!ok){
+		abortCompaction(engine, newBlobFd);
+	}
+	return ok;
 }
 
-static Array getRecordByLocation(HashEngine *engine, RecordLocation *location){
-	Array arr;
-	arr.array = NULL;
-	arr.length = 0;
-
-	Record *record = NULL;
-
-	if(location==NULL){
-		return arr;
+//执行碎片整理，调用时persistenceStatus必须为Compacting，此时持久化线程不会修改数据文件
+static int32 doCompaction(HashEngine *engine){
+	if(engine->diskIndex != NULL){
+		return doDiskIndexCompaction(engine);
+	}
+	//1、创建新文件
+	int newBlobFd = -1;
+	if(!createCompactionFiles(engine, &newBlobFd)){
+		return 0;
 	}
 
-	//不在内存中：从磁盘中读
-	if(location->id==0){
-		record = loadRecord(engine->rfd, location->position, 0);
-		location->id = engine->idSeed++;
-		putToReadCache(engine, location->id, record);
+	//2、对有效记录的位置做快照，按照旧位置排序，使读取为顺序读
+	List *items = makeList();
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	foreachKeyIndex(engine->keyIndex, collectCompactionItem, items);
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	uint64 count = items->length;
+	CompactionItem **sorted = (CompactionItem **)malloc(sizeof(CompactionItem *) * (count + 1));
+	ListNode *listNode = items->head;
+	for(uint64 i = 0; i < count; i++, listNode = listNode->next){
+		sorted[i] = (CompactionItem *)listNode->value;
 	}
+	qsort(sorted, count, sizeof(CompactionItem *), compareCompactionItem);
 
-	//从内存中读
-	//从工作缓存中读
-	if(record==NULL){
-		record = (Record *)getLRUCache(engine->readCache, (uint8*)&location->id);
+	//同时生成新文件对应的提示文件
+	char *hintTmpFilename = (char *)malloc(strlen(engine->hintFilename) + 10);
+	sprintf(hintTmpFilename, "%s.compact", engine->hintFilename);
+	int hintTmpFd = createHintFile(hintTmpFilename);
+	HintWriter hintWriter;
+	initHintWriter(&hintWriter, hintTmpFd, HASH_FILE_HEADER_SIZE, 1);
+
+	//3、拷贝记录，读使用pread不影响其他线程的文件偏移
+	uint64 *newPositions = (uint64 *)malloc(sizeof(uint64) * (count + 1));
+	uint8 *buffer = (uint8 *)malloc(COMPACTION_BUFFER_SIZE);
+	uint8 *blobBuffer = newBlobFd == -1 ? NULL : (uint8 *)malloc(COMPACTION_BUFFER_SIZE);
+	uint64 used = 0;
+	uint64 newPosition = HASH_FILE_HEADER_SIZE;
+	uint64 newBlobPosition = 0;
+	int ok = 1;
+	for(uint64 i = 0; i < count && ok; i++){
+		CompactionItem *item = sorted[i];
+		if(used + item->size > COMPACTION_BUFFER_SIZE){
+			ok = pwriteFully(engine->newrfd, buffer, used, newPosition - used);
+			used = 0;
+		}
+		uint8 *data = NULL;
+		if(item->size > COMPACTION_BUFFER_SIZE){
+			//超大记录单独拷贝
+			data = (uint8 *)malloc(item->size);
+		} else {
+			data = buffer + used;
+			used += item->size;
+		}
+		ok = ok && pread(engine->rfd, data, item->size, item->position) == item->size;
+		if(ok && item->blobSize > 0){
+			//value在blob文件中：拷贝blob，记录中的引用改为新blob文件中的位置
+			ok = copyBlob(engine, data, newBlobFd, &newBlobPosition, blobBuffer);
+		}
+		if(item->size > COMPACTION_BUFFER_SIZE){
+			ok = ok && pwriteFully(engine->newrfd, data, item->size, newPosition);
+		}
+		if(ok && hintTmpFd != -1){
+			appendHintEntry(&hintWriter, ntohll(*(uint64 *)data), newPosition, item->size, item->blobSize,
+							ntohl(*(uint32 *)(data + 8)), data + HASH_RECORD_HEADER_SIZE);
+		}
+		if(item->size > COMPACTION_BUFFER_SIZE){
+			free(data);
+		}
+		newPositions[i] = newPosition;
+		newPosition += item->size;
 	}
-	if(record==NULL){
+	ok = ok && pwriteFully(engine->newrfd, buffer, used, newPosition - used);
+	ok = ok && (newBlobFd == -1 || fsync(newBlobFd) == 0);
+	ok = ok && fsync(engine->newrfd) == 0;
+	free(buffer);
+	free(blobBuffer);
+	if(hintTmpFd != -1){
+		finishHintWriter(&hintWriter, 1);
+	} else {
+		free(hintWriter.buffer);
+	}
+
+	//4、切换文件：持有写锁，保证没有线程正在读旧文件
+	if(ok){
 		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
 		pthread_mutex_lock(&engine->statusMutex);
-		record = (Record *)getLRUCache(engine->writeCache, (uint8*)&location->id);
+		pthread_rwlock_wrlock(&engine->fileLock);
+		//旧提示文件指向旧数据文件的位置，必须先删除，若在切换提示文件之前崩溃，加载时将全量扫描
+		unlink(engine->hintFilename);
+		//压缩设置可能在碎片整理期间被修改，切换之前按当前设置重写新文件的文件头
+		ok = writeMetadata(engine->newrfd, fileFlagsOf(engine)) && rename(engine->newFilename, engine->filename) == 0;
+		if(ok){
+			if(engine->hintFd != -1){
+				close(engine->hintFd);
+				engine->hintFd = -1;
+			}
+			if(hintTmpFd != -1 && rename(hintTmpFilename, engine->hintFilename) == 0){
+				engine->hintFd = hintTmpFd;
+				engine->hintEntryCount = count;
+				hintTmpFd = -1;
+			}
+			for(uint64 i = 0; i < count; i++){
+				sorted[i]->location->position = newPositions[i];
+			}
+			switchCompactionFiles(engine, newBlobFd, newPosition, newBlobPosition);
+			newBlobFd = -1;
+		}
+		pthread_rwlock_unlock(&engine->fileLock);
 		pthread_mutex_unlock(&engine->statusMutex);
 		pthread_cleanup_pop(0);
 	}
+	if(!ok){
+		abortCompaction(engine, newBlobFd);
+	}
+	if(hintTmpFd != -1){
+		close(hintTmpFd);
+		unlink(hintTmpFilename);
+	}
+	free(hintTmpFilename);
+
+	for(uint64 i = 0; i < count; i++){
+		free(sorted[i]);
+	}
+	free(sorted);
+	free(newPositions);
+	freeList(items);
+	return ok;
+}
+
+void setHashEngineCompaction(HashEngine *engine, double threshold, uint64 minFileSize){
+	if(engine->partitions != NULL){
+		for(uint32 i = 0; i < engine->partitionCount; i++){
+			setHashEngineCompaction(engine->partitions[i], threshold, minFileSize);
+		}
+		return;
+	}
 	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
 	pthread_mutex_lock(&engine->statusMutex);
-	//说明在freezeWriteCache中
-	if(record==NULL){
-		if(engine->persistenceStatus == Doing){
-			record = (Record *)getLRUCacheNoChange(engine->freezeWriteCache, (uint8 *)&location->id);
-		} else if(engine->persistenceStatus == After){
-			//另外的线程正在进行清理资源，wait
-			pthread_cond_wait(&engine->statusCond, &engine->statusMutex);
+	engine->compactionThreshold = threshold;
+	engine->compactionMinSize = minFileSize;
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+}
+
+static void *countPersistedLocation(uint32 keyLen, uint8 *key, RecordLocation *location, void *args){
+	if(location->position != 0){
+		(*(uint64 *)args)++;
+	}
+	return NULL;
+}
+
+HashEngineSpaceStats getHashEngineSpaceStats(HashEngine *engine){
+	HashEngineSpaceStats stats;
+	if(engine->partitions != NULL){
+		//汇总各分区
+		memset(&stats, 0, sizeof(stats));
+		for(uint32 i = 0; i < engine->partitionCount; i++){
+			HashEngineSpaceStats partial = getHashEngineSpaceStats(engine->partitions[i]);
+			stats.fileSize += partial.fileSize;
+			stats.liveSize += partial.liveSize;
+			stats.liveCount += partial.liveCount;
+			stats.compactionCount += partial.compactionCount;
+			stats.blobFileSize += partial.blobFileSize;
+			stats.blobLiveSize += partial.blobLiveSize;
+			stats.flushErrorCount += partial.flushErrorCount;
 		}
+		stats.spaceAmplification = (double)(stats.fileSize + stats.blobFileSize) /
+								   (double)(stats.liveSize + stats.blobLiveSize + (uint64)HASH_FILE_HEADER_SIZE * engine->partitionCount);
+		return stats;
 	}
-	//以下代码也需要在临界区内，防止来自freezeWriteCache的record被释放
-	if(record!=NULL){
-		newAndCopyByteArray((uint8**)&arr.array, record->value, record->valueLen);
-		arr.length = record->valueLen;
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	stats.fileSize = engine->fileSize;
+	stats.liveSize = engine->liveSize;
+	stats.liveCount = 0;
+	if(engine->diskIndex != NULL){
+		//磁盘索引中为所有已经持久化的key
+		stats.liveCount = engine->diskIndex->count;
+	} else {
+		foreachKeyIndex(engine->keyIndex, countPersistedLocation, &stats.liveCount);
 	}
+	stats.spaceAmplification = spaceAmplificationOf(engine);
+	stats.compactionCount = engine->compactionCount;
+	stats.blobFileSize = engine->blobFileSize;
+	stats.blobLiveSize = engine->blobLiveSize;
+	stats.flushErrorCount = engine->flushErrorCount;
 	pthread_mutex_unlock(&engine->statusMutex);
 	pthread_cleanup_pop(0);
-	if(record!=NULL){
-		return arr;
+	return stats;
+}
+
+int32 compactHashEngine(HashEngine *engine){
+	if(engine->partitions != NULL){
+		int32 result = 1;
+		for(uint32 i = 0; i < engine->partitionCount; i++){
+			result = compactHashEngine(engine->partitions[i]) && result;
+		}
+		return result;
+	}
+	//等待持久化完成，并阻止新的持久化开始；有未关闭的游标时不整理
+	int32 blocked = 0;
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	while(engine->persistenceStatus != None){
+		pthread_cond_wait(&engine->statusCond, &engine->statusMutex);
+	}
+	blocked = engine->cursorCount > 0;
+	if(!blocked){
+		engine->persistenceStatus = Compacting;
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	if(blocked){
+		return 0;
 	}
-	return getRecordByLocation(engine, location);
+
+	int32 result = doCompaction(engine);
+
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	engine->persistenceStatus = None;
+	pthread_cond_broadcast(&engine->statusCond);
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	return result;
 }
 
-Array getHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key){
-	RecordLocation *location = (RecordLocation *)getHashMap(engine->hashMap, keyLen, key);
-	return getRecordByLocation(engine, location);
-}
-
-void *eachLocationReadRecord(struct Entry *entry, void *args){
-	HashEngine *engine = (HashEngine *)((void **)args)[0];
-	List *result = (List*) ((void**)args)[1];
-	RecordLocation *location = (RecordLocation*)entry->value;
-	Array record = getRecordByLocation(engine, location);
-	Array* copy = malloc(sizeof(Array));
-	copy->length = record.length;
-	copy->array = record.array;
-	addList(result, copy);
-	return NULL;
+/*****************************************************************************
+ *线程处理函数
+ ******************************************************************************/
+
+void setHashEngineFlushPolicy(HashEngine *engine, enum HashEngineDurability durability, uint32 flushBatchSize){
+	if(engine->partitions != NULL){
+		for(uint32 i = 0; i < engine->partitionCount; i++){
+			setHashEngineFlushPolicy(engine->partitions[i], durability, flushBatchSize);
+		}
+		return;
+	}
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	engine->durability = durability;
+	engine->flushBatchSize = flushBatchSize == 0 ? DEFAULT_FLUSH_BATCH_SIZE : flushBatchSize;
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
 }
 
-List *getAllHashEngine(HashEngine *engine){
-	List* result = makeList();
-	void* args[2] = {engine, result};
-	foreachHashMap(engine->hashMap, eachLocationReadRecord, args);
+int32 setHashEngineRedoLog(HashEngine *engine, int32 enable){
+	if(engine->partitions != NULL){
+		int32 result = 1;
+		for(uint32 i = 0; i < engine->partitionCount; i++){
+			result = setHashEngineRedoLog(engine->partitions[i], enable) && result;
+		}
+		return result;
+	}
+	int32 result = 1;
+	int needCheckpoint = 0;
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	engine->redoLogEnabled = enable;
+	if(enable && engine->redoLogWork == NULL){
+		engine->redoLogWork = createHashEngineRedoLog(engine);
+		result = engine->redoLogEnabled = engine->redoLogWork != NULL;
+	} else if(!enable && engine->redoLogWork != NULL){
+		needCheckpoint = 1;
+	}
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+	//关闭：检查点切换写缓存时不再创建新的日志，数据同步之后删除工作中的日志
+	if(needCheckpoint){
+		checkpointHashEngine(engine);
+	}
 	return result;
 }
 
-Array removeHashEngine(HashEngine *engine, uint32 keyLen, uint8 *key){
-	// if(engine->redoLogWork!=NULL){
-	// 	appendRedoLog(engine->redoLogWork, makeHashEngineOperateTuple(engine, 2, keyLen, key, 0, NULL));
-	// }
-	Array arr = getHashEngine(engine, keyLen, key);
-	if (arr.length!=0){
-		putHashEngine(engine, keyLen, key, 0, NULL);
+void setHashEngineCompression(HashEngine *engine, int32 enable){
+	if(engine->partitions != NULL){
+		for(uint32 i = 0; i < engine->partitionCount; i++){
+			setHashEngineCompression(engine->partitions[i], enable);
+		}
+		return;
 	}
-	return arr;
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	engine->compression = enable;
+	//设置保存在文件头中，加载时恢复
+	writeMetadata(engine->wfd, fileFlagsOf(engine));
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
 }
 
-/*****************************************************************************
- *线程处理函数
- ******************************************************************************/
+void setHashEngineBlobThreshold(HashEngine *engine, uint32 threshold){
+	if(engine->partitions != NULL){
+		for(uint32 i = 0; i < engine->partitionCount; i++){
+			setHashEngineBlobThreshold(engine->partitions[i], threshold);
+		}
+		return;
+	}
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	engine->blobThreshold = threshold;
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+}
 
-void flushHashEngine(HashEngine* engine){
-	//Doing阶段：写入磁盘
+void setHashEngineResidentLimit(HashEngine *engine, uint64 limit){
+	if(engine->partitions != NULL){
+		for(uint32 i = 0; i < engine->partitionCount; i++){
+			setHashEngineResidentLimit(engine->partitions[i], limit);
+		}
+		return;
+	}
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	engine->residentLimit = limit;
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+}
+
+//第一次写入blob时创建blob文件，在持久化线程中调用，返回blob文件是否可用
+static int openBlobFile(HashEngine *engine){
+	if(engine->blobFd == -1){
+		engine->blobFd = open(engine->blobFilename, O_RDWR | O_CREAT, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+		engine->blobFileSize = 0;
+	}
+	return engine->blobFd != -1;
+}
+
+//批次中已经序列化的记录及其在数据文件中的位置，批次写入之后更新到位置信息
+typedef struct FlushedRecord
+{
+	LRUNode *node;
+	uint64 position;
+	uint32 size;
+	uint32 blobSize;
+} FlushedRecord;
+
+//批次写入成功后，在statusMutex中更新批次中记录的位置信息和空间统计，读线程不会看到写了一半的位置
+static void applyFlushedRecords(HashEngine *engine, FlushedRecord *records, uint32 count, uint64 blobFileSize){
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+	pthread_mutex_lock(&engine->statusMutex);
+	for(uint32 i = 0; i < count; i++){
+		Record *record = (Record *)records[i].node->value;
+		RecordLocation* location = getLocation(engine, record->keyLen, record->key);
+		if(location==NULL){
+			//对同一个key并发的删除已经将其移出内存索引，重新加入
+			location = putLocation(engine, record->keyLen, record->key, *(uint64 *)records[i].node->key);
+		}
+		//更新空间统计：旧版本变为垃圾（重试时上一次尝试的位置同样被扣除，统计保持一致）
+		if(location->position!=0){
+			engine->liveSize -= location->size;
+			engine->blobLiveSize -= location->blobSize;
+		}
+		engine->liveSize += records[i].size;
+		engine->blobLiveSize += records[i].blobSize;
+		engine->fileSize += records[i].size;
+		location->position = records[i].position;
+		location->size = records[i].size;
+		location->blobSize = records[i].blobSize;
+		if(engine->hintFd != -1){
+			engine->hintEntryCount++;
+		}
+		//此时：id ！= 0 && position ！= 0
+	}
+	engine->blobFileSize = blobFileSize;
+	pthread_mutex_unlock(&engine->statusMutex);
+	pthread_cleanup_pop(0);
+}
+
+//Doing阶段的一次尝试：将冻结写缓存中的记录写入磁盘，同时将其追加到提示文件
+//记录序列化到连续的批次缓冲区，每批一次pwrite，整个检查点一次fdatasync，每批写入后在statusMutex中更新位置信息和统计
+//写入或同步失败时返回0：数据文件和blob文件尺寸恢复为开始时的值，提示文件不写入，已经修改的位置信息在重试时被覆盖
+//（这些key的id不为0，读操作从冻结写缓存中获取记录，不会访问这些位置）
+static int writeFreezeWriteCache(HashEngine *engine, int retireRedoLog){
 	LRUCache *freezeCache = engine->freezeWriteCache;
 	LRUNode *node = freezeCache->head;
-	while ((node = node->next) != freezeCache->head){
+	uint64 startFileSize = engine->fileSize;
+	uint64 startBlobFileSize = engine->blobFileSize;
+	uint64 startHintEntryCount = engine->hintEntryCount;
+	//blob文件的写入位置，批次写入后更新到engine->blobFileSize
+	uint64 blobFileSize = engine->blobFileSize;
+	FlushedRecord *flushed = (FlushedRecord *)malloc(sizeof(FlushedRecord) * (freezeCache->size + 1));
+	uint32 flushedCount = 0;
+	HintWriter hintWriter;
+	initHintWriter(&hintWriter, engine->hintFd, engine->fileSize, 0);
+	enum HashEngineDurability durability = engine->durability;
+	uint64 batchCapacity = engine->flushBatchSize;
+	uint8 *batch = (uint8 *)malloc(batchCapacity);
+	uint64 batchUsed = 0;
+	uint64 batchPosition = engine->fileSize; //批次在数据文件中的起始位置
+	int compress = engine->compression;
+	uint32 blobThreshold = engine->blobThreshold;
+	//本批次是否写入了blob，数据文件同步之前先同步blob文件，保证同步后的记录引用的blob都已经落盘
+	int blobWritten = 0;
+	int ok = 1;
+	while (ok && (node = node->next) != freezeCache->head){
 		// 在遍历该缓存时，不能有其他线程进行LRU的访问，应为LRU访问会破坏链表结构
 		Record *record = (Record*)node->value;
-		uint64 position = writeRecord(engine->wfd, record);
-		RecordLocation* location = getHashMap(engine->hashMap, record->keyLen, record->key);
-		location->position = position;
-		//此时：id ！= 0 && position ！= 0
+		uint32 size = recordMaxSize(record);
+		if(batchUsed > 0 && batchUsed + size > batchCapacity){
+			ok = pwriteFully(engine->wfd, batch, batchUsed, batchPosition);
+			if(ok && durability == SyncPerBatch){
+				if(blobWritten){
+					ok = fdatasync(engine->blobFd) == 0;
+					blobWritten = 0;
+				}
+				ok = ok && fdatasync(engine->wfd) == 0;
+			}
+			if(!ok){
+				break;
+			}
+			applyFlushedRecords(engine, flushed, flushedCount, blobFileSize);
+			flushedCount = 0;
+			batchPosition += batchUsed;
+			batchUsed = 0;
+		}
+		if(size > batchCapacity){
+			//超大记录，扩大缓冲区
+			batchCapacity = size;
+			batch = (uint8 *)realloc(batch, batchCapacity);
+		}
+		uint64 position = batchPosition + batchUsed;
+		uint32 blobSize = 0;
+		if(blobThreshold != 0 && record->valueLen >= blobThreshold && record->valueLen > HASH_BLOB_REF_SIZE &&
+		   openBlobFile(engine)){
+			//大value追加到blob文件，记录中只保存引用
+			if(!pwriteFully(engine->blobFd, record->value, record->valueLen, blobFileSize)){
+				ok = 0;
+				break;
+			}
+			size = serializeBlobRecord(batch + batchUsed, record, blobFileSize);
+			blobSize = record->valueLen;
+			blobFileSize += blobSize;
+			blobWritten = 1;
+		} else {
+			//压缩后的实际尺寸
+			size = serializeRecord(batch + batchUsed, record, compress);
+		}
+		batchUsed += size;
+		flushed[flushedCount].node = node;
+		flushed[flushedCount].position = position;
+		flushed[flushedCount].size = size;
+		flushed[flushedCount].blobSize = blobSize;
+		flushedCount++;
+		if(engine->hintFd != -1){
+			appendHintEntry(&hintWriter, record->version, position, size, blobSize, record->keyLen, record->key);
+		}
+	}
+	if(ok && batchUsed > 0){
+		ok = pwriteFully(engine->wfd, batch, batchUsed, batchPosition);
+	}
+	if(ok){
+		applyFlushedRecords(engine, flushed, flushedCount, blobFileSize);
+	}
+	free(batch);
+	free(flushed);
+	if(ok && (durability != NoSync || retireRedoLog)){
+		//数据没有同步时不能删除冻结的重做日志，失败后重试，直到同步成功才进入After阶段
+		if(blobWritten){
+			ok = fdatasync(engine->blobFd) == 0;
+		}
+		ok = ok && fdatasync(engine->wfd) == 0;
+	}
+	if(!ok){
+		//丢弃本次写入的内容，重试时从同一位置重新写入
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		engine->fileSize = startFileSize;
+		engine->blobFileSize = startBlobFileSize;
+		engine->hintEntryCount = startHintEntryCount;
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+		free(hintWriter.buffer);
+		return 0;
+	}
+	//数据已经持久化，再写入提示文件
+	if(engine->hintFd != -1){
+		finishHintWriter(&hintWriter, durability != NoSync);
+	} else {
+		free(hintWriter.buffer);
+	}
+	return 1;
+}
+
+void flushHashEngine(HashEngine* engine){
+	LRUCache *freezeCache = engine->freezeWriteCache;
+	LRUNode *node = freezeCache->head;
+	//有冻结的重做日志时，数据必须同步之后才能删除日志
+	int retireRedoLog = engine->redoLogFreeze != NULL;
+	//回收已经没有线程在使用的删除的位置信息
+	freeRetiredLocations(engine);
+	//使用磁盘索引时移出没有缓存的key，内存索引的尺寸与缓存容量相当
+	evictColdLocations(engine);
+	//Doing阶段：写入失败时保留冻结写缓存（读操作仍然可以访问），等待一段时间后重试，
+	//写缓存满时写操作在startPersistenceThread中等待，不会丢弃未持久化的记录
+	uint32 retryInterval = FLUSH_RETRY_MIN_INTERVAL;
+	while(!writeFreezeWriteCache(engine, retireRedoLog)){
+		int error = errno;
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		engine->flushErrorCount++;
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+		printf("检查点写入%s失败：%s，%ums后重试\n", engine->filename, strerror(error), retryInterval / 1000);
+		usleep(retryInterval);
+		if(retryInterval < FLUSH_RETRY_MAX_INTERVAL){
+			retryInterval *= 2;
+		}
 	}
 	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
 	pthread_mutex_lock(&engine->statusMutex);
 	engine->persistenceStatus = After;
+	engine->persistedSize = engine->fileSize;
 	pthread_mutex_unlock(&engine->statusMutex);
 	pthread_cleanup_pop(0);
 	//After阶段：
@@ -689,8 +3554,35 @@ void flushHashEngine(HashEngine* engine){
 	// 2、清理内存
 	while ((node = node->next) != freezeCache->head){
 		Record *record = (Record *)node->value;
-		RecordLocation *location = getHashMap(engine->hashMap, record->keyLen, record->key);
-		if (*(uint64 *)node->key == location->id){
+		RecordLocation *location = getLocation(engine, record->keyLen, record->key);
+		if (record->valueLen == 0){
+			//墓碑已经持久化：从内存索引中删除这个key，墓碑本身也成为垃圾
+			pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+			pthread_mutex_lock(&engine->statusMutex);
+			//磁盘上已经没有这个key的有效记录，新的副本在下一个检查点写入
+			//磁盘索引读写失败时保留指向墓碑的位置，查询结果同样是不存在
+			int removed = engine->diskIndex == NULL || removeDiskIndex(engine->diskIndex, record->keyLen, record->key) >= 0;
+			if (*(uint64 *)node->key == location->id){
+				location->id = 0;
+				if (removed){
+					engine->liveSize -= location->size;
+					removeKeyIndex(engine->keyIndex, record->keyLen, record->key);
+				}
+			}
+			pthread_mutex_unlock(&engine->statusMutex);
+			pthread_cleanup_pop(0);
+		} else if (engine->diskIndex != NULL){
+			//与清零id在同一个临界区中，位置可以被移出内存索引时磁盘索引中一定是最新的
+			pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+			pthread_mutex_lock(&engine->statusMutex);
+			DiskIndexValue value = {location->position, location->size, location->blobSize};
+			putDiskIndex(engine->diskIndex, record->keyLen, record->key, &value);
+			if (*(uint64 *)node->key == location->id){
+				location->id = 0;
+			}
+			pthread_mutex_unlock(&engine->statusMutex);
+			pthread_cleanup_pop(0);
+		} else if (*(uint64 *)node->key == location->id){
 			//不相等说明，writecache中存在一个副本，不能清零，避免覆盖
 			location->id = 0;
 		}
@@ -698,11 +3590,32 @@ void flushHashEngine(HashEngine* engine){
 		freeRecord(record);
 	}
 	clearLRUCache(freezeCache);
-	// forceFreeRedoLogAndUnlink(engine->redoLogFreeze);
+	if(engine->diskIndex != NULL){
+		//数据已经同步，写回磁盘索引并记录对应的数据文件尺寸，加载时只扫描之后的部分
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		syncHashEngineDiskIndex(engine);
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+	}
+	retireHashEngineRedoLog(engine);
+	compactHintFile(engine);
+	//空间放大超过阈值：在持久化线程中继续进行碎片整理
+	int needCompaction = 0;
 	pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
 	pthread_mutex_lock(&engine->statusMutex);
-	engine->persistenceStatus = None;
-	pthread_cond_signal(&engine->statusCond); //唤醒等待中的线程
+	needCompaction = shouldCompactHashEngine(engine);
+	engine->persistenceStatus = needCompaction ? Compacting : None;
+	pthread_cond_broadcast(&engine->statusCond); //唤醒等待中的线程
 	pthread_mutex_unlock(&engine->statusMutex);
 	pthread_cleanup_pop(0);
+	if(needCompaction){
+		doCompaction(engine);
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &engine->statusMutex);
+		pthread_mutex_lock(&engine->statusMutex);
+		engine->persistenceStatus = None;
+		pthread_cond_broadcast(&engine->statusCond);
+		pthread_mutex_unlock(&engine->statusMutex);
+		pthread_cleanup_pop(0);
+	}
 }
\ No newline at end of file
@@ -10,6 +10,15 @@
 #include <malloc.h>
 #include "hashmap.h"
 
+//hash表的负载因子控制在0.75
+static const double LOAD_FACTOR = 0.75;
+//负载因子低于该值时自动缩容
+static const double SHRINK_FACTOR = 0.1;
+//每次操作最多迁移的非空桶数
+static const uint32 REHASH_STEP = 1;
+//每次操作最多跳过的空桶数
+static const uint32 REHASH_EMPTY_VISITS = 10;
+
 /*****************************************************************************
  * 通用私有辅助函数
  ******************************************************************************/
@@ -43,10 +52,19 @@ private void freeEntry(Entry* entry){
 	free(entry);
 }
 
-/** 从HashMap中查找节点 */
-private Entry* searchEntry(HashMap* map, uint32 keyLen, uint8* key, uint32 hashcode){
-	uint32 index = hashcode & (map->bucketCapacity-1);
-	Entry *p = map->table[index];
+/** 计算以0.75负载因子容纳capacity个元素需要的桶数组长度（2^n） */
+static uint32 bucketCapacityFor(uint32 capacity){
+	capacity = (uint32)(((double)capacity)/LOAD_FACTOR);
+	uint32 bucketCapacity = 1;
+	while (bucketCapacity < capacity)
+		bucketCapacity <<= 1;
+	return bucketCapacity;
+}
+
+/** 从一个桶数组中查找节点 */
+static Entry *searchTable(Entry **table, uint32 bucketCapacity, uint32 keyLen, uint8 *key, uint32 hashcode){
+	uint32 index = hashcode & (bucketCapacity-1);
+	Entry *p = table[index];
 	while(p){
 		if(p->keyLen == keyLen && p->hashCode == hashcode && byteArrayCompare(keyLen, key, p->key)==0){
 			return p;
@@ -56,24 +74,39 @@ private Entry* searchEntry(HashMap* map, uint32 keyLen, uint8* key, uint32 hashc
 	return NULL;
 }
 
-/** 直接插入到HashMap中，不考虑重复 */
+/** 从HashMap中查找节点，rehash期间先查旧桶数组再查新桶数组 */
+private Entry* searchEntry(HashMap* map, uint32 keyLen, uint8* key, uint32 hashcode){
+	Entry *p = searchTable(map->table, map->bucketCapacity, keyLen, key, hashcode);
+	if(p==NULL && map->rehashTable!=NULL){
+		p = searchTable(map->rehashTable, map->rehashCapacity, keyLen, key, hashcode);
+	}
+	return p;
+}
+
+/** 直接插入到HashMap中，不考虑重复，rehash期间插入到新桶数组 */
 private void insertEntry(HashMap* map, Entry* entry, uint32 hashcode){
-	uint32 index = hashcode & (map->bucketCapacity - 1);
-	Entry *p = map->table[index];
+	Entry **table = map->table;
+	uint32 bucketCapacity = map->bucketCapacity;
+	if(map->rehashTable!=NULL){
+		table = map->rehashTable;
+		bucketCapacity = map->rehashCapacity;
+	}
+	uint32 index = hashcode & (bucketCapacity - 1);
+	Entry *p = table[index];
 	entry->after = p;
-	map->table[index] = entry;
+	table[index] = entry;
 }
 
-/** 从HashTable中删除一个节点并返回，不会释放内存 */
-private Entry *removeEntry(HashMap *map, uint32 keyLen, uint8 *key, uint32 hashcode){
-	uint32 index = hashcode & (map->bucketCapacity - 1);
-	Entry* p = map->table[index];
+/** 从一个桶数组中删除一个节点并返回，不会释放内存 */
+static Entry *removeFromTable(Entry **table, uint32 bucketCapacity, uint32 keyLen, uint8 *key, uint32 hashcode){
+	uint32 index = hashcode & (bucketCapacity - 1);
+	Entry* p = table[index];
 	if(p==NULL){
 		return NULL;
 	}
 	//p第一个位置
 	if(p->keyLen == keyLen && p->hashCode == hashcode && byteArrayCompare(keyLen, key, p->key)==0){
-		map->table[index] = p->after;
+		table[index] = p->after;
 		return p;
 	}
 	//p是q的前驱
@@ -89,28 +122,90 @@ private Entry *removeEntry(HashMap *map, uint32 keyLen, uint8 *key, uint32 hashc
 	return NULL;
 }
 
+/** 从HashTable中删除一个节点并返回，不会释放内存 */
+private Entry *removeEntry(HashMap *map, uint32 keyLen, uint8 *key, uint32 hashcode){
+	Entry *p = removeFromTable(map->table, map->bucketCapacity, keyLen, key, hashcode);
+	if(p==NULL && map->rehashTable!=NULL){
+		p = removeFromTable(map->rehashTable, map->rehashCapacity, keyLen, key, hashcode);
+	}
+	return p;
+}
+
+/** 开始渐进式rehash，已经在rehash或者容量不变时忽略 */
+static void startRehash(HashMap *map, uint32 bucketCapacity){
+	if(map->rehashTable!=NULL || bucketCapacity==map->bucketCapacity){
+		return;
+	}
+	map->rehashTable = (Entry **)calloc(bucketCapacity, sizeof(Entry *));
+	map->rehashCapacity = bucketCapacity;
+	map->rehashIndex = 0;
+}
+
+/** rehash完成，使用新桶数组替换旧桶数组 */
+static void finishRehash(HashMap *map){
+	free(map->table);
+	map->table = map->rehashTable;
+	map->bucketCapacity = map->rehashCapacity;
+	map->rehashTable = NULL;
+	map->rehashCapacity = 0;
+	map->rehashIndex = 0;
+}
+
+/** 
+ * 执行一步rehash：最多迁移REHASH_STEP个非空桶，最多跳过REHASH_EMPTY_VISITS个空桶
+ * 保证单次操作的耗时有上限
+ */
+private void rehashStep(HashMap *map){
+	if(map->rehashTable==NULL){
+		return;
+	}
+	uint32 steps = REHASH_STEP;
+	uint32 emptyVisits = REHASH_EMPTY_VISITS;
+	while(steps > 0 && map->rehashIndex < map->bucketCapacity){
+		Entry *p = map->table[map->rehashIndex];
+		if(p==NULL){
+			map->rehashIndex++;
+			if(--emptyVisits == 0){
+				break;
+			}
+			continue;
+		}
+		while(p){
+			Entry *next = p->after;
+			uint32 index = p->hashCode & (map->rehashCapacity - 1);
+			p->after = map->rehashTable[index];
+			map->rehashTable[index] = p;
+			p = next;
+		}
+		map->table[map->rehashIndex++] = NULL;
+		steps--;
+	}
+	if(map->rehashIndex >= map->bucketCapacity){
+		finishRehash(map);
+	}
+}
+
 
 /*****************************************************************************
  * 公有函数
  ******************************************************************************/
 HashMap *makeHashMap(uint32 capacity){
-	//hash表的负载因子控制在0.75
-	static double loadFactor = 0.75;
 	//无法达到0.75的负载因子
-	if(capacity>0xffffffffu*loadFactor){
+	if(capacity>0xffffffffu*LOAD_FACTOR){
 		return NULL;
 	}
 
 	HashMap *map = (HashMap *)malloc(sizeof(HashMap));
 	//计算并初始化桶数组容量
-	capacity = (uint32)(((double)capacity)/loadFactor);
-	uint32 bucketCapacity = 1;
-	while (bucketCapacity < capacity)
-		bucketCapacity <<= 1;
+	uint32 bucketCapacity = bucketCapacityFor(capacity);
 	map->bucketCapacity = bucketCapacity;
+	map->minBucketCapacity = bucketCapacity;
 	//其他值初始化
 	map->size = 0;
 	map->table = (Entry **)calloc(bucketCapacity, sizeof(Entry *));
+	map->rehashTable = NULL;
+	map->rehashCapacity = 0;
+	map->rehashIndex = 0;
 	return map;
 }
 
@@ -123,9 +218,9 @@ void freeHashMap(HashMap* map){
 	free(map);
 }
 
-void* foreachHashMap(HashMap *map, ForeachMapFunction func, void *args){
-	for (int i = 0; i < map->bucketCapacity; i++){
-		Entry *p = map->table[i], *q=NULL;
+static void* foreachTable(Entry **table, uint32 bucketCapacity, ForeachMapFunction func, void *args){
+	for (uint32 i = 0; i < bucketCapacity; i++){
+		Entry *p = table[i], *q=NULL;
 		if (p==NULL){
 			continue;
 		}
@@ -144,6 +239,14 @@ void* foreachHashMap(HashMap *map, ForeachMapFunction func, void *args){
 	return NULL;
 }
 
+void* foreachHashMap(HashMap *map, ForeachMapFunction func, void *args){
+	void *result = foreachTable(map->table, map->bucketCapacity, func, args);
+	if(result==NULL && map->rehashTable!=NULL){
+		result = foreachTable(map->rehashTable, map->rehashCapacity, func, args);
+	}
+	return result;
+}
+
 static void* foreachFreeEntry(Entry* entry, void* args){
 	freeEntry(entry);
 	return NULL;
@@ -151,6 +254,10 @@ static void* foreachFreeEntry(Entry* entry, void* args){
 
 void clearHashMap(HashMap *map){
 	foreachHashMap(map, (ForeachMapFunction) foreachFreeEntry, NULL);
+	//rehash期间清空，直接使用新桶数组
+	if(map->rehashTable!=NULL){
+		finishRehash(map);
+	}
 	//table清零
 	memset(map->table, 0, map->bucketCapacity * sizeof(Entry *));
 	map->size=0;
@@ -158,6 +265,7 @@ void clearHashMap(HashMap *map){
 
 void putHashMap(HashMap *map, uint32 keyLen, uint8 *originKey, void *value){
 	uint32 hashcode = hashCode(originKey, keyLen);
+	rehashStep(map);
 	Entry *node = searchEntry(map, keyLen, originKey, hashcode);
 	if(node!=NULL){
 		node->value=value;
@@ -168,6 +276,10 @@ void putHashMap(HashMap *map, uint32 keyLen, uint8 *originKey, void *value){
 	node = makeEntry(keyLen, key, value, hashcode);
 	map->size++;
 	insertEntry(map, node, hashcode);
+	//负载因子超过0.75，扩容为2倍
+	if(map->rehashTable==NULL && map->size > map->bucketCapacity*LOAD_FACTOR && map->bucketCapacity < 0x80000000u){
+		startRehash(map, map->bucketCapacity << 1);
+	}
 }
 
 
@@ -182,6 +294,7 @@ void *getHashMap(HashMap *map, uint32 keyLen, uint8 *key){
 
 void *removeHashMap(HashMap *map, uint32 keyLen, uint8 *key){
 	uint32 hashcode = hashCode(key, keyLen);
+	rehashStep(map);
 	Entry *node = removeEntry(
 		map,
 		keyLen,
@@ -193,5 +306,26 @@ void *removeHashMap(HashMap *map, uint32 keyLen, uint8 *key){
 	void *result = node->value;
 	freeEntry(node);
 	map->size--;
+	//负载因子低于0.1，缩容，但不小于初始容量
+	if(map->rehashTable==NULL && map->bucketCapacity > map->minBucketCapacity && map->size < map->bucketCapacity*SHRINK_FACTOR){
+		uint32 bucketCapacity = bucketCapacityFor(map->size);
+		startRehash(map, bucketCapacity > map->minBucketCapacity ? bucketCapacity : map->minBucketCapacity);
+	}
 	return result;
-}
\ No newline at end of file
+}
+
+void shrinkHashMap(HashMap *map){
+	//先完成正在进行的rehash
+	while(map->rehashTable!=NULL){
+		rehashStep(map);
+	}
+	uint32 bucketCapacity = bucketCapacityFor(map->size);
+	if(bucketCapacity < map->bucketCapacity){
+		map->minBucketCapacity = bucketCapacity;
+		startRehash(map, bucketCapacity);
+	}
+}
+
+int32 isRehashingHashMap(HashMap *map){
+	return map->rehashTable!=NULL;
+}
@@ -23,15 +23,16 @@ static const uint32 NODE_META_SIZE = 40;
 
 static uint64 getNextPageId(IndexEngine* engine){
 	uint64 pageId;
+	//共享模式下多个线程可能同时分配
+	pthread_mutex_lock(engine->cache.statusMutex);
 	if(engine->cache.abandonedPageWork->length!=0){
-		pthread_mutex_lock(engine->cache.statusMutex);
 		uint64* value= (uint64*) removeHeadList(engine->cache.abandonedPageWork);
 		pageId = *value;
 		free(value);
-		pthread_mutex_unlock(engine->cache.statusMutex);
 	} else {
 		pageId = engine->nextPageId++;
 	}
+	pthread_mutex_unlock(engine->cache.statusMutex);
 	return pageId;
 }
 
@@ -39,20 +40,46 @@ static uint64 getNextPageId(IndexEngine* engine){
  * 私有函数：申请释结构放内存，结构状态变化
  ******************************************************************************/
 
-/** 创建一个Node，用于存放数据 */
+/** 节点中每个条目的字节数：key + value或孩子页号，变长key时再加上key的长度 */
+static uint32 getEntryLen(IndexEngine *engine, int32 nodeType){
+	uint32 dataLen = nodeType == NODE_TYPE_LINK ? sizeof(uint64) : engine->treeMeta.valueLen;
+	return engine->treeMeta.keyLen + dataLen + (IS_VARIABLE_KEY(engine->flag) ? sizeof(uint16) : 0);
+}
+
+/**
+ * 创建一个Node，用于存放数据：节点结构和页镜像一次分配
+ * 压缩key或变长key时页镜像为解码后的条目，按度分配，可能大于页
+ */
 private IndexTreeNode* makeIndexTreeNode(IndexEngine* engine, int32 nodeType){
-	IndexTreeNode *node = (IndexTreeNode *)calloc(1,sizeof(IndexTreeNode));
-	node->keys = (uint8 **)malloc(sizeof(uint8 *) * (engine->treeMeta.degree + 1));
-	node->type = nodeType;
-	if (nodeType == NODE_TYPE_LINK){
-		node->children = (uint64 *)malloc(sizeof(uint64) * (engine->treeMeta.degree + 1));
-	} else {
-		node->values = (uint8 **)malloc(sizeof(uint8 *) * (engine->treeMeta.degree + 1));
+	uint32 entryLen = getEntryLen(engine, nodeType);
+	uint64 imageLen = NODE_META_SIZE + (uint64)(engine->treeMeta.degree + 1) * entryLen;
+	if(imageLen < engine->pageSize + entryLen){
+		imageLen = engine->pageSize + entryLen;
 	}
+	IndexTreeNode *node = (IndexTreeNode *)malloc(sizeof(IndexTreeNode) + imageLen);
+	memset(node, 0, sizeof(IndexTreeNode));
+	node->type = nodeType;
+	node->entryLen = entryLen;
+	node->page = (uint8 *)(node + 1);
+	node->entries = node->page + NODE_META_SIZE;
+	node->frame = BUFFER_POOL_NIL;
+	pthread_rwlock_init(&node->latch, NULL);
 	return node;
 }
 
 static void putToAbandonedPageFreeze(IndexEngine* engine, uint64 pageId);
+static void putToBufferPool(IndexEngine *engine, IndexTreeNode *node);
+
+/** 将节点占用的页（链接节点、影子节点）放入废弃页链表，同一页只放入一次 */
+static void abandonNodePages(IndexEngine* engine, IndexTreeNode* node){
+	putToAbandonedPageFreeze(engine, node->pageId);
+	if(node->newPageId!=node->pageId){
+		putToAbandonedPageFreeze(engine, node->newPageId);
+	}
+	if(node->after!=node->pageId && node->after!=node->newPageId){
+		putToAbandonedPageFreeze(engine, node->after);
+	}
+}
 
 /** 
  * 改变节点状态 参见《3-索引存储引擎》状态转换图
@@ -71,8 +98,7 @@ private void changeIndexTreeNodeStatus(IndexEngine* engine, IndexTreeNode* node,
 			}
 			node->nodeVersion = engine->nextNodeVersion;
 		} else if(nodeStatus==NODE_STATUS_REMOVE){
-			putToAbandonedPageFreeze(engine, node->pageId);
-			putToAbandonedPageFreeze(engine, node->newPageId);
+			abandonNodePages(engine, node);
 			engine->usedPageCnt--;
 			node->status = NODE_STATUS_REMOVE;
 		} else {
@@ -84,8 +110,7 @@ private void changeIndexTreeNodeStatus(IndexEngine* engine, IndexTreeNode* node,
 				node->after = node->newPageId;
 			}
 		} else if(nodeStatus==NODE_STATUS_REMOVE){
-			putToAbandonedPageFreeze(engine, node->pageId);
-			putToAbandonedPageFreeze(engine, node->newPageId);
+			abandonNodePages(engine, node);
 			engine->usedPageCnt--;
 			node->status = NODE_STATUS_REMOVE;
 		}
@@ -93,7 +118,7 @@ private void changeIndexTreeNodeStatus(IndexEngine* engine, IndexTreeNode* node,
 	}
 }
 
-/** 创建一个状态为NEW的节点，并分配一个PageId */
+/** 创建一个状态为NEW的节点，并分配一个PageId，节点作为脏帧放入缓冲池（被固定） */
 private IndexTreeNode* newIndexTreeNode(IndexEngine* engine, int32 nodeType){
 	engine->usedPageCnt++;
 	IndexTreeNode *result = makeIndexTreeNode(engine, nodeType);
@@ -102,24 +127,18 @@ private IndexTreeNode* newIndexTreeNode(IndexEngine* engine, int32 nodeType){
 	result->nodeVersion = engine->nextNodeVersion;
 	result->newPageId = getNextPageId(engine);
 	result->pageId = result->newPageId;
+	pthread_mutex_lock(engine->cache.poolMutex);
+	putToBufferPool(engine, result);
+	pthread_mutex_unlock(engine->cache.poolMutex);
 	return result;
 }
 
 /** Free一个Node */
 private void freeIndexTreeNode(IndexTreeNode* node){
-	int32 nodeType = node->type;
-	for(int i=0; i<node->size; i++){
-		free(node->keys[i]);
-		if (nodeType != NODE_TYPE_LINK){
-			free(node->values[i]);
-		}
-	}
-	free(node->keys);
-	if (nodeType == NODE_TYPE_LINK){
-		free(node->children);
-	} else {
-		free(node->values);
+	if(node==NULL){
+		return;
 	}
+	pthread_rwlock_destroy(&node->latch);
 	free(node);
 }
 
@@ -131,25 +150,12 @@ private IndexTreeNode* copyIndexTreeNode(IndexEngine* engine, IndexTreeNode* src
 	dest->type = src->type;
 	dest->size = src->size;
 	dest->flag = src->flag;
+	dest->prev = src->prev;
 	dest->next = src->next;
 	dest->nodeVersion = src->nodeVersion;
 	dest->status = src->status;
 	dest->after = src->after;
-
-	if(src->type==NODE_TYPE_LINK){
-		for (int i = 0; i < src->size; i++){
-			dest->keys[i] = (uint8*)malloc(sizeof(uint8)*engine->treeMeta.keyLen);
-			memcpy(dest->keys[i], src->keys[i], engine->treeMeta.keyLen);
-			dest->children[i] = src->children[i];
-		}
-	} else {
-		for (int i = 0; i < src->size; i++){
-			dest->keys[i] = (uint8 *)malloc(sizeof(uint8) * engine->treeMeta.keyLen);
-			memcpy(dest->keys[i], src->keys[i], engine->treeMeta.keyLen);
-			dest->values[i] = (uint8 *)malloc(sizeof(uint8) * engine->treeMeta.valueLen);
-			memcpy(dest->values[i], src->values[i], engine->treeMeta.valueLen);
-		}
-	}
+	memcpy(dest->entries, src->entries, (uint64)src->size * src->entryLen);
 	return dest;
 }
 
@@ -191,6 +197,288 @@ static int copyToBuffer(char* buffer, const void* data, uint32 len){
 	return len;
 }
 
+/*
+ * key压缩的数据页格式（节点元数据之后）：
+ * prefixLen:2, prefix:prefixLen, 条目{restLen:2, rest:restLen, value或孩子页号}
+ * key = prefix + rest + 末尾补0。只有叶子节点使用公共前缀：链接节点的key会被原地替换，
+ * 不使用前缀保证替换只影响一个条目的长度
+ */
+
+/** 条目序列：由最多两个节点的条目连接而成（用于分裂、相邻节点的均衡与合并） */
+typedef struct EntrySeq {
+	uint8 *first;
+	uint32 firstSize;
+	uint8 *second;
+	uint32 secondSize;
+	uint32 entryLen;
+} EntrySeq;
+
+/** 条目序列第i个条目的key */
+static uint8 *getSeqKey(EntrySeq *seq, uint32 i){
+	if(i < seq->firstSize){
+		return seq->first + (uint64)i * seq->entryLen;
+	}
+	return seq->second + (uint64)(i - seq->firstSize) * seq->entryLen;
+}
+
+/** 去掉末尾的0之后key的长度 */
+static uint32 getTrimmedKeyLen(uint8 *key, uint32 keyLen){
+	while(keyLen > 0 && key[keyLen - 1] == 0){
+		keyLen--;
+	}
+	return keyLen;
+}
+
+/** 变长key时条目中记录的key长度 */
+static uint32 getEntryKeyLen(uint8 *entry, uint32 entryLen){
+	uint16 keyLen;
+	memcpy(&keyLen, entry + entryLen - sizeof(keyLen), sizeof(keyLen));
+	return keyLen;
+}
+
+/** 变长key时：条目的key被修改后重新记录key的长度 */
+static void setEntryKeyLen(IndexEngine *engine, uint8 *entry, uint32 entryLen){
+	if(IS_VARIABLE_KEY(engine->flag)){
+		uint16 keyLen = getTrimmedKeyLen(entry, engine->treeMeta.keyLen);
+		memcpy(entry + entryLen - sizeof(keyLen), &keyLen, sizeof(keyLen));
+	}
+}
+
+/** 两个key的公共前缀长度 */
+static uint32 getCommonPrefixLen(uint8 *a, uint8 *b, uint32 keyLen){
+	uint32 len = 0;
+	while(len < keyLen && a[len] == b[len]){
+		len++;
+	}
+	return len;
+}
+
+/** 条目序列[from, to)的公共前缀长度：有序，所以等于首尾两个key的公共前缀 */
+static uint32 getSeqPrefixLen(IndexEngine *engine, int32 nodeType, EntrySeq *seq, uint32 from, uint32 to){
+	if(nodeType == NODE_TYPE_LINK || IS_VARIABLE_KEY(engine->flag) || to <= from){
+		return 0;
+	}
+	return getCommonPrefixLen(getSeqKey(seq, from), getSeqKey(seq, to - 1), engine->treeMeta.keyLen);
+}
+
+/**
+ * 使用给定的公共前缀时条目序列[from, to)压缩后页的长度
+ * 变长key时没有公共前缀，条目中记录的key长度恰好对应槽页中每个条目的槽，结果为槽页的长度
+ */
+static uint32 getSeqEncodedLenWithPrefix(IndexEngine *engine, EntrySeq *seq, uint32 from, uint32 to, uint32 prefixLen){
+	uint32 keyLen = engine->treeMeta.keyLen;
+	uint32 len = NODE_META_SIZE + 2 + prefixLen + (to - from) * (2 + seq->entryLen - keyLen);
+	for(uint32 i = from; i < to; i++){
+		uint32 trimmedLen = getTrimmedKeyLen(getSeqKey(seq, i), keyLen);
+		if(trimmedLen > prefixLen){
+			len += trimmedLen - prefixLen;
+		}
+	}
+	return len;
+}
+
+/** 条目序列[from, to)压缩后页的长度 */
+static uint32 getSeqEncodedLen(IndexEngine *engine, int32 nodeType, EntrySeq *seq, uint32 from, uint32 to){
+	return getSeqEncodedLenWithPrefix(engine, seq, from, to, getSeqPrefixLen(engine, nodeType, seq, from, to));
+}
+
+/**
+ * 压缩节点长度的上限：预留一个key的空间，
+ * 链接节点的key被替换为更长的分隔key时仍然可以放入一个页
+ */
+static uint32 getEncodedLimit(IndexEngine *engine){
+	return engine->pageSize - engine->treeMeta.keyLen - 2;
+}
+
+/**
+ * 选择条目序列的分裂点k：[0,k)与[k,n)压缩后较长的一个尽量短
+ * 左右两边分别从两端开始累加，公共前缀变化时才重新计算，总体为线性复杂度
+ * @return {uint32} 分裂点，1 <= k < n
+ */
+static uint32 chooseSeqSplitPoint(IndexEngine *engine, int32 nodeType, EntrySeq *seq, uint32 n){
+	uint32 keyLen = engine->treeMeta.keyLen;
+	uint32 fixedLen = 2 + seq->entryLen - keyLen;
+	uint32 *trimmedLens = (uint32 *)malloc(sizeof(uint32) * n);
+	uint32 *leftLens = (uint32 *)malloc(sizeof(uint32) * n);
+	for(uint32 i = 0; i < n; i++){
+		trimmedLens[i] = getTrimmedKeyLen(getSeqKey(seq, i), keyLen);
+	}
+	//左边[0,k)
+	uint32 prefixLen = keyLen + 1;
+	uint64 sum = 0;
+	for(uint32 k = 1; k < n; k++){
+		uint32 nowPrefixLen = getSeqPrefixLen(engine, nodeType, seq, 0, k);
+		if(nowPrefixLen != prefixLen){
+			prefixLen = nowPrefixLen;
+			sum = 0;
+			for(uint32 i = 0; i + 1 < k; i++){
+				sum += trimmedLens[i] > prefixLen ? trimmedLens[i] - prefixLen : 0;
+			}
+		}
+		sum += trimmedLens[k - 1] > prefixLen ? trimmedLens[k - 1] - prefixLen : 0;
+		leftLens[k] = NODE_META_SIZE + 2 + prefixLen + k * fixedLen + sum;
+	}
+	//右边[k,n)，取两边较长者最短的k
+	uint32 best = n / 2;
+	uint32 bestLen = MAX_UINT32;
+	prefixLen = keyLen + 1;
+	sum = 0;
+	for(uint32 k = n - 1; k >= 1; k--){
+		uint32 nowPrefixLen = getSeqPrefixLen(engine, nodeType, seq, k, n);
+		if(nowPrefixLen != prefixLen){
+			prefixLen = nowPrefixLen;
+			sum = 0;
+			for(uint32 i = k + 1; i < n; i++){
+				sum += trimmedLens[i] > prefixLen ? trimmedLens[i] - prefixLen : 0;
+			}
+		}
+		sum += trimmedLens[k] > prefixLen ? trimmedLens[k] - prefixLen : 0;
+		uint32 rightLen = NODE_META_SIZE + 2 + prefixLen + (n - k) * fixedLen + sum;
+		//两边的条目数都不能超过度
+		if(k > engine->treeMeta.degree || n - k > engine->treeMeta.degree){
+			continue;
+		}
+		uint32 maxLen = leftLens[k] > rightLen ? leftLens[k] : rightLen;
+		if(maxLen < bestLen){
+			best = k;
+			bestLen = maxLen;
+		}
+	}
+	free(trimmedLens);
+	free(leftLens);
+	return best;
+}
+
+/**
+ * 生成left与right之间最短的分隔key（left < separator <= right）：
+ * 取right的前（公共前缀长度+1）个字节，其余补0
+ */
+static void makeSeparatorKey(uint32 keyLen, uint8 *left, uint8 *right, uint8 *separator){
+	uint32 len = getCommonPrefixLen(left, right, keyLen);
+	if(len < keyLen){
+		len++;
+	}
+	memcpy(separator, right, len);
+	memset(separator + len, 0, keyLen - len);
+}
+
+/** 将size个条目压缩写入buffer的节点元数据之后，返回页的长度 */
+static uint32 encodeEntries(IndexEngine *engine, int32 nodeType, uint8 *entries, uint32 size, uint32 entryLen, char *buffer){
+	uint32 keyLen = engine->treeMeta.keyLen;
+	uint32 dataLen = entryLen - keyLen;
+	EntrySeq seq = {entries, size, NULL, 0, entryLen};
+	uint16 prefixLen = getSeqPrefixLen(engine, nodeType, &seq, 0, size);
+	uint32 len = NODE_META_SIZE;
+	len += copyToBuffer(buffer + len, &prefixLen, sizeof(prefixLen));
+	memcpy(buffer + len, entries, prefixLen);
+	len += prefixLen;
+	for(uint32 i = 0; i < size; i++){
+		uint8 *entry = entries + (uint64)i * entryLen;
+		uint32 trimmedLen = getTrimmedKeyLen(entry, keyLen);
+		uint16 restLen = trimmedLen > prefixLen ? trimmedLen - prefixLen : 0;
+		len += copyToBuffer(buffer + len, &restLen, sizeof(restLen));
+		memcpy(buffer + len, entry + prefixLen, restLen);
+		len += restLen;
+		//value或孩子页号（已经是网络字节序）
+		memcpy(buffer + len, entry + keyLen, dataLen);
+		len += dataLen;
+	}
+	return len;
+}
+
+/** 从buffer的节点元数据之后解压node->size个条目，页损坏返回0 */
+static int32 decodeEntries(IndexEngine *engine, IndexTreeNode *node, char *buffer){
+	uint32 keyLen = engine->treeMeta.keyLen;
+	uint32 dataLen = node->entryLen - keyLen;
+	uint32 pageSize = engine->pageSize;
+	uint32 len = NODE_META_SIZE;
+	uint16 prefixLen = ntohs(*(uint16 *)(buffer + len));
+	len += sizeof(prefixLen);
+	if(prefixLen > keyLen || len + prefixLen > pageSize){
+		return 0;
+	}
+	char *prefix = buffer + len;
+	len += prefixLen;
+	for(uint32 i = 0; i < node->size; i++){
+		if(len + 2 > pageSize){
+			return 0;
+		}
+		uint16 restLen = ntohs(*(uint16 *)(buffer + len));
+		len += sizeof(restLen);
+		if(prefixLen + restLen > keyLen || len + restLen + dataLen > pageSize){
+			return 0;
+		}
+		uint8 *entry = node->entries + (uint64)i * node->entryLen;
+		memcpy(entry, prefix, prefixLen);
+		memcpy(entry + prefixLen, buffer + len, restLen);
+		memset(entry + prefixLen + restLen, 0, keyLen - prefixLen - restLen);
+		len += restLen;
+		memcpy(entry + keyLen, buffer + len, dataLen);
+		len += dataLen;
+	}
+	return 1;
+}
+
+/*
+ * 变长key的数据页格式（槽页，节点元数据之后）：
+ * slotEnd:2, 槽{offset:2}*size, 条目{keyLen:2, key:keyLen, value或孩子页号}
+ * 槽按key的顺序存放条目在页中的偏移，slotEnd为槽数组之后的偏移，key = key + 末尾补0
+ */
+
+/** 将size个条目按槽页格式写入buffer的节点元数据之后，返回页的长度 */
+static uint32 encodeSlottedEntries(IndexEngine *engine, uint8 *entries, uint32 size, uint32 entryLen, char *buffer){
+	uint32 keyLen = engine->treeMeta.keyLen;
+	uint32 dataLen = entryLen - keyLen - sizeof(uint16);
+	uint16 slotEnd = NODE_META_SIZE + sizeof(slotEnd) + size * sizeof(uint16);
+	uint32 len = NODE_META_SIZE;
+	len += copyToBuffer(buffer + len, &slotEnd, sizeof(slotEnd));
+	uint32 offset = slotEnd;
+	for(uint32 i = 0; i < size; i++){
+		uint8 *entry = entries + (uint64)i * entryLen;
+		uint16 slot = offset;
+		uint16 entryKeyLen = getEntryKeyLen(entry, entryLen);
+		len += copyToBuffer(buffer + len, &slot, sizeof(slot));
+		offset += copyToBuffer(buffer + offset, &entryKeyLen, sizeof(entryKeyLen));
+		memcpy(buffer + offset, entry, entryKeyLen);
+		offset += entryKeyLen;
+		//value或孩子页号（已经是网络字节序）
+		memcpy(buffer + offset, entry + keyLen, dataLen);
+		offset += dataLen;
+	}
+	return offset;
+}
+
+/** 从buffer的槽页中读取node->size个条目，页损坏返回0 */
+static int32 decodeSlottedEntries(IndexEngine *engine, IndexTreeNode *node, char *buffer){
+	uint32 keyLen = engine->treeMeta.keyLen;
+	uint32 dataLen = node->entryLen - keyLen - sizeof(uint16);
+	uint32 pageSize = engine->pageSize;
+	uint32 len = NODE_META_SIZE;
+	uint16 slotEnd = ntohs(*(uint16 *)(buffer + len));
+	len += sizeof(slotEnd);
+	if(slotEnd != len + (uint64)node->size * sizeof(uint16) || slotEnd > pageSize){
+		return 0;
+	}
+	for(uint32 i = 0; i < node->size; i++){
+		uint16 offset = ntohs(*(uint16 *)(buffer + len));
+		len += sizeof(offset);
+		if(offset < slotEnd || offset + sizeof(uint16) > pageSize){
+			return 0;
+		}
+		uint16 entryKeyLen = ntohs(*(uint16 *)(buffer + offset));
+		offset += sizeof(entryKeyLen);
+		if(entryKeyLen > keyLen || offset + entryKeyLen + dataLen > pageSize){
+			return 0;
+		}
+		uint8 *entry = node->entries + (uint64)i * node->entryLen;
+		memcpy(entry, buffer + offset, entryKeyLen);
+		memset(entry + entryKeyLen, 0, keyLen - entryKeyLen);
+		memcpy(entry + keyLen, buffer + offset + entryKeyLen, dataLen);
+		memcpy(entry + keyLen + dataLen, &entryKeyLen, sizeof(entryKeyLen));
+	}
+	return 1;
+}
+
 private void metaToBuffer(IndexEngine* engine, char* buffer){
 	IndexTreeMeta* meta = &engine->treeMeta;
 	int len = 0;
@@ -210,7 +498,7 @@ private void metaToBuffer(IndexEngine* engine, char* buffer){
 	len += copyToBuffer(buffer + len, &engine->nextNodeVersion, sizeof(engine->nextNodeVersion));
 }
 
-private void nodeToBuffer(IndexEngine* engine, IndexTreeNode *node, int32 nodeType, char* buffer){
+private uint32 nodeToBuffer(IndexEngine* engine, IndexTreeNode *node, int32 nodeType, char* buffer){
 	int len = 0;
 	uint64 after = 0;
 	if(node->after!=0&&node->pageId==node->newPageId){
@@ -222,23 +510,17 @@ private void nodeToBuffer(IndexEngine* engine, IndexTreeNode *node, int32 nodeTy
 	len += copyToBuffer(buffer + len, &node->nodeVersion, sizeof(node->nodeVersion));
 	len += copyToBuffer(buffer + len, &node->size, sizeof(node->size));
 	len += copyToBuffer(buffer + len, &node->flag, sizeof(node->flag));
-	uint32 keyLen = engine->treeMeta.keyLen;
-	uint32 valueLen = engine->treeMeta.valueLen;
-
-	if(nodeType==NODE_TYPE_LINK){
-		for (int i = 0; i < node->size; i++){
-			memcpy(buffer + len, node->keys[i], keyLen);
-			len += keyLen;
-			len += copyToBuffer(buffer + len, &node->children[i], sizeof(node->children[i]));
-		}
-	} else {
-		for (int i = 0; i < node->size; i++){
-			memcpy(buffer + len, node->keys[i], keyLen);
-			len += keyLen;
-			memcpy(buffer + len, node->values[i], valueLen);
-			len += valueLen;
-		}
+	if(IS_KEY_COMPRESSION(engine->flag)){
+		return encodeEntries(engine, nodeType, node->entries, node->size, node->entryLen, buffer);
+	}
+	if(IS_VARIABLE_KEY(engine->flag)){
+		return encodeSlottedEntries(engine, node->entries, node->size, node->entryLen, buffer);
 	}
+	//条目已经是数据页格式，buffer为节点自己的页镜像时不需要拷贝
+	if(buffer != (char *)node->page){
+		memcpy(buffer + len, node->entries, (uint64)node->size * node->entryLen);
+	}
+	return len + node->size * node->entryLen;
 }
 
 
@@ -299,65 +581,64 @@ private void bufferToNode(
 	len += parseFromBuffer(buffer + len, &node->nodeVersion, sizeof(node->nodeVersion));
 	len += parseFromBuffer(buffer + len, &node->size, sizeof(node->size));
 	len += parseFromBuffer(buffer + len, &node->flag, sizeof(node->flag));
-
-	uint32 keyLen = engine->treeMeta.keyLen;
-	uint32 valueLen = engine->treeMeta.valueLen;
-	if(nodeType==NODE_TYPE_LINK){
-		for (int i = 0; i < node->size; i++){
-			node->keys[i] = (uint8*)malloc(sizeof(uint8)*engine->treeMeta.keyLen);
-			memcpy(node->keys[i], buffer + len, keyLen);
-			len += keyLen;
-			len += parseFromBuffer(buffer + len, &node->children[i], sizeof(node->children[i]));
+	//损坏的页：条目数超过节点容量
+	if(node->size > engine->treeMeta.degree + 1){
+		node->size = 0;
+	}
+	if(IS_KEY_COMPRESSION(engine->flag)){
+		if(!decodeEntries(engine, node, buffer)){
+			node->size = 0;
 		}
-	} else {
-		for (int i = 0; i < node->size; i++){
-			node->keys[i] = (uint8 *)malloc(sizeof(uint8) * engine->treeMeta.keyLen);
-			memcpy(node->keys[i], buffer + len, keyLen);
-			len += keyLen;
-			node->values[i] = (uint8 *)malloc(sizeof(uint8) * engine->treeMeta.valueLen);
-			memcpy(node->values[i], buffer + len, valueLen);
-			len += valueLen;
+		return;
+	}
+	if(IS_VARIABLE_KEY(engine->flag)){
+		if(!decodeSlottedEntries(engine, node, buffer)){
+			node->size = 0;
 		}
+		return;
+	}
+	//buffer为节点自己的页镜像时（直接从文件读入）不需要拷贝
+	if(buffer != (char *)node->page){
+		memcpy(node->entries, buffer + len, (uint64)node->size * node->entryLen);
 	}
 }
 
+/*
+ * 文件读写都使用pread/pwrite，不依赖文件偏移：
+ * 持久化线程的写与工作线程的读可以同时使用同一个文件描述符
+ */
+
 private uint64 writePageIndexFile(IndexEngine* engine, uint64 pageId, char *buffer, uint32 len){
-	lseek(engine->wfd, pageId*engine->pageSize, SEEK_SET);
-	return write(engine->wfd, buffer, len);
+	return pwrite(engine->wfd, buffer, len, pageId * engine->pageSize);
 }
 
 private uint64 readPageIndexFile(IndexEngine* engine, uint64 pageId, char *buffer, uint32 len){
-	lseek(engine->rfd, pageId * engine->pageSize, SEEK_SET);
-	return read(engine->rfd, buffer, len);
+	return pread(engine->rfd, buffer, len, pageId * engine->pageSize);
 }
 
 private uint32 writeTypePosition(IndexEngine *engine, uint64 position, void *dest, uint32 len){
 	char* buffer = (char*)malloc(len);
 	copyToBuffer(buffer, dest, len);
-	lseek(engine->wfd, position, SEEK_SET);
-	write(engine->wfd, buffer, len);
+	pwrite(engine->wfd, buffer, len, position);
 	free(buffer);
 	return len;
 }
 
 private uint32 readTypePosition(IndexEngine *engine, uint64 position, void *dest, uint32 len){
 	char *buffer = (char *)malloc(len);
-	lseek(engine->rfd, position, SEEK_SET);
-	read(engine->rfd, buffer, len);
+	pread(engine->rfd, buffer, len, position);
 	parseFromBuffer(buffer, dest, len);
 	free(buffer);
 	return len;
 }
 
 uint32 writeArrayPosition(IndexEngine *engine, uint64 position, char *dest, uint32 len){
-	lseek(engine->wfd, position, SEEK_SET);
-	write(engine->wfd, dest, len);
+	pwrite(engine->wfd, dest, len, position);
 	return len;
 }
 
 uint32 readArrayPosition(IndexEngine *engine, uint64 position, char *dest, uint32 len){
-	lseek(engine->rfd, position, SEEK_SET);
-	read(engine->rfd, dest, len);
+	pread(engine->rfd, dest, len, position);
 	return len;
 }
 
@@ -390,9 +671,8 @@ private void traverseIndexFileByPage(
 {
 	char* buffer = malloc(engine->pageSize);
 	for(uint64 i=0; ; i++){
-		lseek(engine->rfd, i*engine->pageSize, SEEK_SET);
 		memset(buffer, 0, engine->pageSize);
-		if(read(engine->rfd, buffer, engine->pageSize)<=0){
+		if(pread(engine->rfd, buffer, engine->pageSize, i*engine->pageSize)<=0){
 			break;
 		}
 		func(engine, buffer, i, args);
@@ -411,23 +691,67 @@ private void writeIndexEngineMeta(IndexEngine* engine){
  * 私有函数：缓存组件操作
  ******************************************************************************/
 
+/** 一个节点（节点结构和页镜像）占用的内存，按叶子和链接节点中较大者计算 */
+static uint64 getNodeMemorySize(IndexEngine *engine){
+	uint32 dataLen = engine->treeMeta.valueLen > sizeof(uint64) ? engine->treeMeta.valueLen : sizeof(uint64);
+	uint32 entryLen = engine->treeMeta.keyLen + dataLen + (IS_VARIABLE_KEY(engine->flag) ? sizeof(uint16) : 0);
+	uint64 imageLen = NODE_META_SIZE + (uint64)(engine->treeMeta.degree + 1) * entryLen;
+	if(imageLen < engine->pageSize + entryLen){
+		imageLen = engine->pageSize + entryLen;
+	}
+	return sizeof(IndexTreeNode) + imageLen;
+}
+
+/**
+ * 深度为depth的树一次独占模式的增删最多新增的被固定或为脏的帧数：
+ * 每层路径上的节点、分裂出的节点或者合并的兄弟节点，新的根节点，以及叶子链表上的邻居
+ */
+static uint32 getWriteReserveOfDepth(uint32 depth){
+	return 3 * (depth + 1) + 1;
+}
+
+static uint32 getIndexWriteReserve(IndexEngine *engine){
+	return getWriteReserveOfDepth(engine->treeMeta.depth);
+}
+
+/**
+ * 按照最大堆内存和节点大小创建缓冲池,返回0表示成功
+ * 内存分为3份：2份为缓冲池的帧，1份留给持久化中冻结的脏页，
+ * 所以脏帧达到总帧数的1/3时进行持久化，工作中的和冻结的节点总数不超过maxHeapSize能容纳的节点数
+ * maxHeapSize过小时至少使用INDEX_BUFFER_POOL_MIN_FRAMES个节点，
+ * 缓冲池至少能完成深度为INDEX_BUFFER_POOL_MIN_DEPTH（已有的树更深时为其深度）的树的一次增删
+ * 帧数之后不再改变：所有帧都被固定或为脏时等待或者冻结脏页，而不是扩大缓冲池
+ */
+static int32 initIndexBufferPool(IndexEngine *engine){
+	uint64 total = engine->cache.maxHeapSize / getNodeMemorySize(engine);
+	if(total < INDEX_BUFFER_POOL_MIN_FRAMES){
+		total = INDEX_BUFFER_POOL_MIN_FRAMES;
+	}
+	if(total > 0x7fffffffu){
+		total = 0x7fffffffu;
+	}
+	engine->cache.dirtyLimit = total / 3;
+	uint64 capacity = total - engine->cache.dirtyLimit;
+	uint32 minCapacity = getWriteReserveOfDepth(
+		engine->treeMeta.depth > INDEX_BUFFER_POOL_MIN_DEPTH ? engine->treeMeta.depth : INDEX_BUFFER_POOL_MIN_DEPTH);
+	if(capacity < minCapacity){
+		capacity = minCapacity;
+	}
+	engine->cache.bufferPool = makeBufferPool(capacity, sizeof(engine->treeMeta.root));
+	return engine->cache.bufferPool == NULL ? -1 : 0;
+}
+
 /** 根据最大堆内存大小，创建引擎需要用到的缓存,返回0表示成功 */
 static int32 initIndexCache(IndexEngine* engine, uint64 maxHeapSize){
-	if(maxHeapSize/3 <= 32){
-		return -1;
-	}
-	uint32 capacity = (maxHeapSize/3 - 32) / (32/3+56+engine->treeMeta.keyLen+engine->treeMeta.valueLen);
-	if(capacity<3){
+	engine->cache.maxHeapSize = maxHeapSize;
+	if(initIndexBufferPool(engine)!=0){
 		return -1;
 	}
-	engine->cache.unchangeCache = makeLRUCache(capacity, sizeof(engine->treeMeta.root));
-	engine->cache.changeCacheWork = makeLRUCache(capacity, sizeof(engine->treeMeta.root));
-	engine->cache.changeCacheFreeze = makeLRUCache(capacity, sizeof(engine->treeMeta.root));
-	//一个将changeCache的淘汰上线设置为无限
-	engine->cache.changeCacheWork->capacity = MAX_UINT32;
-	engine->cache.changeCacheFreeze->capacity = MAX_UINT32;
+	//冻结的节点来自缓冲池的脏帧，不会超过缓冲池的帧数，所以不会发生淘汰
+	engine->cache.changeCacheFreeze = makeLRUCache(engine->cache.bufferPool->capacity, sizeof(engine->treeMeta.root));
 	//List
 	engine->cache.abandonedPageFreeze = makeList();
+	engine->cache.abandonedPagePersistence = makeList();
 	engine->cache.abandonedPageWork = makeList();
 	engine->cache.status = 0;
 	engine->cache.statusCond = malloc(sizeof(*engine->cache.statusCond));
@@ -438,14 +762,51 @@ static int32 initIndexCache(IndexEngine* engine, uint64 maxHeapSize){
 	pthread_mutexattr_init(engine->cache.statusAttr);
 	pthread_mutexattr_settype(engine->cache.statusAttr, PTHREAD_MUTEX_RECURSIVE_NP);
 	pthread_mutex_init(engine->cache.statusMutex, engine->cache.statusAttr);
+	engine->cache.treeLock = malloc(sizeof(*engine->cache.treeLock));
+	engine->cache.poolMutex = malloc(sizeof(*engine->cache.poolMutex));
+	engine->cache.poolCond = malloc(sizeof(*engine->cache.poolCond));
+	pthread_rwlock_init(engine->cache.treeLock, NULL);
+	pthread_mutex_init(engine->cache.poolMutex, NULL);
+	pthread_cond_init(engine->cache.poolCond, NULL);
+	engine->cache.treeExclusive = 0;
+	engine->cache.poolWaiters = 0;
+	engine->cache.structureVersion = 0;
+	engine->cache.keyCompare = getKeyCompare(engine->treeMeta.keyLen);
+	//预读线程在第一次请求预读时创建
+	engine->cache.readAheadPages = INDEX_READ_AHEAD_PAGES;
+	engine->cache.readAheadThread = NULL;
+	engine->cache.readAheadMutex = malloc(sizeof(*engine->cache.readAheadMutex));
+	engine->cache.readAheadCond = malloc(sizeof(*engine->cache.readAheadCond));
+	pthread_mutex_init(engine->cache.readAheadMutex, NULL);
+	pthread_cond_init(engine->cache.readAheadCond, NULL);
+	engine->cache.readAheadPageId = 0;
+	engine->cache.readAheadReverse = 0;
+	engine->cache.readAheadStop = 0;
+	engine->cache.readAheadCnt = 0;
 	return 0;
 }
 
-/** 切换change缓存 */
-static void swapChangeCache(IndexEngine *engine){
-	LRUCache* tmp = engine->cache.changeCacheFreeze;
-	engine->cache.changeCacheFreeze = engine->cache.changeCacheWork;
-	engine->cache.changeCacheWork = tmp;
+/** 释放缓冲池中的节点 */
+static void *freeBufferPoolNode(uint32 frame, uint8 *key, void *value, void *args){
+	freeIndexTreeNode((IndexTreeNode *)value);
+	return NULL;
+}
+
+/** 将缓冲池中的脏帧移入changeCacheFreeze，用于持久化 */
+static void *freezeDirtyNode(uint32 frame, uint8 *key, void *value, void *args){
+	IndexEngine *engine = (IndexEngine *)args;
+	IndexTreeNode *node = (IndexTreeNode *)value;
+	if(engine->cache.bufferPool->frames[frame].dirty){
+		removeBufferPool(engine->cache.bufferPool, key);
+		node->frame = BUFFER_POOL_NIL;
+		putLRUCache(engine->cache.changeCacheFreeze, (uint8 *)&node->pageId, (void *)node);
+	}
+	return NULL;
+}
+
+/** 冻结所有的脏页：移入changeCacheFreeze，之后的修改作用在其拷贝上 */
+static void freezeChangedNodes(IndexEngine *engine){
+	foreachBufferPool(engine->cache.bufferPool, freezeDirtyNode, engine);
 }
 
 //声明
@@ -456,10 +817,47 @@ static void swapAndCreateRedoLog(IndexEngine *engine){
 	engine->cache.redoLogWork = createIndexEngineRedoLog(engine);
 }
 
-/** 添加到changeCacheWork中（若UnchangeCache存在则删除） */
-static void putTochangeCacheWork(IndexEngine* engine, IndexTreeNode* node){
-	removeLRUCache(engine->cache.unchangeCache, (uint8 *)&node->pageId);
-	putLRUCache(engine->cache.changeCacheWork, (uint8 *)&node->pageId, (void *)node);
+/**
+ * 将节点放入缓冲池（固定一次），状态不是OLD的节点为脏帧，被淘汰的节点释放内存
+ * 调用者持有poolMutex
+ * 共享模式下fetchTreeNode已经等到了可用的帧；独占模式下进入前已经预留了一次增删需要的帧（reserveIndexWriteFrames），
+ * 所以放入不会失败，失败时等待其他线程解除固定
+ */
+static void putToBufferPool(IndexEngine *engine, IndexTreeNode *node){
+	IndexTreeNode *eliminateNode = (IndexTreeNode *)putBufferPool(
+		engine->cache.bufferPool, (uint8 *)&node->pageId, (void *)node, &node->frame);
+	while(node->frame==BUFFER_POOL_NIL){
+		engine->cache.poolWaiters++;
+		pthread_cond_wait(engine->cache.poolCond, engine->cache.poolMutex);
+		engine->cache.poolWaiters--;
+		eliminateNode = (IndexTreeNode *)putBufferPool(
+			engine->cache.bufferPool, (uint8 *)&node->pageId, (void *)node, &node->frame);
+	}
+	if(eliminateNode!=NULL){
+		freeIndexTreeNode(eliminateNode);
+	}
+	if(node->status!=NODE_STATUS_OLD){
+		setDirtyBufferPool(engine->cache.bufferPool, node->frame, 1);
+	}
+}
+
+/**
+ * 共享模式下修改叶子节点之前检查：叶子节点已经是脏帧，或者脏帧没有达到上限
+ * 否则由调用者转为独占模式（先冻结脏页），使共享模式下的脏帧不会占满缓冲池
+ */
+static int32 canDirtyLeafShared(IndexEngine *engine, IndexTreeNode *leaf){
+	pthread_mutex_lock(engine->cache.poolMutex);
+	BufferPool *pool = engine->cache.bufferPool;
+	int32 result = pool->frames[leaf->frame].dirty || pool->dirtyCnt < engine->cache.dirtyLimit;
+	pthread_mutex_unlock(engine->cache.poolMutex);
+	return result;
+}
+
+/** 节点被修改：标记为脏帧，持久化之前不会被淘汰 */
+static void markTreeNodeDirty(IndexEngine* engine, IndexTreeNode* node){
+	pthread_mutex_lock(engine->cache.poolMutex);
+	setDirtyBufferPool(engine->cache.bufferPool, node->frame, 1);
+	pthread_mutex_unlock(engine->cache.poolMutex);
 }
 
 /** 将pageId放入废弃页链表 */
@@ -471,10 +869,41 @@ static void putToAbandonedPageFreeze(IndexEngine* engine, uint64 pageId){
 	}
 }
 
-/** 检查进行持久化 */
-static void checkThreadPersistence(IndexEngine* engine){
-	//changeCacheWork满了
-	if(engine->cache.changeCacheWork->size>=engine->cache.unchangeCache->capacity){
+/** 进入索引树：exclusive为0时以共享模式进入，否则以独占模式进入 */
+static void lockIndexTree(IndexEngine* engine, int8 exclusive){
+	if(exclusive){
+		pthread_rwlock_wrlock(engine->cache.treeLock);
+		engine->cache.treeExclusive = 1;
+	} else {
+		pthread_rwlock_rdlock(engine->cache.treeLock);
+	}
+}
+
+/** 离开索引树 */
+static void unlockIndexTree(IndexEngine* engine){
+	if(engine->cache.treeExclusive){
+		engine->cache.treeExclusive = 0;
+	}
+	pthread_rwlock_unlock(engine->cache.treeLock);
+}
+
+/** 缓冲池中可用的帧是否不足以完成一次独占模式的增删 */
+static int32 isIndexBufferPoolLow(IndexEngine *engine){
+	return availableBufferPool(engine->cache.bufferPool) < getIndexWriteReserve(engine);
+}
+
+/** 是否需要冻结脏页：脏帧达到上限，或者缓冲池中可用的帧不足 */
+static int32 needFreezeIndexCache(IndexEngine *engine){
+	BufferPool *pool = engine->cache.bufferPool;
+	return pool->dirtyCnt > 0 && (pool->dirtyCnt >= engine->cache.dirtyLimit || isIndexBufferPoolLow(engine));
+}
+
+/**
+ * 需要时冻结脏页并启动持久化线程，冻结后脏帧重新变为可用的帧
+ * 调用者以独占模式持有treeLock，并且没有被固定的节点；上一次持久化尚未完成时等待（写入的背压）
+ */
+static void checkFreezeIndexCache(IndexEngine* engine){
+	if(needFreezeIndexCache(engine)){
 		//读取缓存状态
 		pthread_cleanup_push((void*)pthread_mutex_unlock, engine->cache.statusMutex);
 		pthread_mutex_lock(engine->cache.statusMutex);
@@ -482,8 +911,9 @@ static void checkThreadPersistence(IndexEngine* engine){
 		while(engine->cache.status!=CACHE_STATUS_NORMAL){
 			pthread_cond_wait(engine->cache.statusCond, engine->cache.statusMutex);
 		}
-		//进行cache切换
-		swapChangeCache(engine);
+		//冻结脏页，之前废弃的页在本次持久化完成后才能重新使用
+		freezeChangedNodes(engine);
+		addListToList(engine->cache.abandonedPagePersistence, engine->cache.abandonedPageFreeze);
 		//将状态切换为持久化
 		engine->cache.status = CACHE_STATUS_PERSISTENCE;
 		//此时版本号增加
@@ -491,7 +921,6 @@ static void checkThreadPersistence(IndexEngine* engine){
 		//必须在上一句的下面：创建新的重做日志并将旧的重做日志备份，等待持久化完成后直接强制退出并删除文件
 		swapAndCreateRedoLog(engine);
 		//不需要进一步检查如下if条件，因为其他线程不会修改条件
-		//engine->cache.changeCacheWork->size>=engine->cache.unchangeCache->capacity
 		pthread_mutex_unlock(engine->cache.statusMutex);
 		pthread_cleanup_pop(0);
 
@@ -506,144 +935,156 @@ static void checkThreadPersistence(IndexEngine* engine){
 	}
 }
 
-private IndexTreeNode* getTreeNodeByPageId(IndexEngine *engine, uint64 pageId, int32 nodeType){
-	if(pageId==0){
-		return NULL;
+/**
+ * 独占模式增删之前预留帧：需要时冻结脏页，调用者以独占模式持有treeLock，并且没有被固定的节点
+ * @return {int32} 0 冻结后可用的帧仍然不足（树的深度增长到缓冲池容纳不下一次增删），不能增删；1 成功
+ */
+static int32 reserveIndexWriteFrames(IndexEngine *engine){
+	checkFreezeIndexCache(engine);
+	return !isIndexBufferPoolLow(engine);
+}
+
+/** 检查进行持久化，调用时不能持有treeLock：冻结脏页时以独占模式进入，此时没有被固定的节点 */
+static void checkThreadPersistence(IndexEngine* engine){
+	if(!needFreezeIndexCache(engine)){
+		return;
 	}
+	lockIndexTree(engine, 1);
+	//其他线程可能已经冻结了脏页
+	checkFreezeIndexCache(engine);
+	unlockIndexTree(engine);
+}
 
-	LRUCache *changeCacheWork = engine->cache.changeCacheWork;
-	LRUCache *changeCacheFreeze = engine->cache.changeCacheFreeze;
-	LRUCache *unchangeCache = engine->cache.unchangeCache;
-	
-	//首先从changeCacheWork中获取
-	IndexTreeNode *result = getLRUCache(changeCacheWork, (uint8 *)&pageId);
-	if(result!=NULL){
-		//可以获取到直接返回
-		return result;
+private void unpinTreeNode(IndexEngine *engine, IndexTreeNode *node){
+	if(node!=NULL && node->frame!=BUFFER_POOL_NIL){
+		pthread_mutex_lock(engine->cache.poolMutex);
+		unpinBufferPool(engine->cache.bufferPool, node->frame);
+		//有线程在等待可用的帧
+		if(engine->cache.poolWaiters>0){
+			pthread_cond_broadcast(engine->cache.poolCond);
+		}
+		pthread_mutex_unlock(engine->cache.poolMutex);
+	}
+}
+
+/**
+ * 选出有效数据所在的页：版本不小于nextNodeVersion的为未完成持久化的数据，否则取版本较大者
+ * @return 0 有效数据在链接页，1 有效数据在影子页
+ */
+static int32 chooseValidPage(IndexEngine *engine, uint64 version, uint64 afterVersion){
+	if(version>=engine->nextNodeVersion){
+		return 1;
+	} else if(afterVersion>=engine->nextNodeVersion){
+		return 0;
+	}
+	return version < afterVersion;
+}
+
+/** 正在从文件读入的节点在缓冲池中的占位value：读入期间不持有poolMutex，其他线程查找到占位时等待读入完成 */
+static IndexTreeNode loadingTreeNode;
+
+/** 在持有poolMutex时等待poolCond：其他线程解除固定或者读入完成 */
+static void waitBufferPool(IndexEngine *engine){
+	engine->cache.poolWaiters++;
+	pthread_cond_wait(engine->cache.poolCond, engine->cache.poolMutex);
+	engine->cache.poolWaiters--;
+}
+
+/**
+ * 在持有poolMutex时获取节点：先查缓冲池，再查冻结的缓存，最后读文件
+ * 共享模式下所有帧都被固定或为脏时，等待其他线程解除固定（等待期间其他线程可能已经读入了该节点，重新查找）；
+ * 共享模式下的增删在脏帧达到上限时转为独占模式（先冻结脏页），所以被阻塞的帧主要是短暂的固定，等待会结束
+ * 读文件和解码时释放poolMutex：先放入占位的帧（被固定，不会被淘汰），读入完成后重新加锁替换为节点
+ */
+static IndexTreeNode* fetchTreeNode(IndexEngine *engine, uint64 pageId, int32 nodeType){
+	BufferPool *pool = engine->cache.bufferPool;
+	IndexTreeNode *result;
+	uint32 frame;
+	for(;;){
+		//首先从缓冲池中获取：一次查找，命中时固定
+		result = (IndexTreeNode *)pinBufferPool(pool, (uint8 *)&pageId, &frame);
+		if(result==&loadingTreeNode){
+			//其他线程正在读入该节点
+			unpinBufferPool(pool, frame);
+			waitBufferPool(engine);
+			continue;
+		}
+		if(result!=NULL){
+			return result;
+		}
+		if(engine->cache.treeExclusive || availableBufferPool(pool)>0){
+			break;
+		}
+		waitBufferPool(engine);
 	}
 
 	//否则判断是否需要在changeCacheFreeze中获取
 	pthread_mutex_lock(engine->cache.statusMutex);
 	//当前处于持久化中的状态，搜索冻结的缓存
 	if(engine->cache.status==CACHE_STATUS_PERSISTENCE){
-		result = getLRUCacheNoChange(changeCacheFreeze, (uint8*)&pageId);
+		result = getLRUCacheNoChange(engine->cache.changeCacheFreeze, (uint8*)&pageId);
 	}
-	//获取到了，将其拷贝插入到unchangeCache
+	//获取到了，将其拷贝放入缓冲池：持久化完成后有效数据在newPageId，下次写入另一页
 	if (result != NULL){
-		IndexTreeNode *copyNode = getLRUCache(unchangeCache, (uint8 *)&result->pageId);
-		if(copyNode==NULL){
-			copyNode = getLRUCache(changeCacheWork, (uint8 *)&result->pageId);
-		}
-		if(copyNode==NULL){
-			copyNode = copyIndexTreeNode(engine, result);
-			copyNode->status = NODE_STATUS_OLD;
-			if(result->type==NODE_STATUS_NEW){
-				//相当于OLD
-				copyNode->pageId = result->pageId;
-				copyNode->newPageId = result->pageId;
-			} else if(result->type==NODE_STATUS_UPDATE) {
-				if(result->pageId==result->newPageId){
-					// 有效数据在：链接节点
-					copyNode->pageId = result->pageId;
-					// copyNode->newPageId = result->after;
-					//添加到废弃链表
-					putToAbandonedPageFreeze(engine, result->after);
-					copyNode->newPageId = 0;
-					copyNode->after = 0;
-					copyNode->status = NODE_STATUS_UPDATE;
-					copyNode->nodeVersion = engine->nextNodeVersion;
-				} else {
-					//有效数据在：影子节点
-					copyNode->pageId = result->pageId;
-					copyNode->newPageId = result->pageId;
-					copyNode->status = NODE_STATUS_UPDATE;
-					copyNode->nodeVersion = engine->nextNodeVersion;
-				}
-			}
-			//状态为为old
-			if(copyNode->status==NODE_STATUS_OLD){
-				putLRUCache(unchangeCache, (uint8 *)&copyNode->pageId, copyNode);
-			} else {
-				putLRUCache(changeCacheWork, (uint8 *)&copyNode->pageId, copyNode);
-			}
-
+		IndexTreeNode *copyNode = copyIndexTreeNode(engine, result);
+		copyNode->status = NODE_STATUS_OLD;
+		if(result->newPageId!=result->pageId){
+			//有效数据在：影子节点
+			copyNode->newPageId = result->pageId;
+		} else {
+			//有效数据在：链接节点
+			copyNode->newPageId = result->after!=0 ? result->after : result->pageId;
 		}
 		result = copyNode;
 	}
 	pthread_mutex_unlock(engine->cache.statusMutex);
 	if (result != NULL){
+		putToBufferPool(engine, result);
 		return result;
 	}
 
-	//从unchangeCache中读取
-	result = getLRUCache(unchangeCache, (uint8*)&pageId);
-	if(result!=NULL){
-		return result;
+	//放入占位的帧后释放poolMutex，从文件中读取：直接读入节点的页镜像，压缩key或变长key时读入临时缓冲再解码
+	IndexTreeNode *eliminateNode = (IndexTreeNode *)putBufferPool(pool, (uint8 *)&pageId, (void *)&loadingTreeNode, &frame);
+	if(eliminateNode!=NULL){
+		freeIndexTreeNode(eliminateNode);
 	}
-
-	//从文件中读取
-	char *buffer = (char *)malloc(sizeof(char) * engine->pageSize);
+	pthread_mutex_unlock(engine->cache.poolMutex);
 	IndexTreeNode *nodes[2]={NULL, NULL};
 	uint64 pageIdBak = pageId;
+	char *pageBuffer = IS_ENCODED_PAGE(engine->flag) ? (char *)malloc(engine->pageSize) : NULL;
 	for(int i=0; i<2 && pageId; i++){
-		readPageIndexFile(engine, pageId, buffer, engine->pageSize);
 		nodes[i] = makeIndexTreeNode(engine, nodeType);
+		char *buffer = pageBuffer != NULL ? pageBuffer : (char *)nodes[i]->page;
+		memset(buffer, 0, NODE_META_SIZE);
+		readPageIndexFile(engine, pageId, buffer, engine->pageSize);
 		bufferToNode(engine, nodes[i], nodeType, buffer);
-		IndexTreeNode *eliminateNode = (IndexTreeNode *)putLRUCache(unchangeCache, (uint8*)&pageId, (void *)result);
-		//发生淘汰，清理内存
-		if(eliminateNode!=NULL){
-			freeIndexTreeNode(eliminateNode);
-		}
 		pageId = nodes[i]->after;
 	}
-	if(nodes[1]==NULL){
-		result = nodes[0];
-	} else {
-		if(nodes[0]->nodeVersion>=engine->nextNodeVersion){
-			result = nodes[1];
-			freeIndexTreeNode(nodes[0]);
-		} else if(nodes[1]->nodeVersion>=engine->nextNodeVersion){
-			result = nodes[0];
-			freeIndexTreeNode(nodes[1]);
-		}
-	}
-	if(result!=NULL){
-		result->pageId = pageIdBak;
-		result->newPageId = pageIdBak;
-		result->after = 0;
-		putLRUCache(unchangeCache, (uint8 *)&result->pageId, result);
-	} else {
-		if (nodes[0]->nodeVersion < nodes[1]->nodeVersion){
-			//有效数据在node[1]：影子节点
-			result = nodes[1];
-			result->pageId = pageIdBak;
-			result->newPageId = pageIdBak;
-			result->after = nodes[0]->after;
-			result->status = NODE_STATUS_UPDATE;
-			result->nodeVersion = engine->nextNodeVersion;
-			freeIndexTreeNode(nodes[0]);
-		} else {
-			//有效数据在node[0]：链接节点
-			result = nodes[0];
-			result->pageId = pageIdBak;
-			// result->newPageId = result->after;
-			// result->after = nodes[0]->after;
-			//添加到废弃链表
-			pthread_mutex_lock(engine->cache.statusMutex);
-			putToAbandonedPageFreeze(engine, result->after);
-			pthread_mutex_unlock(engine->cache.statusMutex);
-			result->newPageId = 0;
-			result->after = 0;
-			result->status = NODE_STATUS_UPDATE;
-			result->nodeVersion = engine->nextNodeVersion;
-			freeIndexTreeNode(nodes[1]);
-		}
-	}
-	if(result->status==NODE_STATUS_OLD){
-		putLRUCache(unchangeCache, (uint8 *)&result->pageId, result);
-	} else {
-		putLRUCache(changeCacheWork, (uint8 *)&result->pageId, result);
+	free(pageBuffer);
+	int32 valid = nodes[1]!=NULL ? chooseValidPage(engine, nodes[0]->nodeVersion, nodes[1]->nodeVersion) : 0;
+	result = nodes[valid];
+	result->pageId = pageIdBak;
+	result->after = nodes[0]->after;
+	//下次修改时写入另一页（无效的一页），与磁盘一致，状态为OLD
+	result->newPageId = valid ? pageIdBak : (result->after!=0 ? result->after : pageIdBak);
+	freeIndexTreeNode(nodes[1 - valid]);
+	//替换占位的帧，唤醒等待读入的线程
+	pthread_mutex_lock(engine->cache.poolMutex);
+	setValueBufferPool(pool, frame, (void *)result);
+	result->frame = frame;
+	if(engine->cache.poolWaiters>0){
+		pthread_cond_broadcast(engine->cache.poolCond);
+	}
+	return result;
+}
+
+private IndexTreeNode* getTreeNodeByPageId(IndexEngine *engine, uint64 pageId, int32 nodeType){
+	if(pageId==0){
+		return NULL;
 	}
+	pthread_mutex_lock(engine->cache.poolMutex);
+	IndexTreeNode *result = fetchTreeNode(engine, pageId, nodeType);
+	pthread_mutex_unlock(engine->cache.poolMutex);
 	return result;
 }
 
@@ -818,10 +1259,11 @@ IndexEngine *makeIndexEngine(
 	//初始化为16k
 	if(pageSize==0) pageSize = 16*1024; 
 	if(maxHeapSize==0) maxHeapSize = 96*1024*1024;
+	//读写都使用pread/pwrite，只需要一个文件描述符
 	int wfd = createIndexFile(filename);
-	int rfd = openIndexFile(filename);
+	int rfd = wfd;
 	//异常情况判断：无法创建文件，或文件不存在
-	if(wfd==-1 || rfd==-1) {
+	if(wfd==-1) {
 		return NULL;
 	}
 	//异常情况2：页大小过小
@@ -917,10 +1359,11 @@ IndexEngine *loadIndexEngine(char *filename, uint64 maxHeapSize,
 							 enum RedoFlushStrategy flushStrategy,
 							 uint64 flushStrategyArg)
 {
+	//读写都使用pread/pwrite，只需要一个文件描述符
 	int rfd = openIndexFile(filename);
-	int wfd = openIndexFile(filename);
+	int wfd = rfd;
 	if (maxHeapSize == 0) maxHeapSize = 96 * 1024 * 1024;
-	if(rfd==-1||wfd==-1) return NULL;
+	if(rfd==-1) return NULL;
 	IndexEngine* engine = (IndexEngine*) calloc(1, sizeof(IndexEngine));
 	engine->rfd = rfd;
 	engine->wfd = wfd;
@@ -936,7 +1379,6 @@ IndexEngine *loadIndexEngine(char *filename, uint64 maxHeapSize,
 	//上次尚未创建完成，直接删除即可
 	if(IS_CREATING(flag)){
 		close(rfd);
-		close(wfd);
 		unlink(filename);
 		free(engine);
 		return NULL;
@@ -1001,20 +1443,138 @@ IndexEngine *loadIndexEngine(char *filename, uint64 maxHeapSize,
 	return engine;
 }
 
+/**
+ * 切换数据页中key的存储格式（压缩key、变长key或定长），只能切换空的索引
+ * 节点的度和条目长度随格式改变，重建缓冲池，返回1表示成功
+ */
+static int32 changeIndexEngineKeyFormat(IndexEngine *engine, int8 isCompression, int8 isVariableKey){
+	IndexTreeMeta *treeMeta = &engine->treeMeta;
+	//只能设置空的、没有未持久化修改的索引
+	pthread_mutex_lock(engine->cache.statusMutex);
+	int32 isEmpty = engine->count == 0 && treeMeta->depth == 1 &&
+					engine->cache.bufferPool->dirtyCnt == 0 &&
+					engine->cache.status == CACHE_STATUS_NORMAL;
+	pthread_mutex_unlock(engine->cache.statusMutex);
+	if(!isEmpty){
+		return 0;
+	}
+	uint32 keyLen = treeMeta->keyLen;
+	uint32 dataLen = 8 > treeMeta->valueLen ? 8 : treeMeta->valueLen;
+	uint32 degree = (engine->pageSize - NODE_META_SIZE) / (keyLen + dataLen);
+	if(isCompression){
+		//分裂后的两个节点都能放入长度上限：至少容纳4个最长的条目以及两份前缀
+		if(4 * (2 + keyLen + dataLen) + 2 * (NODE_META_SIZE + 2 + keyLen) + keyLen + 2 > engine->pageSize){
+			return 0;
+		}
+		//每个条目至少为 restLen + 数据
+		uint32 compressedDegree = (engine->pageSize - NODE_META_SIZE - 2) / (2 + dataLen);
+		if(compressedDegree > degree * INDEX_COMPRESSION_DEGREE_RATIO){
+			compressedDegree = degree * INDEX_COMPRESSION_DEGREE_RATIO;
+		}
+		degree = compressedDegree;
+	}
+	if(isVariableKey){
+		//槽的偏移为2字节；分裂后的两个节点都能放入长度上限：至少容纳4个最长的条目
+		if(engine->pageSize > 0xffff || 4 * (4 + keyLen + dataLen) + 2 * (NODE_META_SIZE + 2) + keyLen + 2 > engine->pageSize){
+			return 0;
+		}
+		//每个条目至少为 槽 + keyLen + 数据
+		uint32 variableDegree = (engine->pageSize - NODE_META_SIZE - 2) / (4 + dataLen);
+		if(variableDegree > degree * INDEX_COMPRESSION_DEGREE_RATIO){
+			variableDegree = degree * INDEX_COMPRESSION_DEGREE_RATIO;
+		}
+		degree = variableDegree;
+	}
+	//节点大小随度和条目长度改变，按照新的格式重建缓冲池，缓冲池中的节点（空的根节点）按照旧的格式分配，丢弃
+	BufferPool *bufferPool = engine->cache.bufferPool;
+	uint32 dirtyLimit = engine->cache.dirtyLimit;
+	uint32 oldDegree = treeMeta->degree;
+	uint32 oldFlag = engine->flag;
+	treeMeta->degree = degree;
+	if(isCompression){
+		SET_KEY_COMPRESSION(engine->flag);
+	} else {
+		CLR_KEY_COMPRESSION(engine->flag);
+	}
+	if(isVariableKey){
+		SET_VARIABLE_KEY(engine->flag);
+	} else {
+		CLR_VARIABLE_KEY(engine->flag);
+	}
+	if(initIndexBufferPool(engine) != 0){
+		treeMeta->degree = oldDegree;
+		engine->flag = oldFlag;
+		engine->cache.bufferPool = bufferPool;
+		engine->cache.dirtyLimit = dirtyLimit;
+		return 0;
+	}
+	foreachBufferPool(bufferPool, freeBufferPoolNode, NULL);
+	freeBufferPool(bufferPool);
+	engine->cache.changeCacheFreeze->capacity = engine->cache.bufferPool->capacity;
+	writeIndexEngineMeta(engine);
+	fsync(engine->wfd);
+	return 1;
+}
+
+int32 setIndexEngineKeyCompression(IndexEngine *engine, int8 isCompression){
+	if(!isCompression == !IS_KEY_COMPRESSION(engine->flag)){
+		return 1;
+	}
+	//与变长key二选一
+	if(isCompression && IS_VARIABLE_KEY(engine->flag)){
+		return 0;
+	}
+	return changeIndexEngineKeyFormat(engine, isCompression, 0);
+}
+
+int32 setIndexEngineVariableKey(IndexEngine *engine, int8 isVariableKey){
+	if(!isVariableKey == !IS_VARIABLE_KEY(engine->flag)){
+		return 1;
+	}
+	if(isVariableKey && IS_KEY_COMPRESSION(engine->flag)){
+		return 0;
+	}
+	return changeIndexEngineKeyFormat(engine, 0, isVariableKey);
+}
+
+void setIndexEngineReadAhead(IndexEngine *engine, uint32 pages){
+	engine->cache.readAheadPages = pages;
+}
+
 void freeIndexEngine(IndexEngine * engine){
 	if(engine->filename!=NULL){
 		free(engine->filename);
 	}
-	if(engine->cache.unchangeCache!=NULL){
-		freeLRUCache(engine->cache.unchangeCache);
-		freeLRUCache(engine->cache.changeCacheWork);
+	if(engine->cache.bufferPool!=NULL){
+		//先让预读线程退出：预读线程会访问缓冲池和文件
+		pthread_mutex_lock(engine->cache.readAheadMutex);
+		engine->cache.readAheadStop = 1;
+		pthread_cond_signal(engine->cache.readAheadCond);
+		pthread_mutex_unlock(engine->cache.readAheadMutex);
+		if(engine->cache.readAheadThread!=NULL){
+			pthread_join(*engine->cache.readAheadThread, NULL);
+			free(engine->cache.readAheadThread);
+		}
+		pthread_mutex_destroy(engine->cache.readAheadMutex);
+		pthread_cond_destroy(engine->cache.readAheadCond);
+		free(engine->cache.readAheadMutex);
+		free(engine->cache.readAheadCond);
+		foreachBufferPool(engine->cache.bufferPool, freeBufferPoolNode, NULL);
+		freeBufferPool(engine->cache.bufferPool);
 		freeLRUCache(engine->cache.changeCacheFreeze);
 		freeList(engine->cache.abandonedPageWork);
 		freeList(engine->cache.abandonedPageFreeze);
+		freeList(engine->cache.abandonedPagePersistence);
 		free(engine->cache.statusCond);
 		free(engine->cache.statusMutex);
 		free(engine->cache.statusAttr);
 		free(engine->cache.persistenceThread);
+		pthread_rwlock_destroy(engine->cache.treeLock);
+		pthread_mutex_destroy(engine->cache.poolMutex);
+		pthread_cond_destroy(engine->cache.poolCond);
+		free(engine->cache.treeLock);
+		free(engine->cache.poolMutex);
+		free(engine->cache.poolCond);
 	}
 	free(engine);
 }
@@ -1024,6 +1584,158 @@ void freeIndexEngine(IndexEngine * engine){
  * 私有函数：增删改查辅助函数
  ******************************************************************************/
 
+/** 节点第i个条目的key */
+static uint8 *nodeKey(IndexTreeNode *node, int32 i){
+	return node->entries + (uint64)i * node->entryLen;
+}
+
+/** 叶子节点第i个条目的value */
+static uint8 *nodeValue(IndexEngine *engine, IndexTreeNode *node, int32 i){
+	return nodeKey(node, i) + engine->treeMeta.keyLen;
+}
+
+/** 链接节点第i个孩子的页号 */
+static uint64 nodeChild(IndexEngine *engine, IndexTreeNode *node, int32 i){
+	uint64 child;
+	parseFromBuffer((char *)nodeKey(node, i) + engine->treeMeta.keyLen, &child, sizeof(child));
+	return child;
+}
+
+/** 设置节点第i个条目的key */
+static void setNodeKey(IndexEngine *engine, IndexTreeNode *node, int32 i, uint8 *key){
+	memcpy(nodeKey(node, i), key, engine->treeMeta.keyLen);
+	setEntryKeyLen(engine, nodeKey(node, i), node->entryLen);
+}
+
+/**
+ * 在节点的第i个位置插入一个条目，之后的条目后移，size加1
+ * @param data 叶子节点为value，链接节点为孩子页号（uint64*，主机字节序）
+ */
+static void insertNodeEntry(IndexEngine *engine, IndexTreeNode *node, int32 i, uint8 *key, void *data){
+	uint32 keyLen = engine->treeMeta.keyLen;
+	uint8 *entry = nodeKey(node, i);
+	memmove(entry + node->entryLen, entry, (uint64)(node->size - i) * node->entryLen);
+	memcpy(entry, key, keyLen);
+	if(node->type == NODE_TYPE_LINK){
+		copyToBuffer((char *)entry + keyLen, data, sizeof(uint64));
+	} else {
+		memcpy(entry + keyLen, data, engine->treeMeta.valueLen);
+	}
+	setEntryKeyLen(engine, entry, node->entryLen);
+	node->size++;
+}
+
+/** 删除节点从第i个开始的len个条目，之后的条目前移 */
+static void deleteNodeEntries(IndexTreeNode *node, int32 i, uint32 len){
+	memmove(nodeKey(node, i), nodeKey(node, i + len), (uint64)(node->size - i - len) * node->entryLen);
+	node->size -= len;
+}
+
+/** 将src从第srcIdx开始的len个条目插入到dest的第destIdx个位置 */
+static void moveNodeEntries(IndexTreeNode *dest, int32 destIdx, IndexTreeNode *src, int32 srcIdx, uint32 len){
+	uint8 *entry = nodeKey(dest, destIdx);
+	memmove(entry + (uint64)len * dest->entryLen, entry, (uint64)(dest->size - destIdx) * dest->entryLen);
+	memcpy(entry, nodeKey(src, srcIdx), (uint64)len * src->entryLen);
+	dest->size += len;
+}
+
+/** 节点是否需要分裂：条目数超过度，或者压缩key（变长key）时编码后超过长度上限 */
+static int32 isNodeOverflow(IndexEngine *engine, IndexTreeNode *node){
+	if(node->size > engine->treeMeta.degree){
+		return 1;
+	}
+	if(!IS_ENCODED_PAGE(engine->flag)){
+		return 0;
+	}
+	uint32 limit = getEncodedLimit(engine);
+	//不压缩也放得下时不需要逐个计算
+	if(NODE_META_SIZE + 2 + engine->treeMeta.keyLen + (uint64)node->size * (2 + node->entryLen) <= limit){
+		return 0;
+	}
+	EntrySeq seq = {node->entries, node->size, NULL, 0, node->entryLen};
+	return getSeqEncodedLen(engine, node->type, &seq, 0, node->size) > limit;
+}
+
+/** 删除后节点是否过空：条目数少于度的一半，或者压缩key（变长key）时编码后少于长度上限的一半 */
+static int32 isNodeUnderflow(IndexEngine *engine, IndexTreeNode *node){
+	if(!IS_ENCODED_PAGE(engine->flag)){
+		return node->size < (engine->treeMeta.degree + 1) / 2;
+	}
+	EntrySeq seq = {node->entries, node->size, NULL, 0, node->entryLen};
+	return getSeqEncodedLen(engine, node->type, &seq, 0, node->size) < getEncodedLimit(engine) / 2;
+}
+
+/** 相邻的两个节点能否合并为一个节点 */
+static int32 canMergeNodes(IndexEngine *engine, IndexTreeNode *left, IndexTreeNode *right){
+	uint32 size = left->size + right->size;
+	if(!IS_ENCODED_PAGE(engine->flag)){
+		return size < engine->treeMeta.degree + 1;
+	}
+	if(size > engine->treeMeta.degree){
+		return 0;
+	}
+	EntrySeq seq = {left->entries, left->size, right->entries, right->size, left->entryLen};
+	return getSeqEncodedLen(engine, left->type, &seq, 0, size) <= getEncodedLimit(engine);
+}
+
+/**
+ * 父节点中指向right的分隔key：right的第一个key
+ * 压缩key（变长key）时叶子节点使用与左边相邻节点之间最短的分隔key（后缀截断）
+ */
+static void getSeparatorKey(IndexEngine *engine, IndexTreeNode *left, IndexTreeNode *right, uint8 *separator){
+	if(IS_ENCODED_PAGE(engine->flag) && right->type == NODE_TYPE_LEAF && left->size > 0){
+		makeSeparatorKey(engine->treeMeta.keyLen, nodeKey(left, left->size - 1), nodeKey(right, 0), separator);
+	} else {
+		memcpy(separator, nodeKey(right, 0), engine->treeMeta.keyLen);
+	}
+}
+
+/** 参与比较的key长度：变长key时为去掉末尾0之后的长度，否则为keyLen，每次查找只计算一次 */
+static uint32 getSearchKeyLen(IndexEngine *engine, uint8 *key){
+	uint32 keyLen = engine->treeMeta.keyLen;
+	return IS_VARIABLE_KEY(engine->flag) ? getTrimmedKeyLen(key, keyLen) : keyLen;
+}
+
+/**
+ * 比较节点第i个key与key，keyLen为getSearchKeyLen得到的长度
+ * 变长key时只比较两者的实际长度：公共部分相等时较短的key较小（补0之后较长的key在后面有非0字节）
+ */
+static int32 compareNodeKey(IndexEngine *engine, IndexTreeNode *node, int32 i, uint8 *key, uint32 keyLen){
+	uint8 *entry = nodeKey(node, i);
+	if(!IS_VARIABLE_KEY(engine->flag)){
+		return engine->cache.keyCompare(keyLen, entry, key);
+	}
+	uint32 entryKeyLen = getEntryKeyLen(entry, node->entryLen);
+	int32 result = memcmp(entry, key, entryKeyLen < keyLen ? entryKeyLen : keyLen);
+	return result != 0 ? result : (int32)entryKeyLen - (int32)keyLen;
+}
+
+/**
+ * 找到节点中第一个不小于key的元素下标，不存在时返回size
+ * 每轮固定折半，比较结果只用于选择下一轮的起点（编译为条件传送），循环中没有依赖比较结果的分支
+ * 定长的1/2/4/8字节key：待查key只读取一次，节点中的key按大端整数读出直接比较
+ */
+static int32 lowerBoundNode(IndexEngine *engine, IndexTreeNode *node, uint8 *key, uint32 keyLen){
+	int32 base = 0, n = node->size;
+	if(!IS_VARIABLE_KEY(engine->flag) && IS_WORD_KEY_LEN(keyLen)){
+		uint64 target = loadKeyWord(keyLen, key);
+		uint8 *entries = node->entries;
+		uint64 entryLen = node->entryLen;
+		while(n>1){
+			int32 half = n>>1;
+			base = loadKeyWord(keyLen, entries + (base + half) * entryLen) < target ? base + half : base;
+			n -= half;
+		}
+		return base + (loadKeyWord(keyLen, entries + base * entryLen) < target);
+	}
+	while(n>1){
+		int32 half = n>>1;
+		base = compareNodeKey(engine, node, base + half, key, keyLen) < 0 ? base + half : base;
+		n -= half;
+	}
+	return base + (compareNodeKey(engine, node, base, key, keyLen) < 0);
+}
+
 /**
  * 针对B+树的一个节点的keys做二分查找
  * 找到小于等于key的第一个元素的下标，若不存在返回-1
@@ -1032,101 +1744,244 @@ void freeIndexEngine(IndexEngine * engine){
  * key分别为     1  2 5 6 7 8 9 10
  * 则返回值分别为 -1 -1 0 1 2 2 3 3
  * 
+ * @param engine IndexEngine
  * @param root   B+树的一个节点
  * @param key    待查找的key字节数组的指针
- * @param keyLen 带查找的key字节数组的长度
+ * @param keyLen 带查找的key参与比较的长度（getSearchKeyLen）
  * @return root->keys中第一个小于等于key的元素下标，若不存在返回-1
  */
-private int32 binarySearchNode(IndexTreeNode* root, uint8* key, uint32 keyLen){
+private int32 binarySearchNode(IndexEngine *engine, IndexTreeNode* root, uint8* key, uint32 keyLen){
 	if(root->size==0){
 		return -1;
 	}
-	int32 left = 0, right = root->size- 1, mid;
-	int32 result;
-	while(left<right){
-		mid = (left+right)>>1;
-		result = byteArrayCompare(keyLen, root->keys[mid], key);
-		if(result==0){ //keys[mid]==key
-			right=mid;
-		} else if(result<0){ //keys[mid]<key
-			left=mid+1;
-		} else { //keys[mid]>key
-			right=mid-1;
+	int32 index = lowerBoundNode(engine, root, key, keyLen);
+	if(index<root->size && compareNodeKey(engine, root, index, key, keyLen)==0){
+		return index;
+	}
+	return index-1;
+}
+
+/** 只读取页的元数据（兄弟指针、影子页、版本），预读时用于沿叶子链表前进 */
+static void readPageMeta(IndexEngine *engine, uint64 pageId, IndexTreeNode *node){
+	char buffer[NODE_META_SIZE];
+	memset(buffer, 0, NODE_META_SIZE);
+	readPageIndexFile(engine, pageId, buffer, NODE_META_SIZE);
+	int len = 0;
+	len += parseFromBuffer(buffer + len, &node->prev, sizeof(node->prev));
+	len += parseFromBuffer(buffer + len, &node->next, sizeof(node->next));
+	len += parseFromBuffer(buffer + len, &node->after, sizeof(node->after));
+	len += parseFromBuffer(buffer + len, &node->nodeVersion, sizeof(node->nodeVersion));
+}
+
+/**
+ * 预读一个叶子节点，返回沿预读方向的下一个叶子节点的页号
+ * 在缓冲池中的节点不需要读文件，直接取兄弟指针；否则读取链接页和影子页的元数据，
+ * 对两页调用posix_fadvise让操作系统在后台读入，再从有效的一页取兄弟指针
+ * 不持有锁读取的元数据可能已经过期，只作为提示：最坏情况下预读了无用的页
+ */
+static uint64 readAheadLeafNode(IndexEngine *engine, uint64 pageId, int8 reverse){
+	if(pageId>=engine->nextPageId){
+		return 0;
+	}
+	//缓冲池可能在独占模式下不加poolMutex修改，查找时需要以共享模式进入索引树
+	uint64 sibling = 0;
+	uint32 frame = BUFFER_POOL_NIL;
+	lockIndexTree(engine, 0);
+	pthread_mutex_lock(engine->cache.poolMutex);
+	IndexTreeNode *node = (IndexTreeNode *)pinBufferPool(engine->cache.bufferPool, (uint8 *)&pageId, &frame);
+	if(node!=NULL){
+		unpinBufferPool(engine->cache.bufferPool, frame);
+		//其他线程正在读入：按照不在缓冲池中处理
+		if(node==&loadingTreeNode){
+			node = NULL;
+		} else {
+			sibling = reverse ? node->prev : node->next;
 		}
 	}
-	result = byteArrayCompare(keyLen, root->keys[left], key);
-	if (result>0){
-		return left-1;
+	pthread_mutex_unlock(engine->cache.poolMutex);
+	unlockIndexTree(engine);
+	if(node!=NULL){
+		return sibling;
 	}
-	return left;
+
+	IndexTreeNode meta[2];
+	readPageMeta(engine, pageId, &meta[0]);
+	posix_fadvise(engine->rfd, pageId * engine->pageSize, engine->pageSize, POSIX_FADV_WILLNEED);
+	int32 valid = 0;
+	if(meta[0].after!=0 && meta[0].after<engine->nextPageId){
+		readPageMeta(engine, meta[0].after, &meta[1]);
+		posix_fadvise(engine->rfd, meta[0].after * engine->pageSize, engine->pageSize, POSIX_FADV_WILLNEED);
+		valid = chooseValidPage(engine, meta[0].nodeVersion, meta[1].nodeVersion);
+	}
+	engine->cache.readAheadCnt++;
+	return reverse ? meta[valid].prev : meta[valid].next;
+}
+
+/** 预读线程：等待预读请求，沿叶子链表预读readAheadPages个叶子节点，有新的请求时放弃当前请求 */
+static void *readAheadTask(void *args){
+	IndexEngine *engine = (IndexEngine *)args;
+	IndexCache *cache = &engine->cache;
+	pthread_mutex_lock(cache->readAheadMutex);
+	while(!cache->readAheadStop){
+		if(cache->readAheadPageId==0){
+			pthread_cond_wait(cache->readAheadCond, cache->readAheadMutex);
+			continue;
+		}
+		uint64 pageId = cache->readAheadPageId;
+		int8 reverse = cache->readAheadReverse;
+		uint32 pages = cache->readAheadPages;
+		cache->readAheadPageId = 0;
+		pthread_mutex_unlock(cache->readAheadMutex);
+		for(uint32 i=0; i<pages && pageId!=0 && cache->readAheadPageId==0 && !cache->readAheadStop; i++){
+			pageId = readAheadLeafNode(engine, pageId, reverse);
+		}
+		pthread_mutex_lock(cache->readAheadMutex);
+	}
+	pthread_mutex_unlock(cache->readAheadMutex);
+	return NULL;
+}
+
+/** 请求从pageId开始预读，预读只是提示：其他线程正在提交请求时直接放弃，不阻塞扫描 */
+static void requestReadAhead(IndexEngine *engine, uint64 pageId, int8 reverse){
+	IndexCache *cache = &engine->cache;
+	if(pageId==0 || pthread_mutex_trylock(cache->readAheadMutex)!=0){
+		return;
+	}
+	if(cache->readAheadThread==NULL && !cache->readAheadStop){
+		cache->readAheadThread = (pthread_t *)malloc(sizeof(pthread_t));
+		if(pthread_create(cache->readAheadThread, NULL, readAheadTask, (void *)engine)!=0){
+			free(cache->readAheadThread);
+			cache->readAheadThread = NULL;
+		}
+	}
+	if(cache->readAheadThread!=NULL){
+		cache->readAheadPageId = pageId;
+		cache->readAheadReverse = reverse;
+		pthread_cond_signal(cache->readAheadCond);
+	}
+	pthread_mutex_unlock(cache->readAheadMutex);
+}
+
+/**
+ * 沿叶子链表前进一步到达leaf后调用：连续前进INDEX_READ_AHEAD_TRIGGER步视为顺序扫描，
+ * 请求预读leaf之后（reverse时之前）的叶子节点，之后每前进半个预读窗口再请求一次，保持预读领先于扫描
+ */
+static void checkLeafReadAhead(IndexEngine *engine, IndexTreeNode *leaf, int8 reverse, int32 *sequence){
+	uint32 pages = engine->cache.readAheadPages;
+	(*sequence)++;
+	if(pages==0 || leaf==NULL || *sequence<INDEX_READ_AHEAD_TRIGGER){
+		return;
+	}
+	uint32 step = pages/2 > 0 ? pages/2 : 1;
+	if((*sequence - INDEX_READ_AHEAD_TRIGGER) % step == 0){
+		requestReadAhead(engine, reverse ? leaf->prev : leaf->next, reverse);
+	}
+}
+
+/**
+ * 固定叶子节点并加读锁，用于读取叶子节点的条目
+ * 共享模式下链接节点和叶子链表指针不会被修改，只有叶子节点的条目可能被并发修改
+ */
+static IndexTreeNode *getLeafNodeShared(IndexEngine *engine, uint64 pageId){
+	IndexTreeNode *leaf = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LEAF);
+	if(leaf!=NULL){
+		pthread_rwlock_rdlock(&leaf->latch);
+	}
+	return leaf;
+}
+
+/** 释放加锁的叶子节点：解锁并解除固定，leaf可以为NULL */
+static void releaseLeafNode(IndexEngine *engine, IndexTreeNode *leaf){
+	if(leaf!=NULL){
+		pthread_rwlock_unlock(&leaf->latch);
+		unpinTreeNode(engine, leaf);
+	}
+}
+
+/**
+ * 获取leaf的后继（reverse时为前驱）叶子节点并释放leaf，用于沿叶子链表遍历
+ * sequence记录本次遍历连续前进的步数，用于检测顺序扫描并触发预读
+ */
+static IndexTreeNode *switchLeafNode(IndexEngine *engine, IndexTreeNode *leaf, int8 reverse, int32 *sequence){
+	IndexTreeNode *next = getLeafNodeShared(engine, reverse ? leaf->prev : leaf->next);
+	releaseLeafNode(engine, leaf);
+	checkLeafReadAhead(engine, next, reverse, sequence);
+	return next;
 }
 
 /**
  * 在叶子节点中查找所有满足条件的value，放到List中
  * @param engine
  * @param key
- * @param leaf
+ * @param leaf getLeafNodeShared获取的叶子节点，返回前释放
  * @return {List} 一个包含数据的链表
  */
 private List* getLeafNodeValues(IndexEngine *engine, uint8 *key, IndexTreeNode* leaf){
 	int32 quickReturn = 0;
 	List *result = makeList();
 	IndexTreeMeta* treeMeta = &engine->treeMeta;
+	uint32 searchLen = getSearchKeyLen(engine, key);
 	int32 idx=-1;
+	int32 sequence = 0;
 	uint8 *value = NULL;
 	do {
-		idx = binarySearchNode(leaf, key, treeMeta->keyLen);
+		idx = binarySearchNode(engine, leaf, key, searchLen);
 		if (idx == -1){
-			return result;
+			break;
 		}
 		//找到了第一个相等的元素
-		if(0==byteArrayCompare(treeMeta->keyLen, leaf->keys[idx] , key)){
+		if(0==compareNodeKey(engine, leaf, idx, key, searchLen)){
 			if(!quickReturn){
 				quickReturn = 1;
 			}
 			for (int i = idx; i < leaf->size; i++){
-				if(i==idx || 0==byteArrayCompare(treeMeta->keyLen, leaf->keys[i] , key)){
+				if(i==idx || 0==compareNodeKey(engine, leaf, i, key, searchLen)){
 					value = (uint8 *)malloc(treeMeta->valueLen);
-					memcpy(value, leaf->values[i], treeMeta->valueLen);
+					memcpy(value, nodeValue(engine, leaf, i), treeMeta->valueLen);
 					addList(result, (void*)value);
 				} else {
+					releaseLeafNode(engine, leaf);
 					return result;
 				}
 			}
 		} else {
 			if(quickReturn || (idx!=leaf->size-1)){
-				return result;
+				break;
 			}
 		}
-	} while ((leaf=getTreeNodeByPageId(engine, leaf->next, NODE_TYPE_LEAF))!=NULL);
+	} while ((leaf=switchLeafNode(engine, leaf, 0, &sequence))!=NULL);
+	releaseLeafNode(engine, leaf);
 	return result;
 }
 
 static List* getLeafNodeValueByLTOrGT(IndexEngine *engine, uint64 pageId, int32 idx, uint8 relOp){
 	List *result = makeList();
-	IndexTreeNode* leaf = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LEAF);
+	IndexTreeNode* leaf = getLeafNodeShared(engine, pageId);
 	if(leaf==NULL){
 		return result;
 	}
 	IndexTreeMeta *treeMeta = &engine->treeMeta;
 	uint8 *value = NULL;
+	int32 sequence = 0;
+	//释放锁之后叶子节点可能被并发删除了条目
+	if(relOp==RELOP_LT && idx > (int32)leaf->size - 1){
+		idx = leaf->size - 1;
+	}
 	do {
 		if(relOp==RELOP_LT){ // key < ${key}
 			for (int i = idx; i >= 0; i--) {
 				value = (uint8 *)malloc(treeMeta->valueLen);
-				memcpy(value, leaf->values[i], treeMeta->valueLen);
+				memcpy(value, nodeValue(engine, leaf, i), treeMeta->valueLen);
 				addList(result, (void *)value);
 			}
-			pageId = leaf->prev;
 		} else if(relOp==RELOP_GT) {
 			for (int i = idx; i < leaf->size; i++) {
 				value = (uint8 *)malloc(treeMeta->valueLen);
-				memcpy(value, leaf->values[i], treeMeta->valueLen);
+				memcpy(value, nodeValue(engine, leaf, i), treeMeta->valueLen);
 				addList(result, (void *)value);
 			}
-			pageId = leaf->next;
 		}
-		if((leaf = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LEAF)) == NULL){
+		if((leaf = switchLeafNode(engine, leaf, relOp==RELOP_LT, &sequence)) == NULL){
 			break;
 		}
 		if(relOp==RELOP_LT){ // key < ${key}
@@ -1149,14 +2004,16 @@ static List* getLeafNodeValueByGT(IndexEngine *engine, uint64 pageId, int32 idx)
 private List* getLeafNodeValuesByCondition(IndexEngine *engine, uint8 *key, uint8 relOp, IndexTreeNode* leaf){
 	List *result = makeList();
 	IndexTreeMeta* treeMeta = &engine->treeMeta;
+	uint32 searchLen = getSearchKeyLen(engine, key);
 	int32 idx=-1;
 	int32 idxRight = -1;
 	uint64 pageIdRight = 0;
 	int32 idxLeft = -1;
 	uint64 pageIdLeft = 0;
 	uint8 *value = NULL;
+	int32 sequence = 0;
 	do {
-		idx = binarySearchNode(leaf, key, treeMeta->keyLen);
+		idx = binarySearchNode(engine, leaf, key, searchLen);
 		// 设置right起始
 		if (idx == -1){
 			idxRight = 0;
@@ -1167,20 +2024,21 @@ private List* getLeafNodeValuesByCondition(IndexEngine *engine, uint8 *key, uint
 			if(idx==-1){
 				idxLeft = -1;
 			} else {
-				if(0 == byteArrayCompare(treeMeta->keyLen, leaf->keys[idx], key)){
+				if(0 == compareNodeKey(engine, leaf, idx, key, searchLen)){
 					idxLeft = idx-1;
 				} else {
 					idxLeft = idx;
 				}
 			}
 			if(idxLeft==-1){
-				IndexTreeNode* left = getTreeNodeByPageId(engine, leaf->prev, NODE_TYPE_LEAF);
+				IndexTreeNode* left = getLeafNodeShared(engine, leaf->prev);
 				if(left==NULL){
 					idxLeft = -1;
 					pageIdLeft = 0;
 				} else {
 					idxLeft = left->size-1;
 					pageIdLeft = left->pageId;
+					releaseLeafNode(engine, left);
 				}
 			} else {
 				pageIdLeft = leaf->pageId;
@@ -1189,13 +2047,13 @@ private List* getLeafNodeValuesByCondition(IndexEngine *engine, uint8 *key, uint
 		if(idx==-1){
 			break;
 		}
-		if(0==byteArrayCompare(treeMeta->keyLen, leaf->keys[idx] , key)){
+		if(0==compareNodeKey(engine, leaf, idx, key, searchLen)){
 			//如果 idx 等于 key
 			for (int i = idx; i < leaf->size; i++){
-				if(i==idx || 0==byteArrayCompare(treeMeta->keyLen, leaf->keys[i] , key)){
+				if(i==idx || 0==compareNodeKey(engine, leaf, i, key, searchLen)){
 					if(relOp==RELOP_EQ || relOp==RELOP_GTE || relOp==RELOP_LTE){
 						value = (uint8 *)malloc(treeMeta->valueLen);
-						memcpy(value, leaf->values[i], treeMeta->valueLen);
+						memcpy(value, nodeValue(engine, leaf, i), treeMeta->valueLen);
 						addList(result, (void*)value);
 					}
 				} else {
@@ -1204,19 +2062,24 @@ private List* getLeafNodeValuesByCondition(IndexEngine *engine, uint8 *key, uint
 					break;
 				}
 			}
+			//相等的key在本节点中结束，右边从本节点开始，不能再到下一个节点中查找
+			if(pageIdRight == leaf->pageId){
+				break;
+			}
 		} else {
 			// 如果 idx 不等于 key 说明 idx < ley 则 找不到
 			idxRight = idx+1;
 			if(idxRight == leaf->size){
-				IndexTreeNode *right = getTreeNodeByPageId(engine, leaf->next, NODE_TYPE_LEAF);
-				pageIdRight = right->pageId;
+				//最后一个叶子节点：右边没有数据
+				pageIdRight = leaf->next;
 				idxRight = 0;
 			} else {
 				pageIdRight = leaf->pageId;
 			}
 			break;
 		}
-	} while ((leaf=getTreeNodeByPageId(engine, leaf->next, NODE_TYPE_LEAF))!=NULL);
+	} while ((leaf=switchLeafNode(engine, leaf, 0, &sequence))!=NULL);
+	releaseLeafNode(engine, leaf);
 	if (relOp == RELOP_LT || relOp == RELOP_LTE){
 		List* leftList = getLeafNodeValueByLT(engine, pageIdLeft, idxLeft);
 		addListToList(leftList, result);
@@ -1239,18 +2102,16 @@ private List* getLeafNodeValuesByCondition(IndexEngine *engine, uint8 *key, uint
 }
 
 /**
- * 将现有节点分裂成两个节点，返回新创建的节点，平均分配
+ * 将现有节点分裂成两个节点，返回新创建的节点，平均分配（压缩key或变长key时按编码后的字节数平均分配）
  */
 static IndexTreeNode *splitTreeNode(IndexEngine *engine, IndexTreeNode* nowNode, int32 nodeType){
 	IndexTreeNode *newNode = newIndexTreeNode(engine, nodeType);
 	int len = nowNode->size / 2; //此时size == degree+1
-	memcpy(newNode->keys, nowNode->keys+len, sizeof(uint8 *) * (nowNode->size - len));
-	if(NODE_TYPE_LEAF==nodeType){
-		memcpy(newNode->values, nowNode->values+len, sizeof(uint8*) * (nowNode->size-len));
-	} else {
-		memcpy(newNode->children, nowNode->children+len, sizeof(uint64) * (nowNode->size-len));
+	if(IS_ENCODED_PAGE(engine->flag)){
+		EntrySeq seq = {nowNode->entries, nowNode->size, NULL, 0, nowNode->entryLen};
+		len = chooseSeqSplitPoint(engine, nodeType, &seq, nowNode->size);
 	}
-	newNode->size = nowNode->size-len;
+	moveNodeEntries(newNode, 0, nowNode, len, nowNode->size - len);
 	nowNode->size = len;
 	if(nodeType==NODE_TYPE_LEAF){
 		//只有叶子节点才设置链表指针
@@ -1261,65 +2122,86 @@ static IndexTreeNode *splitTreeNode(IndexEngine *engine, IndexTreeNode* nowNode,
 		IndexTreeNode* nextNode = getTreeNodeByPageId(engine, tmp, nodeType);
 		if(nextNode!=NULL){
 			nextNode->prev = newNode->pageId;
+			changeIndexTreeNodeStatus(engine, nextNode, NODE_STATUS_UPDATE);
+			markTreeNodeDirty(engine, nextNode);
+			unpinTreeNode(engine, nextNode);
 		}
 	}
 	return newNode;
 }
 
-/** 递归进行插入及树重建 */
+/** 递归进行插入及树重建，返回分裂出的新节点（被固定）或NULL */
 static IndexTreeNode* insertTo(IndexEngine *engine, uint64 pageId, uint8 *key, uint8 *value, int32 level){
 	IndexTreeMeta *treeMeta = &engine->treeMeta;
+	uint32 searchLen = getSearchKeyLen(engine, key);
 
 	int32 index; 
 	IndexTreeNode *now;
 	//是叶子节点
 	if (level == treeMeta->depth){
 		now = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LEAF);
-		index = binarySearchNode(now, key, treeMeta->keyLen);
-		insertToArray((void **)now->keys, treeMeta->degree + 1, index + 1, (void *)key);
-		insertToArray((void **)now->values, treeMeta->degree + 1, index + 1, (void *)value);
-		now->size++;
+		index = binarySearchNode(engine, now, key, searchLen);
+		insertNodeEntry(engine, now, index + 1, key, value);
 		changeIndexTreeNodeStatus(engine, now, NODE_STATUS_UPDATE);
-		putTochangeCacheWork(engine, now);
-		if (now->size <= treeMeta->degree){ //未满
-			return NULL;
+		markTreeNodeDirty(engine, now);
+		IndexTreeNode *newNode = NULL;
+		if (isNodeOverflow(engine, now)){ //已满
+			newNode = splitTreeNode(engine, now, NODE_TYPE_LEAF);
 		}
-		//已满
-		IndexTreeNode *newNode = splitTreeNode(engine, now, NODE_TYPE_LEAF);
-		putTochangeCacheWork(engine, newNode);
-		
+		unpinTreeNode(engine, now);
 		return newNode;
 	}
+	//now在递归期间保持固定，不会被淘汰
 	now = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LINK);
-	index = binarySearchNode(now, key, treeMeta->keyLen);
+	index = binarySearchNode(engine, now, key, searchLen);
 	if(index==-1){
-		now->keys[0] = key;
+		setNodeKey(engine, now, 0, key);
+		changeIndexTreeNodeStatus(engine, now, NODE_STATUS_UPDATE);
+		markTreeNodeDirty(engine, now);
 		index++;
 	}
-	uint64 next = now->children[index];
+	uint64 next = nodeChild(engine, now, index);
 	IndexTreeNode *result = insertTo(engine, next, key, value, level + 1);
 	//非叶子节点后续处理
 	if(result==NULL){
+		unpinTreeNode(engine, now);
 		return NULL;
 	}
-	//防止now被淘汰
-	now = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LINK);
-	uint8 *childKey = malloc(treeMeta->keyLen);
-	memcpy(childKey, result->keys[0], treeMeta->keyLen);
-	insertToArray((void **)now->keys, treeMeta->degree + 1, index + 1, (void *)childKey);
-	insertToArray((void **)now->children, treeMeta->degree + 1, index + 1, (void *)result->pageId);
-	now->size++;
+	IndexTreeNode *left = getTreeNodeByPageId(engine, next, result->type);
+	uint8 *separator = (uint8 *)malloc(treeMeta->keyLen);
+	getSeparatorKey(engine, left, result, separator);
+	insertNodeEntry(engine, now, index + 1, separator, &result->pageId);
+	free(separator);
+	unpinTreeNode(engine, left);
+	unpinTreeNode(engine, result);
 	changeIndexTreeNodeStatus(engine, now, NODE_STATUS_UPDATE);
-	putTochangeCacheWork(engine, now);
-	if(now->size<=treeMeta->degree){ //未满
-		return NULL;
+	markTreeNodeDirty(engine, now);
+	IndexTreeNode *newNode = NULL;
+	if(isNodeOverflow(engine, now)){ //已满
+		newNode = splitTreeNode(engine, now, NODE_TYPE_LINK);
 	}
-	//已满
-	IndexTreeNode *newNode = splitTreeNode(engine, now, NODE_TYPE_LINK);
-	putTochangeCacheWork(engine, newNode);
+	unpinTreeNode(engine, now);
 	return newNode;
 }
 
+/** 在相邻的两个节点之间搬移条目，使left有leftLen个条目 */
+static void moveBetweenSiblings(IndexTreeNode *left, IndexTreeNode *right, uint32 leftLen){
+	uint32 moveLen;
+	if(left->size < leftLen){ //从right向left迁移
+		moveLen = leftLen - left->size;
+		//搬移条目（key和数据）
+		moveNodeEntries(left, left->size, right, 0, moveLen);
+		//删除
+		deleteNodeEntries(right, 0, moveLen);
+	} else if(left->size > leftLen){ //从left向right迁移
+		moveLen = left->size - leftLen;
+		//搬移条目（key和数据）
+		moveNodeEntries(right, 0, left, leftLen, moveLen);
+		//修改计数
+		left->size = leftLen;
+	}
+}
+
 /**
  * 均衡一下index和index+1号孩子的节点数，使树满足B+数的性质
  */
@@ -1328,48 +2210,39 @@ IndexEngine *engine,
 IndexTreeNode *nowNode, 
 IndexTreeNode *idxNode, IndexTreeNode *idx1Node, 
 int32 index , int8 nodeType){
-	IndexTreeMeta* treeMeta = &engine->treeMeta;
 	uint32 idxLen = idxNode->size;
 	uint32 idx1Len = idx1Node->size;
 	uint32 len = (idxLen + idx1Len) / 2;
-	uint32 moveLen;
-	if(idxLen < idx1Len){ //从idx+1向idx迁移
-		moveLen = idx1Len - len;
-		//搬移key
-		batchInsertToArray((void**)idxNode->keys, treeMeta->degree+1, idxLen, (void**)idx1Node->keys, moveLen);
-		//搬移数据
-		if(nodeType==NODE_TYPE_LEAF) 
-			batchInsertToArray((void**)idxNode->values, treeMeta->degree+1, idxLen, (void**)idx1Node->values, moveLen);
-		else 
-			batchInsertToArray((void**)idxNode->children, treeMeta->degree+1, idxLen, (void**)idx1Node->children, moveLen);
-		//删除
-		batchDeleteFromArray((void**)idx1Node->keys, idx1Len, 0, moveLen);
-		if(nodeType==NODE_TYPE_LEAF) batchDeleteFromArray((void**)idx1Node->values, idx1Len, 0, moveLen);
-		else batchDeleteFromArray((void**)idx1Node->children, idx1Len, 0, moveLen);
-		//修改计数
-		idxNode->size += moveLen;
-		idx1Node->size -= moveLen;
-	} else { //从idx向idx+1迁移
-		moveLen = idxLen - len;
-		//搬移key
-		batchInsertToArray((void**)idx1Node->keys, treeMeta->degree+1, 0, (void**)(idxNode->keys+idxLen-moveLen),  moveLen);
-		//搬移数据
-		if(nodeType==NODE_TYPE_LEAF) 
-			batchInsertToArray((void**)idx1Node->values, treeMeta->degree+1, 0, (void**)(idxNode->values+idxLen-moveLen),  moveLen);
-		else 
-			batchInsertToArray((void**)idx1Node->children, treeMeta->degree+1, 0, (void**)(idxNode->children+idxLen-moveLen),  moveLen);
-		//修改计数
-		idxNode->size -= moveLen;
-		idx1Node->size += moveLen;
+	//均衡后idx的条目数
+	uint32 leftLen = idxLen < idx1Len ? idxLen + idx1Len - len : len;
+	if(IS_ENCODED_PAGE(engine->flag)){
+		EntrySeq seq = {idxNode->entries, idxLen, idx1Node->entries, idx1Len, idxNode->entryLen};
+		leftLen = chooseSeqSplitPoint(engine, nodeType, &seq, idxLen + idx1Len);
 	}
+	moveBetweenSiblings(idxNode, idx1Node, leftLen);
 	//修改父亲的key
-	nowNode->keys[index + 1] = idx1Node->keys[0];
+	uint8 *separator = (uint8 *)malloc(engine->treeMeta.keyLen);
+	getSeparatorKey(engine, idxNode, idx1Node, separator);
+	if(IS_ENCODED_PAGE(engine->flag)){
+		//更长的分隔key使父亲超过长度上限：撤销均衡
+		uint8 *oldSeparator = (uint8 *)malloc(engine->treeMeta.keyLen);
+		memcpy(oldSeparator, nodeKey(nowNode, index + 1), engine->treeMeta.keyLen);
+		setNodeKey(engine, nowNode, index + 1, separator);
+		if(isNodeOverflow(engine, nowNode)){
+			setNodeKey(engine, nowNode, index + 1, oldSeparator);
+			moveBetweenSiblings(idxNode, idx1Node, idxLen);
+		}
+		free(oldSeparator);
+	} else {
+		setNodeKey(engine, nowNode, index + 1, separator);
+	}
+	free(separator);
 	changeIndexTreeNodeStatus(engine, nowNode, NODE_STATUS_UPDATE);
 	changeIndexTreeNodeStatus(engine, idxNode, NODE_STATUS_UPDATE);
 	changeIndexTreeNodeStatus(engine, idx1Node, NODE_STATUS_UPDATE);
-	putTochangeCacheWork(engine, nowNode);
-	putTochangeCacheWork(engine, idxNode);
-	putTochangeCacheWork(engine, idx1Node);
+	markTreeNodeDirty(engine, nowNode);
+	markTreeNodeDirty(engine, idxNode);
+	markTreeNodeDirty(engine, idx1Node);
 }
 
 /**
@@ -1381,94 +2254,99 @@ static void mergeIndexTree(
 	IndexTreeNode *idxNode, IndexTreeNode *idx1Node,
 	int32 index, int8 nodeType)
 {
-	IndexTreeMeta *treeMeta = &engine->treeMeta;
 	uint32 idxLen = idxNode->size;
 	uint32 idx1Len = idx1Node->size;
 	//从idx1拷贝到idx
-	batchInsertToArray((void**)idxNode->keys, treeMeta->degree+1, idxLen, (void**)idx1Node->keys, idx1Len);
-	int32 isLeaf = nodeType==NODE_TYPE_LEAF;
-	if(isLeaf)
-		batchInsertToArray((void**)idxNode->values, treeMeta->degree+1, idxLen, (void**)idx1Node->values, idx1Len);
-	else 
-		batchInsertToArray((void**)idxNode->children, treeMeta->degree+1, idxLen, (void**)idx1Node->children, idx1Len);
-	idxNode->size = idxLen+idx1Len;
+	moveNodeEntries(idxNode, idxLen, idx1Node, 0, idx1Len);
 	idxNode->next = idx1Node->next;
-	//清零，防止二次free key或value
 	idx1Node->size = 0;
+	//叶子链表：idx1的后继的前驱改为idx
+	IndexTreeNode *nextNode = nodeType == NODE_TYPE_LEAF ? getTreeNodeByPageId(engine, idxNode->next, nodeType) : NULL;
+	if(nextNode!=NULL){
+		nextNode->prev = idxNode->pageId;
+		changeIndexTreeNodeStatus(engine, nextNode, NODE_STATUS_UPDATE);
+		markTreeNodeDirty(engine, nextNode);
+		unpinTreeNode(engine, nextNode);
+	}
 	//删除父亲中关于idx1的记录
-	deleteFromArray((void**)nowNode->keys, treeMeta->degree+1, index+1);
-	deleteFromArray((void**)nowNode->children, treeMeta->degree+1, index+1);
-	nowNode->size--;
+	deleteNodeEntries(nowNode, index + 1, 1);
 	//将idx1设为删除状态
 	changeIndexTreeNodeStatus(engine, nowNode, NODE_STATUS_UPDATE);
 	changeIndexTreeNodeStatus(engine, idxNode, NODE_STATUS_UPDATE);
 	changeIndexTreeNodeStatus(engine, idx1Node, NODE_STATUS_REMOVE);
-	putTochangeCacheWork(engine, nowNode);
-	putTochangeCacheWork(engine, idxNode);
-	putTochangeCacheWork(engine, idx1Node);
+	markTreeNodeDirty(engine, nowNode);
+	markTreeNodeDirty(engine, idxNode);
+	markTreeNodeDirty(engine, idx1Node);
 }
 
-static int32 removeFrom(IndexEngine *engine, uint64 nowPageId, uint8 *key, uint8 *value, int32 level){
+/**
+ * 递归删除now中等于key的条目，返回删除的数目
+ * 相等的key可能跨越很多孩子：缓冲池中可用的帧不足时不再进入下一个孩子，置interrupted，
+ * 由removeIndexTree在没有固定节点时冻结脏页后继续删除
+ */
+static int32 removeFrom(IndexEngine *engine, uint64 nowPageId, uint8 *key, uint8 *value, int32 level, int8 *interrupted){
 	IndexTreeMeta* treeMeta = &engine->treeMeta;
+	uint32 searchLen = getSearchKeyLen(engine, key);
 	int32 removeCnt=0;
+	int32 visited=0;
 
 	int32 nodeType = level == treeMeta->depth?NODE_TYPE_LEAF:NODE_TYPE_LINK;
 
+	//now在递归期间保持固定，不会被淘汰
 	IndexTreeNode* now = getTreeNodeByPageId(engine, nowPageId, nodeType);
-	for(int32 index = binarySearchNode(now, key, treeMeta->keyLen); index<now->size; index++){
+	for(int32 index = binarySearchNode(engine, now, key, searchLen); index<now->size; index++){
 		//不存在该节点直接返回
-		if (index == -1) return removeCnt;
+		if (index == -1) break;
 		//是叶子节点
 		if (level == treeMeta->depth){
 			//非根节点的叶子节点不能删光了，要留一个
 			//删空的话，回溯不好处理
 			if(treeMeta->depth>1 && now->size<=1){
-				return removeCnt;
+				break;
 			}
 			//找不到该元素
-			if(byteArrayCompare(treeMeta->keyLen, now->keys[index], key)!=0){
-				return removeCnt;
+			if(compareNodeKey(engine, now, index, key, searchLen)!=0){
+				break;
 			}
 			//存在value只删除kv严格相等的数据
-			if(value!=NULL && byteArrayCompare(treeMeta->valueLen, now->values[index], value)!=0){
+			if(value!=NULL && byteArrayCompare(treeMeta->valueLen, nodeValue(engine, now, index), value)!=0){
 				continue;
 			}
-			//释放数据和key占用的内存
-			free(now->keys[index]);
-			free(now->values[index]);
-			deleteFromArray((void**)now->keys, now->size, index);
-			deleteFromArray((void **)now->values, now->size, index);
-			now->size--;
+			//删除条目
+			deleteNodeEntries(now, index, 1);
 			removeCnt++;
 			//修改状态
 			changeIndexTreeNodeStatus(engine, now, NODE_STATUS_UPDATE);
-			putTochangeCacheWork(engine,now);
+			markTreeNodeDirty(engine, now);
 			continue;
 		}
 		//非叶子节点
-		if(byteArrayCompare(treeMeta->keyLen, key, now->keys[index])<0){
+		if(compareNodeKey(engine, now, index, key, searchLen)>0){
 			// key < keys[index] 说明 key对应数据不在index这个孩子下，直接返回
-			return removeCnt;
+			break;
 		}
-		uint64 nextPageId = now->children[index];
+		//至少处理一个孩子，保证每一轮都有进展
+		if(visited++>0 && isIndexBufferPoolLow(engine)){
+			*interrupted = 1;
+			break;
+		}
+		uint64 nextPageId = nodeChild(engine, now, index);
 		int32 nextNodeType = (level+1 == treeMeta->depth)?NODE_TYPE_LEAF:NODE_TYPE_LINK;
 		//递归调用
-		removeCnt += removeFrom(engine, nextPageId, key, value, level + 1);
+		removeCnt += removeFrom(engine, nextPageId, key, value, level + 1, interrupted);
 		//更新当前节点指向next的key
 		IndexTreeNode *next = getTreeNodeByPageId(engine, nextPageId, nextNodeType);
-		//重新获取now防止被淘汰
-		now = getTreeNodeByPageId(engine, nowPageId, nodeType);
-		//判断是否要更新now指向next的key
-		if(byteArrayCompare(treeMeta->keyLen, now->keys[index],next->keys[0])!=0){
-			free(now->keys[index]);
-			newAndCopyByteArray(&now->keys[index], next->keys[0], treeMeta->keyLen);
-			// now->keys[index] = next->keys[0];
+		//判断是否要更新now指向next的key：压缩key（变长key）时分隔key只要不大于next的第一个key即可
+		int32 cmp = engine->cache.keyCompare(treeMeta->keyLen, nodeKey(now, index), nodeKey(next, 0));
+		if(IS_ENCODED_PAGE(engine->flag) ? cmp > 0 : cmp != 0){
+			setNodeKey(engine, now, index, nodeKey(next, 0));
 			changeIndexTreeNodeStatus(engine, now, NODE_STATUS_UPDATE);
-			putTochangeCacheWork(engine, now);
+			markTreeNodeDirty(engine, now);
 		}
-
+		int32 isUnderflow = isNodeUnderflow(engine, next);
+		unpinTreeNode(engine, next);
 		//任然满足B+树的定义
-		if (next->size>=(treeMeta->degree+1)/2){
+		if (!isUnderflow){
 			continue;
 		}
 		int32 idxBak = index;
@@ -1476,224 +2354,756 @@ static int32 removeFrom(IndexEngine *engine, uint64 nowPageId, uint8 *key, uint8
 		if (index>0){
 			index--;
 		}
-		IndexTreeNode *leftNode = getTreeNodeByPageId(engine, now->children[index], nextNodeType);
-		IndexTreeNode *rightNode = getTreeNodeByPageId(engine, now->children[index+1], nextNodeType);
+		IndexTreeNode *leftNode = getTreeNodeByPageId(engine, nodeChild(engine, now, index), nextNodeType);
+		IndexTreeNode *rightNode = getTreeNodeByPageId(engine, nodeChild(engine, now, index+1), nextNodeType);
 		//相邻的两个孩子匀一匀可以满足B+树定义
-		if((leftNode->size+rightNode->size)>=treeMeta->degree+1){
+		if(!canMergeNodes(engine, leftNode, rightNode)){
 			balanceIndexTree(engine, now, leftNode, rightNode,index, nextNodeType);
+			unpinTreeNode(engine, leftNode);
+			unpinTreeNode(engine, rightNode);
 			//说明根now->size没有发生变化，要恢复index
 			index = idxBak;
 			continue;
 		}
 		//相邻的两个孩子不满足B+树定义：合并两个节点
 		mergeIndexTree(engine, now, leftNode, rightNode, index, nextNodeType);
+		unpinTreeNode(engine, leftNode);
+		unpinTreeNode(engine, rightNode);
 		//当前节点已经不满足树的定义了，不能再删了，直接返回
-		if(now->size<(treeMeta->degree+1)/2){
-			return removeCnt;
+		if(isNodeUnderflow(engine, now)){
+			break;
 		}
 		//此时now->size发生了变化所有index要先-1，以抵消for中++的影响
 		index = idxBak-1;
 	}
+	unpinTreeNode(engine, now);
 	return removeCnt;
 }
 
-/*****************************************************************************
- * 公开API：增删改查
- ******************************************************************************/
-List *searchIndexEngine(IndexEngine *engine, uint8 *key){
-	IndexTreeMeta* treeMeta = &engine->treeMeta;
-	IndexTreeNode *node = NULL;
-	uint64 pageId = treeMeta->root;
-	int32 index = 0;
-	//一直查找到叶子节点
-	for(int32 level = 1; level<treeMeta->depth; level++){
-		node = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LINK);
-		index = binarySearchNode(node, key, treeMeta->keyLen);
-		if(index<0){
-			return makeList();
-		}
-		pageId = node->children[index];
+/** 记录一次操作：追加重做日志并更新计数，共享模式下多个线程可能同时调用 */
+static void commitIndexEngineOperate(IndexEngine *engine, OperateTuple *tuple, int32 countDelta){
+	pthread_cleanup_push((void *)pthread_mutex_unlock, engine->cache.statusMutex);
+	pthread_mutex_lock(engine->cache.statusMutex);
+	appendRedoLog(engine->cache.redoLogWork, tuple);
+	engine->count += countDelta;
+	pthread_mutex_unlock(engine->cache.statusMutex);
+	pthread_cleanup_pop(0);
+}
+
+/** 创建删除操作的重做日志 */
+static OperateTuple *makeRemoveOperateTuple(IndexEngine *engine, uint8 *key, uint8 *value){
+	if(value==NULL){
+		return makeIndexEngineOperateTuple(engine, 2, key);
 	}
-	node = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LEAF);
-	return getLeafNodeValues(engine, key, node);
+	return makeIndexEngineOperateTuple(engine, 3, key, value);
 }
 
-List *searchConditionIndexEngine(IndexEngine *engine, uint8 *key, uint8 relOp){
+/**
+ * 从根节点查找key所在的叶子节点，返回的叶子节点被固定并加锁，使用releaseLeafNode释放
+ * 共享模式下链接节点不会被修改，所以路径上的链接节点不需要加锁
+ * @param exclusive 叶子节点加写锁还是读锁
+ * @param unique 不为NULL时：路径上的下一个key与key相等（相等的key可能跨越多个叶子节点）置为0
+ * @return key小于链接节点的第一个key时返回NULL
+ */
+static IndexTreeNode *findLeafNode(IndexEngine *engine, uint8 *key, int8 exclusive, int32 *unique){
 	IndexTreeMeta* treeMeta = &engine->treeMeta;
-	IndexTreeNode *node = NULL;
+	uint32 searchLen = getSearchKeyLen(engine, key);
 	uint64 pageId = treeMeta->root;
-	int32 index = 0;
-	//一直查找到叶子节点
 	for(int32 level = 1; level<treeMeta->depth; level++){
-		node = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LINK);
-		index = binarySearchNode(node, key, treeMeta->keyLen);
+		IndexTreeNode *node = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LINK);
+		int32 index = binarySearchNode(engine, node, key, searchLen);
+		if(index>=0){
+			pageId = nodeChild(engine, node, index);
+			if(unique!=NULL && index+1<node->size && compareNodeKey(engine, node, index+1, key, searchLen)==0){
+				*unique = 0;
+			}
+		}
+		unpinTreeNode(engine, node);
 		if(index<0){
-			return makeList();
+			return NULL;
 		}
-		pageId = node->children[index];
 	}
-	node = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LEAF);
-	return getLeafNodeValuesByCondition(engine, key, relOp, node);
+	IndexTreeNode *leaf = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LEAF);
+	if(exclusive){
+		pthread_rwlock_wrlock(&leaf->latch);
+	} else {
+		pthread_rwlock_rdlock(&leaf->latch);
+	}
+	return leaf;
 }
 
-List *searchAllIndexEngine(IndexEngine *engine, uint8 *key){
-	uint64 pageId = engine->treeMeta.sqt;
-	List* result = makeList();
-	while(pageId!=0){
-		IndexTreeNode *node = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LEAF);
-		for(int i=0; i<node->size; i++){
-			uint8 *value = (uint8 *)malloc(engine->treeMeta.valueLen);
-			memcpy(value, node->values[i], engine->treeMeta.valueLen);
-			addList(result, (void *)value);
+/** 查找key对应的value，调用者持有treeLock */
+static List *searchIndexTree(IndexEngine *engine, uint8 *key){
+	IndexTreeNode *leaf = findLeafNode(engine, key, 0, NULL);
+	if(leaf==NULL){
+		return makeList();
+	}
+	return getLeafNodeValues(engine, key, leaf);
+}
+
+/**
+ * 乐观插入：共享模式下只给目标叶子节点加写锁进行插入
+ * @return {int32} 1 成功，-1 违反唯一约束，0 需要改变树结构（叶子节点分裂或修改链接节点的key），要以独占模式重新插入
+ */
+static int32 insertLeafOptimistic(IndexEngine *engine, uint8 *key, uint8 *value){
+	IndexTreeMeta *treeMeta = &engine->treeMeta;
+	uint32 searchLen = getSearchKeyLen(engine, key);
+	IndexTreeNode *leaf = findLeafNode(engine, key, 1, NULL);
+	if(leaf==NULL){
+		return 0;
+	}
+	int32 result = 1;
+	int32 index = binarySearchNode(engine, leaf, key, searchLen);
+	if(treeMeta->isUnique && index>=0 && compareNodeKey(engine, leaf, index, key, searchLen)==0){
+		//违反唯一约束
+		result = -1;
+	} else if(!canDirtyLeafShared(engine, leaf)){
+		//脏帧达到上限，由独占模式冻结脏页后插入
+		result = 0;
+	} else {
+		insertNodeEntry(engine, leaf, index + 1, key, value);
+		if(isNodeOverflow(engine, leaf)){
+			//撤销插入，由独占模式分裂
+			deleteNodeEntries(leaf, index + 1, 1);
+			result = 0;
+		} else {
+			changeIndexTreeNodeStatus(engine, leaf, NODE_STATUS_UPDATE);
+			markTreeNodeDirty(engine, leaf);
 		}
-		pageId = node->next;
 	}
+	if(result!=0){
+		commitIndexEngineOperate(engine, makeIndexEngineOperateTuple(engine, 1, key, value), result==1);
+	}
+	releaseLeafNode(engine, leaf);
 	return result;
 }
 
-int32 insertIndexEngine(IndexEngine *engine, uint8 *key, uint8 *value){
-	pthread_cleanup_push((void *)pthread_mutex_unlock, engine->cache.statusMutex);
-	pthread_mutex_lock(engine->cache.statusMutex);
-	appendRedoLog(engine->cache.redoLogWork, makeIndexEngineOperateTuple(engine, 1, key, value));
-	pthread_mutex_unlock(engine->cache.statusMutex);
-	pthread_cleanup_pop(0);
+/**
+ * 乐观删除：共享模式下只给目标叶子节点加写锁进行删除
+ * @return {int32} 删除的数目，-1 表示需要改变树结构（叶子节点过空、第一个key改变或相等的key跨越多个叶子节点），要以独占模式重新删除
+ */
+static int32 removeLeafOptimistic(IndexEngine *engine, uint8 *key, uint8 *value){
+	IndexTreeMeta *treeMeta = &engine->treeMeta;
+	uint32 searchLen = getSearchKeyLen(engine, key);
+	int32 unique = 1;
+	IndexTreeNode *leaf = findLeafNode(engine, key, 1, &unique);
+	if(leaf==NULL){
+		commitIndexEngineOperate(engine, makeRemoveOperateTuple(engine, key, value), 0);
+		return 0;
+	}
+	if(!unique){
+		releaseLeafNode(engine, leaf);
+		return -1;
+	}
+	//备份条目，不满足条件时恢复
+	uint32 size = leaf->size;
+	uint8 *backup = (uint8 *)malloc((uint64)size * leaf->entryLen + 1);
+	memcpy(backup, leaf->entries, (uint64)size * leaf->entryLen);
+	int32 removeCnt = 0;
+	int32 index = binarySearchNode(engine, leaf, key, searchLen);
+	for(int32 i = index < 0 ? 0 : index; i<leaf->size && compareNodeKey(engine, leaf, i, key, searchLen)==0;){
+		//存在value只删除kv严格相等的数据
+		if(value!=NULL && byteArrayCompare(treeMeta->valueLen, nodeValue(engine, leaf, i), value)!=0){
+			i++;
+			continue;
+		}
+		deleteNodeEntries(leaf, i, 1);
+		removeCnt++;
+	}
+	if(removeCnt>0){
+		//过空需要合并或均衡；定长key时父亲中的key必须等于第一个key；脏帧达到上限时由独占模式冻结脏页后删除
+		if((treeMeta->depth>1 && (leaf->size==0 || isNodeUnderflow(engine, leaf) ||
+			(!IS_ENCODED_PAGE(engine->flag) && engine->cache.keyCompare(treeMeta->keyLen, nodeKey(leaf, 0), backup)!=0))) ||
+			!canDirtyLeafShared(engine, leaf)){
+			memcpy(leaf->entries, backup, (uint64)size * leaf->entryLen);
+			leaf->size = size;
+			removeCnt = -1;
+		}
+	}
+	free(backup);
+	if(removeCnt>0){
+		changeIndexTreeNodeStatus(engine, leaf, NODE_STATUS_UPDATE);
+		markTreeNodeDirty(engine, leaf);
+	}
+	if(removeCnt>=0){
+		commitIndexEngineOperate(engine, makeRemoveOperateTuple(engine, key, value), -removeCnt);
+	}
+	releaseLeafNode(engine, leaf);
+	return removeCnt;
+}
+
+/** 独占模式下插入，可能分裂节点、更换根节点 */
+static int32 insertIndexTree(IndexEngine *engine, uint8 *key, uint8 *value){
 	IndexTreeMeta* treeMeta = &engine->treeMeta;
+	engine->cache.structureVersion++;
 	//违反唯一约束
 	if (treeMeta->isUnique){
-		List* list =searchIndexEngine(engine, key);
-		if(list->length!=0){
+		List* list = searchIndexTree(engine, key);
+		uint32 length = list->length;
+		freeList(list);
+		if(length!=0){
+			commitIndexEngineOperate(engine, makeIndexEngineOperateTuple(engine, 1, key, value), 0);
 			return -1;
 		}
 	}
-	uint8 *newKey = NULL, *newValue=NULL;
-	newAndCopyByteArray(&newKey, key, engine->treeMeta.keyLen);
-	newAndCopyByteArray(&newValue, value, engine->treeMeta.valueLen);
-	IndexTreeNode *newChild = insertTo(engine, engine->treeMeta.root, newKey, newValue, 1);
+	IndexTreeNode *newChild = insertTo(engine, engine->treeMeta.root, key, value, 1);
 	if (newChild != NULL)
 	{
 		IndexTreeNode *newRoot = newIndexTreeNode(engine, NODE_TYPE_LINK);
 		IndexTreeNode *oldRoot = getTreeRootNode(engine);
-		newAndCopyByteArray(&newRoot->keys[0], oldRoot->keys[0], treeMeta->keyLen);
-		newAndCopyByteArray(&newRoot->keys[1], newChild->keys[0], treeMeta->keyLen);
-		newRoot->children[0] = oldRoot->pageId;
-		newRoot->children[1] = newChild->pageId;
-		newRoot->size = 2;
+		uint8 *separator = (uint8 *)malloc(treeMeta->keyLen);
+		getSeparatorKey(engine, oldRoot, newChild, separator);
+		insertNodeEntry(engine, newRoot, 0, nodeKey(oldRoot, 0), &oldRoot->pageId);
+		insertNodeEntry(engine, newRoot, 1, separator, &newChild->pageId);
+		free(separator);
 		treeMeta->root = newRoot->pageId;
 		treeMeta->depth++;
-		putTochangeCacheWork(engine,newRoot);
+		markTreeNodeDirty(engine, newRoot);
+		unpinTreeNode(engine, oldRoot);
+		unpinTreeNode(engine, newChild);
+		unpinTreeNode(engine, newRoot);
 	}
-	engine->count++; //计数
-	checkThreadPersistence(engine);
+	commitIndexEngineOperate(engine, makeIndexEngineOperateTuple(engine, 1, key, value), 1);
 	return 1;
 }
 
-int32 removeIndexEngine(IndexEngine *engine, uint8 *key, uint8 *value){
-	pthread_cleanup_push((void *)pthread_mutex_unlock, engine->cache.statusMutex);
-	pthread_mutex_lock(engine->cache.statusMutex);
-	if(value==NULL){
-		appendRedoLog(engine->cache.redoLogWork, makeIndexEngineOperateTuple(engine, 2, key));
-	} else {
-		appendRedoLog(engine->cache.redoLogWork, makeIndexEngineOperateTuple(engine, 3, key, value));
-	}
-	pthread_mutex_unlock(engine->cache.statusMutex);
-	pthread_cleanup_pop(0);
-
+/**
+ * 独占模式下删除，可能合并节点、更换根节点
+ * 每一轮之间没有被固定的节点，此时可以冻结脏页：重做日志在删除完成后才记录，恢复时重新删除是幂等的
+ */
+static int32 removeIndexTree(IndexEngine *engine, uint8 *key, uint8 *value){
 	int32 removeCnt = 0;
+	engine->cache.structureVersion++;
 	for(;;){
-		int32 cnt = removeFrom(engine, engine->treeMeta.root, key, value, 1);
+		int8 interrupted = 0;
+		checkFreezeIndexCache(engine);
+		int32 cnt = removeFrom(engine, engine->treeMeta.root, key, value, 1, &interrupted);
 		removeCnt += cnt;
-		if(cnt==0){
+		if(cnt==0 && !interrupted){
 			break;
 		}
 		IndexTreeNode* root = getTreeRootNode(engine);
 		if(root->size==1 && engine->treeMeta.depth>1){
 			//将节点标记为删除
 			changeIndexTreeNodeStatus(engine, root, NODE_STATUS_REMOVE);
-			putTochangeCacheWork(engine, root);
+			markTreeNodeDirty(engine, root);
 			//设置新的root
-			engine->treeMeta.root = root->children[0];
+			engine->treeMeta.root = nodeChild(engine, root, 0);
 			//深度--
 			engine->treeMeta.depth--;
 		}
+		unpinTreeNode(engine, root);
+	}
+	commitIndexEngineOperate(engine, makeRemoveOperateTuple(engine, key, value), -removeCnt);
+	return removeCnt;
+}
+
+/*****************************************************************************
+ * 公开API：增删改查
+ ******************************************************************************/
+List *searchIndexEngine(IndexEngine *engine, uint8 *key){
+	lockIndexTree(engine, 0);
+	List *result = searchIndexTree(engine, key);
+	unlockIndexTree(engine);
+	return result;
+}
+
+List *searchConditionIndexEngine(IndexEngine *engine, uint8 *key, uint8 relOp){
+	lockIndexTree(engine, 0);
+	List *result;
+	IndexTreeNode *leaf = findLeafNode(engine, key, 0, NULL);
+	if(leaf==NULL){
+		result = makeList();
+	} else {
+		result = getLeafNodeValuesByCondition(engine, key, relOp, leaf);
+	}
+	unlockIndexTree(engine);
+	return result;
+}
+
+List *searchAllIndexEngine(IndexEngine *engine, uint8 *key){
+	lockIndexTree(engine, 0);
+	List* result = makeList();
+	int32 sequence = 0;
+	IndexTreeNode *node = getLeafNodeShared(engine, engine->treeMeta.sqt);
+	while(node!=NULL){
+		for(int i=0; i<node->size; i++){
+			uint8 *value = (uint8 *)malloc(engine->treeMeta.valueLen);
+			memcpy(value, nodeValue(engine, node, i), engine->treeMeta.valueLen);
+			addList(result, (void *)value);
+		}
+		node = switchLeafNode(engine, node, 0, &sequence);
+	}
+	unlockIndexTree(engine);
+	return result;
+}
+
+int32 insertIndexEngine(IndexEngine *engine, uint8 *key, uint8 *value){
+	checkThreadPersistence(engine);
+	//先以共享模式只修改叶子节点，需要分裂时再以独占模式插入
+	lockIndexTree(engine, 0);
+	int32 result = insertLeafOptimistic(engine, key, value);
+	unlockIndexTree(engine);
+	if(result==0){
+		lockIndexTree(engine, 1);
+		//预留分裂需要的帧
+		result = reserveIndexWriteFrames(engine) ? insertIndexTree(engine, key, value) : -1;
+		unlockIndexTree(engine);
+	}
+	checkThreadPersistence(engine);
+	return result;
+}
+
+int32 removeIndexEngine(IndexEngine *engine, uint8 *key, uint8 *value){
+	checkThreadPersistence(engine);
+	//先以共享模式只修改叶子节点，需要合并或均衡时再以独占模式删除
+	lockIndexTree(engine, 0);
+	int32 removeCnt = removeLeafOptimistic(engine, key, value);
+	unlockIndexTree(engine);
+	if(removeCnt<0){
+		lockIndexTree(engine, 1);
+		//预留合并需要的帧，删除期间树的深度不会增加，之后每一轮冻结脏页后都足够
+		removeCnt = reserveIndexWriteFrames(engine) ? removeIndexTree(engine, key, value) : -1;
+		unlockIndexTree(engine);
 	}
-	engine->count -= removeCnt; //计数
 	checkThreadPersistence(engine);
 	return removeCnt;
 }
 
 /*****************************************************************************
- * 辅助函数
+ * 公开API：范围游标
  ******************************************************************************/
 
-#ifndef PROFILE_TEST
-void flushIndexEngine(IndexEngine **engines){
-	IndexEngine *engine = engines[0];
-	IndexEngine *freezeEngine = engines[1];
-	uint32 diskFlag = engine->flag;
+/** 节点中key小于（orEqual时小于等于）key的条目数 */
+static int32 countNodeKeysBelow(IndexEngine *engine, IndexTreeNode *node, uint8 *key, int32 orEqual){
+	uint32 searchLen = getSearchKeyLen(engine, key);
+	int32 left = 0, right = node->size;
+	while(left<right){
+		int32 mid = (left+right)>>1;
+		int32 result = compareNodeKey(engine, node, mid, key, searchLen);
+		if(result<0 || (orEqual && result==0)){
+			left = mid+1;
+		} else {
+			right = mid;
+		}
+	}
+	return left;
+}
 
-	//开始持久化
-	//切换到正在持久化状态
-	SET_PERSISTENCE(diskFlag);
-	writeTypePosition(engine, 12, &diskFlag, sizeof(diskFlag));
-	fsync(engine->wfd);
-	LRUCache *freezeCache = engine->cache.changeCacheFreeze;
-	
-	LRUNode* node = freezeCache->head;
-	char *buffer = (char *)malloc(engine->pageSize);
-	while((node=node->next)!=freezeCache->head){
-		IndexTreeNode *treeNode = (IndexTreeNode *)node->value;
-		if(treeNode->newPageId!=0 && treeNode->status!=NODE_STATUS_REMOVE){
-			nodeToBuffer(engine, treeNode, treeNode->type, buffer);
-			uint32 len = NODE_META_SIZE + treeNode->size * (
-				engine->treeMeta.keyLen +
-				(treeNode->type == NODE_TYPE_LINK ? 8 : engine->treeMeta.valueLen)
-			);
-			writePageIndexFile(engine, treeNode->newPageId, buffer, len);
+/**
+ * 在节点中定位游标的起点：正向为第一个在key之后的条目，反向为最后一个在key之前的条目
+ * 链接节点中key不小于孩子的第一个key、不大于下一个孩子的key，所以起点所在的孩子为返回值
+ */
+static int32 searchCursorStart(IndexEngineCursor *cursor, IndexTreeNode *node, uint8 *key, int32 inclusive){
+	if(key==NULL){
+		return cursor->reverse ? (int32)node->size-1 : 0;
+	}
+	int32 cnt = countNodeKeysBelow(cursor->engine, node, key, cursor->reverse ? inclusive : !inclusive);
+	if(node->type==NODE_TYPE_LINK){
+		return cnt>0 ? cnt-1 : 0;
+	}
+	return cursor->reverse ? cnt-1 : cnt;
+}
+
+/** 从根节点定位游标的起点，返回被固定并加读锁的叶子节点，index为叶子节点中的下标（可能越界） */
+static IndexTreeNode *seekIndexEngineCursor(IndexEngineCursor *cursor, int32 *index){
+	IndexEngine *engine = cursor->engine;
+	IndexTreeMeta *treeMeta = &engine->treeMeta;
+	//第一次从边界开始，之后从上次读入的key之后开始
+	uint8 *key = cursor->reverse ? cursor->upper : cursor->lower;
+	int32 inclusive = cursor->reverse ? cursor->upperInclusive : cursor->lowerInclusive;
+	if(cursor->started){
+		key = cursor->lastKey;
+		inclusive = 0;
+	}
+	uint64 pageId = treeMeta->root;
+	for(int32 level = 1; level<treeMeta->depth; level++){
+		IndexTreeNode *node = getTreeNodeByPageId(engine, pageId, NODE_TYPE_LINK);
+		pageId = nodeChild(engine, node, searchCursorStart(cursor, node, key, inclusive));
+		unpinTreeNode(engine, node);
+	}
+	IndexTreeNode *leaf = getLeafNodeShared(engine, pageId);
+	*index = searchCursorStart(cursor, leaf, key, inclusive);
+	return leaf;
+}
+
+/** key是否超出了游标的终点边界 */
+static int32 isBeyondCursorEnd(IndexEngineCursor *cursor, uint8 *key){
+	uint8 *end = cursor->reverse ? cursor->lower : cursor->upper;
+	if(end==NULL){
+		return 0;
+	}
+	int32 result = cursor->engine->cache.keyCompare(cursor->engine->treeMeta.keyLen, key, end);
+	if(cursor->reverse){
+		result = -result;
+	}
+	return result>0 || (result==0 && !(cursor->reverse ? cursor->lowerInclusive : cursor->upperInclusive));
+}
+
+/**
+ * 读入下一批记录：从起点读到叶子节点的末尾，相等的key跨越叶子节点时一并读入，保证下一次可以从lastKey之后开始
+ * 树结构版本没有变化时页号仍然有效，直接在上次停下的叶子节点中定位
+ */
+static void fillIndexEngineCursor(IndexEngineCursor *cursor){
+	IndexEngine *engine = cursor->engine;
+	uint32 keyLen = engine->treeMeta.keyLen;
+	uint32 entryLen = keyLen + engine->treeMeta.valueLen;
+	cursor->size = cursor->offset = 0;
+	lockIndexTree(engine, 0);
+	IndexTreeNode *leaf = NULL;
+	int32 index = 0;
+	if(cursor->started && cursor->structureVersion==engine->cache.structureVersion){
+		leaf = getLeafNodeShared(engine, cursor->pageId);
+		index = searchCursorStart(cursor, leaf, cursor->lastKey, 0);
+	} else {
+		leaf = seekIndexEngineCursor(cursor, &index);
+	}
+	cursor->structureVersion = engine->cache.structureVersion;
+	cursor->started = 1;
+	cursor->pageId = 0;
+	int32 switched = 0;
+	while(leaf!=NULL){
+		if(index<0 || index>=leaf->size){
+			leaf = switchLeafNode(engine, leaf, cursor->reverse, &cursor->sequence);
+			if(leaf!=NULL){
+				index = cursor->reverse ? (int32)leaf->size-1 : 0;
+			}
+			switched = 1;
+			continue;
 		}
-		//更新类型页，设置after字段
-		if(treeNode->status==NODE_STATUS_UPDATE && treeNode->pageId!=treeNode->newPageId){
-			writeTypePosition(
-				engine,
-				treeNode->pageId * engine->pageSize + 16,
-				&treeNode->after,
-				sizeof(treeNode->after));
+		uint8 *key = nodeKey(leaf, index);
+		if(isBeyondCursorEnd(cursor, key) || (cursor->limit!=0 && cursor->count+cursor->size>=cursor->limit)){
+			break;
+		}
+		//已经读完一个叶子节点，并且不会把相等的key分开
+		if(switched && cursor->size>0 && engine->cache.keyCompare(keyLen, key, cursor->lastKey)!=0){
+			cursor->pageId = leaf->pageId;
+			break;
+		}
+		if(cursor->size==cursor->capacity){
+			cursor->capacity *= 2;
+			cursor->buffer = (uint8 *)realloc(cursor->buffer, (uint64)cursor->capacity * entryLen);
 		}
+		uint8 *entry = cursor->buffer + (uint64)cursor->size * entryLen;
+		memcpy(entry, key, keyLen);
+		memcpy(entry + keyLen, nodeValue(engine, leaf, index), entryLen - keyLen);
+		memcpy(cursor->lastKey, key, keyLen);
+		cursor->size++;
+		index += cursor->reverse ? -1 : 1;
+	}
+	releaseLeafNode(engine, leaf);
+	unlockIndexTree(engine);
+}
+
+/** 拷贝边界，NULL表示没有边界 */
+static uint8 *copyCursorBound(IndexEngine *engine, uint8 *bound){
+	if(bound==NULL){
+		return NULL;
 	}
-	//备份磁盘中重要元数据
-	writeMetaBackData(engine);
-	//磁盘状态：切换到切换树状态
-	CLR_PERSISTENCE(diskFlag);
-	SET_SWITCHTREE(diskFlag);
-	writeTypePosition(engine, 12, &diskFlag, sizeof(diskFlag));
-	//确保数据写入
-	fsync(engine->wfd);
-	//完成树切换：将新的元数据可入磁盘
-	writeIndexEngineMeta(freezeEngine);
+	uint8 *result = (uint8 *)malloc(engine->treeMeta.keyLen);
+	memcpy(result, bound, engine->treeMeta.keyLen);
+	return result;
+}
+
+IndexEngineCursor *openIndexEngineCursor(IndexEngine *engine,
+	uint8 *lower, int32 lowerInclusive, uint8 *upper, int32 upperInclusive, int32 reverse, uint64 limit){
+	IndexEngineCursor *cursor = (IndexEngineCursor *)calloc(1, sizeof(IndexEngineCursor));
+	cursor->engine = engine;
+	cursor->lower = copyCursorBound(engine, lower);
+	cursor->lowerInclusive = lowerInclusive;
+	cursor->upper = copyCursorBound(engine, upper);
+	cursor->upperInclusive = upperInclusive;
+	cursor->reverse = reverse;
+	cursor->limit = limit;
+	//初始为一个叶子节点的条目数，相等的key跨越叶子节点时扩容
+	cursor->capacity = engine->treeMeta.degree + 1;
+	cursor->buffer = (uint8 *)malloc((uint64)cursor->capacity * (engine->treeMeta.keyLen + engine->treeMeta.valueLen));
+	cursor->lastKey = (uint8 *)malloc(engine->treeMeta.keyLen);
+	return cursor;
+}
+
+int32 nextIndexEngineCursor(IndexEngineCursor *cursor){
+	if(cursor->limit!=0 && cursor->count>=cursor->limit){
+		return 0;
+	}
+	if(cursor->offset==cursor->size){
+		if(cursor->started && cursor->pageId==0){
+			return 0;
+		}
+		fillIndexEngineCursor(cursor);
+		if(cursor->size==0){
+			return 0;
+		}
+	}
+	uint32 keyLen = cursor->engine->treeMeta.keyLen;
+	cursor->key = cursor->buffer + (uint64)cursor->offset * (keyLen + cursor->engine->treeMeta.valueLen);
+	cursor->value = cursor->key + keyLen;
+	cursor->offset++;
+	cursor->count++;
+	return 1;
+}
+
+void closeIndexEngineCursor(IndexEngineCursor *cursor){
+	free(cursor->lower);
+	free(cursor->upper);
+	free(cursor->buffer);
+	free(cursor->lastKey);
+	free(cursor);
+}
+
+/*****************************************************************************
+ * 公开API：批量构建
+ ******************************************************************************/
+
+/** 将第level层正在填充的节点写入文件，next为下一个叶子节点的页号 */
+static void writeBuilderNode(IndexEngineBuilder *builder, uint32 level, uint64 next){
+	IndexEngine *engine = builder->engine;
+	IndexBuilderLevel *now = &builder->levels[level];
+	uint64 after = 0;
+	uint32 flag = 0;
+	int len = 0;
+	len += copyToBuffer(now->buffer + len, &now->prev, sizeof(now->prev));
+	len += copyToBuffer(now->buffer + len, &next, sizeof(next));
+	len += copyToBuffer(now->buffer + len, &after, sizeof(after));
+	len += copyToBuffer(now->buffer + len, &engine->nextNodeVersion, sizeof(engine->nextNodeVersion));
+	len += copyToBuffer(now->buffer + len, &now->size, sizeof(now->size));
+	len += copyToBuffer(now->buffer + len, &flag, sizeof(flag));
+	uint32 entryLen = getEntryLen(engine, level == 0 ? NODE_TYPE_LEAF : NODE_TYPE_LINK);
+	if(IS_ENCODED_PAGE(engine->flag)){
+		memcpy(builder->pageBuffer, now->buffer, NODE_META_SIZE);
+		uint8 *entries = (uint8 *)now->buffer + NODE_META_SIZE;
+		uint32 len = IS_KEY_COMPRESSION(engine->flag) ?
+			encodeEntries(engine, level == 0 ? NODE_TYPE_LEAF : NODE_TYPE_LINK, entries, now->size, entryLen, builder->pageBuffer) :
+			encodeSlottedEntries(engine, entries, now->size, entryLen, builder->pageBuffer);
+		writePageIndexFile(engine, now->pageId, builder->pageBuffer, len);
+	} else {
+		writePageIndexFile(engine, now->pageId, now->buffer, NODE_META_SIZE + now->size * entryLen);
+	}
+	now->written++;
+	builder->pageCnt++;
+}
+
+static void addBuilderEntry(IndexEngineBuilder *builder, uint32 level, uint8 *key, uint8 *data);
+
+/**
+ * 将第level层刚写入文件的节点的分隔key和页号加入上一层
+ * 分隔key为节点的第一个key，压缩key（变长key）时叶子节点使用与前一个节点之间最短的分隔key
+ */
+static void pushBuilderNode(IndexEngineBuilder *builder, uint32 level){
+	IndexEngine *engine = builder->engine;
+	IndexBuilderLevel *now = &builder->levels[level];
+	uint32 keyLen = engine->treeMeta.keyLen;
+	uint8 *first = (uint8 *)now->buffer + NODE_META_SIZE;
+	if(!IS_ENCODED_PAGE(engine->flag) || level != 0){
+		addBuilderEntry(builder, level + 1, first, (uint8 *)&now->pageId);
+		return;
+	}
+	uint8 *separator = (uint8 *)malloc(keyLen);
+	if(now->written > 1){
+		makeSeparatorKey(keyLen, now->prevLastKey, first, separator);
+	} else {
+		memcpy(separator, first, keyLen);
+	}
+	uint32 entryLen = getEntryLen(engine, NODE_TYPE_LEAF);
+	memcpy(now->prevLastKey, first + (uint64)(now->size - 1) * entryLen, keyLen);
+	addBuilderEntry(builder, level + 1, separator, (uint8 *)&now->pageId);
+	free(separator);
+}
+
+/** 压缩key或变长key时：第level层正在填充的节点加入key之后编码后的长度，prefixLen返回公共前缀长度 */
+static uint32 getBuilderEncodedLen(IndexEngineBuilder *builder, uint32 level, uint8 *key, uint32 *prefixLen){
+	IndexEngine *engine = builder->engine;
+	IndexBuilderLevel *now = &builder->levels[level];
+	uint32 keyLen = engine->treeMeta.keyLen;
+	uint32 entryLen = getEntryLen(engine, level == 0 ? NODE_TYPE_LEAF : NODE_TYPE_LINK);
+	EntrySeq seq = {(uint8 *)now->buffer + NODE_META_SIZE, now->size, key, 1, entryLen};
+	*prefixLen = getSeqPrefixLen(engine, level == 0 ? NODE_TYPE_LEAF : NODE_TYPE_LINK, &seq, 0, now->size + 1);
+	//公共前缀变化（有序输入时很少发生）才需要重新计算全部条目
+	if(now->size == 0 || *prefixLen != now->prefixLen){
+		return getSeqEncodedLenWithPrefix(engine, &seq, 0, now->size + 1, *prefixLen);
+	}
+	uint32 trimmedLen = getTrimmedKeyLen(key, keyLen);
+	return now->encodedLen + 2 + entryLen - keyLen + (trimmedLen > *prefixLen ? trimmedLen - *prefixLen : 0);
+}
+
+/** 向第level层添加一个条目，叶子层data为value，链接层data为孩子页号（主机字节序） */
+static void addBuilderEntry(IndexEngineBuilder *builder, uint32 level, uint8 *key, uint8 *data){
+	IndexEngine *engine = builder->engine;
+	uint32 keyLen = engine->treeMeta.keyLen;
+	uint32 valueLen = engine->treeMeta.valueLen;
+	uint32 entryLen = getEntryLen(engine, level == 0 ? NODE_TYPE_LEAF : NODE_TYPE_LINK);
+	uint32 capacity = level == 0 ? builder->leafCapacity : builder->linkCapacity;
+	int32 isEncoded = IS_ENCODED_PAGE(engine->flag);
+	//新的一层
+	if(level == builder->depth){
+		//压缩key或变长key时缓冲存放节点中格式的条目，按度分配
+		uint64 bufferLen = NODE_META_SIZE + (uint64)(engine->treeMeta.degree + 1) * entryLen;
+		builder->levels[level].buffer = (char *)malloc(bufferLen > engine->pageSize ? bufferLen : engine->pageSize);
+		builder->levels[level].prevLastKey = (uint8 *)malloc(keyLen);
+		builder->levels[level].pageId = engine->nextPageId++;
+		if(level == 0){
+			builder->sqt = builder->levels[level].pageId;
+		}
+		builder->depth++;
+	}
+	IndexBuilderLevel *now = &builder->levels[level];
+	uint32 prefixLen = 0;
+	uint32 encodedLen = isEncoded ? getBuilderEncodedLen(builder, level, key, &prefixLen) : 0;
+	//节点已满：写入文件，将第一个key和页号加入上一层，开始填充本层下一个节点
+	if(now->size == capacity || (isEncoded && now->size > (level == 0 ? 0 : 1) && encodedLen > builder->encodedCapacity)){
+		uint64 next = engine->nextPageId++;
+		writeBuilderNode(builder, level, level == 0 ? next : 0);
+		pushBuilderNode(builder, level);
+		now->prev = level == 0 ? now->pageId : 0;
+		now->pageId = next;
+		now->size = 0;
+		if(isEncoded){
+			encodedLen = getBuilderEncodedLen(builder, level, key, &prefixLen);
+		}
+	}
+	now->encodedLen = encodedLen;
+	now->prefixLen = prefixLen;
+	char *entry = now->buffer + NODE_META_SIZE + now->size * entryLen;
+	memcpy(entry, key, keyLen);
+	if(level == 0){
+		memcpy(entry + keyLen, data, valueLen);
+	} else {
+		copyToBuffer(entry + keyLen, data, 8);
+	}
+	setEntryKeyLen(engine, (uint8 *)entry, entryLen);
+	now->size++;
+}
+
+IndexEngineBuilder *makeIndexEngineBuilder(IndexEngine *engine, uint32 fillFactor){
+	//只能构建空的、没有未持久化修改的索引
+	pthread_mutex_lock(engine->cache.statusMutex);
+	int32 isEmpty = engine->count == 0 && engine->treeMeta.depth == 1 &&
+					engine->cache.bufferPool->dirtyCnt == 0 &&
+					engine->cache.status == CACHE_STATUS_NORMAL;
+	pthread_mutex_unlock(engine->cache.statusMutex);
+	if(!isEmpty){
+		return NULL;
+	}
+	if(fillFactor == 0) fillFactor = INDEX_BUILDER_DEFAULT_FILL_FACTOR;
+	if(fillFactor > 100) fillFactor = 100;
+	IndexEngineBuilder *builder = (IndexEngineBuilder *)calloc(1, sizeof(IndexEngineBuilder));
+	builder->engine = engine;
+	builder->leafCapacity = (uint64)engine->treeMeta.degree * fillFactor / 100;
+	builder->linkCapacity = builder->leafCapacity;
+	if(builder->leafCapacity < 1) builder->leafCapacity = 1;
+	if(builder->linkCapacity < 2) builder->linkCapacity = 2;
+	if(IS_ENCODED_PAGE(engine->flag)){
+		builder->encodedCapacity = (uint64)getEncodedLimit(engine) * fillFactor / 100;
+		builder->pageBuffer = (char *)malloc(engine->pageSize);
+	}
+	builder->lastKey = (uint8 *)malloc(engine->treeMeta.keyLen);
+	builder->nextPageId = engine->nextPageId;
+	//与持久化相同：先将磁盘状态切换为正在持久化，断电后加载时会清理写入一半的页
+	builder->diskFlag = engine->flag;
+	SET_PERSISTENCE(builder->diskFlag);
+	writeTypePosition(engine, 12, &builder->diskFlag, sizeof(builder->diskFlag));
 	fsync(engine->wfd);
+	return builder;
+}
+
+int32 addIndexEngineBuilder(IndexEngineBuilder *builder, uint8 *key, uint8 *value){
+	IndexTreeMeta *treeMeta = &builder->engine->treeMeta;
+	if(builder->error){
+		return -1;
+	}
+	if(builder->count != 0){
+		int32 result = builder->engine->cache.keyCompare(treeMeta->keyLen, builder->lastKey, key);
+		//乱序或违反唯一约束
+		if(result > 0 || (result == 0 && treeMeta->isUnique)){
+			builder->error = 1;
+			return -1;
+		}
+	}
+	memcpy(builder->lastKey, key, treeMeta->keyLen);
+	addBuilderEntry(builder, 0, key, value);
+	builder->count++;
+	return 1;
+}
+
+int32 finishIndexEngineBuilder(IndexEngineBuilder *builder){
+	IndexEngine *engine = builder->engine;
+	IndexTreeMeta *treeMeta = &engine->treeMeta;
+	uint32 diskFlag = builder->diskFlag;
+	int32 result = builder->error ? -1 : 1;
+	if(builder->error){
+		//放弃构建：已写入的页没有被引用，回收页号
+		engine->nextPageId = builder->nextPageId;
+	} else if(builder->count != 0){
+		//自底向上写出每一层剩余的节点，直到某一层只有一个节点（根节点）
+		uint32 level = 0;
+		while(level != builder->depth - 1 || builder->levels[level].written != 0){
+			writeBuilderNode(builder, level, 0);
+			pushBuilderNode(builder, level);
+			level++;
+		}
+		writeBuilderNode(builder, level, 0);
+		//旧的根节点（空的叶子）不再被引用
+		IndexTreeNode *oldRoot = (IndexTreeNode *)removeBufferPool(engine->cache.bufferPool, (uint8 *)&treeMeta->root);
+		if(oldRoot != NULL){
+			freeIndexTreeNode(oldRoot);
+		}
+		treeMeta->root = builder->levels[level].pageId;
+		engine->cache.structureVersion++;
+		treeMeta->sqt = builder->sqt;
+		treeMeta->depth = level + 1;
+		engine->count = builder->count;
+		engine->usedPageCnt += builder->pageCnt - 1;
+		engine->nextNodeVersion++;
+		//备份磁盘中重要元数据，切换到切换树状态
+		writeMetaBackData(engine);
+		CLR_PERSISTENCE(diskFlag);
+		SET_SWITCHTREE(diskFlag);
+		writeTypePosition(engine, 12, &diskFlag, sizeof(diskFlag));
+		fsync(engine->wfd);
+		//完成树切换：将新的元数据写入磁盘
+		writeIndexEngineMeta(engine);
+		fsync(engine->wfd);
+		//旧的重做日志中只有空索引上的操作，已经没有意义
+		pthread_cleanup_push((void *)pthread_mutex_unlock, engine->cache.statusMutex);
+		pthread_mutex_lock(engine->cache.statusMutex);
+		//等待持久化线程退出后再删除文件：强制取消可能在线程唤醒前释放其互斥量
+		RedoLog *redoLog = engine->cache.redoLogWork;
+		char *redoLogFilename = (char *)malloc(strlen(redoLog->filename) + 1);
+		strcpy(redoLogFilename, redoLog->filename);
+		freeRedoLog(redoLog);
+		unlink(redoLogFilename);
+		free(redoLogFilename);
+		engine->cache.redoLogWork = createIndexEngineRedoLog(engine);
+		pthread_mutex_unlock(engine->cache.statusMutex);
+		pthread_cleanup_pop(0);
+	}
 	//磁盘状态：切换到正常状态
+	CLR_PERSISTENCE(diskFlag);
 	CLR_SWITCHTREE(diskFlag);
 	writeTypePosition(engine, 12, &diskFlag, sizeof(diskFlag));
 	fsync(engine->wfd);
-	//线程状态：恢复到NORMAL状态
-	pthread_cleanup_push((void *)pthread_mutex_unlock, engine->cache.statusMutex);
-	pthread_mutex_lock(engine->cache.statusMutex);
-	engine->cache.status = CACHE_STATUS_NORMAL;
-	//将abandonedPageFreeze元素放入abandonedPageWork中
-	if (engine->cache.abandonedPageFreeze->length!=0){
-		addListToList(engine->cache.abandonedPageWork, engine->cache.abandonedPageFreeze);
+	for(uint32 i = 0; i < builder->depth; i++){
+		free(builder->levels[i].buffer);
+		free(builder->levels[i].prevLastKey);
 	}
-	//清空缓存缓存
-	clearLRUCache(freezeCache);
-	//通知其他阻塞线程
-	pthread_cond_signal(engine->cache.statusCond);
-	pthread_mutex_unlock(engine->cache.statusMutex);
-	pthread_cleanup_pop(0);
-	//清空内存
-	free(freezeEngine);
-	free(engines);
+	free(builder->pageBuffer);
+	free(builder->lastKey);
+	free(builder);
+	return result;
 }
-#else
+
+/*****************************************************************************
+ * 辅助函数
+ ******************************************************************************/
+
+#ifdef PROFILE_TEST
 volatile int persistenceExceptionId=0;
+/** 测试用：persistenceExceptionId等于id时在此处退出，模拟持久化过程中崩溃 */
+#define PERSISTENCE_EXCEPTION_POINT(id) if(persistenceExceptionId==(id)) return
+#else
+#define PERSISTENCE_EXCEPTION_POINT(id)
+#endif
+
 void flushIndexEngine(IndexEngine **engines){
 	IndexEngine *engine = engines[0];
 	IndexEngine *freezeEngine = engines[1];
@@ -1702,23 +3112,21 @@ void flushIndexEngine(IndexEngine **engines){
 	//开始持久化
 	//切换到正在持久化状态
 	SET_PERSISTENCE(diskFlag);
-	if(persistenceExceptionId==1) return;
+	PERSISTENCE_EXCEPTION_POINT(1);
 	writeTypePosition(engine, 12, &diskFlag, sizeof(diskFlag));
-	if(persistenceExceptionId==2) return;
+	PERSISTENCE_EXCEPTION_POINT(2);
 	fsync(engine->wfd);
-	if(persistenceExceptionId==3) return;
+	PERSISTENCE_EXCEPTION_POINT(3);
 	LRUCache *freezeCache = engine->cache.changeCacheFreeze;
+	char *pageBuffer = IS_ENCODED_PAGE(engine->flag) ? (char *)malloc(engine->pageSize) : NULL;
 	
 	LRUNode* node = freezeCache->head;
-	char *buffer = (char *)malloc(engine->pageSize);
 	while((node=node->next)!=freezeCache->head){
 		IndexTreeNode *treeNode = (IndexTreeNode *)node->value;
 		if(treeNode->newPageId!=0 && treeNode->status!=NODE_STATUS_REMOVE){
-			nodeToBuffer(engine, treeNode, treeNode->type, buffer);
-			uint32 len = NODE_META_SIZE + treeNode->size * (
-				engine->treeMeta.keyLen +
-				(treeNode->type == NODE_TYPE_LINK ? 8 : engine->treeMeta.valueLen)
-			);
+			//节点元数据填入页镜像，直接写出；压缩key或变长key时编码到页缓冲
+			char *buffer = pageBuffer != NULL ? pageBuffer : (char *)treeNode->page;
+			uint32 len = nodeToBuffer(engine, treeNode, treeNode->type, buffer);
 			writePageIndexFile(engine, treeNode->newPageId, buffer, len);
 		}
 		//更新类型页，设置after字段
@@ -1730,39 +3138,40 @@ void flushIndexEngine(IndexEngine **engines){
 				sizeof(treeNode->after));
 		}
 	}
-	if(persistenceExceptionId==4) return;
+	free(pageBuffer);
+	PERSISTENCE_EXCEPTION_POINT(4);
 	//备份磁盘中重要元数据
 	writeMetaBackData(engine);
-	if(persistenceExceptionId==5) return;
+	PERSISTENCE_EXCEPTION_POINT(5);
 	//磁盘状态：切换到切换树状态
 	CLR_PERSISTENCE(diskFlag);
 	SET_SWITCHTREE(diskFlag);
 	writeTypePosition(engine, 12, &diskFlag, sizeof(diskFlag));
-	if(persistenceExceptionId==6) return;
+	PERSISTENCE_EXCEPTION_POINT(6);
 	//确保数据写入
 	fsync(engine->wfd);
-	if(persistenceExceptionId==7) return;
+	PERSISTENCE_EXCEPTION_POINT(7);
 	//完成树切换：将新的元数据可入磁盘
 	writeIndexEngineMeta(freezeEngine);
-	if(persistenceExceptionId==8) return;
+	PERSISTENCE_EXCEPTION_POINT(8);
 	fsync(engine->wfd);
-	if(persistenceExceptionId==9) return;
+	PERSISTENCE_EXCEPTION_POINT(9);
 	//磁盘状态：切换到正常状态
 	CLR_SWITCHTREE(diskFlag);
 	writeTypePosition(engine, 12, &diskFlag, sizeof(diskFlag));
-	if(persistenceExceptionId==10) return;
+	PERSISTENCE_EXCEPTION_POINT(10);
 	fsync(engine->wfd);
-	if(persistenceExceptionId==11) return;
+	PERSISTENCE_EXCEPTION_POINT(11);
 	//线程状态：恢复到NORMAL状态
 	pthread_cleanup_push((void *)pthread_mutex_unlock, engine->cache.statusMutex);
 	pthread_mutex_lock(engine->cache.statusMutex);
 	engine->cache.status = CACHE_STATUS_NORMAL;
-	//将abandonedPageFreeze元素放入abandonedPageWork中
-	if (engine->cache.abandonedPageFreeze->length!=0){
-		addListToList(engine->cache.abandonedPageWork, engine->cache.abandonedPageFreeze);
+	//将abandonedPagePersistence元素放入abandonedPageWork中，持久化期间废弃的页要等到下一次持久化完成
+	if (engine->cache.abandonedPagePersistence->length!=0){
+		addListToList(engine->cache.abandonedPageWork, engine->cache.abandonedPagePersistence);
 	}
-	if(persistenceExceptionId==12) return;
-	//清空缓存缓存 
+	PERSISTENCE_EXCEPTION_POINT(12);
+	//释放冻结的节点并清空缓存
 	node = freezeCache->head;
 	while((node=node->next)!=freezeCache->head){
 		IndexTreeNode *treeNode = (IndexTreeNode *)node->value;
@@ -1779,7 +3188,6 @@ void flushIndexEngine(IndexEngine **engines){
 	free(freezeEngine);
 	free(engines);
 }
-#endif
 
 static void doRedoOperatation(OperateTuple* operateTuple, IndexEngine* engine){
 	//TODO 执行日志
@@ -0,0 +1,358 @@
+/*****************************************************************************
+ * Copyright (c) 2018, rectcircle. All rights reserved.
+ *
+ * @filename: keyindex.c
+ * @description: Hash引擎内存索引函数实现
+ * @author: Rectcircle
+ * @version: 1.0
+ * @date: 2026-10-17
+ ******************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "keyindex.h"
+
+//负载因子控制在0.75
+static const double LOAD_FACTOR = 0.75;
+//负载因子低于该值时自动缩容
+static const double SHRINK_FACTOR = 0.1;
+//每次操作最多迁移的旧槽数
+static const uint32 REHASH_STEP = 16;
+//已迁移的旧槽：查找时跳过但不终止探测
+static const uint32 SLOT_MOVED = 0xffffffffu;
+//arena中的垃圾超过一半且不少于该值时整理arena
+static const uint64 ARENA_COMPACT_MIN_GARBAGE = 64 * 1024;
+
+/*****************************************************************************
+ * 私有函数
+ ******************************************************************************/
+
+/** 计算key的hash值（与HashMap相同的改进FNV算法） */
+static uint32 hashKey(uint8 *key, uint32 keyLen){
+	static uint32 p = 16777619;
+	uint32 hash = 2166136261;
+	for (uint32 i = 0; i < keyLen; i++)
+		hash = (hash ^ key[i]) * p;
+	hash += hash << 13;
+	hash ^= hash >> 7;
+	hash += hash << 3;
+	hash ^= hash >> 17;
+	hash += hash << 5;
+	return hash;
+}
+
+/** 计算以0.75负载因子容纳capacity个元素需要的槽数组长度（2^n，至少为8） */
+static uint32 slotCapacityFor(uint32 capacity){
+	capacity = (uint32)(((double)capacity)/LOAD_FACTOR);
+	uint32 slotCapacity = 8;
+	while (slotCapacity < capacity)
+		slotCapacity <<= 1;
+	return slotCapacity;
+}
+
+static KeyIndexEntry *entryAt(KeyIndex *index, uint32 i){
+	return index->chunks[i >> KEY_INDEX_CHUNK_SHIFT] + (i & ((1u << KEY_INDEX_CHUNK_SHIFT) - 1));
+}
+
+static uint64 arenaOffsetOf(KeyIndexEntry *entry){
+	uint64 offset;
+	memcpy(&offset, entry->key, sizeof(offset));
+	return offset;
+}
+
+static uint8 *entryKey(KeyIndex *index, KeyIndexEntry *entry){
+	if(entry->keyLen <= KEY_INDEX_INLINE_KEY_SIZE){
+		return entry->key;
+	}
+	return index->arena + arenaOffsetOf(entry);
+}
+
+/** 在一个槽数组中查找key，返回槽下标，不存在返回-1 */
+static int64 searchSlots(KeyIndex *index, KeyIndexSlot *slots, uint32 slotCapacity, uint32 keyLen, uint8 *key, uint32 hash){
+	uint32 mask = slotCapacity - 1;
+	for(uint32 i = hash & mask; slots[i].entry != 0; i = (i + 1) & mask){
+		if(slots[i].hash != hash || slots[i].entry == SLOT_MOVED){
+			continue;
+		}
+		KeyIndexEntry *entry = entryAt(index, slots[i].entry - 1);
+		if(entry->keyLen == keyLen && memcmp(entryKey(index, entry), key, keyLen) == 0){
+			return i;
+		}
+	}
+	return -1;
+}
+
+/** 插入到槽数组的第一个空槽（调用者保证key不存在且有空槽） */
+static void insertSlot(KeyIndexSlot *slots, uint32 slotCapacity, uint32 hash, uint32 entry){
+	uint32 mask = slotCapacity - 1;
+	uint32 i = hash & mask;
+	while(slots[i].entry != 0){
+		i = (i + 1) & mask;
+	}
+	slots[i].hash = hash;
+	slots[i].entry = entry;
+}
+
+/** 删除一个槽：后续同一簇中的槽向前移动，不留下墓碑（只用于没有已迁移标记的新槽数组） */
+static void deleteSlot(KeyIndexSlot *slots, uint32 slotCapacity, uint32 i){
+	uint32 mask = slotCapacity - 1;
+	uint32 j = i;
+	while(1){
+		j = (j + 1) & mask;
+		if(slots[j].entry == 0){
+			break;
+		}
+		//j距离其理想位置不小于距离i时，可以移动到i
+		uint32 ideal = slots[j].hash & mask;
+		if(((j - ideal) & mask) >= ((j - i) & mask)){
+			slots[i] = slots[j];
+			i = j;
+		}
+	}
+	slots[i].entry = 0;
+}
+
+static void finishRehash(KeyIndex *index){
+	free(index->oldSlots);
+	index->oldSlots = NULL;
+	index->oldSlotCapacity = 0;
+	index->oldSize = 0;
+	index->rehashIndex = 0;
+}
+
+/** 迁移少量旧槽到新槽数组 */
+static void rehashStep(KeyIndex *index){
+	if(index->oldSlots == NULL){
+		return;
+	}
+	for(uint32 n = 0; n < REHASH_STEP && index->rehashIndex < index->oldSlotCapacity; n++){
+		KeyIndexSlot *slot = index->oldSlots + index->rehashIndex++;
+		if(slot->entry != 0 && slot->entry != SLOT_MOVED){
+			insertSlot(index->slots, index->slotCapacity, slot->hash, slot->entry);
+			slot->entry = SLOT_MOVED;
+			index->oldSize--;
+		}
+	}
+	if(index->rehashIndex >= index->oldSlotCapacity){
+		finishRehash(index);
+	}
+}
+
+/** 开始rehash：当前槽数组变为旧槽数组 */
+static void startRehash(KeyIndex *index, uint32 slotCapacity){
+	index->oldSlots = index->slots;
+	index->oldSlotCapacity = index->slotCapacity;
+	index->oldSize = index->size;
+	index->rehashIndex = 0;
+	index->slots = (KeyIndexSlot *)calloc(slotCapacity, sizeof(KeyIndexSlot));
+	index->slotCapacity = slotCapacity;
+}
+
+static uint32 allocEntry(KeyIndex *index){
+	if(index->freeHead != 0){
+		uint32 i = index->freeHead - 1;
+		index->freeHead = entryAt(index, i)->keyLen;
+		return i;
+	}
+	if(index->entryCount == index->chunkCount << KEY_INDEX_CHUNK_SHIFT){
+		index->chunks = (KeyIndexEntry **)realloc(index->chunks, sizeof(KeyIndexEntry *) * (index->chunkCount + 1));
+		index->chunks[index->chunkCount++] = (KeyIndexEntry *)malloc(sizeof(KeyIndexEntry) << KEY_INDEX_CHUNK_SHIFT);
+	}
+	return index->entryCount++;
+}
+
+static uint64 appendArena(KeyIndex *index, uint8 *key, uint32 keyLen){
+	if(index->arenaSize + keyLen > index->arenaCapacity){
+		uint64 capacity = index->arenaCapacity == 0 ? 4096 : index->arenaCapacity;
+		while(capacity < index->arenaSize + keyLen){
+			capacity <<= 1;
+		}
+		index->arena = (uint8 *)realloc(index->arena, capacity);
+		index->arenaCapacity = capacity;
+	}
+	uint64 offset = index->arenaSize;
+	memcpy(index->arena + offset, key, keyLen);
+	index->arenaSize += keyLen;
+	return offset;
+}
+
+static void *moveKeyToArena(uint32 keyLen, uint8 *key, RecordLocation *location, void *args){
+	KeyIndex *index = (KeyIndex *)args;
+	if(keyLen > KEY_INDEX_INLINE_KEY_SIZE){
+		uint64 offset = appendArena(index, key, keyLen);
+		memcpy(((KeyIndexEntry *)location)->key, &offset, sizeof(offset));
+	}
+	return NULL;
+}
+
+/** 删除的长key超过一半时，将有效的长key拷贝到新的arena */
+static void compactArena(KeyIndex *index){
+	if(index->arenaGarbage < ARENA_COMPACT_MIN_GARBAGE || index->arenaGarbage * 2 < index->arenaSize){
+		return;
+	}
+	//遍历时从旧arena读取key，写入target的arena并更新条目中的偏移
+	KeyIndex target;
+	target.arenaCapacity = index->arenaCapacity;
+	target.arena = (uint8 *)malloc(target.arenaCapacity);
+	target.arenaSize = 0;
+	foreachKeyIndex(index, moveKeyToArena, &target);
+	free(index->arena);
+	index->arena = target.arena;
+	index->arenaSize = target.arenaSize;
+	index->arenaGarbage = 0;
+}
+
+static void *foreachSlots(KeyIndex *index, KeyIndexSlot *slots, uint32 slotCapacity, ForeachKeyIndexFunction func, void *args){
+	for(uint32 i = 0; i < slotCapacity; i++){
+		if(slots[i].entry == 0 || slots[i].entry == SLOT_MOVED){
+			continue;
+		}
+		KeyIndexEntry *entry = entryAt(index, slots[i].entry - 1);
+		void *result = func(entry->keyLen, entryKey(index, entry), &entry->location, args);
+		if(result != NULL){
+			return result;
+		}
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+ * 公开API
+ ******************************************************************************/
+
+KeyIndex *makeKeyIndex(uint32 capacity){
+	KeyIndex *index = (KeyIndex *)calloc(1, sizeof(KeyIndex));
+	index->slotCapacity = slotCapacityFor(capacity);
+	index->minSlotCapacity = index->slotCapacity;
+	index->slots = (KeyIndexSlot *)calloc(index->slotCapacity, sizeof(KeyIndexSlot));
+	return index;
+}
+
+void freeKeyIndex(KeyIndex *index){
+	for(uint32 i = 0; i < index->chunkCount; i++){
+		free(index->chunks[i]);
+	}
+	free(index->chunks);
+	free(index->slots);
+	free(index->oldSlots);
+	free(index->arena);
+	free(index);
+}
+
+RecordLocation *getKeyIndex(KeyIndex *index, uint32 keyLen, uint8 *key){
+	uint32 hash = hashKey(key, keyLen);
+	int64 i;
+	if(index->oldSlots != NULL && (i = searchSlots(index, index->oldSlots, index->oldSlotCapacity, keyLen, key, hash)) >= 0){
+		return &entryAt(index, index->oldSlots[i].entry - 1)->location;
+	}
+	if((i = searchSlots(index, index->slots, index->slotCapacity, keyLen, key, hash)) >= 0){
+		return &entryAt(index, index->slots[i].entry - 1)->location;
+	}
+	return NULL;
+}
+
+RecordLocation *putKeyIndex(KeyIndex *index, uint32 keyLen, uint8 *key){
+	RecordLocation *location = getKeyIndex(index, keyLen, key);
+	if(location != NULL){
+		return location;
+	}
+	rehashStep(index);
+	//新槽数组中的数目超过负载因子（迁移尚未完成时发生），直接完成迁移
+	while(index->oldSlots != NULL && index->size - index->oldSize + 1 > index->slotCapacity * LOAD_FACTOR){
+		rehashStep(index);
+	}
+	uint32 i = allocEntry(index);
+	KeyIndexEntry *entry = entryAt(index, i);
+	memset(&entry->location, 0, sizeof(RecordLocation));
+	entry->keyLen = keyLen;
+	if(keyLen <= KEY_INDEX_INLINE_KEY_SIZE){
+		memcpy(entry->key, key, keyLen);
+	} else {
+		uint64 offset = appendArena(index, key, keyLen);
+		memcpy(entry->key, &offset, sizeof(offset));
+	}
+	insertSlot(index->slots, index->slotCapacity, hashKey(key, keyLen), i + 1);
+	index->size++;
+	//负载因子超过0.75，扩容为2倍
+	if(index->oldSlots == NULL && index->size > index->slotCapacity * LOAD_FACTOR && index->slotCapacity < 0x80000000u){
+		startRehash(index, index->slotCapacity << 1);
+	}
+	return &entry->location;
+}
+
+RecordLocation *removeKeyIndex(KeyIndex *index, uint32 keyLen, uint8 *key){
+	uint32 hash = hashKey(key, keyLen);
+	uint32 entryIndex = 0;
+	int64 i;
+	if(index->oldSlots != NULL && (i = searchSlots(index, index->oldSlots, index->oldSlotCapacity, keyLen, key, hash)) >= 0){
+		//旧槽数组中有已迁移标记，不能移动，直接标记
+		entryIndex = index->oldSlots[i].entry;
+		index->oldSlots[i].entry = SLOT_MOVED;
+		index->oldSize--;
+	} else if((i = searchSlots(index, index->slots, index->slotCapacity, keyLen, key, hash)) >= 0){
+		entryIndex = index->slots[i].entry;
+		deleteSlot(index->slots, index->slotCapacity, i);
+	} else {
+		return NULL;
+	}
+	index->size--;
+	KeyIndexEntry *entry = entryAt(index, entryIndex - 1);
+	if(entry->keyLen > KEY_INDEX_INLINE_KEY_SIZE){
+		index->arenaGarbage += entry->keyLen;
+	}
+	//加入待回收链表，location字段保持不变
+	entry->keyLen = index->retiredHead;
+	index->retiredHead = entryIndex;
+	rehashStep(index);
+	//负载因子低于0.1，缩容，但不小于初始容量
+	if(index->oldSlots == NULL && index->slotCapacity > index->minSlotCapacity && index->size < index->slotCapacity * SHRINK_FACTOR){
+		uint32 slotCapacity = slotCapacityFor(index->size);
+		startRehash(index, slotCapacity > index->minSlotCapacity ? slotCapacity : index->minSlotCapacity);
+	}
+	compactArena(index);
+	return &entry->location;
+}
+
+//将head指向的链表中的条目全部放入空闲链表
+static void reclaimEntries(KeyIndex *index, uint32 *head){
+	while(*head != 0){
+		uint32 i = *head - 1;
+		KeyIndexEntry *entry = entryAt(index, i);
+		*head = entry->keyLen;
+		entry->keyLen = index->freeHead;
+		index->freeHead = i + 1;
+	}
+}
+
+void reclaimKeyIndex(KeyIndex *index){
+	reclaimEntries(index, &index->pendingHead);
+	reclaimEntries(index, &index->retiredHead);
+}
+
+void reclaimPreviousKeyIndex(KeyIndex *index){
+	reclaimEntries(index, &index->pendingHead);
+	index->pendingHead = index->retiredHead;
+	index->retiredHead = 0;
+}
+
+void *foreachKeyIndex(KeyIndex *index, ForeachKeyIndexFunction func, void *args){
+	void *result = NULL;
+	if(index->oldSlots != NULL){
+		result = foreachSlots(index, index->oldSlots, index->oldSlotCapacity, func, args);
+	}
+	if(result == NULL){
+		result = foreachSlots(index, index->slots, index->slotCapacity, func, args);
+	}
+	return result;
+}
+
+uint64 getKeyIndexMemory(KeyIndex *index){
+	return sizeof(KeyIndex) +
+		   (uint64)index->slotCapacity * sizeof(KeyIndexSlot) +
+		   (uint64)index->oldSlotCapacity * sizeof(KeyIndexSlot) +
+		   (uint64)index->chunkCount * (sizeof(KeyIndexEntry *) + (sizeof(KeyIndexEntry) << KEY_INDEX_CHUNK_SHIFT)) +
+		   index->arenaCapacity;
+}
+
+int32 isRehashingKeyIndex(KeyIndex *index){
+	return index->oldSlots != NULL;
+}
@@ -106,6 +106,54 @@ private void moveToFirst(LRUCache* cache, LRUNode* node){
 private void defaultEliminateHook(uint32 keyLen, uint8 *key, void *value) {
 }
 
+/** 创建带头结点的空双向循环链表 */
+private LRUNode *makeLRUListHead(){
+	LRUNode *head = makeLRUNode(NULL, NULL);
+	head->prev = head;
+	head->next = head;
+	return head;
+}
+
+/** 释放双向循环链表中的所有节点（不包括头结点），并将链表置空 */
+private void clearLRUList(LRUNode *head){
+	LRUNode* next = head->next;
+	LRUNode* node = NULL;
+	while((node=next)!=head){
+		next = node->next;
+		free(node->key);
+		free(node);
+	}
+	head->next = head;
+	head->prev = head;
+}
+
+/**
+ * 选出插入新key时要淘汰的节点，缓存未满返回NULL
+ * 2Q策略下试用队列超过目标容量（或主队列为空）时淘汰试用队列的尾部，否则淘汰主队列的尾部
+ */
+private LRUNode *selectVictim(LRUCache *cache){
+	if(cache->size < cache->capacity || cache->size == 0){
+		return NULL;
+	}
+	if(cache->probationSize > 0 &&
+	   (cache->probationSize > cache->probationCapacity || cache->probationSize == cache->size)){
+		return cache->probationHead->prev;
+	}
+	return cache->head->prev;
+}
+
+/** 从幽灵队列中删除key，返回key是否存在（幽灵队列与缓存的keyLen相同，hash值可以复用） */
+private int removeFromGhost(LRUCache *cache, uint8 *key, uint32 hashcode){
+	LRUNode *node = removeFromHashTable(cache->ghost, key, hashcode);
+	if(node==NULL){
+		return 0;
+	}
+	removeLRUNode(node);
+	free(node->key);
+	free(node);
+	cache->ghost->size--;
+	return 1;
+}
 
 /*****************************************************************************
  * 公有函数
@@ -132,9 +180,26 @@ LRUCache *makeLRUCache(uint32 capacity, uint32 keyLen){
 	cache->keyLen = keyLen;
 	cache->table = (LRUNode**)calloc(bucketCapacity, sizeof(LRUNode*));
 	//为了方便编程，创建一个头结点
-	cache->head = makeLRUNode(NULL, NULL);
-	cache->head->prev = cache->head;
-	cache->head->next = cache->head;
+	cache->head = makeLRUListHead();
+	//默认为LRU策略
+	cache->policy = LRUPolicy;
+	cache->probationHead = NULL;
+	cache->probationSize = 0;
+	cache->probationCapacity = 0;
+	cache->ghost = NULL;
+	return cache;
+}
+
+LRUCache *makeLRUCacheWithPolicy(uint32 capacity, uint32 keyLen, enum LRUCachePolicy policy){
+	LRUCache *cache = makeLRUCache(capacity, keyLen);
+	if(cache==NULL || policy==LRUPolicy){
+		return cache;
+	}
+	//2Q论文推荐的参数：Kin为容量的25%，Kout为容量的50%
+	cache->policy = TwoQueuePolicy;
+	cache->probationHead = makeLRUListHead();
+	cache->probationCapacity = capacity / 4;
+	cache->ghost = makeLRUCache(capacity / 2 > 0 ? capacity / 2 : 1, keyLen);
 	return cache;
 }
 
@@ -145,6 +210,8 @@ void freeLRUCache(LRUCache *cache){
 	clearLRUCache(cache);
 	free(cache->table);
 	free(cache->head);
+	free(cache->probationHead);
+	freeLRUCache(cache->ghost);
 	free(cache);
 }
 
@@ -163,33 +230,44 @@ void (*hook)(uint32, uint8 *, void *)){
 	LRUNode* node = getFromHashTable(cache, originKey, hashcode);
 	if(node!=NULL){
 		node->value=value;
-		moveToFirst(cache, node);
+		//试用队列是FIFO，命中不提升
+		if(!node->probation){
+			moveToFirst(cache, node);
+		}
 	} else {
 		uint8 *key = (uint8 *)malloc(cache->keyLen);
 		memcpy(key, originKey, cache->keyLen);
-		if(cache->size>=cache->capacity){
-			//从hash表中删除最后一个元素
-			node = removeFromHashTable(
-				cache,
-				cache->head->prev->key,
-				hashCode(cache->head->prev->key, cache->keyLen));
-			//从双向链表中删除节点
+		node = selectVictim(cache);
+		if(node!=NULL){
+			//从hash表和双向链表中删除被淘汰的节点
+			removeFromHashTable(cache, node->key, hashCode(node->key, cache->keyLen));
 			removeLRUNode(node);
-			//复用node节点
 			result = node->value;
-			//释放key内存
-			free(node->key);
-			//调用hook
+			//调用hook，此时key仍然有效
 			if(hook!=NULL) hook(cache->keyLen, node->key, node->value);
-			//清理内存
+			//从试用队列淘汰的key记入幽灵队列
+			if(node->probation){
+				cache->probationSize--;
+				putLRUCache(cache->ghost, node->key, NULL);
+			}
+			//复用node节点
+			free(node->key);
 			node->key = key;
 			node->value = value;
 		} else {
 			node = makeLRUNode(key,value);
 			cache->size++;
 		}
-		//插到链表首部
-		insertLRUNode(cache->head, node);
+		//2Q：幽灵队列中存在说明最近被访问过，直接进入主队列，否则进入试用队列
+		if(cache->policy==TwoQueuePolicy && !removeFromGhost(cache, key, hashcode)){
+			node->probation = 1;
+			cache->probationSize++;
+			insertLRUNode(cache->probationHead, node);
+		} else {
+			node->probation = 0;
+			//插到链表首部
+			insertLRUNode(cache->head, node);
+		}
 		//插到HashMap结构中
 		insertToHashTable(cache, node, hashcode);
 	}
@@ -200,7 +278,9 @@ void *getLRUCache(LRUCache *cache, uint8 *key){
 	uint32 hashcode = hashCode(key, cache->keyLen);
 	LRUNode* node = getFromHashTable(cache, key, hashcode);
 	if(node!=NULL){
-		moveToFirst(cache, node);
+		if(!node->probation){
+			moveToFirst(cache, node);
+		}
 		return node->value;
 	}
 	return NULL;
@@ -225,6 +305,9 @@ void *removeLRUCache(LRUCache *cache, uint8 *key){
 		return NULL;
 	}
 	removeLRUNode(node);
+	if(node->probation){
+		cache->probationSize--;
+	}
 	void *result = node->value;
 	free(node->key);
 	free(node);
@@ -233,17 +316,36 @@ void *removeLRUCache(LRUCache *cache, uint8 *key){
 }
 
 void clearLRUCache(LRUCache *cache){
-	LRUNode* next = cache->head->next;
-	LRUNode* node = NULL;
-	while((node=next)!=cache->head){
-		next = node->next;
-		free(node->key);
-		free(node);
+	clearLRUList(cache->head);
+	if(cache->probationHead!=NULL){
+		clearLRUList(cache->probationHead);
+		cache->probationSize = 0;
+	}
+	if(cache->ghost!=NULL){
+		clearLRUCache(cache->ghost);
 	}
-	//重新设置头指针
-	node->next = node;
-	node->prev = node;
 	//table清零
 	memset(cache->table, 0, cache->bucketCapacity * sizeof(LRUNode *));
 	cache->size=0;
-}
\ No newline at end of file
+}
+
+uint8 *evictionCandidateLRUCache(LRUCache *cache){
+	LRUNode *node = selectVictim(cache);
+	return node == NULL ? NULL : node->key;
+}
+
+void *foreachLRUCache(LRUCache *cache, ForeachLRUCacheFunction func, void *args){
+	LRUNode *heads[2] = {cache->head, cache->probationHead};
+	for(int i = 0; i < 2 && heads[i] != NULL; i++){
+		LRUNode *node = heads[i]->next;
+		while(node != heads[i]){
+			LRUNode *next = node->next;
+			void *result = func(cache->keyLen, node->key, node->value, args);
+			if(result != NULL){
+				return result;
+			}
+			node = next;
+		}
+	}
+	return NULL;
+}
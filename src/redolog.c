@@ -13,6 +13,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+//组缓冲区的初始容量
+#define REDO_LOG_BUFFER_INIT_SIZE (64 * 1024)
+//写入后超过该容量的组缓冲区被释放
+#define REDO_LOG_BUFFER_KEEP_SIZE (4 * 1024 * 1024)
+
 /** 创建文件：以O_APPEND方式 */
 static int createRedoLogFile(const char * filename){
 	return open(filename, O_APPEND | O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
@@ -30,10 +35,57 @@ void operateListForEach(void* value, void* args){
 	redoLog->freeOperateTuple(operateTuple);
 }
 
-/** 进行持久化 */
-void doPersistence(RedoLog *redoLog, List *operateList){
+/** 将组缓冲区写入文件，返回是否完整写入 */
+static int writeRedoLogBuffer(RedoLog *redoLog){
+	uint8 *p = redoLog->buffer;
+	uint32 len = redoLog->bufferLen;
+	while(len > 0){
+		ssize_t n = write(redoLog->fd, p, len);
+		if(n <= 0){
+			break;
+		}
+		p += n;
+		len -= n;
+	}
+	redoLog->bufferLen = 0;
+	//偶尔出现的大组不长期占用内存
+	if(redoLog->bufferCap > REDO_LOG_BUFFER_KEEP_SIZE){
+		free(redoLog->buffer);
+		redoLog->buffer = NULL;
+		redoLog->bufferCap = 0;
+	}
+	return len == 0;
+}
+
+static void operateListFreeForEach(void* value, void* args);
+
+/**
+ * 进行持久化：一组操作序列化后一次写入，开启同步时一组只同步一次，返回是否成功
+ * 失败后文件尾部可能是不完整的记录，重放时在此停止，之后的组即使写入也无法重放，因此不再写入
+ */
+int doPersistence(RedoLog *redoLog, List *operateList){
+	if(operateList->length == 0){
+		return !redoLog->failed;
+	}
+	if(redoLog->failed){
+		foreachList(operateList, operateListFreeForEach, (void*)redoLog);
+		clearList(operateList);
+		return 0;
+	}
 	foreachList(operateList, operateListForEach, (void*)redoLog);
 	clearList(operateList);
+	int ok = 1;
+	if(redoLog->bufferLen > 0){
+		ok = writeRedoLogBuffer(redoLog);
+	}
+	if(ok && redoLog->syncOnPersistence){
+		ok = fdatasync(redoLog->fd) == 0;
+	}
+	if(!ok){
+		printf("重做日志%s写入失败，之后的操作不再写入\n", redoLog->filename);
+	}
+	redoLog->flushCount++;
+	return ok;
 }
 
 /** 检查是否需要进行持久化 */
@@ -55,45 +107,65 @@ int checkNeedPersistence(RedoLog* redoLog){
 	return 1;
 }
 
-/** 持久化任务 */
+/** 持久化线程等待新的操作，定时策略下最多等到下一次定时 */
+static void waitForOperate(RedoLog *redoLog){
+	if(redoLog->flushStrategy != definiteTime || redoLog->operateList->length == 0){
+		pthread_cond_wait(&redoLog->statusCond, &redoLog->statusMutex);
+		return;
+	}
+	uint64 deadline = redoLog->lastFlushTime + redoLog->flushStrategyArg;
+	struct timespec ts;
+	ts.tv_sec = deadline / 1000;
+	ts.tv_nsec = (deadline % 1000) * 1000000;
+	pthread_cond_timedwait(&redoLog->statusCond, &redoLog->statusMutex, &ts);
+}
+
+/** 持久化任务：每次取走队列中的全部操作作为一组 */
 static void persistenceTask(RedoLog* redoLog){
 	List *operateList = makeList();
-	while(1){
+	int finished = 0;
+	while(!finished){
+		uint64 seq = 0;
 		pthread_cleanup_push((void *)pthread_mutex_unlock, &redoLog->statusMutex);
 		pthread_mutex_lock(&redoLog->statusMutex);
 		pthread_testcancel();
-		//如果设置为finish状态，处理完剩余的直接结束
-		if (redoLog->status == finish){
-			addListToList(operateList, redoLog->operateList);
-			doPersistence(redoLog, operateList);
-			pthread_exit(NULL);
-		}
-		if(redoLog->status == normal && checkNeedPersistence(redoLog)){
-			//如果需要进行持久化
-			//切换状态
-			redoLog->status = persistence;
-			//清空并拷贝列表
-			addListToList(operateList, redoLog->operateList);
-		} else {
+		while(redoLog->status != finish && !checkNeedPersistence(redoLog)){
 			//不需要进行持久化，wait
-			pthread_cond_wait(&redoLog->statusCond, &redoLog->statusMutex);
+			waitForOperate(redoLog);
 			pthread_testcancel();
 		}
+		//如果设置为finish状态，处理完剩余的直接结束
+		finished = redoLog->status == finish;
+		if(!finished){
+			redoLog->status = persistence;
+		}
+		//清空并拷贝列表，持久化期间新追加的操作进入下一组
+		addListToList(operateList, redoLog->operateList);
+		seq = redoLog->appendSeq;
+		pthread_cond_broadcast(&redoLog->statusCond);
 		pthread_mutex_unlock(&redoLog->statusMutex);
 		pthread_cleanup_pop(0);
 
-		if(redoLog->status == persistence){
-			doPersistence(redoLog, operateList);
-			redoLog->lastFlushTime = currentTimeMillis();
-			if (redoLog->status == persistence){
-				redoLog->status = normal;
-			}
-			// if(redoLog->flushStrategy==synchronize){
-			//同步策略立即通知工作线程
-			pthread_cond_signal(&redoLog->statusCond);
-			// }
+		int ok = doPersistence(redoLog, operateList);
+
+		pthread_cleanup_push((void *)pthread_mutex_unlock, &redoLog->statusMutex);
+		pthread_mutex_lock(&redoLog->statusMutex);
+		redoLog->lastFlushTime = currentTimeMillis();
+		if(ok){
+			redoLog->durableSeq = seq;
+		} else {
+			//本组的等待者返回失败
+			redoLog->failed = 1;
 		}
+		if (redoLog->status == persistence){
+			redoLog->status = normal;
+		}
+		//唤醒等待本组的工作线程
+		pthread_cond_broadcast(&redoLog->statusCond);
+		pthread_mutex_unlock(&redoLog->statusMutex);
+		pthread_cleanup_pop(0);
 	}
+	freeList(operateList);
 }
 
 // static void persistenceTask(RedoLog* redoLog){
@@ -170,6 +242,15 @@ static RedoLog *initRedoLog(
 	redoLog->persistenceFunction = persistenceFunction;
 	redoLog->freeOperateTuple = freeOperateTuple;
 	redoLog->env = env;
+	redoLog->appendSeq = 0;
+	redoLog->durableSeq = 0;
+	redoLog->waiters = 0;
+	redoLog->flushCount = 0;
+	redoLog->syncOnPersistence = 0;
+	redoLog->failed = 0;
+	redoLog->buffer = NULL;
+	redoLog->bufferLen = 0;
+	redoLog->bufferCap = 0;
 	//初始化线程相关内容
 	pthread_cond_init(&redoLog->statusCond, NULL);
 	pthread_mutexattr_init(&redoLog->statusAttr);
@@ -225,23 +306,62 @@ RedoLog *loadRedoLog(
 	return redoLog;
 }
 
-void appendRedoLog(RedoLog *redoLog, OperateTuple *ops){
+uint64 appendRedoLogAsync(RedoLog *redoLog, OperateTuple *ops){
+	uint64 seq = 0;
 	pthread_cleanup_push((void *)pthread_mutex_unlock, &redoLog->statusMutex);
 	pthread_mutex_lock(&redoLog->statusMutex);
-	//如果设置为策略为同步且正在进行持久化要等待
-	if (redoLog->status == persistence && redoLog->flushStrategy==synchronize){
+	//定时和阈值策略：内存中的操作过多时等待持久化线程取走
+	while (redoLog->flushStrategy != synchronize && redoLog->status != finish &&
+		   redoLog->operateList->length >= redoLog->operateListMaxSize){
 		pthread_cond_wait(&redoLog->statusCond, &redoLog->statusMutex);
 	}
 	if(redoLog->status != finish){
 		addList(redoLog->operateList, (void *)ops);
-		int flag = redoLog->operateList->length >= redoLog->operateListMaxSize;
-		pthread_cond_signal(&redoLog->statusCond);
-		if (flag || redoLog->flushStrategy == synchronize){
-			pthread_cond_wait(&redoLog->statusCond, &redoLog->statusMutex);
-		}
+		seq = ++redoLog->appendSeq;
+		pthread_cond_broadcast(&redoLog->statusCond);
+	} else {
+		redoLog->freeOperateTuple(ops);
+		seq = redoLog->durableSeq;
+	}
+	redoLog->waiters++;
+	pthread_mutex_unlock(&redoLog->statusMutex);
+	pthread_cleanup_pop(0);
+	return seq;
+}
+
+int32 waitRedoLog(RedoLog *redoLog, uint64 seq){
+	int32 result = 0;
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &redoLog->statusMutex);
+	pthread_mutex_lock(&redoLog->statusMutex);
+	//同步策略：等待所在的组写入完成或者失败
+	while (redoLog->flushStrategy == synchronize && redoLog->durableSeq < seq && !redoLog->failed){
+		pthread_cond_wait(&redoLog->statusCond, &redoLog->statusMutex);
+	}
+	result = redoLog->durableSeq >= seq || !redoLog->failed;
+	if(--redoLog->waiters == 0){
+		pthread_cond_broadcast(&redoLog->statusCond);
 	}
 	pthread_mutex_unlock(&redoLog->statusMutex);
 	pthread_cleanup_pop(0);
+	return result;
+}
+
+int32 appendRedoLog(RedoLog *redoLog, OperateTuple *ops){
+	return waitRedoLog(redoLog, appendRedoLogAsync(redoLog, ops));
+}
+
+uint8 *reserveRedoLogBuffer(RedoLog *redoLog, uint32 len){
+	if(redoLog->bufferLen + len > redoLog->bufferCap){
+		uint32 cap = redoLog->bufferCap == 0 ? REDO_LOG_BUFFER_INIT_SIZE : redoLog->bufferCap;
+		while(cap < redoLog->bufferLen + len){
+			cap *= 2;
+		}
+		redoLog->buffer = (uint8 *)realloc(redoLog->buffer, cap);
+		redoLog->bufferCap = cap;
+	}
+	uint8 *p = redoLog->buffer + redoLog->bufferLen;
+	redoLog->bufferLen += len;
+	return p;
 }
 
 // void appendRedoLog(RedoLog *redoLog, OperateTuple *ops)
@@ -279,16 +399,28 @@ void freeRedoLog(RedoLog *redoLog){
 	pthread_mutex_unlock(&redoLog->statusMutex);
 	pthread_cleanup_pop(0);
 	pthread_join(redoLog->persistenceThread, NULL);
+	//等待还没有返回的waitRedoLog
+	pthread_cleanup_push((void *)pthread_mutex_unlock, &redoLog->statusMutex);
+	pthread_mutex_lock(&redoLog->statusMutex);
+	while(redoLog->waiters > 0){
+		pthread_cond_wait(&redoLog->statusCond, &redoLog->statusMutex);
+	}
+	pthread_mutex_unlock(&redoLog->statusMutex);
+	pthread_cleanup_pop(0);
 	close(redoLog->fd);
 	free(redoLog->filename);
+	free(redoLog->buffer);
 	freeList(redoLog->operateList);
 	free(redoLog);
 }
 
 void forceFreeRedoLog(RedoLog *redoLog){
+	//等待线程退出后再释放：线程可能正在写入缓冲区
 	pthread_cancel(redoLog->persistenceThread);
+	pthread_join(redoLog->persistenceThread, NULL);
 	close(redoLog->fd);
 	free(redoLog->filename);
+	free(redoLog->buffer);
 	freeList(redoLog->operateList);
 	free(redoLog);
 }
@@ -301,9 +433,11 @@ static void operateListFreeForEach(void* value, void* args){
 
 void forceFreeRedoLogAndUnlink(RedoLog *redoLog){
 	pthread_cancel(redoLog->persistenceThread);
+	pthread_join(redoLog->persistenceThread, NULL);
 	close(redoLog->fd);
 	unlink(redoLog->filename);
 	free(redoLog->filename);
+	free(redoLog->buffer);
 	foreachList(redoLog->operateList, operateListFreeForEach, (void *)redoLog);
 	freeList(redoLog->operateList);
 	free(redoLog);
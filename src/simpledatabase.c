@@ -122,7 +122,14 @@ int createTable(SimpleDatabase *dbms, const char *databasename, const char *tabl
 	char * tableFilename = genTablefilename(databasename, tablename);
 	char * tableFilepath = genFullpath(dbms->dirpath, tableFilename);
 	//创建HashEngine
-	HashEngine *tableData = makeHashEngine(tableFilepath, dataHashMapCap, dataCacheCap, 1024, sizeThreshold, 1024);
+	//开启重做日志的表使用立即写入策略：写操作等待所在的组写入并同步之后才返回，并发的写操作组成一组提交
+	HashEngine *tableData = makeHashEngine(tableFilepath, dataHashMapCap, dataCacheCap, 1024, synchronize, 0);
+	//行数据包含定长字段的0填充，压缩存储
+	setHashEngineCompression(tableData, 1);
+	//超过16KB的行（大字符串字段）存放到blob文件，更新和碎片整理只拷贝引用
+	setHashEngineBlobThreshold(tableData, 16 * 1024);
+	//行数据写入重做日志
+	setHashEngineRedoLog(tableData, 1);
 	putHashMap(dbms->dataMap, strlen(tableFilename), (uint8 *)tableFilename, tableData);
 	//循环创建索引文件
 	uint64 pageSize = 16*1024;
@@ -149,6 +156,10 @@ int createTable(SimpleDatabase *dbms, const char *databasename, const char *tabl
 			isUnique,
 			maxHeapSize,
 			1024, sizeThreshold, 1024);
+		//字符串字段补0到字段长度，变长存储和比较，短字符串的扇出更高
+		if(field->type==FIELD_TYPE_STRING){
+			setIndexEngineVariableKey(tableIndex, 1);
+		}
 		putHashMap(dbms->indexMap, strlen(indexFilename), (uint8 *)indexFilename, tableIndex);
 		free(indexFilename);
 		free(indexFilepath);
@@ -396,11 +407,99 @@ static List* parseRecord(List* fields, Array* hashResult){
 	return result;
 }
 
+// 使用游标按文件顺序扫描整张表，逐条解析，不保留全部的原始value
+static List* scanAllRecords(List* fields, HashEngine *hashEngine){
+	List* result = makeList();
+	HashEngineCursor *cursor = openHashEngineCursor(hashEngine);
+	while (nextHashEngineCursor(cursor)) {
+		Array value;
+		value.array = cursor->value;
+		value.length = cursor->valueLen;
+		addList(result, parseRecord(fields, &value));
+	}
+	closeHashEngineCursor(cursor);
+	return result;
+}
+
 static int comparePrimaryKey(void *a, void *b, void *args){
 	FieldDefinition *primaryKeyField = (FieldDefinition *)args;
 	return byteArrayCompare(primaryKeyField->length, a, b);
 }
 
+/** 条件中的值转换为索引的key：字符串补齐到字段长度 */
+static uint8* dumpIndexKey(FieldDefinition *field, void *value){
+	Array* data = dumpValue(field, value);
+	if(data == NULL){
+		return NULL;
+	}
+	uint8 *key = calloc(1, field->length);
+	memcpy(key, data->array, data->length);
+	free(data->array);
+	free(data);
+	return key;
+}
+
+/** node之前是否已经有同一个字段上的范围条件，即已经合并扫描过 */
+static int isRangeMerged(List *conditions, ListNode *node){
+	QueryCondition *cond = (QueryCondition *)node->value;
+	for(ListNode *prev = conditions->head; prev != node; prev = prev->next){
+		QueryCondition *prevCond = (QueryCondition *)prev->value;
+		if(prevCond->relOp != RELOP_NEQ && strcmp(prevCond->name, cond->name) == 0){
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * 条件之间是AND关系：同一个索引字段上的范围条件取交集，使用游标只扫描范围内的记录
+ * @return List<void* 主键>
+ */
+static List* searchIndexRange(IndexEngine *indexEngine, FieldDefinition *field, List *conditions){
+	uint8 *lower = NULL, *upper = NULL;
+	int32 lowerInclusive = 1, upperInclusive = 1;
+	for(ListNode *node = conditions->head; node != NULL; node = node->next){
+		QueryCondition *cond = (QueryCondition *)node->value;
+		if(cond->relOp == RELOP_NEQ || strcmp(cond->name, field->name) != 0){
+			continue;
+		}
+		uint8 *key = dumpIndexKey(field, cond->value);
+		if(key == NULL){
+			continue;
+		}
+		if(cond->relOp == RELOP_EQ || cond->relOp == RELOP_GT || cond->relOp == RELOP_GTE){
+			int32 inclusive = cond->relOp != RELOP_GT;
+			int result = lower == NULL ? 1 : byteArrayCompare(field->length, key, lower);
+			if(result > 0 || (result == 0 && !inclusive)){
+				free(lower);
+				newAndCopyByteArray(&lower, key, field->length);
+				lowerInclusive = inclusive;
+			}
+		}
+		if(cond->relOp == RELOP_EQ || cond->relOp == RELOP_LT || cond->relOp == RELOP_LTE){
+			int32 inclusive = cond->relOp != RELOP_LT;
+			int result = upper == NULL ? -1 : byteArrayCompare(field->length, key, upper);
+			if(result < 0 || (result == 0 && !inclusive)){
+				free(upper);
+				newAndCopyByteArray(&upper, key, field->length);
+				upperInclusive = inclusive;
+			}
+		}
+		free(key);
+	}
+	List *result = makeList();
+	IndexEngineCursor *cursor = openIndexEngineCursor(indexEngine, lower, lowerInclusive, upper, upperInclusive, 0, 0);
+	while(nextIndexEngineCursor(cursor)){
+		uint8 *primaryKey;
+		newAndCopyByteArray(&primaryKey, cursor->value, indexEngine->treeMeta.valueLen);
+		addList(result, primaryKey);
+	}
+	closeIndexEngineCursor(cursor);
+	free(lower);
+	free(upper);
+	return result;
+}
+
 /**
  * 解析条件, 并查询索引
  * @return List<void* 主键> 
@@ -430,9 +529,16 @@ static List* parseConditions(SimpleDatabase *dbms, const char *databasename, con
 		} else {
 			char* indexfilename = genIndexfilename(databasename, tablename, targetField->name);
 			IndexEngine* indexEngine = (IndexEngine*) getHashMap(dbms->indexMap, strlen(indexfilename), (uint8*)indexfilename);
-			Array* key = dumpValue(targetField, cond->value);
-			List *now = searchConditionIndexEngine(indexEngine, key->array, cond->relOp);
-			addListToList(result, now);
+			if(cond->relOp != RELOP_NEQ){
+				//同一个字段上的范围条件合并为一次扫描
+				if(!isRangeMerged(conditions, node)){
+					addListToList(result, searchIndexRange(indexEngine, targetField, conditions));
+				}
+			} else {
+				Array* key = dumpValue(targetField, cond->value);
+				List *now = searchConditionIndexEngine(indexEngine, key->array, cond->relOp);
+				addListToList(result, now);
+			}
 		}
 		node = node->next;
 	}
@@ -442,16 +548,25 @@ static List* parseConditions(SimpleDatabase *dbms, const char *databasename, con
 
 static List *queryHashEngineByPrimaryList(HashEngine* engine, FieldDefinition *primaryKeyField, List *primaryKeyList){
 	List* result = makeList();
+	//批量查找：只加锁一次，磁盘读按位置排序
+	uint32 count = primaryKeyList->length;
+	uint32 *keyLens = malloc(sizeof(uint32) * (count + 1));
+	uint8 **keys = malloc(sizeof(uint8 *) * (count + 1));
+	Array *values = malloc(sizeof(Array) * (count + 1));
 	ListNode *node = primaryKeyList->head;
-	while (node != NULL) {
-		void* key = node->value;
-		Array value = getHashEngine(engine, primaryKeyField->length, key);
+	for (uint32 i = 0; node != NULL; i++, node = node->next) {
+		keyLens[i] = primaryKeyField->length;
+		keys[i] = node->value;
+	}
+	getBatchHashEngine(engine, count, keyLens, keys, values);
+	for (uint32 i = 0; i < count; i++) {
 		Array* array = malloc(sizeof(Array));
-		array->length = value.length;
-		newAndCopyByteArray((uint8**)&array->array, (uint8*)value.array, array->length);
+		*array = values[i];
 		addList(result, array);
-		node = node->next;
 	}
+	free(keyLens);
+	free(keys);
+	free(values);
 	return result;
 }
 
@@ -489,9 +604,9 @@ static int conditionTest(void* a, void* b, QueryCondition* cond ,FieldDefinition
 	} else if (cond->relOp == RELOP_LTE){
 		return result <= 0;
 	} else if (cond->relOp == RELOP_GT){
-		return result >= 0;
+		return result > 0;
 	} else if (cond->relOp == RELOP_GTE){
-		return result != 0;
+		return result >= 0;
 	} else {
 		return 0;
 	}
@@ -557,15 +672,17 @@ List *searchRecord(SimpleDatabase *dbms, const char *databasename, const char *t
 	//从Hash引擎拿到的数据
 	// List<Array*>
 	List* hashRecords = NULL;
+	//全表扫描直接解析为结果 List<List<void*>>
+	List* result = NULL;
 	if (conditions==NULL){
-		hashRecords = getAllHashEngine(hashEngine);
+		result = scanAllRecords(fields, hashEngine);
 	} else {
 		// 解析条件查询...
 		// 查询索引
 		// 循环查询Hash引擎
 		List *primaryKeyList = parseConditions(dbms, databasename, tablename, conditions, primaryKeyField);
 		if (primaryKeyList==NULL){
-			hashRecords = getAllHashEngine(hashEngine);
+			result = scanAllRecords(fields, hashEngine);
 		} else if(primaryKeyList->length==0) {
 			// 没有主键被选中
 			pthread_mutex_unlock(mutex);
@@ -574,18 +691,20 @@ List *searchRecord(SimpleDatabase *dbms, const char *databasename, const char *t
 			hashRecords = queryHashEngineByPrimaryList(hashEngine, primaryKeyField, primaryKeyList);
 		}
 	}
-	if(hashRecords==NULL){
+	if(result==NULL && hashRecords==NULL){
 		pthread_mutex_unlock(mutex);
 		return NULL;
 	}
 
 	//获取数据解析 List<Array*> -> List<List<void*>>
-	List* result = makeList();
-	ListNode* node = hashRecords->head;
-	while (node != NULL) {
-		List *record = parseRecord(fields, (Array *) node->value);
-		addList(result, record);
-		node = node->next;
+	if(result==NULL){
+		result = makeList();
+		ListNode* node = hashRecords->head;
+		while (node != NULL) {
+			List *record = parseRecord(fields, (Array *) node->value);
+			addList(result, record);
+			node = node->next;
+		}
 	}
 	// 过滤查询结果
 	List* answer = filterResult(result, conditions, fields);
@@ -23,6 +23,83 @@ void testBinarySearch(){
 	}
 }
 
+//=========test binarySearch 速度=========
+//原实现：逐字节比较，按比较结果分支
+static int32 referenceBinarySearch(BTreeNode* root, uint8* key, uint32 keyLen){
+	if(root->size==0){
+		return -1;
+	}
+	int32 left = 0, right = root->size-1, mid;
+	int32 result;
+	while(left<right){
+		mid = (left+right)>>1;
+		result = byteArrayCompare(keyLen, root->keys[mid], key);
+		if(result==0){
+			right=mid;
+		} else if(result<0){
+			left=mid+1;
+		} else {
+			right=mid-1;
+		}
+	}
+	result = byteArrayCompare(keyLen, root->keys[left], key);
+	if (result>0){
+		return left-1;
+	}
+	return left;
+}
+
+void testBinarySearchSpeed(){
+	const uint32 lens[] = {1, 4, 8, 16, 64};
+	const uint32 SIZE = 256;
+	const uint32 ROUNDS = 200;
+	for(int l=0; l<sizeof(lens)/sizeof(lens[0]); l++){
+		uint32 keyLen = lens[l];
+		BTree *config = makeBTree(SIZE, keyLen, 1, 0);
+		BTreeNode *node = config->root;
+		//有序且有重复的key：最后一个字节为2*(i/2)，前面补0
+		for(uint32 i=0; i<SIZE; i++){
+			node->keys[i] = (uint8 *)malloc(keyLen);
+			memset(node->keys[i], 0, keyLen);
+			node->keys[i][keyLen-1] = i / 2 * 2;
+		}
+		node->size = SIZE;
+		uint8 *key = (uint8 *)malloc(keyLen);
+		memset(key, 0, keyLen);
+		uint32 errors = 0;
+		for(uint32 k=0; k<SIZE; k++){
+			key[keyLen-1] = k;
+			if(binarySearch(node, key, keyLen)!=referenceBinarySearch(node, key, keyLen)){
+				errors++;
+			}
+		}
+		volatile int32 sink = 0;
+		uint64 start = currentTimeMillis();
+		for(uint32 r=0; r<ROUNDS; r++){
+			for(uint32 k=0; k<SIZE*4; k++){
+				key[keyLen-1] = k % 256;
+				sink += referenceBinarySearch(node, key, keyLen);
+			}
+		}
+		uint64 referenceTime = currentTimeMillis() - start;
+		start = currentTimeMillis();
+		for(uint32 r=0; r<ROUNDS; r++){
+			for(uint32 k=0; k<SIZE*4; k++){
+				key[keyLen-1] = k % 256;
+				sink += binarySearch(node, key, keyLen);
+			}
+		}
+		printf("keyLen=%u; 结果不一致%u次; 查找%u次：原实现%llums，专用比较+无分支查找%llums\n",
+			keyLen, errors, ROUNDS*SIZE*4, referenceTime, currentTimeMillis() - start);
+		free(key);
+		for(uint32 i=0; i<SIZE; i++){
+			free(node->keys[i]);
+		}
+		freeBTreeNode(config, node, 1);
+		free(config);
+	}
+}
+
 //=========test searchBTree=========
 void testSearchBTree(){
 	BTree *config = makeBTree(5, 1, 1, 1);
@@ -325,6 +402,8 @@ int main(int argc, char const *argv[])
 {
 	printf("=========test binarySearch=========\n");
 	testBinarySearch();
+	printf("=========test binarySearch 速度=========\n");
+	testBinarySearchSpeed();
 	printf("=========test searchBTree=========\n");
 	testSearchBTree();
 	printf("=========test insertBTree (1)=========\n");
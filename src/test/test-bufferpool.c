@@ -0,0 +1,123 @@
+/**
+ * Copyright (c) 2018, rectcircle. All rights reserved.
+ *
+ * @file test-bufferpool.c
+ * @author rectcircle
+ * @date 2026-10-17
+ * @version 0.0.1
+ */
+#include "bufferpool.h"
+#include "test.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+static void *countFrame(uint32 frame, uint8 *key, void *value, void *args){
+	(*(uint32 *)args)++;
+	return NULL;
+}
+
+void testPinAndEvict(){
+	printf("====测试固定与CLOCK淘汰====\n");
+	uint32 values[8];
+	uint32 frames[8];
+	BufferPool *pool = makeBufferPool(4, sizeof(uint32));
+	for(uint32 i = 0; i < 4; i++){
+		values[i] = i;
+		assertnull(putBufferPool(pool, (uint8 *)&i, &values[i], &frames[i]), "有空闲帧时不应该淘汰");
+	}
+	assertuint(4, pool->pinnedCnt, "放入的帧应该被固定");
+	assertuint(0, availableBufferPool(pool), "全部固定时没有可用的帧");
+	//全部固定：放入失败，不扩容
+	uint32 key = 4;
+	values[4] = 4;
+	assertnull(putBufferPool(pool, (uint8 *)&key, &values[4], &frames[4]), "所有帧被固定时不应该淘汰");
+	assertuint(BUFFER_POOL_NIL, frames[4], "所有帧被固定时应该放入失败");
+	assertuint(4, pool->capacity, "帧数不应该改变");
+	assertuint(1, pool->fullCnt, "放入失败次数应该为1");
+	assertnull(pinBufferPool(pool, (uint8 *)&key, NULL), "放入失败的key不应该存在");
+	//被固定的帧不能删除
+	key = 0;
+	assertnull(removeBufferPool(pool, (uint8 *)&key), "被固定的帧不应该被删除");
+	unpinBufferPool(pool, frames[0]);
+	assertuint(1, availableBufferPool(pool), "解除固定后应该有可用的帧");
+	for(uint32 i = 0; i < 4; i++){
+		unpinBufferPool(pool, frames[i]);
+		assertbool(1, &values[i] == removeBufferPool(pool, (uint8 *)&i), "解除固定后应该能删除");
+	}
+	freeBufferPool(pool);
+
+	pool = makeBufferPool(3, sizeof(uint32));
+	for(uint32 i = 0; i < 3; i++){
+		putBufferPool(pool, (uint8 *)&i, &values[i], &frames[i]);
+	}
+	//0固定，1脏，只有2可以淘汰
+	unpinBufferPool(pool, frames[1]);
+	unpinBufferPool(pool, frames[2]);
+	setDirtyBufferPool(pool, frames[1], 1);
+	assertuint(1, pool->pinnedCnt, "解除固定后的数目应该正确");
+	assertuint(1, pool->dirtyCnt, "脏帧数目应该正确");
+	key = 3;
+	assertbool(1, &values[2] == putBufferPool(pool, (uint8 *)&key, &values[3], &frames[3]), "应该淘汰未固定且不脏的帧");
+	key = 2;
+	assertnull(pinBufferPool(pool, (uint8 *)&key, NULL), "被淘汰的key不应该存在");
+	key = 0;
+	assertbool(1, &values[0] == pinBufferPool(pool, (uint8 *)&key, NULL), "固定的帧不应该被淘汰");
+	key = 1;
+	assertbool(1, &values[1] == pinBufferPool(pool, (uint8 *)&key, NULL), "脏帧不应该被淘汰");
+	unpinBufferPool(pool, frames[1]);
+	setDirtyBufferPool(pool, frames[1], 0);
+	assertuint(0, pool->dirtyCnt, "清除脏标志后的数目应该正确");
+	assertuint(1, availableBufferPool(pool), "只有被固定的0和3不可用");
+	//替换value：占位的帧读入完成后替换为真正的值
+	setValueBufferPool(pool, frames[3], &values[4]);
+	key = 3;
+	assertbool(1, &values[4] == pinBufferPool(pool, (uint8 *)&key, NULL), "应该查找到替换后的值");
+	uint32 count = 0;
+	foreachBufferPool(pool, countFrame, &count);
+	assertuint(3, count, "遍历的帧数目应该正确");
+	freeBufferPool(pool);
+}
+
+void testClock(){
+	printf("====测试CLOCK访问位====\n");
+	const uint32 CAPACITY = 64;
+	uint32 *values = (uint32 *)malloc(sizeof(uint32) * CAPACITY * 4);
+	BufferPool *pool = makeBufferPool(CAPACITY, sizeof(uint32));
+	uint32 frame;
+	for(uint32 i = 0; i < CAPACITY; i++){
+		values[i] = i;
+		putBufferPool(pool, (uint8 *)&i, &values[i], &frame);
+		unpinBufferPool(pool, frame);
+	}
+	//转一圈清除所有访问位：放入一个新key淘汰第一帧
+	uint32 key = CAPACITY;
+	values[key] = key;
+	assertbool(1, &values[0] == putBufferPool(pool, (uint8 *)&key, &values[key], &frame), "访问位全部为1时应该淘汰时钟指针之后的第一帧");
+	unpinBufferPool(pool, frame);
+	//热点key：每次淘汰前都被访问，不应该被淘汰
+	uint32 hot = CAPACITY / 2;
+	uint32 evictHot = 0;
+	for(uint32 i = CAPACITY + 1; i < CAPACITY * 4; i++){
+		if(pinBufferPool(pool, (uint8 *)&hot, &frame) == NULL){
+			evictHot++;
+		} else {
+			unpinBufferPool(pool, frame);
+		}
+		values[i] = i;
+		void *evicted = putBufferPool(pool, (uint8 *)&i, &values[i], &frame);
+		assertbool(1, evicted != NULL, "缓冲池满时应该淘汰");
+		unpinBufferPool(pool, frame);
+	}
+	assertuint(0, evictHot, "经常访问的帧不应该被淘汰");
+	assertuint(CAPACITY, pool->size, "缓冲池的帧数目应该不变");
+	assertuint(0, pool->fullCnt, "有可淘汰的帧时不应该放入失败");
+	freeBufferPool(pool);
+	free(values);
+}
+
+int main(int argc, char const *argv[])
+{
+	printf("=========test BufferPool=========\n");
+	launchTests(2, testPinAndEvict, testClock);
+	return 0;
+}
@@ -0,0 +1,117 @@
+/**
+ * Copyright (c) 2018, rectcircle. All rights reserved.
+ *
+ * @file test-compress.c
+ * @author rectcircle
+ * @date 2026-10-17
+ * @version 0.0.1
+ */
+#include "compress.h"
+#include "test.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//压缩再解压，返回压缩后长度，结果不一致返回0
+static uint32 roundTrip(const uint8 *src, uint32 len){
+	uint32 cap = lzCompressBound(len);
+	uint8 *compressed = (uint8 *)malloc(cap);
+	uint8 *restored = (uint8 *)malloc(len + 1);
+	uint32 compressedLen = lzCompress(src, len, compressed, cap);
+	int32 restoredLen = lzDecompress(compressed, compressedLen, restored, len);
+	uint32 result = compressedLen;
+	if(compressedLen == 0 || restoredLen != (int32)len || memcmp(src, restored, len) != 0){
+		result = 0;
+	}
+	free(compressed);
+	free(restored);
+	return result;
+}
+
+void testRoundTrip(){
+	printf("====测试压缩解压====\n");
+	const uint32 LEN = 1024 * 1024;
+	uint8 *data = (uint8 *)malloc(LEN);
+
+	assertuint(1, roundTrip((uint8 *)"", 0) > 0, "空数据应该可以压缩解压");
+	assertuint(1, roundTrip((uint8 *)"abc", 3) > 0, "短数据应该可以压缩解压");
+
+	//全0：模拟定长字段的填充
+	memset(data, 0, LEN);
+	uint32 len = roundTrip(data, LEN);
+	printf("全0数据：%u -> %u\n", LEN, len);
+	assertuint(1, len > 0 && len < LEN / 100, "全0数据压缩后应该很小");
+
+	//重复的文本
+	const char *text = "hello hash engine, ";
+	for(uint32 i = 0; i < LEN; i++){
+		data[i] = text[i % strlen(text)];
+	}
+	len = roundTrip(data, LEN);
+	printf("重复文本：%u -> %u\n", LEN, len);
+	assertuint(1, len > 0 && len < LEN / 10, "重复文本压缩后应该很小");
+
+	//模拟一行数据：短字符串后跟随大量0填充
+	memset(data, 0, LEN);
+	for(uint32 row = 0; row < LEN / 256; row++){
+		sprintf((char *)data + row * 256, "row-%u-content-%u", row, row * 7);
+	}
+	len = roundTrip(data, LEN);
+	printf("带填充的行：%u -> %u\n", LEN, len);
+	assertuint(1, len > 0 && len < LEN / 4, "带填充的行压缩后应该明显变小");
+
+	//随机数据：不可压缩
+	srand(1);
+	for(uint32 i = 0; i < LEN; i++){
+		data[i] = rand() & 0xff;
+	}
+	assertuint(1, roundTrip(data, LEN) > 0, "随机数据应该可以压缩解压");
+	uint8 *compressed = (uint8 *)malloc(LEN);
+	assertuint(0, lzCompress(data, LEN, compressed, LEN - 1), "不可压缩的数据输出缓冲区不足时应该返回0");
+	free(compressed);
+	free(data);
+}
+
+void testCorrupt(){
+	printf("====测试损坏的压缩数据====\n");
+	const uint32 LEN = 4096;
+	uint8 *data = (uint8 *)calloc(LEN, 1);
+	uint8 *compressed = (uint8 *)malloc(lzCompressBound(LEN));
+	uint8 *restored = (uint8 *)malloc(LEN);
+	uint32 compressedLen = lzCompress(data, LEN, compressed, lzCompressBound(LEN));
+	assertuint(1, lzDecompress(compressed, compressedLen, restored, LEN - 1) == -1, "输出缓冲区不足应该返回-1");
+	assertuint(1, lzDecompress(compressed, compressedLen / 2, restored, LEN) != LEN, "截断的数据不应该解压成功");
+	//offset指向输出之前
+	uint8 bad[] = {0x10, 'a', 0x05, 0x00};
+	assertuint(1, lzDecompress(bad, sizeof(bad), restored, LEN) == -1, "越界的offset应该返回-1");
+	free(data);
+	free(compressed);
+	free(restored);
+}
+
+void testSpeed(){
+	printf("====测试压缩速度====\n");
+	const uint32 LEN = 16 * 1024 * 1024;
+	uint8 *data = (uint8 *)calloc(LEN, 1);
+	for(uint32 row = 0; row < LEN / 256; row++){
+		sprintf((char *)data + row * 256, "row-%u-content-%u", row, row * 7);
+	}
+	uint32 cap = lzCompressBound(LEN);
+	uint8 *compressed = (uint8 *)malloc(cap);
+	uint64 start = currentTimeMillis();
+	uint32 compressedLen = lzCompress(data, LEN, compressed, cap);
+	uint64 compressTime = currentTimeMillis() - start;
+	start = currentTimeMillis();
+	int32 restoredLen = lzDecompress(compressed, compressedLen, data, LEN);
+	printf("16MB：压缩到%u字节耗时%llums，解压耗时%llums\n", compressedLen, compressTime, currentTimeMillis() - start);
+	assertuint(LEN, restoredLen, "解压后长度应该正确");
+	free(data);
+	free(compressed);
+}
+
+int main(int argc, char const *argv[])
+{
+	launchTests(3, testRoundTrip, testCorrupt, testSpeed);
+	return 0;
+}
@@ -0,0 +1,218 @@
+/**
+ * Copyright (c) 2018, rectcircle. All rights reserved.
+ *
+ * @file test-diskindex.c
+ * @author rectcircle
+ * @date 2026-10-17
+ * @version 0.0.1
+ */
+#include "diskindex.h"
+#include "test.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+static const char *INDEX_FILENAME = "test.diskindex";
+
+//生成第i个key，长度随i变化
+static uint32 makeKey(uint32 i, uint8 *key){
+	return sprintf((char *)key, "disk-index-key-%u-%.*s", i, i % 23, "abcdefghijklmnopqrstuvw");
+}
+
+static void *countEntry(uint32 keyLen, uint8 *key, DiskIndexValue *value, void *args){
+	(*(uint64 *)args)++;
+	return NULL;
+}
+
+void testBasic(){
+	printf("====测试插入查找删除====\n");
+	DiskIndex *index = makeDiskIndex(INDEX_FILENAME, 8);
+	uint8 key[64];
+	DiskIndexValue value;
+	for(uint32 i = 0; i < 100; i++){
+		uint32 len = makeKey(i, key);
+		value.position = i;
+		value.size = i + 1;
+		value.blobSize = i + 2;
+		assertint(1, putDiskIndex(index, len, key, &value), "新的key应该返回1");
+	}
+	assertulonglong(100, index->count, "插入后的数目应该正确");
+	uint32 len = makeKey(7, key);
+	value.position = 700;
+	value.size = 8;
+	value.blobSize = 9;
+	assertint(0, putDiskIndex(index, len, key, &value), "已存在的key应该返回0");
+	assertulonglong(100, index->count, "更新不改变数目");
+	uint32 errors = 0;
+	for(uint32 i = 0; i < 100; i++){
+		len = makeKey(i, key);
+		errors += getDiskIndex(index, len, key, &value) != 1 || value.position != (i == 7 ? 700 : i) ||
+				  value.size != i + 1 || value.blobSize != i + 2;
+	}
+	assertuint(0, errors, "所有key都应该可以查到");
+	len = makeKey(1000, key);
+	assertint(0, getDiskIndex(index, len, key, &value), "不存在的key应该返回0");
+	len = makeKey(3, key);
+	assertint(1, removeDiskIndex(index, len, key), "删除存在的key应该返回1");
+	assertint(0, removeDiskIndex(index, len, key), "重复删除应该返回0");
+	assertint(0, getDiskIndex(index, len, key, &value), "删除后应该查不到");
+	uint64 count = 0;
+	foreachDiskIndex(index, countEntry, &count);
+	assertulonglong(99, count, "遍历的数目应该正确");
+	uint8 longKey[DISK_INDEX_MAX_KEY_SIZE + 1];
+	memset(longKey, 'k', sizeof(longKey));
+	assertint(-1, putDiskIndex(index, sizeof(longKey), longKey, &value), "过长的key应该被拒绝");
+	assertint(1, putDiskIndex(index, DISK_INDEX_MAX_KEY_SIZE, longKey, &value), "最大长度的key应该可以插入");
+	freeDiskIndex(index);
+	unlink(INDEX_FILENAME);
+}
+
+void testGrow(){
+	printf("====测试分裂与溢出页====\n");
+	const uint32 COUNT = 200000;
+	DiskIndex *index = makeDiskIndex(INDEX_FILENAME, 16);
+	uint8 key[64];
+	DiskIndexValue value = {0, 0, 0};
+	for(uint32 i = 0; i < COUNT; i++){
+		uint32 len = makeKey(i, key);
+		value.position = (uint64)i * 3;
+		putDiskIndex(index, len, key, &value);
+	}
+	printf("插入%u条后：桶%u个，读取页%llu次，写回页%llu次\n", COUNT, getDiskIndexBucketCount(index), index->pageReads, index->pageWrites);
+	assertulonglong(COUNT, index->count, "插入后的数目应该正确");
+	assertuint(1, getDiskIndexBucketCount(index) > COUNT / 100, "桶应该随数据量分裂");
+	assertuint(1, index->pages->size <= 16, "缓存的页数不超过容量");
+	//删除一半，再插入另一批，重用空闲页
+	for(uint32 i = 0; i < COUNT; i += 2){
+		uint32 len = makeKey(i, key);
+		removeDiskIndex(index, len, key);
+	}
+	for(uint32 i = COUNT; i < COUNT + COUNT / 4; i++){
+		uint32 len = makeKey(i, key);
+		value.position = (uint64)i * 3;
+		putDiskIndex(index, len, key, &value);
+	}
+	uint32 errors = 0;
+	for(uint32 i = 0; i < COUNT + COUNT / 4; i++){
+		uint32 len = makeKey(i, key);
+		int32 found = getDiskIndex(index, len, key, &value);
+		if(i < COUNT && i % 2 == 0){
+			errors += found != 0;
+		} else {
+			errors += found != 1 || value.position != (uint64)i * 3;
+		}
+	}
+	assertuint(0, errors, "分裂和删除后查询结果应该正确");
+	uint64 count = 0;
+	foreachDiskIndex(index, countEntry, &count);
+	assertulonglong(COUNT / 2 + COUNT / 4, count, "遍历的数目应该正确");
+	assertulonglong(count, index->count, "数目应该与遍历一致");
+	freeDiskIndex(index);
+	unlink(INDEX_FILENAME);
+}
+
+void testPersist(){
+	printf("====测试持久化与崩溃检测====\n");
+	const uint32 COUNT = 50000;
+	DiskIndex *index = makeDiskIndex(INDEX_FILENAME, 8);
+	uint8 key[64];
+	DiskIndexValue value = {0, 0, 0};
+	for(uint32 i = 0; i < COUNT; i++){
+		uint32 len = makeKey(i, key);
+		value.position = i;
+		putDiskIndex(index, len, key, &value);
+	}
+	uint64 userData[DISK_INDEX_USER_DATA_COUNT] = {1, 2, 3, 4};
+	assertint(1, syncDiskIndex(index, userData), "同步应该成功");
+	uint64 writes = index->pageWrites;
+	assertint(1, syncDiskIndex(index, userData), "没有修改时同步应该成功");
+	assertulonglong(writes, index->pageWrites, "没有修改时同步不应该写回页");
+	uint32 buckets = getDiskIndexBucketCount(index);
+	freeDiskIndex(index);
+
+	index = loadDiskIndex(INDEX_FILENAME, 8);
+	assertuint(1, index != NULL, "同步后应该可以加载");
+	assertulonglong(COUNT, index->count, "加载后的数目应该正确");
+	assertuint(buckets, getDiskIndexBucketCount(index), "加载后的桶数目应该正确");
+	assertulonglong(3, index->userData[2], "userData应该被持久化");
+	uint32 errors = 0;
+	for(uint32 i = 0; i < COUNT; i++){
+		uint32 len = makeKey(i, key);
+		errors += getDiskIndex(index, len, key, &value) != 1 || value.position != i;
+	}
+	assertuint(0, errors, "加载后所有key都应该可以查到");
+
+	//修改后不同步，写回过页的索引不能被加载
+	for(uint32 i = COUNT; i < COUNT * 2; i++){
+		uint32 len = makeKey(i, key);
+		putDiskIndex(index, len, key, &value);
+	}
+	assertuint(1, index->pageWrites > 0 && index->dirty, "缓存不足时应该写回页并标记未同步");
+	freeDiskIndex(index);
+	assertnull(loadDiskIndex(INDEX_FILENAME, 8), "未同步的索引应该加载失败");
+	assertnull(loadDiskIndex("test.diskindex.none", 8), "不存在的文件应该加载失败");
+	unlink(INDEX_FILENAME);
+}
+
+void testIOFailure(){
+	printf("====测试页读写失败====\n");
+	const uint32 COUNT = 2000;
+	DiskIndex *index = makeDiskIndex(INDEX_FILENAME, 4);
+	uint8 key[64];
+	DiskIndexValue value = {0, 0, 0};
+	for(uint32 i = 0; i < COUNT; i++){
+		uint32 len = makeKey(i, key);
+		value.position = i;
+		putDiskIndex(index, len, key, &value);
+	}
+	assertint(1, syncDiskIndex(index, NULL), "同步应该成功");
+	freeDiskIndex(index);
+	index = loadDiskIndex(INDEX_FILENAME, 4);
+	int saved = dup(index->fd);
+
+	//读取失败：返回错误，不能把读取失败的页当作空页缓存
+	int writeOnly = open("/dev/null", O_WRONLY);
+	dup2(writeOnly, index->fd);
+	close(writeOnly);
+	uint32 len = makeKey(0, key);
+	assertint(-1, getDiskIndex(index, len, key, &value), "读取页失败应该返回-1");
+	dup2(saved, index->fd);
+	assertint(1, getDiskIndex(index, len, key, &value), "读取恢复后应该可以查到key");
+
+	//写回失败：被淘汰的脏页保留在缓存中，修改返回错误，索引不再同步
+	int readOnly = open(INDEX_FILENAME, O_RDONLY);
+	dup2(readOnly, index->fd);
+	close(readOnly);
+	uint8 *updated = (uint8 *)calloc(COUNT, 1);
+	uint32 failures = 0;
+	for(uint32 i = 0; i < COUNT; i++){
+		len = makeKey(i, key);
+		value.position = COUNT + i;
+		int32 result = putDiskIndex(index, len, key, &value);
+		updated[i] = result == 0;
+		failures += result == -1;
+	}
+	assertuint(1, failures > 0 && failures < COUNT, "缓存不足且写回失败时部分修改应该失败");
+	assertint(1, index->failed, "修改失败后应该标记索引失败");
+	dup2(saved, index->fd);
+	close(saved);
+	assertint(0, syncDiskIndex(index, NULL), "修改失败后不应该同步");
+	uint32 errors = 0;
+	for(uint32 i = 0; i < COUNT; i++){
+		len = makeKey(i, key);
+		errors += getDiskIndex(index, len, key, &value) != 1 || value.position != (updated[i] ? COUNT + i : i);
+	}
+	assertuint(0, errors, "写回失败的页不应该丢失修改");
+	free(updated);
+	freeDiskIndex(index);
+	assertnull(loadDiskIndex(INDEX_FILENAME, 4), "修改失败的索引应该加载失败（需要重建）");
+	unlink(INDEX_FILENAME);
+}
+
+int main(int argc, char const *argv[])
+{
+	launchTests(4, testBasic, testGrow, testPersist, testIOFailure);
+	return 0;
+}
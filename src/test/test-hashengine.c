@@ -12,6 +12,11 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <fcntl.h>
 
 void cleanRedoLogFile(const char * engineFilename){
 	char *filename = malloc(strlen(engineFilename) + 30);
@@ -179,11 +184,1420 @@ void testRandomOps(){
 	freeHashEngine(engine);
 }
 
+void testCompaction(){
+	printf("====测试在线碎片整理====\n");
+	char *filename = "test.hashengine";
+	unlink(filename);
+	cleanRedoLogFile(filename);
+	HashEngine *engine = makeHashEngine(filename, 100, 3, 3, synchronize, 0);
+	//关闭自动整理，手动触发
+	setHashEngineCompaction(engine, 0, 0);
+	const uint32 KEY_COUNT = 50;
+	const uint32 ROUND = 10;
+	for(uint32 r=0; r<ROUND; r++){
+		for(uint32 key=0; key<KEY_COUNT; key++){
+			uint64 value = r * 1000 + key;
+			putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+		}
+	}
+	HashEngineSpaceStats stats = getHashEngineSpaceStats(engine);
+	printf("整理前：fileSize=%llu, liveSize=%llu, liveCount=%llu, 放大倍数=%.2f\n",
+		   stats.fileSize, stats.liveSize, stats.liveCount, stats.spaceAmplification);
+	assertuint(1, stats.spaceAmplification > 5, "整理前空间放大应该大于5");
+	assertuint(1, compactHashEngine(engine), "碎片整理应该成功");
+	stats = getHashEngineSpaceStats(engine);
+	printf("整理后：fileSize=%llu, liveSize=%llu, liveCount=%llu, 放大倍数=%.2f\n",
+		   stats.fileSize, stats.liveSize, stats.liveCount, stats.spaceAmplification);
+	assertulonglong(1, stats.compactionCount, "碎片整理次数应该为1");
+	assertulonglong(stats.liveSize + 8, stats.fileSize, "整理后文件中只有有效记录");
+	//整理后继续读写
+	for(uint32 key=0; key<KEY_COUNT; key++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		assertulonglong((ROUND - 1) * 1000 + key, *(uint64 *)arr.array, "整理后查询结果应该为最新值");
+		free(arr.array);
+	}
+	for(uint32 key=0; key<KEY_COUNT; key+=2){
+		uint64 value = 99999 + key;
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	freeHashEngine(engine);
+	//重新加载验证
+	engine = loadHashEngine(filename, 100, 3, 3, synchronize, 0);
+	for(uint32 key=0; key<KEY_COUNT; key++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		uint64 expect = key % 2 == 0 ? 99999 + key : (ROUND - 1) * 1000 + key;
+		assertulonglong(expect, *(uint64 *)arr.array, "重新加载后查询结果应该为最新值");
+		free(arr.array);
+	}
+	freeHashEngine(engine);
+}
+
+void testAutoCompaction(){
+	printf("====测试自动碎片整理====\n");
+	char *filename = "test.hashengine";
+	unlink(filename);
+	cleanRedoLogFile(filename);
+	HashEngine *engine = makeHashEngine(filename, 100, 3, 3, synchronize, 0);
+	setHashEngineCompaction(engine, 2.0, 0);
+	const uint32 KEY_COUNT = 10;
+	for(uint32 r=0; r<100; r++){
+		for(uint32 key=0; key<KEY_COUNT; key++){
+			uint64 value = r * 1000 + key;
+			putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+		}
+	}
+	HashEngineSpaceStats stats = getHashEngineSpaceStats(engine);
+	printf("compactionCount=%llu, fileSize=%llu, liveSize=%llu, 放大倍数=%.2f\n",
+		   stats.compactionCount, stats.fileSize, stats.liveSize, stats.spaceAmplification);
+	assertuint(1, stats.compactionCount > 0, "应该自动进行过碎片整理");
+	assertuint(1, stats.fileSize < 100 * KEY_COUNT * (16 + 4 + 8) / 2, "数据文件尺寸应该被控制");
+	for(uint32 key=0; key<KEY_COUNT; key++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		assertulonglong(99 * 1000 + key, *(uint64 *)arr.array, "查询结果应该为最新值");
+		free(arr.array);
+	}
+	freeHashEngine(engine);
+}
+
+static void verifyHintEngine(const char *filename, uint32 keyCount, const char *msg){
+	HashEngine *engine = loadHashEngine(filename, 100, 3, 3, synchronize, 0);
+	for(uint32 key=0; key<keyCount; key++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		assertulonglong(2 * 1000 + key, *(uint64 *)arr.array, msg);
+		free(arr.array);
+	}
+	freeHashEngine(engine);
+}
+
+static off_t fileSizeOf(const char *filename){
+	struct stat st;
+	if(stat(filename, &st) != 0){
+		return -1;
+	}
+	return st.st_size;
+}
+
+void testHintFile(){
+	printf("====测试提示文件加载====\n");
+	char *filename = "test.hashengine";
+	char *hintFilename = "test.hashengine.hint";
+	unlink(filename);
+	cleanRedoLogFile(filename);
+	HashEngine *engine = makeHashEngine(filename, 100, 3, 3, synchronize, 0);
+	const uint32 KEY_COUNT = 100;
+	for(uint32 r=0; r<3; r++){
+		for(uint32 key=0; key<KEY_COUNT; key++){
+			uint64 value = r * 1000 + key;
+			putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+		}
+	}
+	freeHashEngine(engine);
+	printf("提示文件尺寸=%ld\n", (long)fileSizeOf(hintFilename));
+	assertuint(1, fileSizeOf(hintFilename) > 8, "持久化后应该生成提示文件");
+	verifyHintEngine(filename, KEY_COUNT, "通过提示文件加载后查询结果应该为最新值");
+
+	//模拟检查点写入数据文件后、写入提示文件前崩溃：只扫描尾部
+	truncate(hintFilename, 8 + 30);
+	verifyHintEngine(filename, KEY_COUNT, "提示文件不完整时查询结果应该为最新值");
+	assertuint(1, fileSizeOf(hintFilename) > 8 + 30, "加载后应该重写提示文件");
+
+	//提示文件丢失：全量扫描
+	unlink(hintFilename);
+	verifyHintEngine(filename, KEY_COUNT, "提示文件丢失时查询结果应该为最新值");
+	assertuint(1, fileSizeOf(hintFilename) > 8, "加载后应该重新生成提示文件");
+	verifyHintEngine(filename, KEY_COUNT, "重新生成提示文件后查询结果应该为最新值");
+
+	//不进行碎片整理时反复更新少量key：检查点根据内存索引重写提示文件，尺寸不随写入量增长
+	unlink(filename);
+	cleanRedoLogFile(filename);
+	engine = makeHashEngine(filename, 100, 3, 3, synchronize, 0);
+	setHashEngineCompaction(engine, 0, 0);
+	const uint32 ROUNDS = 2000, HOT_KEY_COUNT = 10;
+	for(uint32 r=0; r<ROUNDS; r++){
+		for(uint32 key=0; key<HOT_KEY_COUNT; key++){
+			uint64 value = r * 1000 + key;
+			putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+		}
+	}
+	freeHashEngine(engine);
+	printf("更新%u次后提示文件尺寸=%ld\n", ROUNDS * HOT_KEY_COUNT, (long)fileSizeOf(hintFilename));
+	assertuint(1, fileSizeOf(hintFilename) < ROUNDS * HOT_KEY_COUNT * (28 + 4) / 2, "提示文件应该被重写");
+	engine = loadHashEngine(filename, 100, 3, 3, synchronize, 0);
+	for(uint32 key=0; key<HOT_KEY_COUNT; key++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		assertulonglong((ROUNDS - 1) * 1000 + key, *(uint64 *)arr.array, "通过重写的提示文件加载后查询结果应该为最新值");
+		free(arr.array);
+	}
+	freeHashEngine(engine);
+}
+
+void testGroupCommit(){
+	printf("====测试批量提交持久化====\n");
+	char *filename = "test.hashengine";
+	const uint32 KEY_COUNT = 5000;
+	enum HashEngineDurability policies[] = {NoSync, SyncPerCheckpoint, SyncPerBatch};
+	char *policyNames[] = {"NoSync", "SyncPerCheckpoint", "SyncPerBatch"};
+	uint32 batchSizes[] = {0, 0, 4096};
+	uint8 value[100];
+	uint8 bigValue[10000];
+	memset(bigValue, 7, sizeof(bigValue));
+	for(int p = 0; p < 3; p++){
+		unlink(filename);
+		cleanRedoLogFile(filename);
+		HashEngine *engine = makeHashEngine(filename, KEY_COUNT, KEY_COUNT, 3, synchronize, 0);
+		setHashEngineFlushPolicy(engine, policies[p], batchSizes[p]);
+		for(uint32 key=0; key<KEY_COUNT; key++){
+			memset(value, key % 256, sizeof(value));
+			if(key == KEY_COUNT / 2){
+				//大于批次大小的记录
+				putHashEngine(engine, 4, (uint8 *)&key, sizeof(bigValue), bigValue);
+			} else {
+				putHashEngine(engine, 4, (uint8 *)&key, sizeof(value), value);
+			}
+		}
+		//析构时进行一次检查点持久化
+		uint64 start = currentTimeMillis();
+		freeHashEngine(engine);
+		printf("%s: 一个检查点持久化%u条记录耗时%llums\n", policyNames[p], KEY_COUNT, currentTimeMillis() - start);
+
+		engine = loadHashEngine(filename, KEY_COUNT, 3, 3, synchronize, 0);
+		for(uint32 key=0; key<KEY_COUNT; key++){
+			Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+			if(key == KEY_COUNT / 2){
+				assertuint(0, memcmp(bigValue, arr.array, sizeof(bigValue)), "重新加载后大记录应该正确");
+			} else {
+				memset(value, key % 256, sizeof(value));
+				assertuint(0, memcmp(value, arr.array, sizeof(value)), "重新加载后查询结果应该正确");
+			}
+			free(arr.array);
+		}
+		freeHashEngine(engine);
+	}
+}
+
+#define CONCURRENT_KEY_COUNT 2000
+#define CONCURRENT_READER_COUNT 4
+
+typedef struct ConcurrentArgs
+{
+	HashEngine *engine;
+	uint32 seed;
+	uint32 ops;
+	uint32 errors;
+} ConcurrentArgs;
+
+static uint64 concurrentValueOf(uint32 key){
+	return (uint64)key * 31 + 7;
+}
+
+static void *concurrentReader(void *arg){
+	ConcurrentArgs *args = (ConcurrentArgs *)arg;
+	for(uint32 i=0; i<args->ops; i++){
+		uint32 key = rand_r(&args->seed) % CONCURRENT_KEY_COUNT;
+		Array arr = getHashEngine(args->engine, 4, (uint8 *)&key);
+		if(arr.length != 8 || *(uint64 *)arr.array != concurrentValueOf(key)){
+			args->errors++;
+		}
+		free(arr.array);
+	}
+	return NULL;
+}
+
+static void *concurrentWriter(void *arg){
+	ConcurrentArgs *args = (ConcurrentArgs *)arg;
+	for(uint32 i=0; i<args->ops; i++){
+		//重写相同的值，使记录在读缓存、写缓存、冻结写缓存和磁盘之间移动
+		uint32 key = rand_r(&args->seed) % CONCURRENT_KEY_COUNT;
+		uint64 value = concurrentValueOf(key);
+		putHashEngine(args->engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	return NULL;
+}
+
+void testConcurrentGet(){
+	printf("====测试多线程并发读====\n");
+	char *filename = "test.hashengine";
+	unlink(filename);
+	cleanRedoLogFile(filename);
+	HashEngine *engine = makeHashEngine(filename, CONCURRENT_KEY_COUNT, 64, 3, synchronize, 0);
+	for(uint32 key=0; key<CONCURRENT_KEY_COUNT; key++){
+		uint64 value = concurrentValueOf(key);
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	freeHashEngine(engine);
+	//读缓存很小，大部分读取需要访问磁盘
+	engine = loadHashEngine(filename, CONCURRENT_KEY_COUNT, 64, 3, synchronize, 0);
+	for(int readerCount = 1; readerCount <= CONCURRENT_READER_COUNT; readerCount *= 2){
+		pthread_t threads[CONCURRENT_READER_COUNT + 1];
+		ConcurrentArgs args[CONCURRENT_READER_COUNT + 1];
+		uint64 start = currentTimeMillis();
+		for(int i=0; i<=readerCount; i++){
+			args[i].engine = engine;
+			args[i].seed = i + 1;
+			args[i].ops = 20000;
+			args[i].errors = 0;
+			//最后一个线程为写线程
+			pthread_create(&threads[i], NULL, i < readerCount ? concurrentReader : concurrentWriter, &args[i]);
+		}
+		uint32 errors = 0;
+		for(int i=0; i<=readerCount; i++){
+			pthread_join(threads[i], NULL);
+			errors += args[i].errors;
+		}
+		printf("%d个读线程+1个写线程，每个线程%u次操作，耗时%llums\n", readerCount, args[0].ops, currentTimeMillis() - start);
+		assertuint(0, errors, "并发读的结果应该都正确");
+	}
+	freeHashEngine(engine);
+}
+
+void testMmapView(){
+	printf("====测试内存映射零拷贝读====\n");
+	char *filename = "test.hashengine";
+	unlink(filename);
+	cleanRedoLogFile(filename);
+	const uint32 KEY_COUNT = 20;
+	const uint32 BIG_SIZE = 1024 * 1024;
+	uint8 *big = (uint8 *)malloc(BIG_SIZE);
+	HashEngine *engine = makeHashEngine(filename, 100, 3, 3, synchronize, 0);
+	setHashEngineCompaction(engine, 0, 0);
+	for(uint32 key=0; key<KEY_COUNT; key++){
+		memset(big, key + 1, BIG_SIZE);
+		putHashEngine(engine, 4, (uint8 *)&key, BIG_SIZE, big);
+	}
+	freeHashEngine(engine);
+
+	engine = loadHashEngine(filename, 100, 3, 3, synchronize, 0);
+	setHashEngineCompaction(engine, 0, 0);
+	setHashEngineMmapRead(engine, 1);
+	HashEngineView views[KEY_COUNT];
+	uint32 errors = 0, mapped = 0;
+	for(uint32 key=0; key<KEY_COUNT; key++){
+		views[key] = getViewHashEngine(engine, 4, (uint8 *)&key);
+		memset(big, key + 1, BIG_SIZE);
+		errors += views[key].length != BIG_SIZE || memcmp(big, views[key].value, BIG_SIZE) != 0;
+		mapped += views[key].mapping != NULL;
+	}
+	assertuint(0, errors, "视图的内容应该正确");
+	assertuint(KEY_COUNT, mapped, "磁盘上的记录应该直接指向映射区");
+
+	//更新后的记录在写缓存中，返回拷贝
+	uint32 key = 0;
+	uint64 small = 12345;
+	putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&small);
+	HashEngineView view = getViewHashEngine(engine, 4, (uint8 *)&key);
+	assertuint(8, view.length, "写缓存中的记录长度应该正确");
+	assertulonglong(small, *(uint64 *)view.value, "写缓存中的记录应该为最新值");
+	releaseHashEngineView(engine, &view);
+
+	//文件增长超出映射范围、碎片整理切换文件之后，已借出的视图仍然有效
+	for(uint32 k=KEY_COUNT; k<KEY_COUNT * 2; k++){
+		memset(big, k + 1, BIG_SIZE);
+		putHashEngine(engine, 4, (uint8 *)&k, BIG_SIZE, big);
+	}
+	assertuint(1, compactHashEngine(engine), "碎片整理应该成功");
+	errors = 0;
+	for(uint32 k=0; k<KEY_COUNT; k++){
+		memset(big, k + 1, BIG_SIZE);
+		errors += memcmp(big, views[k].value, BIG_SIZE) != 0;
+		releaseHashEngineView(engine, &views[k]);
+	}
+	assertuint(0, errors, "重新映射后旧视图的内容应该不变");
+
+	//重新映射后读取新写入的记录
+	errors = 0;
+	for(uint32 k=1; k<KEY_COUNT * 2; k++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&k);
+		memset(big, k + 1, BIG_SIZE);
+		errors += arr.length != BIG_SIZE || memcmp(big, arr.array, BIG_SIZE) != 0;
+		free(arr.array);
+	}
+	assertuint(0, errors, "开启映射读后getHashEngine的结果应该正确");
+	freeHashEngine(engine);
+	free(big);
+}
+
+static void verifyTombstoneEngine(HashEngine *engine, uint32 keyCount, const char *msg){
+	uint32 errors = 0;
+	for(uint32 key=0; key<keyCount; key++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		if(key % 2 == 0){
+			errors += arr.length != 0;
+		} else {
+			errors += arr.length != 8 || *(uint64 *)arr.array != key + 1000;
+		}
+		free(arr.array);
+	}
+	assertuint(0, errors, msg);
+}
+
+void testTombstone(){
+	printf("====测试墓碑删除====\n");
+	char *filename = "test.hashengine";
+	char *hintFilename = "test.hashengine.hint";
+	unlink(filename);
+	unlink(hintFilename);
+	cleanRedoLogFile(filename);
+	const uint32 KEY_COUNT = 100;
+	HashEngine *engine = makeHashEngine(filename, 16, 3, 3, synchronize, 0);
+	setHashEngineCompaction(engine, 0, 0);
+	for(uint32 key=0; key<KEY_COUNT; key++){
+		uint64 value = key;
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	//删除偶数key，之后再插入一次并删除，验证删除后重新插入的key
+	for(uint32 key=0; key<KEY_COUNT; key+=2){
+		assertuint(1, deleteHashEngine(engine, 4, (uint8 *)&key), "删除存在的key应该返回1");
+	}
+	for(uint32 key=0; key<KEY_COUNT; key++){
+		uint64 value = key + 1000;
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	for(uint32 key=0; key<KEY_COUNT; key+=2){
+		deleteHashEngine(engine, 4, (uint8 *)&key);
+	}
+	uint32 missing = KEY_COUNT * 2;
+	assertuint(0, deleteHashEngine(engine, 4, (uint8 *)&missing), "删除不存在的key应该返回0");
+	verifyTombstoneEngine(engine, KEY_COUNT, "删除后查询结果应该正确");
+	freeHashEngine(engine);
+
+	//墓碑持久化后，内存索引中只有有效的key
+	engine = loadHashEngine(filename, 16, 3, 3, synchronize, 0);
+	assertuint(KEY_COUNT / 2, engine->keyIndex->size, "从提示文件加载后内存索引中只有有效的key");
+	verifyTombstoneEngine(engine, KEY_COUNT, "从提示文件加载后查询结果应该正确");
+	HashEngineSpaceStats stats = getHashEngineSpaceStats(engine);
+	assertulonglong(KEY_COUNT / 2, stats.liveCount, "有效记录数目应该正确");
+	assertulonglong((uint64)(KEY_COUNT / 2) * (HASH_RECORD_HEADER_SIZE + 4 + 8), stats.liveSize, "墓碑和被删除的记录不计入有效空间");
+	freeHashEngine(engine);
+
+	unlink(hintFilename);
+	engine = loadHashEngine(filename, 16, 3, 3, synchronize, 0);
+	assertuint(KEY_COUNT / 2, engine->keyIndex->size, "扫描数据文件加载后内存索引中只有有效的key");
+	verifyTombstoneEngine(engine, KEY_COUNT, "扫描数据文件加载后查询结果应该正确");
+
+	//运行中删除：墓碑持久化后key从内存索引中删除
+	for(uint32 key=1; key<KEY_COUNT; key+=2){
+		deleteHashEngine(engine, 4, (uint8 *)&key);
+	}
+	assertuint(1, compactHashEngine(engine), "碎片整理应该成功");
+	for(uint32 i=0; i<3; i++){
+		//写满写缓存，使剩余的墓碑也被持久化
+		uint32 key = KEY_COUNT + i;
+		uint64 value = 0;
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+		deleteHashEngine(engine, 4, (uint8 *)&key);
+	}
+	assertuint(1, compactHashEngine(engine), "碎片整理应该成功");
+	assertuint(1, engine->keyIndex->size < KEY_COUNT / 2, "墓碑持久化后内存索引应该缩小");
+	freeHashEngine(engine);
+	engine = loadHashEngine(filename, 16, 3, 3, synchronize, 0);
+	assertuint(0, engine->keyIndex->size, "全部删除后内存索引应该为空");
+	freeHashEngine(engine);
+}
+
+#define PARTITION_WRITER_COUNT 4
+#define PARTITION_KEYS_PER_WRITER 20000
+
+static void *partitionWriter(void *arg){
+	ConcurrentArgs *args = (ConcurrentArgs *)arg;
+	//每个写线程写入不相交的key
+	for(uint32 i=0; i<args->ops; i++){
+		uint32 key = args->seed * PARTITION_KEYS_PER_WRITER + i;
+		uint64 value = concurrentValueOf(key);
+		putHashEngine(args->engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	return NULL;
+}
+
+static uint64 writeWithThreads(HashEngine *engine){
+	pthread_t threads[PARTITION_WRITER_COUNT];
+	ConcurrentArgs args[PARTITION_WRITER_COUNT];
+	uint64 start = currentTimeMillis();
+	for(int i=0; i<PARTITION_WRITER_COUNT; i++){
+		args[i].engine = engine;
+		args[i].seed = i;
+		args[i].ops = PARTITION_KEYS_PER_WRITER;
+		args[i].errors = 0;
+		pthread_create(&threads[i], NULL, partitionWriter, &args[i]);
+	}
+	for(int i=0; i<PARTITION_WRITER_COUNT; i++){
+		pthread_join(threads[i], NULL);
+	}
+	return currentTimeMillis() - start;
+}
+
+static uint32 verifyPartitionedEngine(HashEngine *engine){
+	uint32 errors = 0;
+	for(uint32 key=0; key<PARTITION_WRITER_COUNT * PARTITION_KEYS_PER_WRITER; key++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		errors += arr.length != 8 || *(uint64 *)arr.array != concurrentValueOf(key);
+		free(arr.array);
+	}
+	return errors;
+}
+
+void testPartitioned(){
+	printf("====测试分区引擎====\n");
+	char *filename = "test.hashengine";
+	const uint32 PARTITION_COUNT = 4;
+	const uint32 TOTAL = PARTITION_WRITER_COUNT * PARTITION_KEYS_PER_WRITER;
+	char name[64];
+	unlink(filename);
+	unlink("test.hashengine.hint");
+	for(uint32 i=0; i<PARTITION_COUNT; i++){
+		sprintf(name, "%s.p%u", filename, i);
+		unlink(name);
+		sprintf(name, "%s.p%u.hint", filename, i);
+		unlink(name);
+	}
+	//对照：普通引擎
+	HashEngine *engine = makeHashEngine(filename, TOTAL, 4096, 3, synchronize, 0);
+	setHashEngineFlushPolicy(engine, NoSync, 0);
+	printf("普通引擎：%d个写线程写入%u条记录耗时%llums\n", PARTITION_WRITER_COUNT, TOTAL, writeWithThreads(engine));
+	freeHashEngine(engine);
+	unlink(filename);
+	unlink("test.hashengine.hint");
+
+	engine = makePartitionedHashEngine(filename, PARTITION_COUNT, TOTAL, 4096, 3, synchronize, 0);
+	assertuint(PARTITION_COUNT, engine->partitionCount, "分区数目应该正确");
+	setHashEngineFlushPolicy(engine, NoSync, 0);
+	printf("%u个分区：%d个写线程写入%u条记录耗时%llums\n", PARTITION_COUNT, PARTITION_WRITER_COUNT, TOTAL, writeWithThreads(engine));
+	assertuint(0, verifyPartitionedEngine(engine), "分区引擎查询结果应该正确");
+	uint32 minSize = TOTAL, maxSize = 0;
+	for(uint32 i=0; i<PARTITION_COUNT; i++){
+		uint32 size = engine->partitions[i]->keyIndex->size;
+		minSize = size < minSize ? size : minSize;
+		maxSize = size > maxSize ? size : maxSize;
+	}
+	assertuint(1, maxSize < minSize * 2, "key应该均匀分布到各个分区");
+	uint32 key = 7;
+	assertuint(1, deleteHashEngine(engine, 4, (uint8 *)&key), "分区引擎删除应该成功");
+	uint64 value = concurrentValueOf(key);
+	putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	freeHashEngine(engine);
+
+	//loadHashEngine根据清单文件加载所有分区
+	engine = loadHashEngine(filename, TOTAL, 4096, 3, synchronize, 0);
+	assertuint(PARTITION_COUNT, engine->partitionCount, "加载后分区数目应该正确");
+	assertuint(0, verifyPartitionedEngine(engine), "加载后查询结果应该正确");
+	List *all = getAllHashEngine(engine);
+	assertuint(TOTAL, all->length, "getAllHashEngine应该返回所有分区的记录");
+	for(ListNode *node = all->head; node != NULL; node = node->next){
+		free(((Array *)node->value)->array);
+		free(node->value);
+	}
+	freeList(all);
+	HashEngineSpaceStats stats = getHashEngineSpaceStats(engine);
+	assertulonglong(TOTAL, stats.liveCount, "统计信息应该汇总所有分区");
+	freeHashEngine(engine);
+}
+
+static uint32 verifyBatch(HashEngine *engine, uint32 count, uint32 *keys, uint64 round){
+	uint32 *keyLens = (uint32 *)malloc(sizeof(uint32) * count);
+	uint8 **keyPtrs = (uint8 **)malloc(sizeof(uint8 *) * count);
+	Array *values = (Array *)malloc(sizeof(Array) * count);
+	for(uint32 i=0; i<count; i++){
+		keyLens[i] = 4;
+		keyPtrs[i] = (uint8 *)&keys[i];
+	}
+	uint32 errors = 0;
+	uint32 found = getBatchHashEngine(engine, count, keyLens, keyPtrs, values);
+	for(uint32 i=0; i<count; i++){
+		if(keys[i] % 1000 < 500){
+			errors += values[i].length != 8 || *(uint64 *)values[i].array != keys[i] + round;
+		} else {
+			//不存在的key
+			errors += values[i].length != 0;
+		}
+		free(values[i].array);
+	}
+	errors += found != count / 2;
+	free(keyLens);
+	free(keyPtrs);
+	free(values);
+	return errors;
+}
+
+static void testBatchWith(HashEngine *engine, const char *filename, uint32 partitionCount){
+	const uint32 COUNT = 2000;
+	uint32 *keys = (uint32 *)malloc(sizeof(uint32) * COUNT);
+	uint32 *keyLens = (uint32 *)malloc(sizeof(uint32) * COUNT);
+	uint8 **keyPtrs = (uint8 **)malloc(sizeof(uint8 *) * COUNT);
+	uint32 *valueLens = (uint32 *)malloc(sizeof(uint32) * COUNT);
+	uint8 **valuePtrs = (uint8 **)malloc(sizeof(uint8 *) * COUNT);
+	uint64 *values = (uint64 *)malloc(sizeof(uint64) * COUNT);
+	for(uint64 round=0; round<3; round++){
+		//key为i/2，每个key在批次中出现两次，后出现的值生效
+		for(uint32 i=0; i<COUNT; i++){
+			keys[i] = (i / 2) / 500 * 1000 + (i / 2) % 500;
+			values[i] = keys[i] + round * 10 + (i % 2) * round;
+			keyLens[i] = 4;
+			keyPtrs[i] = (uint8 *)&keys[i];
+			valueLens[i] = 8;
+			valuePtrs[i] = (uint8 *)&values[i];
+		}
+		assertuint(COUNT, putBatchHashEngine(engine, COUNT, keyLens, keyPtrs, valueLens, valuePtrs), "批量插入应该全部成功");
+	}
+	//查找：一半存在一半不存在，乱序
+	uint32 *queryKeys = (uint32 *)malloc(sizeof(uint32) * COUNT);
+	for(uint32 i=0; i<COUNT; i++){
+		queryKeys[i] = (i / 2) / 500 * 1000 + (i / 2) % 500 + (i % 2) * 500;
+	}
+	srand(1);
+	for(uint32 i=COUNT-1; i>0; i--){
+		uint32 j = rand() % (i + 1);
+		uint32 tmp = queryKeys[i];
+		queryKeys[i] = queryKeys[j];
+		queryKeys[j] = tmp;
+	}
+	assertuint(0, verifyBatch(engine, COUNT, queryKeys, 2 * 10 + 2), "批量查找结果应该正确");
+	freeHashEngine(engine);
+
+	//重新加载后从磁盘批量读取
+	engine = loadHashEngine(filename, COUNT, 64, 3, synchronize, 0);
+	assertuint(partitionCount, engine->partitionCount, "加载后分区数目应该正确");
+	uint64 start = currentTimeMillis();
+	assertuint(0, verifyBatch(engine, COUNT, queryKeys, 2 * 10 + 2), "从磁盘批量查找结果应该正确");
+	uint64 batchTime = currentTimeMillis() - start;
+	freeHashEngine(engine);
+	engine = loadHashEngine(filename, COUNT, 64, 3, synchronize, 0);
+	start = currentTimeMillis();
+	for(uint32 i=0; i<COUNT; i++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&queryKeys[i]);
+		free(arr.array);
+	}
+	printf("%u个分区：批量查找%u个key耗时%llums，逐个查找耗时%llums\n", partitionCount, COUNT, batchTime, currentTimeMillis() - start);
+	setHashEngineMmapRead(engine, 1);
+	assertuint(0, verifyBatch(engine, COUNT, queryKeys, 2 * 10 + 2), "开启映射读后批量查找结果应该正确");
+	freeHashEngine(engine);
+	free(keys);
+	free(keyLens);
+	free(keyPtrs);
+	free(valueLens);
+	free(valuePtrs);
+	free(values);
+	free(queryKeys);
+}
+
+void testBatch(){
+	printf("====测试批量插入和查找====\n");
+	char *filename = "test.hashengine";
+	char name[64];
+	unlink(filename);
+	unlink("test.hashengine.hint");
+	testBatchWith(makeHashEngine(filename, 2000, 64, 3, synchronize, 0), filename, 0);
+	unlink(filename);
+	unlink("test.hashengine.hint");
+	for(uint32 i=0; i<4; i++){
+		sprintf(name, "%s.p%u", filename, i);
+		unlink(name);
+		sprintf(name, "%s.p%u.hint", filename, i);
+		unlink(name);
+	}
+	testBatchWith(makePartitionedHashEngine(filename, 4, 2000, 64, 3, synchronize, 0), filename, 4);
+}
+
+#define COMPRESSION_VALUE_SIZE 16384
+
+//模拟一行数据：短字符串加定长字段的0填充，key为3的倍数时为不可压缩的随机数据，为7的倍数时为短value
+static uint32 makeRowValue(uint32 key, uint8 *value){
+	if(key % 7 == 0){
+		*(uint32 *)value = key;
+		return 4;
+	}
+	if(key % 3 == 0){
+		uint32 seed = key;
+		for(uint32 i=0; i<COMPRESSION_VALUE_SIZE; i++){
+			value[i] = rand_r(&seed) & 0xff;
+		}
+		return COMPRESSION_VALUE_SIZE;
+	}
+	memset(value, 0, COMPRESSION_VALUE_SIZE);
+	sprintf((char *)value, "name-%u", key);
+	sprintf((char *)value + 256, "content of row %u", key);
+	return COMPRESSION_VALUE_SIZE;
+}
+
+static uint32 verifyRows(HashEngine *engine, uint32 keyCount){
+	uint8 *expect = (uint8 *)malloc(COMPRESSION_VALUE_SIZE);
+	uint32 errors = 0;
+	for(uint32 key=0; key<keyCount; key++){
+		uint32 len = makeRowValue(key, expect);
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		errors += arr.length != len || memcmp(arr.array, expect, len) != 0;
+		free(arr.array);
+	}
+	free(expect);
+	return errors;
+}
+
+static uint64 writeRows(const char *filename, uint32 keyCount, int32 compression, int32 mixed){
+	unlink(filename);
+	unlink("test.hashengine.hint");
+	uint8 *value = (uint8 *)malloc(COMPRESSION_VALUE_SIZE);
+	HashEngine *engine = makeHashEngine(filename, keyCount, 64, 3, synchronize, 0);
+	setHashEngineCompaction(engine, 0, 0);
+	setHashEngineCompression(engine, compression);
+	uint64 start = currentTimeMillis();
+	for(uint32 key=0; key<keyCount; key++){
+		if(mixed && key == keyCount / 2){
+			//写入一半后切换压缩模式，文件中同时存在两种记录
+			setHashEngineCompression(engine, !compression);
+		}
+		uint32 len = makeRowValue(key, value);
+		putHashEngine(engine, 4, (uint8 *)&key, len, value);
+	}
+	freeHashEngine(engine);
+	uint64 time = currentTimeMillis() - start;
+	free(value);
+	return time;
+}
+
+void testCompression(){
+	printf("====测试value压缩====\n");
+	char *filename = "test.hashengine";
+	const uint32 KEY_COUNT = 2000;
+	uint64 rawWrite = writeRows(filename, KEY_COUNT, 0, 0);
+	off_t rawSize = fileSizeOf(filename);
+	HashEngine *engine = loadHashEngine(filename, KEY_COUNT, 64, 3, synchronize, 0);
+	uint64 start = currentTimeMillis();
+	assertuint(0, verifyRows(engine, KEY_COUNT), "未压缩的记录查询结果应该正确");
+	uint64 rawRead = currentTimeMillis() - start;
+	freeHashEngine(engine);
+
+	uint64 compressedWrite = writeRows(filename, KEY_COUNT, 1, 0);
+	off_t compressedSize = fileSizeOf(filename);
+	engine = loadHashEngine(filename, KEY_COUNT, 64, 3, synchronize, 0);
+	start = currentTimeMillis();
+	assertuint(0, verifyRows(engine, KEY_COUNT), "压缩的记录查询结果应该正确");
+	uint64 compressedRead = currentTimeMillis() - start;
+	printf("未压缩：文件%lld字节，写入%llums，读取%llums\n", (long long)rawSize, rawWrite, rawRead);
+	printf("压缩：  文件%lld字节，写入%llums，读取%llums\n", (long long)compressedSize, compressedWrite, compressedRead);
+	assertuint(1, compressedSize < rawSize / 2, "压缩后文件应该明显变小");
+	assertint(1, engine->compression, "压缩设置应该保存在文件头中，加载时恢复");
+	//映射读和批量读同样解压
+	setHashEngineMmapRead(engine, 1);
+	assertuint(0, verifyRows(engine, KEY_COUNT), "映射读压缩的记录结果应该正确");
+	uint32 key = 1;
+	HashEngineView view = getViewHashEngine(engine, 4, (uint8 *)&key);
+	assertuint(COMPRESSION_VALUE_SIZE, view.length, "压缩记录的视图长度应该为原长度");
+	assertuint(1, view.mapping == NULL, "压缩记录的视图应该是解压后的拷贝");
+	releaseHashEngineView(engine, &view);
+	//碎片整理原样拷贝压缩的记录
+	assertuint(1, compactHashEngine(engine), "碎片整理应该成功");
+	assertuint(0, verifyRows(engine, KEY_COUNT), "碎片整理后压缩的记录查询结果应该正确");
+	freeHashEngine(engine);
+	engine = loadHashEngine(filename, KEY_COUNT, 64, 3, synchronize, 0);
+	assertint(1, engine->compression, "碎片整理后的文件头应该保留压缩设置");
+	//超过valueLen字段长度位的value：插入失败，不会被误认为压缩或blob记录
+	uint8 dummy = 0;
+	uint32 hugeLen = HASH_VALUE_MAX_SIZE + 1, keyLen = 4;
+	uint8 *keys[] = {(uint8 *)&key};
+	uint8 *values[] = {&dummy};
+	assertint(0, putHashEngine(engine, 4, (uint8 *)&key, hugeLen, &dummy), "超过最大长度的value应该插入失败");
+	assertint(0, putBatchHashEngine(engine, 1, &keyLen, keys, &hugeLen, values), "批量插入超过最大长度的value应该失败");
+	assertuint(0, verifyRows(engine, KEY_COUNT), "插入失败后查询结果应该不变");
+	freeHashEngine(engine);
+
+	//压缩和未压缩的记录混合
+	writeRows(filename, KEY_COUNT, 1, 1);
+	engine = loadHashEngine(filename, KEY_COUNT, 64, 3, synchronize, 0);
+	assertuint(0, verifyRows(engine, KEY_COUNT), "混合文件查询结果应该正确");
+	freeHashEngine(engine);
+	unlink("test.hashengine.hint");
+	engine = loadHashEngine(filename, KEY_COUNT, 64, 3, synchronize, 0);
+	assertuint(0, verifyRows(engine, KEY_COUNT), "扫描混合文件加载后查询结果应该正确");
+	freeHashEngine(engine);
+}
+
+static uint64 cursorValueOf(uint32 key){
+	return key % 3 == 0 ? key + 1000 : key;
+}
+
+void testCursor(){
+	printf("====测试顺序扫描游标====\n");
+	char *filename = "test.hashengine";
+	unlink(filename);
+	unlink("test.hashengine.hint");
+	const uint32 KEY_COUNT = 1000;
+	HashEngine *engine = makeHashEngine(filename, KEY_COUNT, 64, 3, synchronize, 0);
+	setHashEngineCompaction(engine, 0, 0);
+	for(uint32 key=0; key<KEY_COUNT; key++){
+		uint64 value = key;
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	//3的倍数更新（最后一部分只在写缓存中，旧版本在文件中），5的倍数删除
+	for(uint32 key=0; key<KEY_COUNT; key+=3){
+		uint64 value = cursorValueOf(key);
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	uint32 liveCount = 0;
+	for(uint32 key=0; key<KEY_COUNT; key++){
+		if(key % 5 == 0){
+			deleteHashEngine(engine, 4, (uint8 *)&key);
+		} else {
+			liveCount++;
+		}
+	}
+	uint8 *seen = (uint8 *)calloc(KEY_COUNT * 2, 1);
+	uint32 errors = 0, count = 0;
+	HashEngineCursor *cursor = openHashEngineCursor(engine);
+	assertuint(0, compactHashEngine(engine), "游标打开期间不应该进行碎片整理");
+	while(nextHashEngineCursor(cursor)){
+		uint32 key = *(uint32 *)cursor->key;
+		if(key < KEY_COUNT){
+			errors += key % 5 == 0 || cursor->valueLen != 8 || *(uint64 *)cursor->value != cursorValueOf(key);
+			count++;
+		}
+		errors += cursor->keyLen != 4 || key >= KEY_COUNT * 2 || seen[key]++ != 0;
+		//扫描期间写入新的key，触发持久化，不影响已有key的扫描
+		uint32 newKey = key + KEY_COUNT;
+		if(newKey < KEY_COUNT * 2){
+			uint64 value = 0;
+			putHashEngine(engine, 4, (uint8 *)&newKey, 8, (uint8 *)&value);
+		}
+	}
+	closeHashEngineCursor(cursor);
+	assertuint(0, errors, "游标返回的记录应该正确且不重复");
+	assertuint(liveCount, count, "游标应该返回每个有效的key");
+	assertuint(1, compactHashEngine(engine), "游标关闭后碎片整理应该成功");
+	List *all = getAllHashEngine(engine);
+	assertuint(liveCount + liveCount, all->length, "getAllHashEngine应该返回所有有效记录");
+	for(ListNode *node = all->head; node != NULL; node = node->next){
+		free(((Array *)node->value)->array);
+		free(node->value);
+	}
+	freeList(all);
+	freeHashEngine(engine);
+	free(seen);
+
+	//压缩和未压缩混合的文件
+	writeRows(filename, KEY_COUNT, 1, 1);
+	engine = loadHashEngine(filename, KEY_COUNT, 64, 3, synchronize, 0);
+	uint8 *expect = (uint8 *)malloc(COMPRESSION_VALUE_SIZE);
+	errors = count = 0;
+	cursor = openHashEngineCursor(engine);
+	while(nextHashEngineCursor(cursor)){
+		uint32 len = makeRowValue(*(uint32 *)cursor->key, expect);
+		errors += cursor->valueLen != len || memcmp(cursor->value, expect, len) != 0;
+		count++;
+	}
+	closeHashEngineCursor(cursor);
+	assertuint(0, errors, "游标应该返回解压后的value");
+	assertuint(KEY_COUNT, count, "游标应该返回所有记录");
+	free(expect);
+	freeHashEngine(engine);
+}
+
+#define BLOB_THRESHOLD 4096
+#define BLOB_TITLE_SIZE 64
+
+//3的倍数为小value，其他为大value（开头BLOB_TITLE_SIZE字节模拟小字段，之后为大字段），round用于区分更新
+static uint32 makeBlobValue(uint32 key, uint32 round, uint8 *value){
+	uint32 len = key % 3 == 0 ? 100 : 32 * 1024 + key * 16;
+	memset(value, 0, BLOB_TITLE_SIZE);
+	sprintf((char *)value, "title-%u-%u", key, round);
+	for(uint32 i = BLOB_TITLE_SIZE; i < len; i++){
+		value[i] = (key * 31 + round * 7 + i) & 0xff;
+	}
+	return len;
+}
+
+//全量读取、按范围读取小字段和大字段的尾部，返回错误数目
+static uint32 verifyBlobEngine(HashEngine *engine, uint32 keyCount, uint32 round){
+	uint8 *expect = (uint8 *)malloc(64 * 1024);
+	uint32 errors = 0;
+	for(uint32 key=0; key<keyCount; key++){
+		uint32 len = makeBlobValue(key, round, expect);
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		errors += arr.length != len || memcmp(arr.array, expect, len) != 0;
+		free(arr.array);
+		arr = getRangeHashEngine(engine, 4, (uint8 *)&key, 0, BLOB_TITLE_SIZE);
+		errors += arr.length != BLOB_TITLE_SIZE || memcmp(arr.array, expect, BLOB_TITLE_SIZE) != 0;
+		free(arr.array);
+		arr = getRangeHashEngine(engine, 4, (uint8 *)&key, len - 10, 100);
+		errors += arr.length != 10 || memcmp(arr.array, expect + len - 10, 10) != 0;
+		free(arr.array);
+	}
+	free(expect);
+	return errors;
+}
+
+static uint64 writeBlobRound(HashEngine *engine, uint32 keyCount, uint32 round){
+	uint8 *value = (uint8 *)malloc(64 * 1024);
+	uint64 blobBytes = 0;
+	for(uint32 key=0; key<keyCount; key++){
+		uint32 len = makeBlobValue(key, round, value);
+		putHashEngine(engine, 4, (uint8 *)&key, len, value);
+		blobBytes += len >= BLOB_THRESHOLD ? len : 0;
+	}
+	free(value);
+	return blobBytes;
+}
+
+void testBlob(){
+	printf("====测试大value存放在blob文件中====\n");
+	char *filename = "test.hashengine";
+	char *blobFilename = "test.hashengine.blob";
+	unlink(filename);
+	unlink("test.hashengine.hint");
+	const uint32 KEY_COUNT = 300;
+	HashEngine *engine = makeHashEngine(filename, KEY_COUNT, 3, 3, synchronize, 0);
+	setHashEngineCompaction(engine, 0, 0);
+	setHashEngineCompression(engine, 1);
+	setHashEngineBlobThreshold(engine, BLOB_THRESHOLD);
+	writeBlobRound(engine, KEY_COUNT, 0);
+	uint64 blobBytes = writeBlobRound(engine, KEY_COUNT, 1);
+	assertuint(0, verifyBlobEngine(engine, KEY_COUNT, 1), "blob记录查询结果应该正确");
+	Array arr = getRangeHashEngine(engine, 4, (uint8 *)&KEY_COUNT, 0, 10);
+	assertuint(0, arr.length, "不存在的key按范围读取长度应该为0");
+	uint32 key = 1;
+	arr = getRangeHashEngine(engine, 4, (uint8 *)&key, 1024 * 1024, 10);
+	assertuint(0, arr.length, "超出value长度的范围读取长度应该为0");
+	HashEngineSpaceStats stats = getHashEngineSpaceStats(engine);
+	printf("fileSize=%llu, blobFileSize=%llu, blobLiveSize=%llu, 放大倍数=%.2f\n",
+		   stats.fileSize, stats.blobFileSize, stats.blobLiveSize, stats.spaceAmplification);
+	assertulonglong(blobBytes, stats.blobLiveSize, "有效blob字节数应该正确");
+	assertuint(1, stats.fileSize < KEY_COUNT * 2 * 1024, "大value不应该写入数据文件");
+	assertuint(1, stats.spaceAmplification > 1.8, "更新后blob文件中的旧版本应该计入空间放大");
+
+	//删除一部分大value（30的倍数+1都不是3的倍数）
+	uint64 deletedBytes = 0;
+	for(key=1; key<KEY_COUNT; key+=30){
+		deletedBytes += 32 * 1024 + key * 16;
+		deleteHashEngine(engine, 4, (uint8 *)&key);
+	}
+	//重新加载保证墓碑已经持久化（写缓存中的墓碑对应的旧版本仍然有效）
+	freeHashEngine(engine);
+	engine = loadHashEngine(filename, KEY_COUNT, 3, 3, synchronize, 0);
+	setHashEngineCompaction(engine, 0, 0);
+	setHashEngineBlobThreshold(engine, BLOB_THRESHOLD);
+	assertuint(1, compactHashEngine(engine), "碎片整理应该成功");
+	stats = getHashEngineSpaceStats(engine);
+	printf("整理后：fileSize=%llu, blobFileSize=%llu, blobLiveSize=%llu, 放大倍数=%.2f\n",
+		   stats.fileSize, stats.blobFileSize, stats.blobLiveSize, stats.spaceAmplification);
+	assertulonglong(blobBytes - deletedBytes, stats.blobLiveSize, "删除后有效blob字节数应该正确");
+	assertulonglong(stats.blobLiveSize, stats.blobFileSize, "整理后blob文件中只有有效的blob");
+	assertulonglong(stats.blobFileSize, fileSizeOf(blobFilename), "blob文件尺寸应该正确");
+	uint8 *expect = (uint8 *)malloc(64 * 1024);
+	for(key=1; key<KEY_COUNT; key+=30){
+		assertuint(0, getRangeHashEngine(engine, 4, (uint8 *)&key, 0, 10).length, "删除的key应该查不到");
+		//重新写入被删除的key，后续统一验证
+		uint32 len = makeBlobValue(key, 1, expect);
+		putHashEngine(engine, 4, (uint8 *)&key, len, expect);
+	}
+	assertuint(0, verifyBlobEngine(engine, KEY_COUNT, 1), "碎片整理后查询结果应该正确");
+
+	//映射读、批量读和游标
+	setHashEngineMmapRead(engine, 1);
+	key = 2;
+	HashEngineView view = getViewHashEngine(engine, 4, (uint8 *)&key);
+	assertuint(32 * 1024 + key * 16, view.length, "blob记录的视图长度应该正确");
+	assertuint(1, view.mapping == NULL, "blob记录的视图应该是堆上的拷贝");
+	releaseHashEngineView(engine, &view);
+	assertuint(0, verifyBlobEngine(engine, KEY_COUNT, 1), "映射读查询结果应该正确");
+	uint32 keys[KEY_COUNT], keyLens[KEY_COUNT];
+	uint8 *keyPtrs[KEY_COUNT];
+	Array values[KEY_COUNT];
+	for(uint32 i=0; i<KEY_COUNT; i++){
+		keys[i] = i;
+		keyLens[i] = 4;
+		keyPtrs[i] = (uint8 *)&keys[i];
+	}
+	assertuint(KEY_COUNT, getBatchHashEngine(engine, KEY_COUNT, keyLens, keyPtrs, values), "批量读应该找到所有key");
+	uint32 errors = 0;
+	for(uint32 i=0; i<KEY_COUNT; i++){
+		uint32 len = makeBlobValue(i, 1, expect);
+		errors += values[i].length != len || memcmp(values[i].array, expect, len) != 0;
+		free(values[i].array);
+	}
+	assertuint(0, errors, "批量读结果应该正确");
+	errors = 0;
+	uint32 count = 0;
+	HashEngineCursor *cursor = openHashEngineCursor(engine);
+	while(nextHashEngineCursor(cursor)){
+		uint32 len = makeBlobValue(*(uint32 *)cursor->key, 1, expect);
+		errors += cursor->valueLen != len || memcmp(cursor->value, expect, len) != 0;
+		count++;
+	}
+	closeHashEngineCursor(cursor);
+	assertuint(0, errors, "游标应该返回blob中的value");
+	assertuint(KEY_COUNT, count, "游标应该返回所有记录");
+	freeHashEngine(engine);
+
+	//重新加载：范围读不经过读缓存，比全量读取少读大部分数据
+	engine = loadHashEngine(filename, KEY_COUNT, KEY_COUNT, 3, synchronize, 0);
+	uint64 start = currentTimeMillis();
+	for(uint32 r=0; r<20; r++){
+		for(key=0; key<KEY_COUNT; key++){
+			arr = getRangeHashEngine(engine, 4, (uint8 *)&key, 0, BLOB_TITLE_SIZE);
+			free(arr.array);
+		}
+	}
+	uint64 rangeTime = currentTimeMillis() - start;
+	assertuint(0, engine->readCache->size, "按范围读取不应该放入读缓存");
+	assertulonglong(blobBytes, getHashEngineSpaceStats(engine).blobLiveSize, "加载后有效blob字节数应该正确");
+	freeHashEngine(engine);
+	engine = loadHashEngine(filename, KEY_COUNT, 3, 3, synchronize, 0);
+	start = currentTimeMillis();
+	for(uint32 r=0; r<20; r++){
+		for(key=0; key<KEY_COUNT; key++){
+			arr = getHashEngine(engine, 4, (uint8 *)&key);
+			free(arr.array);
+		}
+	}
+	printf("读取%u个key的前%u字节20次：范围读%llums，全量读%llums\n", KEY_COUNT, BLOB_TITLE_SIZE, rangeTime, currentTimeMillis() - start);
+	freeHashEngine(engine);
+
+	//模拟碎片整理切换时崩溃：数据文件已经切换、blob文件还没有重命名
+	rename(blobFilename, "test.hashengine.blob.compact");
+	engine = loadHashEngine(filename, KEY_COUNT, 3, 3, synchronize, 0);
+	assertuint(0, verifyBlobEngine(engine, KEY_COUNT, 1), "数据文件切换后崩溃，加载时应该完成blob文件的切换");
+	freeHashEngine(engine);
+	//模拟切换之前崩溃：残留的新文件被删除
+	FILE *fp = fopen("test.hashengine.compact", "w");
+	fclose(fp);
+	fp = fopen("test.hashengine.blob.compact", "w");
+	fclose(fp);
+	unlink("test.hashengine.hint");
+	engine = loadHashEngine(filename, KEY_COUNT, 3, 3, synchronize, 0);
+	assertuint(0, verifyBlobEngine(engine, KEY_COUNT, 1), "切换前崩溃，加载时应该删除残留的新文件");
+	assertuint(1, fileSizeOf("test.hashengine.blob.compact") == -1, "残留的新blob文件应该被删除");
+	freeHashEngine(engine);
+	free(expect);
+}
+
+static uint64 redoValueOf(uint32 key){
+	return (uint64)key * 3 + 1;
+}
+
+//子进程中开启重做日志写入后直接退出：模拟已经确认的写入在检查点之前崩溃
+static void writeAndCrash(const char *filename, uint32 keyCount, int withDelete){
+	pid_t pid = fork();
+	if(pid == 0){
+		HashEngine *engine = makeHashEngine(filename, keyCount, keyCount * 2, 3, synchronize, 0);
+		setHashEngineRedoLog(engine, 1);
+		for(uint32 key = 0; key < keyCount; key++){
+			uint64 value = redoValueOf(key);
+			putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+		}
+		for(uint32 key = 0; withDelete && key < keyCount; key += 10){
+			deleteHashEngine(engine, 4, (uint8 *)&key);
+		}
+		_exit(0);
+	}
+	waitpid(pid, NULL, 0);
+}
+
+//返回与预期不一致的key数目，deleted为每10个删除一个
+static uint32 verifyRedoEngine(HashEngine *engine, uint32 keyCount, int deleted){
+	uint32 errors = 0;
+	for(uint32 key = 0; key < keyCount; key++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		if(deleted && key % 10 == 0){
+			errors += arr.length != 0;
+		} else {
+			errors += arr.length != 8 || *(uint64 *)arr.array != redoValueOf(key);
+		}
+		free(arr.array);
+	}
+	return errors;
+}
+
+void testRedoLog(){
+	printf("====测试重做日志崩溃恢复====\n");
+	char *filename = "test.hashengine";
+	char logFilename[64];
+	sprintf(logFilename, "%s_0x%016llx.redolog", filename, 1ull);
+	const uint32 KEY_COUNT = 2000;
+	unlink(filename);
+	cleanRedoLogFile(filename);
+
+	writeAndCrash(filename, KEY_COUNT, 1);
+	printf("崩溃后数据文件%ld字节，重做日志%ld字节\n", (long)fileSizeOf(filename), (long)fileSizeOf(logFilename));
+	assertuint(1, fileSizeOf(logFilename) > 0, "崩溃后应该残留重做日志");
+	HashEngine *engine = loadHashEngine(filename, KEY_COUNT, 64, 3, synchronize, 0);
+	assertuint(0, verifyRedoEngine(engine, KEY_COUNT, 1), "重放重做日志后查询结果应该正确");
+	assertint(-1, fileSizeOf(logFilename), "重放并持久化后应该删除重做日志");
+	freeHashEngine(engine);
+	engine = loadHashEngine(filename, KEY_COUNT, 64, 3, synchronize, 0);
+	assertuint(0, verifyRedoEngine(engine, KEY_COUNT, 1), "重放的数据应该已经持久化");
+	freeHashEngine(engine);
+
+	//日志最后一条记录不完整：丢弃，之前的记录正常重放
+	unlink(filename);
+	writeAndCrash(filename, KEY_COUNT, 0);
+	truncate(logFilename, fileSizeOf(logFilename) - 3);
+	engine = loadHashEngine(filename, KEY_COUNT, 64, 3, synchronize, 0);
+	assertuint(0, verifyRedoEngine(engine, KEY_COUNT - 1, 0), "不完整记录之前的操作应该被重放");
+	uint32 lastKey = KEY_COUNT - 1;
+	Array arr = getHashEngine(engine, 4, (uint8 *)&lastKey);
+	assertuint(0, arr.length, "不完整的记录应该被丢弃");
+	free(arr.array);
+	freeHashEngine(engine);
+
+	//正常关闭：检查点之后删除日志，重新创建同名引擎时删除残留的日志
+	engine = loadHashEngine(filename, KEY_COUNT, 3, 3, synchronize, 0);
+	setHashEngineRedoLog(engine, 1);
+	for(uint32 key = 0; key < 100; key++){
+		uint64 value = redoValueOf(key);
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	freeHashEngine(engine);
+	cleanRedoLogFile(filename);
+	engine = loadHashEngine(filename, KEY_COUNT, 3, 3, synchronize, 0);
+	assertuint(0, verifyRedoEngine(engine, 100, 0), "正常关闭后不需要重做日志");
+	freeHashEngine(engine);
+}
+
+#define REDO_WRITER_COUNT 8
+#define REDO_WRITER_OPS 300
+
+static void *redoWriter(void *arg){
+	ConcurrentArgs *args = (ConcurrentArgs *)arg;
+	for(uint32 i = 0; i < args->ops; i++){
+		uint32 key = args->seed * args->ops + i;
+		uint64 value = redoValueOf(key);
+		putHashEngine(args->engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	return NULL;
+}
+
+//多个线程同时写入时共享日志同步，返回日志的组数
+static uint64 runRedoWriters(HashEngine *engine, uint32 threadCount, uint64 *millis){
+	pthread_t threads[REDO_WRITER_COUNT];
+	ConcurrentArgs args[REDO_WRITER_COUNT];
+	uint64 start = currentTimeMillis();
+	for(uint32 i = 0; i < threadCount; i++){
+		args[i].engine = engine;
+		args[i].seed = i;
+		args[i].ops = REDO_WRITER_OPS;
+		pthread_create(&threads[i], NULL, redoWriter, &args[i]);
+	}
+	for(uint32 i = 0; i < threadCount; i++){
+		pthread_join(threads[i], NULL);
+	}
+	*millis = currentTimeMillis() - start;
+	return engine->redoLogWork->flushCount;
+}
+
+void testRedoLogGroupCommit(){
+	printf("====测试重做日志组提交====\n");
+	char *filename = "test.hashengine";
+	const uint32 TOTAL = REDO_WRITER_COUNT * REDO_WRITER_OPS;
+	uint64 millis;
+	unlink(filename);
+	HashEngine *engine = makeHashEngine(filename, TOTAL, TOTAL * 2, 3, synchronize, 0);
+	setHashEngineRedoLog(engine, 1);
+	uint64 groups = runRedoWriters(engine, 1, &millis);
+	printf("1个线程写入%u条：日志同步%llu次，耗时%llums\n", REDO_WRITER_OPS, groups, millis);
+	assertulonglong(REDO_WRITER_OPS, groups, "单线程写入每条都需要同步一次");
+	freeHashEngine(engine);
+
+	unlink(filename);
+	engine = makeHashEngine(filename, TOTAL, TOTAL * 2, 3, synchronize, 0);
+	setHashEngineRedoLog(engine, 1);
+	groups = runRedoWriters(engine, REDO_WRITER_COUNT, &millis);
+	printf("%d个线程写入%u条：日志同步%llu次，耗时%llums\n", REDO_WRITER_COUNT, TOTAL, groups, millis);
+	assertuint(1, groups < TOTAL, "并发写入应该共享日志同步");
+	freeHashEngine(engine);
+	engine = loadHashEngine(filename, TOTAL, 64, 3, synchronize, 0);
+	assertuint(0, verifyRedoEngine(engine, TOTAL, 0), "组提交写入的数据应该正确");
+	freeHashEngine(engine);
+
+	//日志写入失败（/dev/full返回ENOSPC）时写操作返回0
+	unlink(filename);
+	engine = makeHashEngine(filename, TOTAL, TOTAL * 2, 3, synchronize, 0);
+	setHashEngineRedoLog(engine, 1);
+	uint32 key = 1;
+	uint64 value = redoValueOf(key);
+	assertint(1, putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value), "日志写入成功时返回1");
+	int full = open("/dev/full", O_WRONLY);
+	dup2(full, engine->redoLogWork->fd);
+	close(full);
+	assertint(0, putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value), "日志写入失败时put返回0");
+	assertint(0, deleteHashEngine(engine, 4, (uint8 *)&key), "日志写入失败时delete返回0");
+	freeHashEngine(engine);
+	cleanRedoLogFile(filename);
+}
+
+static uint64 diskIndexValueOf(uint32 key, uint32 round){
+	return (uint64)key * 2654435761u + round;
+}
+
+//key为已删除（key % 3 == 0且deleted）时应该不存在，返回错误数目
+static uint32 verifyDiskIndexEngine(HashEngine *engine, uint32 keyCount, uint32 round, int deleted){
+	uint32 errors = 0;
+	for(uint32 key = 0; key < keyCount; key++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		if(deleted && key % 3 == 0){
+			errors += arr.length != 0;
+		} else {
+			errors += arr.length != 8 || *(uint64 *)arr.array != diskIndexValueOf(key, round);
+		}
+		free(arr.array);
+	}
+	return errors;
+}
+
+static void cleanDiskIndexFiles(const char *filename){
+	char name[64];
+	unlink(filename);
+	const char *suffixes[] = {".index", ".index.compact", ".compact", ".hint", ".blob"};
+	for(uint32 i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++){
+		sprintf(name, "%s%s", filename, suffixes[i]);
+		unlink(name);
+	}
+}
+
+void testDiskIndex(){
+	printf("====测试磁盘索引====\n");
+	char *filename = "test.diskhash";
+	char indexFilename[64], newIndexFilename[64], hintFilename[64], newFilename[64];
+	sprintf(indexFilename, "%s.index", filename);
+	sprintf(newIndexFilename, "%s.index.compact", filename);
+	sprintf(hintFilename, "%s.hint", filename);
+	sprintf(newFilename, "%s.compact", filename);
+	const uint32 KEY_COUNT = 50000;
+	const uint64 RESIDENT_LIMIT = 2000;
+	cleanDiskIndexFiles(filename);
+	HashEngine *engine = makeDiskIndexHashEngine(filename, 16, 256, 3, synchronize, 0);
+	setHashEngineResidentLimit(engine, RESIDENT_LIMIT);
+	for(uint32 key = 0; key < KEY_COUNT; key++){
+		uint64 value = diskIndexValueOf(key, 0);
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	//随机读取，内存索引中的key数目保持有界
+	uint32 maxResident = 0, errors = 0;
+	for(uint32 i = 0; i < KEY_COUNT; i++){
+		uint32 key = (i * 7919u) % KEY_COUNT;
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		errors += arr.length != 8 || *(uint64 *)arr.array != diskIndexValueOf(key, 0);
+		free(arr.array);
+		if(engine->keyIndex->size > maxResident){
+			maxResident = engine->keyIndex->size;
+		}
+	}
+	printf("%u个key：内存索引最多%u个key（%llu字节），磁盘索引%u个桶\n", KEY_COUNT, maxResident,
+		   getKeyIndexMemory(engine->keyIndex), getDiskIndexBucketCount(engine->diskIndex));
+	assertuint(0, errors, "使用磁盘索引时查询结果应该正确");
+	assertuint(1, maxResident < KEY_COUNT / 4, "内存索引中的key数目应该有界");
+	uint32 key = KEY_COUNT + 1;
+	assertuint(0, getHashEngine(engine, 4, (uint8 *)&key).length, "不存在的key应该查不到");
+	assertint(0, deleteHashEngine(engine, 4, (uint8 *)&key), "删除不存在的key应该返回0");
+	uint8 longKey[DISK_INDEX_MAX_KEY_SIZE + 1] = {0};
+	assertint(0, putHashEngine(engine, sizeof(longKey), longKey, 4, longKey), "过长的key应该被拒绝");
+
+	//更新和删除
+	for(key = 0; key < KEY_COUNT; key++){
+		if(key % 3 == 0){
+			deleteHashEngine(engine, 4, (uint8 *)&key);
+		} else {
+			uint64 value = diskIndexValueOf(key, 1);
+			putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+		}
+	}
+	assertuint(0, verifyDiskIndexEngine(engine, KEY_COUNT, 1, 1), "更新和删除后查询结果应该正确");
+	freeHashEngine(engine);
+	assertint(-1, access(hintFilename, F_OK), "使用磁盘索引时不应该有提示文件");
+
+	//加载：根据索引文件自动使用磁盘索引
+	engine = loadHashEngine(filename, 16, 256, 3, synchronize, 0);
+	assertuint(1, engine->diskIndex != NULL, "加载时应该使用磁盘索引");
+	assertuint(0, engine->keyIndex->size, "加载时不应该将key加入内存索引");
+	uint32 liveCount = KEY_COUNT - (KEY_COUNT + 2) / 3;
+	assertulonglong(liveCount, getHashEngineSpaceStats(engine).liveCount, "有效记录数目应该正确");
+	assertuint(0, verifyDiskIndexEngine(engine, KEY_COUNT, 1, 1), "加载后查询结果应该正确");
+	//游标
+	uint32 count = 0;
+	errors = 0;
+	HashEngineCursor *cursor = openHashEngineCursor(engine);
+	while(nextHashEngineCursor(cursor)){
+		uint32 cursorKey = *(uint32 *)cursor->key;
+		errors += cursor->valueLen != 8 || *(uint64 *)cursor->value != diskIndexValueOf(cursorKey, 1);
+		count++;
+	}
+	closeHashEngineCursor(cursor);
+	assertuint(liveCount, count, "游标应该返回所有有效记录");
+	assertuint(0, errors, "游标返回的记录应该正确");
+	//碎片整理
+	uint64 fileSize = getHashEngineSpaceStats(engine).fileSize;
+	assertint(1, compactHashEngine(engine), "碎片整理应该成功");
+	HashEngineSpaceStats stats = getHashEngineSpaceStats(engine);
+	printf("碎片整理：%llu -> %llu字节\n", fileSize, stats.fileSize);
+	assertuint(1, stats.fileSize < fileSize, "碎片整理后文件应该变小");
+	assertulonglong(liveCount, stats.liveCount, "碎片整理后有效记录数目不变");
+	assertuint(0, verifyDiskIndexEngine(engine, KEY_COUNT, 1, 1), "碎片整理后查询结果应该正确");
+	freeHashEngine(engine);
+	engine = loadHashEngine(filename, 16, 256, 3, synchronize, 0);
+	assertuint(0, verifyDiskIndexEngine(engine, KEY_COUNT, 1, 1), "碎片整理后加载的查询结果应该正确");
+	freeHashEngine(engine);
+
+	//写回过程中崩溃（索引带有未同步标记）：全量扫描重建
+	DiskIndex *index = loadDiskIndex(indexFilename, 4);
+	markDirtyDiskIndex(index);
+	freeDiskIndex(index);
+	engine = loadHashEngine(filename, 16, 256, 3, synchronize, 0);
+	assertuint(0, verifyDiskIndexEngine(engine, KEY_COUNT, 1, 1), "重建磁盘索引后查询结果应该正确");
+	freeHashEngine(engine);
+	index = loadDiskIndex(indexFilename, 4);
+	assertuint(1, index != NULL, "重建的磁盘索引应该已经同步");
+	if(index != NULL){
+		freeDiskIndex(index);
+	}
+
+	//碎片整理切换数据文件之后、切换磁盘索引之前崩溃：加载时完成切换
+	rename(indexFilename, newIndexFilename);
+	engine = loadHashEngine(filename, 16, 256, 3, synchronize, 0);
+	assertint(-1, access(newIndexFilename, F_OK), "新磁盘索引应该被重命名");
+	assertuint(0, verifyDiskIndexEngine(engine, KEY_COUNT, 1, 1), "完成切换后查询结果应该正确");
+	freeHashEngine(engine);
+	//切换数据文件之前崩溃：删除残留的新文件
+	close(open(newFilename, O_RDWR | O_CREAT, 0644));
+	close(open(newIndexFilename, O_RDWR | O_CREAT, 0644));
+	engine = loadHashEngine(filename, 16, 256, 3, synchronize, 0);
+	assertint(-1, access(newIndexFilename, F_OK), "残留的新磁盘索引应该被删除");
+	assertuint(0, verifyDiskIndexEngine(engine, KEY_COUNT, 1, 1), "删除残留文件后查询结果应该正确");
+	freeHashEngine(engine);
+	cleanDiskIndexFiles(filename);
+}
+
+void testFlushRetry(){
+	printf("====测试检查点写入失败后重试====\n");
+	char *filename = "test.hashengine";
+	unlink(filename);
+	cleanRedoLogFile(filename);
+	const uint32 KEY_COUNT = 100;
+	HashEngine *engine = makeHashEngine(filename, KEY_COUNT, KEY_COUNT, 3, synchronize, 0);
+	//模拟磁盘已满：数据文件描述符指向/dev/full，写入返回ENOSPC
+	int saved = dup(engine->wfd);
+	int full = open("/dev/full", O_WRONLY);
+	dup2(full, engine->wfd);
+	//最后一次写入时写缓存已满，启动检查点
+	for(uint32 key = 0; key <= KEY_COUNT; key++){
+		uint64 value = key * 7;
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	usleep(500 * 1000);
+	HashEngineSpaceStats stats = getHashEngineSpaceStats(engine);
+	assertuint(1, stats.flushErrorCount > 0, "检查点写入失败应该被记录");
+	assertulonglong(HASH_FILE_HEADER_SIZE, stats.fileSize, "写入失败时不应该推进数据文件尺寸");
+	for(uint32 key = 0; key <= KEY_COUNT; key++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		assertulonglong(key * 7, arr.length == 8 ? *(uint64 *)arr.array : 0, "写入失败时记录应该保留在缓存中");
+		free(arr.array);
+	}
+	//磁盘恢复：重试成功后正常关闭
+	dup2(saved, engine->wfd);
+	close(saved);
+	close(full);
+	freeHashEngine(engine);
+	engine = loadHashEngine(filename, KEY_COUNT, KEY_COUNT, 3, synchronize, 0);
+	for(uint32 key = 0; key <= KEY_COUNT; key++){
+		Array arr = getHashEngine(engine, 4, (uint8 *)&key);
+		assertulonglong(key * 7, arr.length == 8 ? *(uint64 *)arr.array : 0, "重试成功后记录应该已经持久化");
+		free(arr.array);
+	}
+	freeHashEngine(engine);
+
+	//blob文件写入失败：同样重试，不推进blob文件尺寸
+	unlink(filename);
+	unlink("test.hashengine.blob");
+	engine = makeHashEngine(filename, KEY_COUNT, 3, 3, synchronize, 0);
+	setHashEngineBlobThreshold(engine, BLOB_THRESHOLD);
+	writeBlobRound(engine, 10, 0);
+	freeHashEngine(engine);
+	engine = loadHashEngine(filename, KEY_COUNT, KEY_COUNT, 3, synchronize, 0);
+	setHashEngineBlobThreshold(engine, BLOB_THRESHOLD);
+	uint64 blobFileSize = getHashEngineSpaceStats(engine).blobFileSize;
+	saved = dup(engine->blobFd);
+	full = open("/dev/full", O_WRONLY);
+	dup2(full, engine->blobFd);
+	uint8 *value = (uint8 *)malloc(64 * 1024);
+	for(uint32 key = 0; key <= KEY_COUNT; key++){
+		uint32 len = makeBlobValue(key, 1, value);
+		putHashEngine(engine, 4, (uint8 *)&key, len, value);
+	}
+	usleep(500 * 1000);
+	stats = getHashEngineSpaceStats(engine);
+	assertuint(1, stats.flushErrorCount > 0, "blob写入失败应该被记录");
+	assertulonglong(blobFileSize, stats.blobFileSize, "blob写入失败时不应该推进blob文件尺寸");
+	dup2(saved, engine->blobFd);
+	close(saved);
+	close(full);
+	free(value);
+	freeHashEngine(engine);
+	engine = loadHashEngine(filename, KEY_COUNT, KEY_COUNT, 3, synchronize, 0);
+	assertuint(0, verifyBlobEngine(engine, KEY_COUNT + 1, 1), "重试成功后blob记录应该已经持久化");
+	freeHashEngine(engine);
+}
+
+//在statusMutex中修改位置回收周期的计数，模拟一个持有位置指针的操作开始或结束
+static void holdLocationEpoch(HashEngine *engine, uint32 epoch, int32 delta){
+	pthread_mutex_lock(&engine->statusMutex);
+	engine->locationUsers[epoch] += delta;
+	pthread_mutex_unlock(&engine->statusMutex);
+}
+
+void testLocationReclaim(){
+	printf("====测试删除的位置在操作结束之后回收====\n");
+	char *filename = "test.hashengine";
+	unlink(filename);
+	cleanRedoLogFile(filename);
+	HashEngine *engine = makeHashEngine(filename, 100, 3, 3, synchronize, 0);
+	uint64 value = 1;
+	for(uint32 key = 0; key < 6; key++){
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+	}
+	//一个读操作取得位置指针后在锁外读盘，期间key被删除，多次检查点之后位置仍不能被重用
+	pthread_mutex_lock(&engine->statusMutex);
+	uint32 epoch = engine->locationEpoch;
+	pthread_mutex_unlock(&engine->statusMutex);
+	holdLocationEpoch(engine, epoch, 1);
+	uint32 key = 0;
+	RecordLocation *held = getKeyIndex(engine->keyIndex, 4, (uint8 *)&key);
+	deleteHashEngine(engine, 4, (uint8 *)&key);
+	uint32 reused = 0;
+	for(key = 100; key < 200; key++){
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+		pthread_mutex_lock(&engine->statusMutex);
+		reused += getKeyIndex(engine->keyIndex, 4, (uint8 *)&key) == held;
+		pthread_mutex_unlock(&engine->statusMutex);
+	}
+	assertuint(0, reused, "操作结束之前被删除的位置不应该被重用");
+	//操作结束：之后的检查点回收该位置
+	holdLocationEpoch(engine, epoch, -1);
+	for(key = 200; key < 300; key++){
+		putHashEngine(engine, 4, (uint8 *)&key, 8, (uint8 *)&value);
+		pthread_mutex_lock(&engine->statusMutex);
+		reused += getKeyIndex(engine->keyIndex, 4, (uint8 *)&key) == held;
+		pthread_mutex_unlock(&engine->statusMutex);
+	}
+	assertuint(1, reused, "操作结束之后位置应该被回收重用");
+	freeHashEngine(engine);
+}
+
 TESTFUNC funcs[] = {
 	testInMemery,
 	testInDisk,
 	testLoadEngine,
 	testRandomOps,
+	testCompaction,
+	testAutoCompaction,
+	testHintFile,
+	testGroupCommit,
+	testConcurrentGet,
+	testMmapView,
+	testTombstone,
+	testPartitioned,
+	testBatch,
+	testCompression,
+	testCursor,
+	testRedoLog,
+	testRedoLogGroupCommit,
+	testBlob,
+	testDiskIndex,
+	testFlushRetry,
+	testLocationReclaim,
 };
 
 int main(int argc, char const *argv[])
@@ -9,6 +9,7 @@
 #include "hashmap.h"
 #include "test.h"
 #include <stdio.h>
+#include <stdlib.h>
 
 //=========test All=========
 
@@ -57,11 +58,62 @@ void testAll()
 	freeHashMap(map);
 }
 
+void testResize()
+{
+	printf("====测试自动扩容、缩容====\n");
+	const uint32 COUNT = 100000;
+	HashMap* map = makeHashMap(16);
+	uint32 *values = (uint32 *)malloc(sizeof(uint32) * COUNT);
+	uint32 checkedDuringRehash = 0;
+	for(uint32 i=0; i<COUNT; i++){
+		values[i] = i;
+		putHashMap(map, 4, (uint8 *)&i, &values[i]);
+		//rehash期间所有数据都应该可以查到
+		if(isRehashingHashMap(map) && i % 997 == 0){
+			for(uint32 j=0; j<=i; j+=101){
+				uint32 *v = (uint32 *)getHashMap(map, 4, (uint8 *)&j);
+				assertuint(j, v == NULL ? 0xffffffffu : *v, "rehash期间查询结果应该正确");
+			}
+			checkedDuringRehash++;
+		}
+	}
+	printf("插入%u条后：size=%u, bucketCapacity=%u, rehash期间检查%u次\n", COUNT, map->size, map->bucketCapacity, checkedDuringRehash);
+	assertuint(COUNT, map->size, "size应该等于插入数目");
+	assertuint(1, map->bucketCapacity >= COUNT / 2, "桶数组应该自动扩容");
+	assertuint(1, checkedDuringRehash > 0, "应该在rehash期间进行过检查");
+	for(uint32 i=0; i<COUNT; i++){
+		assertuint(i, *(uint32 *)getHashMap(map, 4, (uint8 *)&i), "扩容后查询结果应该正确");
+	}
+	uint32 grownCapacity = map->bucketCapacity;
+	//大量删除后自动缩容
+	for(uint32 i=0; i<COUNT - 100; i++){
+		assertuint(i, *(uint32 *)removeHashMap(map, 4, (uint8 *)&i), "删除返回结果应该正确");
+	}
+	printf("删除后：size=%u, bucketCapacity=%u, rehashCapacity=%u\n", map->size, map->bucketCapacity, map->rehashCapacity);
+	assertuint(1, map->rehashTable != NULL ? map->rehashCapacity < grownCapacity : map->bucketCapacity < grownCapacity, "桶数组应该自动缩容");
+	for(uint32 i=COUNT - 100; i<COUNT; i++){
+		assertuint(i, *(uint32 *)getHashMap(map, 4, (uint8 *)&i), "缩容后查询结果应该正确");
+	}
+	//手动缩容到最小
+	shrinkHashMap(map);
+	uint32 ops = 0;
+	while(isRehashingHashMap(map)){
+		uint32 key = COUNT + ops++;
+		removeHashMap(map, 4, (uint8 *)&key); //不存在的key，推进rehash
+	}
+	printf("手动缩容后：size=%u, bucketCapacity=%u, 经过%u次操作完成rehash\n", map->size, map->bucketCapacity, ops);
+	assertuint(256, map->bucketCapacity, "桶数组应该缩小到能容纳100条数据的最小长度");
+	for(uint32 i=COUNT - 100; i<COUNT; i++){
+		assertuint(i, *(uint32 *)getHashMap(map, 4, (uint8 *)&i), "手动缩容后查询结果应该正确");
+	}
+	freeHashMap(map);
+	free(values);
+}
 
 int main(int argc, char const *argv[])
 {
 	printf("=========test All=========\n");
-	launchTests(1, testAll);
+	launchTests(2, testAll, testResize);
 	return 0;
 }
 
@@ -10,17 +10,24 @@
 #include "util.h"
 #include "indexengine.h"
 #include <time.h>
+#include <glob.h>
 
 static uint64 operateListMaxSize = 10000;
 static enum RedoFlushStrategy flushStrategy = sizeThreshold;
 static uint64 flushStrategyArg = 10000;
 
 static void clearRedoLogFile(char *indexFliename){
-	char *filename = malloc(strlen(indexFliename) + 30);
-	for(uint64 i=2; i<10; i++){
-		sprintf(filename, "%s_0x%016llx.redolog", indexFliename, i);
-		unlink(filename);
+	//持久化次数较多时版本号可能很大，删除所有版本的重做日志
+	char *pattern = malloc(strlen(indexFliename) + 30);
+	sprintf(pattern, "%s_0x*.redolog", indexFliename);
+	glob_t files;
+	if(glob(pattern, 0, NULL, &files) == 0){
+		for(size_t i = 0; i < files.gl_pathc; i++){
+			unlink(files.gl_pathv[i]);
+		}
 	}
+	globfree(&files);
+	free(pattern);
 }
 
 void testReadWriteMeta(){
@@ -303,6 +310,879 @@ void testRemove3(){
 	pthread_join(*engine->cache.persistenceThread, NULL);
 }
 
+void testBulkLoad(){
+	printf("====测试批量构建====\n");
+	char *filename = "test.idx";
+	unlink(filename);
+	clearRedoLogFile(filename);
+	const uint64 COUNT = 200000;
+	//度为6，填充率80%，每个节点4个条目，树较深；缓存较小，之后的插入删除会触发持久化
+	IndexEngine *engine = makeIndexEngine(filename, 8, 8, 136, 1, 16 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	IndexEngineBuilder *builder = makeIndexEngineBuilder(engine, 80);
+	for(uint64 i = 0; i < COUNT; i++){
+		uint64 key = htonll(i * 2);
+		addIndexEngineBuilder(builder, (uint8 *)&key, (uint8 *)&i);
+	}
+	assertint(1, finishIndexEngineBuilder(builder), "有序数据应该构建成功");
+	printf("构建%llu条：深度%u，页数%llu\n", COUNT, engine->treeMeta.depth, engine->usedPageCnt);
+	assertulonglong(COUNT, engine->count, "构建后的数目应该正确");
+	List *list = searchAllIndexEngine(engine, NULL);
+	assertuint(COUNT, list->length, "遍历的数目应该正确");
+	freeList(list);
+	uint32 errors = 0;
+	for(uint64 i = 0; i < COUNT; i += 7){
+		uint64 key = htonll(i * 2);
+		list = searchIndexEngine(engine, (uint8 *)&key);
+		errors += list->length != 1 || *(uint64 *)list->head->value != i;
+		freeList(list);
+		key = htonll(i * 2 + 1);
+		list = searchIndexEngine(engine, (uint8 *)&key);
+		errors += list->length != 0;
+		freeList(list);
+	}
+	assertuint(0, errors, "构建后查询结果应该正确");
+	uint64 key = htonll(COUNT);
+	list = searchConditionIndexEngine(engine, (uint8 *)&key, RELOP_LT);
+	assertuint(COUNT / 2, list->length, "范围查询结果应该正确");
+	freeList(list);
+	//构建后可以继续插入删除
+	for(uint64 i = 0; i < 1000; i++){
+		uint64 value = COUNT + i;
+		key = htonll(i * 2 + 1);
+		insertIndexEngine(engine, (uint8 *)&key, (uint8 *)&value);
+		key = htonll(i * 2);
+		removeIndexEngine(engine, (uint8 *)&key, NULL);
+	}
+	pthread_join(*engine->cache.persistenceThread, NULL);
+	assertulonglong(COUNT, engine->count, "插入删除后的数目应该正确");
+	uint64 data = 0;
+	key = htonll(data);
+	list = searchIndexEngine(engine, (uint8 *)&key);
+	assertuint(0, list->length, "删除的key应该查不到");
+	freeList(list);
+	data = 1;
+	key = htonll(data);
+	list = searchIndexEngine(engine, (uint8 *)&key);
+	assertulonglong(COUNT, list->length == 1 ? *(uint64 *)list->head->value : 0, "插入的key应该可以查到");
+	freeList(list);
+
+	//重新加载
+	IndexEngine *engine1 = loadIndexEngine(filename, 0, operateListMaxSize, flushStrategy, flushStrategyArg);
+	errors = 0;
+	for(uint64 i = 2000; i < COUNT; i += 13){
+		key = htonll(i * 2);
+		list = searchIndexEngine(engine1, (uint8 *)&key);
+		errors += list->length != 1 || *(uint64 *)list->head->value != i;
+		freeList(list);
+	}
+	assertuint(0, errors, "重新加载后查询结果应该正确");
+
+	//乱序和重复的数据构建失败，索引保持为空
+	unlink(filename);
+	clearRedoLogFile(filename);
+	engine = makeIndexEngine(filename, 8, 8, 136, 1, 0, operateListMaxSize, flushStrategy, flushStrategyArg);
+	builder = makeIndexEngineBuilder(engine, 0);
+	data = 5;
+	key = htonll(data);
+	assertint(1, addIndexEngineBuilder(builder, (uint8 *)&key, (uint8 *)&key), "第一条数据应该添加成功");
+	assertint(-1, addIndexEngineBuilder(builder, (uint8 *)&key, (uint8 *)&key), "唯一索引的重复key应该失败");
+	assertint(-1, finishIndexEngineBuilder(builder), "出现顺序错误时构建失败");
+	assertulonglong(0, engine->count, "构建失败后索引为空");
+	assertulonglong(2, engine->nextPageId, "构建失败后回收页号");
+	insertIndexEngine(engine, (uint8 *)&key, (uint8 *)&key);
+	assertnull(makeIndexEngineBuilder(engine, 0), "非空的索引不能批量构建");
+	unlink(filename);
+	clearRedoLogFile(filename);
+}
+
+void testBulkLoadSpeed(){
+	printf("====测试批量构建速度====\n");
+	char *filename = "test.idx";
+	unlink(filename);
+	clearRedoLogFile(filename);
+	const uint64 COUNT = 1000000;
+	IndexEngine *engine = makeIndexEngine(filename, 8, 8, 0, 0, 0, operateListMaxSize, flushStrategy, flushStrategyArg);
+	clock_t start = clock();
+	IndexEngineBuilder *builder = makeIndexEngineBuilder(engine, 0);
+	for(uint64 i = 0; i < COUNT; i++){
+		uint64 key = htonll(i / 3);
+		addIndexEngineBuilder(builder, (uint8 *)&key, (uint8 *)&i);
+	}
+	assertint(1, finishIndexEngineBuilder(builder), "有序数据应该构建成功");
+	printf("批量构建%llu条用时%.3fs，深度%u\n", COUNT, (double)(clock() - start) / CLOCKS_PER_SEC, engine->treeMeta.depth);
+	uint64 key = htonll(COUNT / 6);
+	List *list = searchIndexEngine(engine, (uint8 *)&key);
+	assertuint(3, list->length, "重复的key应该都可以查到");
+	freeList(list);
+	unlink(filename);
+	clearRedoLogFile(filename);
+}
+
+//生成第i本书的标题，256字节补0的字符串key，有较长的公共前缀
+static void makeTitleKey(uint64 i, uint8 *key){
+	memset(key, 0, 256);
+	sprintf((char *)key, "the art of computer programming, volume %llu", i);
+}
+
+static int compareTitle(const void *a, const void *b){
+	return memcmp(*(char **)a, *(char **)b, 256);
+}
+
+//查找每个标题对应的值，返回错误数
+static uint32 checkTitleKeys(IndexEngine *engine, uint64 count, uint64 step){
+	uint8 key[256];
+	uint32 errors = 0;
+	for(uint64 i = 0; i < count; i += step){
+		makeTitleKey(i, key);
+		List *list = searchIndexEngine(engine, key);
+		errors += list->length != 1 || *(uint64 *)list->head->value != i;
+		freeList(list);
+	}
+	return errors;
+}
+
+void testKeyCompression(){
+	printf("====测试key压缩====\n");
+	char *filename = "test.idx";
+	char *plainFilename = "test1.idx";
+	unlink(filename);
+	clearRedoLogFile(filename);
+	unlink(plainFilename);
+	clearRedoLogFile(plainFilename);
+	const uint64 COUNT = 20000;
+	IndexEngine *engine = makeIndexEngine(filename, 256, 8, 4096, 0, 256 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	IndexEngine *plain = makeIndexEngine(plainFilename, 256, 8, 4096, 0, 256 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	uint32 plainDegree = engine->treeMeta.degree;
+	assertint(1, setIndexEngineKeyCompression(engine, 1), "空的索引应该可以设置压缩");
+	assertuint(1, engine->treeMeta.degree > plainDegree, "压缩后节点的度应该变大");
+	uint8 key[256];
+	for(uint64 i = 0; i < COUNT; i++){
+		//乱序插入
+		uint64 n = i * 7919 % COUNT;
+		makeTitleKey(n, key);
+		insertIndexEngine(engine, key, (uint8 *)&n);
+		insertIndexEngine(plain, key, (uint8 *)&n);
+	}
+	assertint(0, setIndexEngineKeyCompression(engine, 0), "非空的索引不能修改压缩设置");
+	printf("插入%llu条：压缩深度%u页数%llu，不压缩深度%u页数%llu\n", COUNT,
+		engine->treeMeta.depth, engine->usedPageCnt, plain->treeMeta.depth, plain->usedPageCnt);
+	assertuint(1, engine->treeMeta.depth < plain->treeMeta.depth, "压缩后树应该更浅");
+	assertuint(1, engine->usedPageCnt * 3 < plain->usedPageCnt, "压缩后页数应该更少");
+	assertuint(0, checkTitleKeys(engine, COUNT, 1), "压缩后查询结果应该正确");
+	makeTitleKey(COUNT / 2, key);
+	List *list = searchConditionIndexEngine(engine, key, RELOP_GTE);
+	List *plainList = searchConditionIndexEngine(plain, key, RELOP_GTE);
+	assertuint(plainList->length, list->length, "压缩后范围查询结果应该正确");
+	freeList(list);
+	freeList(plainList);
+	pthread_join(*engine->cache.persistenceThread, NULL);
+	//重新加载：从压缩的数据页中读取（重做日志中尚未写入文件的操作会丢失）
+	IndexEngine *engine1 = loadIndexEngine(filename, 256 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	assertuint(1, IS_KEY_COMPRESSION(engine1->flag), "压缩设置应该被持久化");
+	uint64 found = 0;
+	uint32 errors = 0;
+	for(uint64 i = 0; i < COUNT; i++){
+		makeTitleKey(i, key);
+		list = searchIndexEngine(engine1, key);
+		found += list->length;
+		errors += list->length > 1 || (list->length == 1 && *(uint64 *)list->head->value != i);
+		freeList(list);
+	}
+	assertuint(0, errors, "重新加载后查询结果应该正确");
+	assertulonglong(engine1->count, found, "重新加载后的数目应该正确");
+	unlink(filename);
+	clearRedoLogFile(filename);
+	unlink(plainFilename);
+	clearRedoLogFile(plainFilename);
+
+	//删除2/3，触发按字节数的均衡与合并
+	engine = makeIndexEngine(filename, 256, 8, 4096, 0, 0, operateListMaxSize, flushStrategy, flushStrategyArg);
+	setIndexEngineKeyCompression(engine, 1);
+	for(uint64 i = 0; i < COUNT; i++){
+		uint64 n = i * 7919 % COUNT;
+		makeTitleKey(n, key);
+		insertIndexEngine(engine, key, (uint8 *)&n);
+	}
+	for(uint64 i = 0; i < COUNT; i++){
+		if(i % 3 != 0){
+			makeTitleKey(i, key);
+			removeIndexEngine(engine, key, NULL);
+		}
+	}
+	assertulonglong(COUNT / 3 + 1, engine->count, "删除后的数目应该正确");
+	assertuint(0, checkTitleKeys(engine, COUNT, 3), "删除后查询结果应该正确");
+	makeTitleKey(1, key);
+	list = searchIndexEngine(engine, key);
+	assertuint(0, list->length, "删除的key应该查不到");
+	freeList(list);
+	list = searchAllIndexEngine(engine, NULL);
+	assertuint(COUNT / 3 + 1, list->length, "遍历的数目应该正确");
+	freeList(list);
+	unlink(filename);
+	clearRedoLogFile(filename);
+
+	//压缩的批量构建
+	engine = makeIndexEngine(filename, 256, 8, 4096, 1, 256 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	setIndexEngineKeyCompression(engine, 1);
+	IndexEngineBuilder *builder = makeIndexEngineBuilder(engine, 0);
+	//按字节序排序：volume 0, 1, 10, 100...
+	char **titles = (char **)malloc(sizeof(char *) * COUNT);
+	for(uint64 i = 0; i < COUNT; i++){
+		titles[i] = (char *)calloc(1, 256);
+		makeTitleKey(i, (uint8 *)titles[i]);
+	}
+	qsort(titles, COUNT, sizeof(char *), compareTitle);
+	for(uint64 i = 0; i < COUNT; i++){
+		uint64 n;
+		sscanf(titles[i], "the art of computer programming, volume %llu", &n);
+		addIndexEngineBuilder(builder, (uint8 *)titles[i], (uint8 *)&n);
+		free(titles[i]);
+	}
+	free(titles);
+	assertint(1, finishIndexEngineBuilder(builder), "有序数据应该构建成功");
+	printf("压缩的批量构建%llu条：深度%u，页数%llu\n", COUNT, engine->treeMeta.depth, engine->usedPageCnt);
+	assertuint(0, checkTitleKeys(engine, COUNT, 1), "压缩的批量构建后查询结果应该正确");
+	for(uint64 i = COUNT; i < COUNT + 1000; i++){
+		makeTitleKey(i, key);
+		insertIndexEngine(engine, key, (uint8 *)&i);
+	}
+	assertuint(0, checkTitleKeys(engine, COUNT + 1000, 1), "构建后插入的查询结果应该正确");
+	unlink(filename);
+	clearRedoLogFile(filename);
+}
+
+void testBufferPool(){
+	printf("====测试缓冲池====\n");
+	char *filename = "test.idx";
+	unlink(filename);
+	clearRedoLogFile(filename);
+	const uint64 COUNT = 20000;
+	//页大小1k，内存只能容纳约60个节点，树的深度为4
+	IndexEngine *engine = makeIndexEngine(filename, 8, 8, 1024, 0, 64 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	BufferPool *pool = engine->cache.bufferPool;
+	uint32 frames = pool->capacity;
+	printf("缓冲池%u帧，脏帧上限%u\n", frames, engine->cache.dirtyLimit);
+	assertuint(1, frames + engine->cache.dirtyLimit <= 64 * 1024 / (sizeof(IndexTreeNode) + 1024), "缓冲池和冻结的节点不应该超过内存上限");
+	uint32 errors = 0;
+	for(uint64 i = 0; i < COUNT; i++){
+		uint64 n = i * 7919 % COUNT;
+		uint64 key = htonll(n);
+		insertIndexEngine(engine, (uint8 *)&key, (uint8 *)&n);
+		errors += pool->pinnedCnt != 0;
+	}
+	assertuint(0, errors, "插入之后不应该有被固定的节点");
+	for(uint64 i = 0; i < COUNT; i += 2){
+		uint64 key = htonll(i);
+		removeIndexEngine(engine, (uint8 *)&key, NULL);
+		errors += pool->pinnedCnt != 0;
+	}
+	assertuint(0, errors, "删除之后不应该有被固定的节点");
+	for(uint64 i = 0; i < COUNT; i++){
+		uint64 key = htonll(i);
+		List *list = searchIndexEngine(engine, (uint8 *)&key);
+		errors += i % 2 ? list->length != 1 || *(uint64 *)list->head->value != i : list->length != 0;
+		freeList(list);
+	}
+	assertuint(0, errors, "查询结果应该正确");
+	uint64 key = htonll(COUNT / 2);
+	List *list = searchConditionIndexEngine(engine, (uint8 *)&key, RELOP_LT);
+	assertuint(COUNT / 4, list->length, "范围查询结果应该正确");
+	freeList(list);
+	list = searchAllIndexEngine(engine, NULL);
+	assertuint(COUNT / 2, list->length, "遍历的数目应该正确");
+	freeList(list);
+	assertuint(0, pool->pinnedCnt, "查询之后不应该有被固定的节点");
+	//相等的key跨越的叶子节点比缓冲池的帧数多：删除需要在中途冻结脏页
+	const uint64 DUP_COUNT = 4000;
+	uint64 dupKey = htonll(COUNT * 2);
+	for(uint64 i = 0; i < DUP_COUNT; i++){
+		insertIndexEngine(engine, (uint8 *)&dupKey, (uint8 *)&i);
+	}
+	assertuint(DUP_COUNT, removeIndexEngine(engine, (uint8 *)&dupKey, NULL), "应该删除所有相等的key");
+	list = searchIndexEngine(engine, (uint8 *)&dupKey);
+	assertuint(0, list->length, "相等的key应该全部被删除");
+	freeList(list);
+	assertuint(0, pool->pinnedCnt, "删除之后不应该有被固定的节点");
+	assertuint(0, pool->fullCnt, "缓冲池不应该没有可用的帧");
+	assertuint(frames, pool->capacity, "缓冲池的帧数应该不变");
+	pthread_join(*engine->cache.persistenceThread, NULL);
+	unlink(filename);
+	clearRedoLogFile(filename);
+
+	//度为3的树：顺序插入时很快变深，深度超过缓冲池能够完成一次分裂的深度后插入失败，而不是超出帧数
+	engine = makeIndexEngine(filename, 24, 8, 136, 0, 48 * (sizeof(IndexTreeNode) + 136), operateListMaxSize, flushStrategy, flushStrategyArg);
+	pool = engine->cache.bufferPool;
+	frames = pool->capacity;
+	uint8 deepKey[24] = {0};
+	int32 result = 1;
+	uint64 inserted = 0;
+	for(uint64 i = 0; i < 100000 && result == 1; i++){
+		uint64 n = htonll(i);
+		memcpy(deepKey + 16, &n, sizeof(n));
+		result = insertIndexEngine(engine, deepKey, (uint8 *)&i);
+		inserted += result == 1;
+	}
+	printf("缓冲池%u帧，插入%llu条后深度为%u\n", frames, inserted, engine->treeMeta.depth);
+	assertint(-1, result, "缓冲池容纳不下一次分裂时插入应该失败");
+	assertuint(1, engine->treeMeta.depth > INDEX_BUFFER_POOL_MIN_DEPTH, "树的深度应该超过缓冲池能容纳的深度");
+	assertuint(frames, pool->capacity, "缓冲池的帧数应该不变");
+	assertuint(0, pool->fullCnt, "缓冲池不应该没有可用的帧");
+	errors = 0;
+	for(uint64 i = 0; i < inserted; i++){
+		uint64 n = htonll(i);
+		memcpy(deepKey + 16, &n, sizeof(n));
+		list = searchIndexEngine(engine, deepKey);
+		errors += list->length != 1 || *(uint64 *)list->head->value != i;
+		freeList(list);
+	}
+	assertuint(0, errors, "插入成功的数据应该都能查到");
+	pthread_join(*engine->cache.persistenceThread, NULL);
+	unlink(filename);
+	clearRedoLogFile(filename);
+}
+
+#define CURSOR_KEY_BASE 1000
+#define CURSOR_KEY_COUNT 3000
+#define CURSOR_KEY_INFINITY 0xffffffffffffffffull
+
+//key为10的倍数时有3条记录
+static uint32 cursorDupCount(uint64 key){
+	return key % 10 == 0 ? 3 : 1;
+}
+
+/** 检查游标返回的记录：有序、在范围内、数目正确，返回错误数 */
+static uint32 checkRangeCursor(IndexEngine *engine, uint64 lower, int32 lowerInclusive, uint64 upper, int32 upperInclusive, int32 reverse, uint64 limit){
+	uint64 lowerKey = htonll(lower), upperKey = htonll(upper);
+	uint64 expect = 0;
+	for(uint64 key = CURSOR_KEY_BASE; key < CURSOR_KEY_BASE + CURSOR_KEY_COUNT; key++){
+		if((key > lower || (key == lower && lowerInclusive)) && (key < upper || (key == upper && upperInclusive))){
+			expect += cursorDupCount(key);
+		}
+	}
+	if(limit != 0 && expect > limit){
+		expect = limit;
+	}
+	IndexEngineCursor *cursor = openIndexEngineCursor(engine,
+		(uint8 *)&lowerKey, lowerInclusive, (uint8 *)&upperKey, upperInclusive, reverse, limit);
+	uint32 errors = 0;
+	uint64 count = 0, last = reverse ? CURSOR_KEY_INFINITY : 0;
+	while(nextIndexEngineCursor(cursor)){
+		uint64 key = ntohll(*(uint64 *)cursor->key);
+		errors += reverse ? key > last : key < last;
+		errors += key < lower || (key == lower && !lowerInclusive) || key > upper || (key == upper && !upperInclusive);
+		errors += *(uint64 *)cursor->value / 4 != key;
+		last = key;
+		count++;
+	}
+	closeIndexEngineCursor(cursor);
+	return errors + (count != expect);
+}
+
+void testRangeCursor(){
+	printf("====测试范围游标====\n");
+	char *filename = "test.idx";
+	unlink(filename);
+	clearRedoLogFile(filename);
+	//页大小256，每个叶子节点约15条记录
+	IndexEngine *engine = makeIndexEngine(filename, 8, 8, 256, 0, 64 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	for(uint64 i = 0; i < CURSOR_KEY_COUNT; i++){
+		uint64 n = CURSOR_KEY_BASE + i * 7919 % CURSOR_KEY_COUNT;
+		uint64 key = htonll(n);
+		for(uint64 j = 0; j < cursorDupCount(n); j++){
+			uint64 value = n * 4 + j;
+			insertIndexEngine(engine, (uint8 *)&key, (uint8 *)&value);
+		}
+	}
+	printf("树的深度%u\n", engine->treeMeta.depth);
+	const uint64 MIN = CURSOR_KEY_BASE, MAX = CURSOR_KEY_BASE + CURSOR_KEY_COUNT - 1;
+	assertuint(0, checkRangeCursor(engine, 0, 1, CURSOR_KEY_INFINITY, 1, 0, 0), "正向遍历全部");
+	assertuint(0, checkRangeCursor(engine, 0, 1, CURSOR_KEY_INFINITY, 1, 1, 0), "反向遍历全部");
+	assertuint(0, checkRangeCursor(engine, MIN + 5, 0, MIN + 10, 0, 0, 0), "开区间");
+	assertuint(0, checkRangeCursor(engine, MIN + 10, 1, MIN + 100, 1, 0, 0), "闭区间，边界有重复的key");
+	assertuint(0, checkRangeCursor(engine, MIN + 10, 0, MIN + 100, 0, 1, 0), "反向开区间，边界有重复的key");
+	assertuint(0, checkRangeCursor(engine, MIN + 500, 1, MAX, 1, 1, 0), "反向到最大的key");
+	assertuint(0, checkRangeCursor(engine, MIN, 1, MAX, 0, 0, 37), "限制数目");
+	assertuint(0, checkRangeCursor(engine, MIN + 100, 1, MAX, 1, 1, 37), "反向限制数目");
+	assertuint(0, checkRangeCursor(engine, MIN + 100, 1, MIN + 100, 1, 0, 0), "上下界相等");
+	assertuint(0, checkRangeCursor(engine, MIN + 100, 0, MIN + 100, 1, 0, 0), "空区间");
+	assertuint(0, checkRangeCursor(engine, MAX, 0, CURSOR_KEY_INFINITY, 1, 0, 0), "大于最大的key");
+	assertuint(0, checkRangeCursor(engine, 0, 1, MIN, 0, 1, 0), "小于最小的key");
+
+	//遍历期间修改：删除前面的key，在后面插入新的key（分裂叶子节点，树结构版本变化）
+	IndexEngineCursor *cursor = openIndexEngineCursor(engine, NULL, 0, NULL, 0, 0, 0);
+	uint64 count = 0, last = 0;
+	uint32 errors = 0;
+	while(nextIndexEngineCursor(cursor)){
+		uint64 key = ntohll(*(uint64 *)cursor->key);
+		errors += key < last;
+		last = key;
+		if(++count == CURSOR_KEY_COUNT / 2){
+			for(uint64 i = MIN; i < MIN + 100; i++){
+				uint64 removeKey = htonll(i);
+				removeIndexEngine(engine, (uint8 *)&removeKey, NULL);
+			}
+			for(uint64 i = MAX + 1; i <= MAX + 100; i++){
+				uint64 insertKey = htonll(i), value = i * 4;
+				insertIndexEngine(engine, (uint8 *)&insertKey, (uint8 *)&value);
+			}
+		}
+	}
+	closeIndexEngineCursor(cursor);
+	uint64 expect = 100;
+	for(uint64 key = MIN; key <= MAX; key++){
+		expect += cursorDupCount(key);
+	}
+	assertuint(0, errors, "遍历期间修改：返回的key应该有序");
+	assertulonglong(expect, count, "遍历期间修改：没有读过的新key应该返回，已经读过的key不会重复");
+	assertuint(0, engine->cache.bufferPool->pinnedCnt, "游标不应该固定节点");
+	pthread_join(*engine->cache.persistenceThread, NULL);
+	unlink(filename);
+	clearRedoLogFile(filename);
+}
+
+/** 等待预读线程处理请求，返回预读过的叶子节点数 */
+static uint64 waitReadAhead(IndexEngine *engine){
+	for(int i = 0; i < 2000 && engine->cache.readAheadCnt == 0; i++){
+		usleep(1000);
+	}
+	return engine->cache.readAheadCnt;
+}
+
+void testReadAhead(){
+	printf("====测试顺序扫描预读====\n");
+	char *filename = "test.idx";
+	unlink(filename);
+	clearRedoLogFile(filename);
+	const uint64 COUNT = 20000;
+	//页大小256，缓冲池很小，扫描的叶子节点大部分需要从文件读取
+	IndexEngine *engine = makeIndexEngine(filename, 8, 8, 256, 1, 16 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	IndexEngineBuilder *builder = makeIndexEngineBuilder(engine, 0);
+	for(uint64 i = 0; i < COUNT; i++){
+		uint64 key = htonll(i);
+		addIndexEngineBuilder(builder, (uint8 *)&key, (uint8 *)&i);
+	}
+	finishIndexEngineBuilder(builder);
+	printf("叶子节点约%llu个\n", engine->usedPageCnt);
+	assertulonglong(0, engine->cache.readAheadCnt, "扫描之前不应该预读");
+
+	List *list = searchAllIndexEngine(engine, NULL);
+	uint32 errors = list->length != COUNT;
+	uint64 expect = 0;
+	for(ListNode *node = list->head; node != NULL; node = node->next){
+		errors += *(uint64 *)node->value != expect++;
+	}
+	freeList(list);
+	assertuint(0, errors, "预读时遍历全部的结果应该正确");
+	assertbool(waitReadAhead(engine) > 0, 1, "顺序遍历应该触发预读");
+
+	//反向游标沿prev方向预读
+	engine->cache.readAheadCnt = 0;
+	IndexEngineCursor *cursor = openIndexEngineCursor(engine, NULL, 0, NULL, 0, 1, 0);
+	errors = 0;
+	expect = COUNT;
+	while(nextIndexEngineCursor(cursor)){
+		errors += *(uint64 *)cursor->value != --expect;
+	}
+	closeIndexEngineCursor(cursor);
+	assertuint(0, errors + (expect != 0), "预读时反向游标的结果应该正确");
+	assertbool(waitReadAhead(engine) > 0, 1, "反向游标应该触发预读");
+
+	//范围查询沿叶子链表遍历
+	uint64 key = htonll(COUNT / 2);
+	list = searchConditionIndexEngine(engine, (uint8 *)&key, RELOP_GTE);
+	assertuint(COUNT / 2, list->length, "预读时范围查询的结果应该正确");
+	freeList(list);
+
+	//关闭预读
+	setIndexEngineReadAhead(engine, 0);
+	usleep(100 * 1000);
+	engine->cache.readAheadCnt = 0;
+	list = searchAllIndexEngine(engine, NULL);
+	assertuint(COUNT, list->length, "关闭预读后遍历全部的结果应该正确");
+	freeList(list);
+	usleep(100 * 1000);
+	assertulonglong(0, engine->cache.readAheadCnt, "关闭预读后不应该预读");
+	assertuint(0, engine->cache.bufferPool->pinnedCnt, "预读不应该固定节点");
+	unlink(filename);
+	clearRedoLogFile(filename);
+}
+
+//生成第i个变长的key：十进制的i之后接i%16个x，256字节补0
+static void makeVariableKey(uint64 i, uint8 *key){
+	memset(key, 0, 256);
+	int len = sprintf((char *)key, "%llu", i);
+	memset(key + len, 'x', i % 16);
+}
+
+//查找每个变长key对应的值，返回错误数
+static uint32 checkVariableKeys(IndexEngine *engine, uint64 count, uint64 step){
+	uint8 key[256];
+	uint32 errors = 0;
+	for(uint64 i = 0; i < count; i += step){
+		makeVariableKey(i, key);
+		List *list = searchIndexEngine(engine, key);
+		errors += list->length != 1 || *(uint64 *)list->head->value != i;
+		freeList(list);
+	}
+	return errors;
+}
+
+//两个索引按key的顺序遍历得到的value序列是否相同，返回错误数
+static uint32 compareIndexOrder(IndexEngine *a, IndexEngine *b){
+	IndexEngineCursor *cursorA = openIndexEngineCursor(a, NULL, 0, NULL, 0, 0, 0);
+	IndexEngineCursor *cursorB = openIndexEngineCursor(b, NULL, 0, NULL, 0, 0, 0);
+	uint32 errors = 0;
+	int32 hasA, hasB;
+	while((hasA = nextIndexEngineCursor(cursorA)) & (hasB = nextIndexEngineCursor(cursorB))){
+		errors += *(uint64 *)cursorA->value != *(uint64 *)cursorB->value;
+	}
+	closeIndexEngineCursor(cursorA);
+	closeIndexEngineCursor(cursorB);
+	return errors + (hasA != hasB);
+}
+
+void testVariableKey(){
+	printf("====测试变长key====\n");
+	char *filename = "test.idx";
+	char *plainFilename = "test1.idx";
+	unlink(filename);
+	clearRedoLogFile(filename);
+	unlink(plainFilename);
+	clearRedoLogFile(plainFilename);
+	const uint64 COUNT = 20000;
+	IndexEngine *engine = makeIndexEngine(filename, 256, 8, 4096, 0, 256 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	IndexEngine *plain = makeIndexEngine(plainFilename, 256, 8, 4096, 0, 256 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	uint32 plainDegree = engine->treeMeta.degree;
+	assertint(1, setIndexEngineVariableKey(engine, 1), "空的索引应该可以设置变长key");
+	assertuint(1, engine->treeMeta.degree > plainDegree, "变长key时节点的度应该变大");
+	assertint(0, setIndexEngineKeyCompression(engine, 1), "变长key与key压缩二选一");
+	uint8 key[256];
+	for(uint64 i = 0; i < COUNT; i++){
+		//乱序插入
+		uint64 n = i * 7919 % COUNT;
+		makeVariableKey(n, key);
+		insertIndexEngine(engine, key, (uint8 *)&n);
+		insertIndexEngine(plain, key, (uint8 *)&n);
+	}
+	assertint(0, setIndexEngineVariableKey(engine, 0), "非空的索引不能修改变长key设置");
+	printf("插入%llu条：变长深度%u页数%llu，定长深度%u页数%llu\n", COUNT,
+		engine->treeMeta.depth, engine->usedPageCnt, plain->treeMeta.depth, plain->usedPageCnt);
+	assertuint(1, engine->treeMeta.depth < plain->treeMeta.depth, "变长key时树应该更浅");
+	assertuint(1, engine->usedPageCnt * 3 < plain->usedPageCnt, "变长key时页数应该更少");
+	assertuint(0, checkVariableKeys(engine, COUNT, 1), "变长key时查询结果应该正确");
+	assertuint(0, compareIndexOrder(engine, plain), "变长key时遍历顺序应该与定长相同");
+	makeVariableKey(COUNT / 2, key);
+	List *list = searchConditionIndexEngine(engine, key, RELOP_LT);
+	List *plainList = searchConditionIndexEngine(plain, key, RELOP_LT);
+	assertuint(plainList->length, list->length, "变长key时范围查询结果应该正确");
+	freeList(list);
+	freeList(plainList);
+	pthread_join(*engine->cache.persistenceThread, NULL);
+	//重新加载：从槽页中读取（重做日志中尚未写入文件的操作会丢失）
+	IndexEngine *engine1 = loadIndexEngine(filename, 256 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	assertuint(1, IS_VARIABLE_KEY(engine1->flag), "变长key设置应该被持久化");
+	uint64 found = 0;
+	uint32 errors = 0;
+	for(uint64 i = 0; i < COUNT; i++){
+		makeVariableKey(i, key);
+		list = searchIndexEngine(engine1, key);
+		found += list->length;
+		errors += list->length > 1 || (list->length == 1 && *(uint64 *)list->head->value != i);
+		freeList(list);
+	}
+	assertuint(0, errors, "重新加载后查询结果应该正确");
+	assertulonglong(engine1->count, found, "重新加载后的数目应该正确");
+	unlink(filename);
+	clearRedoLogFile(filename);
+	unlink(plainFilename);
+	clearRedoLogFile(plainFilename);
+
+	//删除2/3，触发按字节数的均衡与合并
+	engine = makeIndexEngine(filename, 256, 8, 4096, 0, 0, operateListMaxSize, flushStrategy, flushStrategyArg);
+	setIndexEngineVariableKey(engine, 1);
+	for(uint64 i = 0; i < COUNT; i++){
+		uint64 n = i * 7919 % COUNT;
+		makeVariableKey(n, key);
+		insertIndexEngine(engine, key, (uint8 *)&n);
+	}
+	for(uint64 i = 0; i < COUNT; i++){
+		if(i % 3 != 0){
+			makeVariableKey(i, key);
+			removeIndexEngine(engine, key, NULL);
+		}
+	}
+	assertulonglong(COUNT / 3 + 1, engine->count, "删除后的数目应该正确");
+	assertuint(0, checkVariableKeys(engine, COUNT, 3), "删除后查询结果应该正确");
+	list = searchAllIndexEngine(engine, NULL);
+	assertuint(COUNT / 3 + 1, list->length, "遍历的数目应该正确");
+	freeList(list);
+	unlink(filename);
+	clearRedoLogFile(filename);
+
+	//key中间有0：按补0之后的字节序比较，"ab" < "ab\0\0d" < "ab\0c" < "abc"
+	engine = makeIndexEngine(filename, 8, 8, 256, 0, 0, operateListMaxSize, flushStrategy, flushStrategyArg);
+	setIndexEngineVariableKey(engine, 1);
+	uint8 keys[4][8] = {"abc", "ab\0c", "ab", "ab\0\0d"};
+	uint64 order[4] = {3, 2, 0, 1};
+	for(uint64 i = 0; i < 4; i++){
+		insertIndexEngine(engine, keys[i], (uint8 *)&order[i]);
+	}
+	IndexEngineCursor *cursor = openIndexEngineCursor(engine, NULL, 0, NULL, 0, 0, 0);
+	errors = 0;
+	uint64 expect = 0;
+	while(nextIndexEngineCursor(cursor)){
+		errors += *(uint64 *)cursor->value != expect++;
+	}
+	closeIndexEngineCursor(cursor);
+	assertuint(0, errors + (expect != 4), "中间有0的key顺序应该正确");
+	list = searchIndexEngine(engine, keys[2]);
+	assertuint(1, list->length, "较短的key只匹配自己");
+	freeList(list);
+	unlink(filename);
+	clearRedoLogFile(filename);
+
+	//变长key的批量构建
+	engine = makeIndexEngine(filename, 256, 8, 4096, 1, 256 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	setIndexEngineVariableKey(engine, 1);
+	IndexEngineBuilder *builder = makeIndexEngineBuilder(engine, 0);
+	char **sorted = (char **)malloc(sizeof(char *) * COUNT);
+	for(uint64 i = 0; i < COUNT; i++){
+		sorted[i] = (char *)calloc(1, 256);
+		makeVariableKey(i, (uint8 *)sorted[i]);
+	}
+	qsort(sorted, COUNT, sizeof(char *), compareTitle);
+	for(uint64 i = 0; i < COUNT; i++){
+		uint64 n;
+		sscanf(sorted[i], "%llu", &n);
+		addIndexEngineBuilder(builder, (uint8 *)sorted[i], (uint8 *)&n);
+		free(sorted[i]);
+	}
+	free(sorted);
+	assertint(1, finishIndexEngineBuilder(builder), "有序数据应该构建成功");
+	printf("变长key的批量构建%llu条：深度%u，页数%llu\n", COUNT, engine->treeMeta.depth, engine->usedPageCnt);
+	assertuint(0, checkVariableKeys(engine, COUNT, 1), "变长key的批量构建后查询结果应该正确");
+	for(uint64 i = COUNT; i < COUNT + 1000; i++){
+		makeVariableKey(i, key);
+		insertIndexEngine(engine, key, (uint8 *)&i);
+	}
+	assertuint(0, checkVariableKeys(engine, COUNT + 1000, 1), "构建后插入的查询结果应该正确");
+	unlink(filename);
+	clearRedoLogFile(filename);
+}
+
+#define CONCURRENT_MAX_THREAD_COUNT 8
+#define CONCURRENT_PRELOAD_COUNT 20000
+
+typedef struct ConcurrentArgs
+{
+	IndexEngine *engine;
+	uint32 id;
+	uint32 threadCount;
+	/** 本轮写入的key从base开始 */
+	uint64 base;
+	uint32 seed;
+	uint32 ops;
+	/** 查询所占的百分比 */
+	uint32 readPercent;
+	uint32 inserted;
+	uint32 errors;
+} ConcurrentArgs;
+
+//第id个线程写入的第seq个key
+static uint64 concurrentKeyOf(ConcurrentArgs *args, uint32 seq){
+	return args->base + (uint64)seq * args->threadCount + args->id;
+}
+
+static void *concurrentWorker(void *arg){
+	ConcurrentArgs *args = (ConcurrentArgs *)arg;
+	for(uint32 i = 0; i < args->ops; i++){
+		if(rand_r(&args->seed) % 100 < args->readPercent){
+			//预先插入的key不会被修改
+			uint64 n = rand_r(&args->seed) % CONCURRENT_PRELOAD_COUNT;
+			uint64 key = htonll(n);
+			List *list = searchIndexEngine(args->engine, (uint8 *)&key);
+			args->errors += list->length != 1 || *(uint64 *)list->head->value != n;
+			freeList(list);
+			continue;
+		}
+		//插入新的key，并删除上一个偶数序号的key
+		uint32 seq = args->inserted++;
+		uint64 n = concurrentKeyOf(args, seq);
+		uint64 key = htonll(n);
+		args->errors += insertIndexEngine(args->engine, (uint8 *)&key, (uint8 *)&n) != 1;
+		if(seq % 2 == 1){
+			key = htonll(concurrentKeyOf(args, seq - 1));
+			args->errors += removeIndexEngine(args->engine, (uint8 *)&key, NULL) != 1;
+		}
+	}
+	return NULL;
+}
+
+void testConcurrentAccess(){
+	printf("====测试多线程并发访问====\n");
+	char *filename = "test.idx";
+	unlink(filename);
+	clearRedoLogFile(filename);
+	//内存较小，并发访问期间会发生淘汰和持久化
+	IndexEngine *engine = makeIndexEngine(filename, 8, 8, 1024, 1, 256 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+	for(uint64 i = 0; i < CONCURRENT_PRELOAD_COUNT; i++){
+		uint64 n = i * 7919 % CONCURRENT_PRELOAD_COUNT;
+		uint64 key = htonll(n);
+		insertIndexEngine(engine, (uint8 *)&key, (uint8 *)&n);
+	}
+	uint64 base = CONCURRENT_PRELOAD_COUNT;
+	uint64 expectCount = CONCURRENT_PRELOAD_COUNT;
+	for(uint32 threadCount = 1; threadCount <= CONCURRENT_MAX_THREAD_COUNT; threadCount *= 2){
+		pthread_t threads[CONCURRENT_MAX_THREAD_COUNT];
+		ConcurrentArgs args[CONCURRENT_MAX_THREAD_COUNT];
+		uint64 start = currentTimeMillis();
+		for(uint32 i = 0; i < threadCount; i++){
+			args[i].engine = engine;
+			args[i].id = i;
+			args[i].threadCount = threadCount;
+			args[i].base = base;
+			args[i].seed = i + 1;
+			args[i].ops = 20000;
+			args[i].readPercent = 80;
+			args[i].inserted = 0;
+			args[i].errors = 0;
+			pthread_create(&threads[i], NULL, concurrentWorker, &args[i]);
+		}
+		uint32 errors = 0;
+		uint32 maxInserted = 0;
+		for(uint32 i = 0; i < threadCount; i++){
+			pthread_join(threads[i], NULL);
+			errors += args[i].errors;
+			//奇数序号的key和最后一个偶数序号的key保留
+			expectCount += (args[i].inserted + 1) / 2;
+			maxInserted = args[i].inserted > maxInserted ? args[i].inserted : maxInserted;
+		}
+		uint64 time = currentTimeMillis() - start;
+		printf("%u个线程，每个线程%u次操作（%u%%查询），耗时%llums，吞吐量%.0f次/秒\n",
+			threadCount, args[0].ops, args[0].readPercent, time, (double)threadCount * args[0].ops * 1000 / (time ? time : 1));
+		assertuint(0, errors, "并发操作的结果应该都正确");
+		//检查写入的key
+		for(uint32 i = 0; i < threadCount; i++){
+			for(uint32 seq = 0; seq < args[i].inserted; seq++){
+				uint64 n = concurrentKeyOf(&args[i], seq);
+				uint64 key = htonll(n);
+				List *list = searchIndexEngine(engine, (uint8 *)&key);
+				int32 exist = seq % 2 == 1 || seq + 1 == args[i].inserted;
+				errors += exist ? list->length != 1 || *(uint64 *)list->head->value != n : list->length != 0;
+				freeList(list);
+			}
+		}
+		assertuint(0, errors, "并发写入之后查询结果应该正确");
+		assertulonglong(expectCount, engine->count, "并发写入之后计数应该正确");
+		List *list = searchAllIndexEngine(engine, NULL);
+		assertulonglong(expectCount, list->length, "并发写入之后遍历的数目应该正确");
+		freeList(list);
+		assertuint(0, engine->cache.bufferPool->pinnedCnt, "并发操作之后不应该有被固定的节点");
+		base += (uint64)maxInserted * threadCount + threadCount;
+	}
+	pthread_join(*engine->cache.persistenceThread, NULL);
+	unlink(filename);
+	clearRedoLogFile(filename);
+}
+
+static int32 signOf(int32 x){
+	return (x > 0) - (x < 0);
+}
+
+/** 只用少量字节值生成key，让比较经常进行到后面的字节 */
+static void makeCompareKey(uint32 len, uint8 *key){
+	static const uint8 bytes[] = {0x00, 0x01, 0x7f, 0x80, 0xff};
+	for(uint32 i = 0; i < len; i++){
+		key[i] = bytes[rand() % sizeof(bytes)];
+	}
+}
+
+/** 在keyLen字节的key的末尾4字节写入大端的n，前面补0 */
+static void makeWideKey(uint32 keyLen, uint32 n, uint8 *key){
+	memset(key, 0, keyLen);
+	uint32 value = htonl(n);
+	memcpy(key + keyLen - sizeof(value), &value, sizeof(value));
+}
+
+void testKeyCompare(){
+	printf("====测试定长key的专用比较函数====\n");
+	const uint32 lens[] = {1, 2, 3, 4, 8, 16, 64};
+	const uint32 PAIRS = 4096;
+	const uint32 ROUNDS = 2000;
+	srand(2018);
+	for(uint32 l = 0; l < sizeof(lens) / sizeof(lens[0]); l++){
+		uint32 len = lens[l];
+		uint8 *a = (uint8 *)malloc(PAIRS * len);
+		uint8 *b = (uint8 *)malloc(PAIRS * len);
+		for(uint32 i = 0; i < PAIRS; i++){
+			makeCompareKey(len, a + i * len);
+			makeCompareKey(len, b + i * len);
+			//一半的key只有最后一个字节可能不同
+			if(i % 2 == 0){
+				memcpy(b + i * len, a + i * len, len - 1);
+			}
+		}
+		KeyCompare compare = getKeyCompare(len);
+		uint32 errors = 0;
+		for(uint32 i = 0; i < PAIRS; i++){
+			if(signOf(compare(len, a + i * len, b + i * len)) != signOf(byteArrayCompare(len, a + i * len, b + i * len))){
+				errors++;
+			}
+		}
+		assertuint(0, errors, "专用比较函数的结果应该与逐字节比较相同");
+		volatile int32 sink = 0;
+		uint64 start = currentTimeMillis();
+		for(uint32 r = 0; r < ROUNDS; r++){
+			for(uint32 i = 0; i < PAIRS; i++){
+				sink += byteArrayCompare(len, a + i * len, b + i * len);
+			}
+		}
+		uint64 loopTime = currentTimeMillis() - start;
+		start = currentTimeMillis();
+		for(uint32 r = 0; r < ROUNDS; r++){
+			for(uint32 i = 0; i < PAIRS; i++){
+				sink += compare(len, a + i * len, b + i * len);
+			}
+		}
+		printf("%u字节key比较%u次：逐字节%llums，专用函数%llums\n", len, PAIRS * ROUNDS, loopTime, currentTimeMillis() - start);
+		free(a);
+		free(b);
+	}
+
+	//通过索引查找覆盖节点内查找的整字key和memcmp两条路径
+	char *filename = "test.idx";
+	const uint32 COUNT = 20000;
+	const uint32 keyLens[] = {4, 16};
+	uint8 key[16];
+	for(uint32 l = 0; l < sizeof(keyLens) / sizeof(keyLens[0]); l++){
+		uint32 keyLen = keyLens[l];
+		unlink(filename);
+		clearRedoLogFile(filename);
+		IndexEngine *engine = makeIndexEngine(filename, keyLen, 8, 1024, 1, 256 * 1024, operateListMaxSize, flushStrategy, flushStrategyArg);
+		for(uint32 i = 0; i < COUNT; i++){
+			//乱序插入偶数key
+			uint64 n = (uint64)i * 7919 % COUNT;
+			makeWideKey(keyLen, n * 2, key);
+			insertIndexEngine(engine, key, (uint8 *)&n);
+		}
+		uint32 errors = 0;
+		uint64 start = currentTimeMillis();
+		for(uint32 k = 0; k < COUNT * 2; k++){
+			makeWideKey(keyLen, k, key);
+			List *list = searchIndexEngine(engine, key);
+			int32 expect = k % 2 == 0 ? 1 : 0;
+			if(list->length != expect || (expect > 0 && *(uint64 *)list->head->value != k / 2)){
+				errors++;
+			}
+			freeList(list);
+		}
+		printf("%u字节key：查找%u次耗时%llums\n", keyLen, COUNT * 2, currentTimeMillis() - start);
+		assertuint(0, errors, "节点内查找的结果应该正确");
+		unlink(filename);
+		clearRedoLogFile(filename);
+	}
+}
+
 TESTFUNC funcs[] = {
 	testReadWriteMeta,
 	testInsertAndSearch,
@@ -311,6 +1191,15 @@ TESTFUNC funcs[] = {
 	testRemove1,
 	testRemove2,
 	testRemove3,
+	testBulkLoad,
+	testBulkLoadSpeed,
+	testKeyCompression,
+	testBufferPool,
+	testConcurrentAccess,
+	testRangeCursor,
+	testReadAhead,
+	testVariableKey,
+	testKeyCompare,
 };
 
 int main(int argc, char const *argv[])
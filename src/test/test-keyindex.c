@@ -0,0 +1,230 @@
+/**
+ * Copyright (c) 2018, rectcircle. All rights reserved.
+ *
+ * @file test-keyindex.c
+ * @author rectcircle
+ * @date 2026-10-17
+ * @version 0.0.1
+ */
+#include "keyindex.h"
+#include "hashmap.h"
+#include "test.h"
+#include "util.h"
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//生成第i个长key（超过内联长度）
+static uint32 makeLongKey(uint32 i, uint8 *key){
+	return sprintf((char *)key, "long-key-for-index-test-%010u", i);
+}
+
+static void *countEntry(uint32 keyLen, uint8 *key, RecordLocation *location, void *args){
+	(*(uint32 *)args)++;
+	return NULL;
+}
+
+void testBasic(){
+	printf("====测试插入查找删除====\n");
+	KeyIndex *index = makeKeyIndex(16);
+	uint8 longKey[64];
+	for(uint32 i = 0; i < 100; i++){
+		RecordLocation *location = putKeyIndex(index, 4, (uint8 *)&i);
+		assertulonglong(0, location->position, "新建的位置应该为0");
+		location->position = i + 1;
+		uint32 len = makeLongKey(i, longKey);
+		putKeyIndex(index, len, longKey)->position = i + 1000;
+	}
+	assertuint(200, index->size, "插入后的数目应该正确");
+	uint32 key = 7;
+	assertulonglong(8, putKeyIndex(index, 4, (uint8 *)&key)->position, "插入已存在的key应该返回已有的位置");
+	assertuint(200, index->size, "插入已存在的key数目不变");
+	uint32 errors = 0;
+	for(uint32 i = 0; i < 100; i++){
+		RecordLocation *location = getKeyIndex(index, 4, (uint8 *)&i);
+		errors += location == NULL || location->position != i + 1;
+		uint32 len = makeLongKey(i, longKey);
+		location = getKeyIndex(index, len, longKey);
+		errors += location == NULL || location->position != i + 1000;
+	}
+	assertuint(0, errors, "短key和长key都应该可以查到");
+	key = 1000;
+	assertnull(getKeyIndex(index, 4, (uint8 *)&key), "不存在的key应该返回NULL");
+	assertnull(getKeyIndex(index, 3, (uint8 *)&key), "长度不同的key应该返回NULL");
+
+	//删除后位置在回收之前仍然有效
+	key = 3;
+	RecordLocation *removed = removeKeyIndex(index, 4, (uint8 *)&key);
+	assertulonglong(4, removed->position, "删除应该返回被删除的位置");
+	assertnull(getKeyIndex(index, 4, (uint8 *)&key), "删除后应该查不到");
+	assertnull(removeKeyIndex(index, 4, (uint8 *)&key), "重复删除应该返回NULL");
+	assertulonglong(4, removed->position, "回收之前被删除的位置仍然有效");
+	uint32 count = 0;
+	foreachKeyIndex(index, countEntry, &count);
+	assertuint(199, count, "遍历的数目应该正确");
+	reclaimKeyIndex(index);
+	//回收的条目被重用
+	uint32 entryCount = index->entryCount;
+	key = 5000;
+	putKeyIndex(index, 4, (uint8 *)&key);
+	assertuint(entryCount, index->entryCount, "回收的条目应该被重用");
+	freeKeyIndex(index);
+}
+
+void testResize(){
+	printf("====测试自动扩容、缩容====\n");
+	const uint32 COUNT = 200000;
+	KeyIndex *index = makeKeyIndex(16);
+	uint8 longKey[64];
+	uint32 checkedDuringRehash = 0;
+	for(uint32 i = 0; i < COUNT; i++){
+		RecordLocation *location;
+		if(i % 4 == 0){
+			uint32 len = makeLongKey(i, longKey);
+			location = putKeyIndex(index, len, longKey);
+		} else {
+			location = putKeyIndex(index, 4, (uint8 *)&i);
+		}
+		location->position = i;
+		//rehash期间所有数据都应该可以查到
+		if(isRehashingKeyIndex(index) && i % 997 == 0){
+			uint32 errors = 0;
+			for(uint32 j = 1; j <= i; j += 101){
+				if(j % 4 == 0){
+					continue;
+				}
+				RecordLocation *found = getKeyIndex(index, 4, (uint8 *)&j);
+				errors += found == NULL || found->position != j;
+			}
+			assertuint(0, errors, "rehash期间查询结果应该正确");
+			checkedDuringRehash++;
+		}
+	}
+	printf("插入%u条后：size=%u, slotCapacity=%u, rehash期间检查%u次\n", COUNT, index->size, index->slotCapacity, checkedDuringRehash);
+	assertuint(COUNT, index->size, "插入后的数目应该正确");
+	uint32 grownCapacity = index->slotCapacity;
+	//删除大部分数据，触发缩容和arena整理
+	for(uint32 i = 0; i < COUNT; i++){
+		if(i % 20 == 0){
+			continue;
+		}
+		if(i % 4 == 0){
+			uint32 len = makeLongKey(i, longKey);
+			removeKeyIndex(index, len, longKey);
+		} else {
+			removeKeyIndex(index, 4, (uint8 *)&i);
+		}
+	}
+	while(isRehashingKeyIndex(index)){
+		uint32 key = COUNT + 1;
+		removeKeyIndex(index, 4, (uint8 *)&key);
+		getKeyIndex(index, 4, (uint8 *)&key);
+		putKeyIndex(index, 4, (uint8 *)&key);
+		removeKeyIndex(index, 4, (uint8 *)&key);
+	}
+	reclaimKeyIndex(index);
+	printf("删除后：size=%u, slotCapacity=%u, arena=%llu字节\n", index->size, index->slotCapacity, index->arenaSize);
+	assertuint(COUNT / 20, index->size, "删除后的数目应该正确");
+	assertuint(1, index->slotCapacity < grownCapacity, "删除后应该自动缩容");
+	assertuint(1, index->arenaSize < (uint64)COUNT / 4 * 32, "删除后arena应该被整理");
+	uint32 errors = 0;
+	for(uint32 i = 0; i < COUNT; i++){
+		RecordLocation *location;
+		if(i % 4 == 0){
+			uint32 len = makeLongKey(i, longKey);
+			location = getKeyIndex(index, len, longKey);
+		} else {
+			location = getKeyIndex(index, 4, (uint8 *)&i);
+		}
+		if(i % 20 == 0){
+			errors += location == NULL || location->position != i;
+		} else {
+			errors += location != NULL;
+		}
+	}
+	assertuint(0, errors, "缩容和整理后查询结果应该正确");
+	freeKeyIndex(index);
+}
+
+//与HashMap+独立分配的RecordLocation对比内存和查找速度
+void testCompare(){
+	printf("====测试与HashMap对比====\n");
+	const uint32 COUNT = 1000000;
+	struct mallinfo2 before = mallinfo2();
+	HashMap *map = makeHashMap(COUNT);
+	for(uint32 i = 0; i < COUNT; i++){
+		RecordLocation *location = (RecordLocation *)calloc(1, sizeof(RecordLocation));
+		location->position = i;
+		putHashMap(map, 4, (uint8 *)&i, location);
+	}
+	uint64 mapMemory = mallinfo2().uordblks - before.uordblks + (mallinfo2().hblkhd - before.hblkhd);
+	KeyIndex *index = makeKeyIndex(COUNT);
+	for(uint32 i = 0; i < COUNT; i++){
+		putKeyIndex(index, 4, (uint8 *)&i)->position = i;
+	}
+	uint64 indexMemory = getKeyIndexMemory(index);
+
+	uint64 sum = 0;
+	uint64 start = currentTimeMillis();
+	for(uint32 round = 0; round < 3; round++){
+		for(uint32 i = 0; i < COUNT; i++){
+			uint32 key = (i * 2654435761u) % COUNT;
+			sum += ((RecordLocation *)getHashMap(map, 4, (uint8 *)&key))->position;
+		}
+	}
+	uint64 mapTime = currentTimeMillis() - start;
+	start = currentTimeMillis();
+	for(uint32 round = 0; round < 3; round++){
+		for(uint32 i = 0; i < COUNT; i++){
+			uint32 key = (i * 2654435761u) % COUNT;
+			sum -= getKeyIndex(index, 4, (uint8 *)&key)->position;
+		}
+	}
+	uint64 indexTime = currentTimeMillis() - start;
+	printf("%u个key：HashMap %llu字节（每个key %llu字节），查找%llums\n", COUNT, mapMemory, mapMemory / COUNT, mapTime);
+	printf("%u个key：KeyIndex %llu字节（每个key %llu字节），查找%llums\n", COUNT, indexMemory, indexMemory / COUNT, indexTime);
+	assertulonglong(0, sum, "两者的查询结果应该相同");
+	assertuint(1, indexMemory * 2 <= mapMemory, "每个key占用的内存应该至少减半");
+	freeKeyIndex(index);
+	freeHashMap(map);
+}
+
+void testReclaimPrevious(){
+	printf("====测试分批回收====\n");
+	KeyIndex *index = makeKeyIndex(16);
+	for(uint32 key = 0; key < 4; key++){
+		putKeyIndex(index, 4, (uint8 *)&key)->position = key + 1;
+	}
+	uint32 key = 0;
+	RecordLocation *first = removeKeyIndex(index, 4, (uint8 *)&key);
+	uint32 entryCount = index->entryCount;
+	//第一次调用：之前删除的位置只是转入下一批，不能被重用
+	reclaimPreviousKeyIndex(index);
+	key = 100;
+	putKeyIndex(index, 4, (uint8 *)&key);
+	assertuint(entryCount + 1, index->entryCount, "第一次调用之后位置不应该被重用");
+	assertulonglong(1, first->position, "第一次调用之后被删除的位置仍然有效");
+	key = 1;
+	removeKeyIndex(index, 4, (uint8 *)&key);
+	//第二次调用：回收第一次调用之前删除的位置，之后删除的位置转入下一批
+	reclaimPreviousKeyIndex(index);
+	entryCount = index->entryCount;
+	key = 101;
+	assertuint(1, first == putKeyIndex(index, 4, (uint8 *)&key), "第二次调用之后应该重用第一批位置");
+	key = 102;
+	putKeyIndex(index, 4, (uint8 *)&key);
+	assertuint(entryCount + 1, index->entryCount, "第二批位置不应该被重用");
+	//全部回收
+	reclaimKeyIndex(index);
+	key = 103;
+	putKeyIndex(index, 4, (uint8 *)&key);
+	assertuint(entryCount + 1, index->entryCount, "reclaimKeyIndex应该回收所有批次");
+	freeKeyIndex(index);
+}
+
+int main(int argc, char const *argv[])
+{
+	launchTests(4, testBasic, testResize, testCompare, testReclaimPrevious);
+	return 0;
+}
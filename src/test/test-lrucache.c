@@ -8,6 +8,7 @@
  */
 #include "lrucache.h"
 #include "test.h"
+#include <stdlib.h>
 
 //=========test All=========
 
@@ -69,11 +70,126 @@ void testAll()
 	}
 }
 
+//=========test 2Q=========
+
+static uint32 expectedEvictedKey = 0;
+static uint32 hookErrors = 0;
+
+void checkEliminateKey(uint32 keyLen, uint8 *key, void *value){
+	//hook被调用时key必须仍然有效
+	hookErrors += *(uint32 *)key != expectedEvictedKey;
+}
+
+static void *countNode(uint32 keyLen, uint8 *key, void *value, void *args){
+	(*(uint32 *)args)++;
+	return NULL;
+}
+
+void testTwoQueue(){
+	printf("====测试2Q策略====\n");
+	//Kin=2，Kout=4
+	LRUCache *cache = makeLRUCacheWithPolicy(8, 4, TwoQueuePolicy);
+	LRUCache *lru = makeLRUCache(8, 4);
+	static uint32 values[1000];
+	for(uint32 i = 1; i <= 8; i++){
+		values[i] = i;
+		putLRUCache(cache, (uint8 *)&i, &values[i]);
+		putLRUCache(lru, (uint8 *)&i, &values[i]);
+	}
+	assertuint(8, cache->probationSize, "新数据应该进入试用队列");
+	//试用队列超过Kin，从试用队列尾部淘汰
+	uint32 key = 1;
+	assertuint(key, *(uint32 *)evictionCandidateLRUCache(cache), "应该淘汰最早进入试用队列的key");
+	getLRUCache(cache, (uint8 *)&key);
+	assertuint(key, *(uint32 *)evictionCandidateLRUCache(cache), "试用队列中的命中不应该提升");
+	expectedEvictedKey = 1;
+	key = 9;
+	values[key] = key;
+	assertuint(1, putLRUCacheWithHook(cache, (uint8 *)&key, &values[key], checkEliminateKey) == &values[1], "应该返回被淘汰的value");
+	assertuint(0, hookErrors, "hook中应该可以读取被淘汰的key");
+	assertuint(1, cache->ghost->size, "被淘汰的key应该进入幽灵队列");
+	//幽灵队列中的key再次插入时进入主队列
+	key = 1;
+	putLRUCache(cache, (uint8 *)&key, &values[key]);
+	putLRUCache(lru, (uint8 *)&key, &values[key]);
+	assertuint(7, cache->probationSize, "幽灵队列中的key应该进入主队列");
+	assertuint(1, cache->ghost->size, "进入主队列后应该从幽灵队列删除（只剩下刚淘汰的2）");
+	//扫描大量只访问一次的数据
+	for(uint32 i = 100; i < 1000; i++){
+		values[i] = i;
+		putLRUCache(cache, (uint8 *)&i, &values[i]);
+		putLRUCache(lru, (uint8 *)&i, &values[i]);
+	}
+	assertuint(1, getLRUCache(cache, (uint8 *)&key) == &values[1], "2Q主队列中的数据不应该被扫描冲掉");
+	assertnull(getLRUCache(lru, (uint8 *)&key), "LRU中的数据会被扫描冲掉");
+	assertuint(7, cache->probationSize, "扫描只会替换试用队列中的数据");
+	uint32 count = 0;
+	foreachLRUCache(cache, countNode, &count);
+	assertuint(cache->size, count, "遍历应该包括主队列和试用队列");
+	key = 999;
+	assertuint(1, removeLRUCache(cache, (uint8 *)&key) == &values[key], "应该可以删除试用队列中的数据");
+	assertuint(6, cache->probationSize, "删除后试用队列数目应该减少");
+	clearLRUCache(cache);
+	assertuint(0, cache->size + cache->probationSize + cache->ghost->size, "清空后所有队列都应该为空");
+	freeLRUCache(cache);
+	freeLRUCache(lru);
+}
+
+//=========test 命中率=========
+
+//模拟旁路缓存：查询不命中时插入，返回命中次数
+static uint32 accessCache(LRUCache *cache, uint32 key){
+	if(getLRUCache(cache, (uint8 *)&key) != NULL){
+		return 1;
+	}
+	putLRUCache(cache, (uint8 *)&key, cache);
+	return 0;
+}
+
+//热点数据访问中穿插全表扫描；scanLen为0时只有热点访问
+static void compareHitRatio(const char *name, uint32 hotKeys, uint32 keySpace, uint32 scanLen, uint32 *lruHits, uint32 *twoQueueHits){
+	const uint32 CAPACITY = 1000;
+	const uint32 ACCESSES = 200000;
+	LRUCache *lru = makeLRUCache(CAPACITY, 4);
+	LRUCache *twoQueue = makeLRUCacheWithPolicy(CAPACITY, 4, TwoQueuePolicy);
+	uint32 scanKey = keySpace;
+	*lruHits = *twoQueueHits = 0;
+	srand(1);
+	for(uint32 i = 0; i < ACCESSES; i++){
+		uint32 key;
+		if(scanLen > 0 && i % 10000 < scanLen){
+			//扫描访问的都是只出现一次的key
+			key = scanKey++;
+		} else {
+			key = rand() % keySpace;
+			//80%的访问落在热点数据上
+			if(rand() % 10 < 8){
+				key %= hotKeys;
+			}
+		}
+		*lruHits += accessCache(lru, key);
+		*twoQueueHits += accessCache(twoQueue, key);
+	}
+	printf("%s：LRU命中率%.2f%%，2Q命中率%.2f%%\n", name,
+		   *lruHits * 100.0 / ACCESSES, *twoQueueHits * 100.0 / ACCESSES);
+	freeLRUCache(lru);
+	freeLRUCache(twoQueue);
+}
+
+void testHitRatio(){
+	printf("====测试LRU与2Q的命中率====\n");
+	uint32 lruHits, twoQueueHits;
+	compareHitRatio("热点访问", 700, 5000, 0, &lruHits, &twoQueueHits);
+	assertuint(1, twoQueueHits >= lruHits * 9 / 10, "没有扫描时2Q的命中率不应该明显低于LRU");
+	compareHitRatio("热点访问+扫描", 700, 5000, 2000, &lruHits, &twoQueueHits);
+	assertuint(1, twoQueueHits > lruHits * 11 / 10, "有扫描时2Q的命中率应该明显高于LRU");
+}
+
 #include <stdio.h>
 int main(int argc, char const *argv[])
 {
 	printf("=========test All=========\n");
-	launchTests(1, testAll);
+	launchTests(3, testAll, testTwoQueue, testHitRatio);
 	return 0;
 }
 
@@ -11,6 +11,7 @@
 #include "redolog.h"
 #include "indexengine.h"
 #include <unistd.h>
+#include <fcntl.h>
 
 void demoPersistenceFunction(struct RedoLog* redoLog, struct OperateTuple *op){
 	if(op->type == OPERATETUPLE_TYPE_INSERT){
@@ -194,6 +195,35 @@ void testForceFree(){
 	forceFreeRedoLog(redoLog);
 }
 
+/** 将key序列化到组缓冲区 */
+void bufferPersistenceFunction(struct RedoLog* redoLog, struct OperateTuple *op){
+	uint8 *p = reserveRedoLogBuffer(redoLog, sizeof(uint64));
+	memcpy(p, op->objects->head->value, sizeof(uint64));
+}
+
+void testWriteFailure(){
+	char* filename = "test.redolog";
+	unlink(filename);
+	RedoLog *redoLog = makeRedoLog(filename, NULL, 0, (RedoPersistenceFunction)bufferPersistenceFunction, (FreeOperateTupleFunction)demoFreeOperateTuple, synchronize, 0);
+	printf("===测试写入失败===\n");
+	uint64 *key, *value;
+	uint64 input = 1;
+	newAndCopyByteArray((uint8 **)&key, (uint8 *)&input, sizeof(input));
+	newAndCopyByteArray((uint8 **)&value, (uint8 *)&input, sizeof(input));
+	assertint(1, appendRedoLog(redoLog, makeIndexEngineOperateTuple(&testEngine, 1, key, value)), "正常写入返回1");
+	//写入/dev/full返回ENOSPC，模拟磁盘已满
+	int full = open("/dev/full", O_WRONLY);
+	dup2(full, redoLog->fd);
+	close(full);
+	for(input = 2; input <= 4; input++){
+		newAndCopyByteArray((uint8 **)&key, (uint8 *)&input, sizeof(input));
+		newAndCopyByteArray((uint8 **)&value, (uint8 *)&input, sizeof(input));
+		assertint(0, appendRedoLog(redoLog, makeIndexEngineOperateTuple(&testEngine, 1, key, value)), "写入失败后返回0");
+	}
+	assertint(1, redoLog->failed, "日志标记为失败");
+	freeRedoLog(redoLog);
+}
+
 TESTFUNC funcs[] = {
 	init,
 	testSynchronize,
@@ -202,6 +232,7 @@ TESTFUNC funcs[] = {
 	// testPersistence,
 	testOperateListMaxSize,
 	testForceFree,
+	testWriteFailure,
 };
 
 int main(int argc, char const *argv[])
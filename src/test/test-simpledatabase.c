@@ -309,6 +309,20 @@ void testInsertAndQueryTable(){
 	cond.relOp = RELOP_GTE;
 	result = searchRecord(dbms, databasename, tablename, conds);
 	showRecords(dbms, fields, result);
+	assertuint(7, result->length, "id >= 4");
+	//同一个索引字段上的条件合并为一次范围扫描
+	uint64 maxId = 8;
+	QueryCondition cond1 ={
+		"id",
+		RELOP_LT,
+		&maxId,
+		LOGOP_AND
+	};
+	cond.relOp = RELOP_GT;
+	addList(conds, &cond1);
+	result = searchRecord(dbms, databasename, tablename, conds);
+	showRecords(dbms, fields, result);
+	assertuint(3, result->length, "id > 4 and id < 8");
 }
 
 TESTFUNC funcs[] = {
@@ -23,6 +23,85 @@ int32 byteArrayCompare(uint32 len, uint8* a, uint8* b){
 	return 0;
 }
 
+/*****************************************************************************
+ * getKeyCompare
+ ******************************************************************************/
+
+/** 大端整数转为主机字节序：gcc内建的字节交换在不开优化时也不会产生函数调用（ntohl会） */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define KEY_WORD(bits, x) __builtin_bswap##bits(x)
+#else
+#define KEY_WORD(bits, x) (x)
+#endif
+
+uint64 loadKeyWord(uint32 len, uint8 *key){
+	uint16 u16;
+	uint32 u32;
+	uint64 u64;
+	switch(len){
+	case 1:
+		return key[0];
+	case 2:
+		memcpy(&u16, key, sizeof(u16));
+		return KEY_WORD(16, u16);
+	case 4:
+		memcpy(&u32, key, sizeof(u32));
+		return KEY_WORD(32, u32);
+	default:
+		memcpy(&u64, key, sizeof(u64));
+		return KEY_WORD(64, u64);
+	}
+}
+
+static int32 compareKey1(uint32 len, uint8 *a, uint8 *b){
+	return (int32)a[0] - (int32)b[0];
+}
+
+static int32 compareKey2(uint32 len, uint8 *a, uint8 *b){
+	uint16 x, y;
+	memcpy(&x, a, sizeof(x));
+	memcpy(&y, b, sizeof(y));
+	return (int32)KEY_WORD(16, x) - (int32)KEY_WORD(16, y);
+}
+
+/** 4字节以上的差值会溢出int32，用两次比较得到符号 */
+static int32 compareKey4(uint32 len, uint8 *a, uint8 *b){
+	uint32 x, y;
+	memcpy(&x, a, sizeof(x));
+	memcpy(&y, b, sizeof(y));
+	x = KEY_WORD(32, x);
+	y = KEY_WORD(32, y);
+	return (x > y) - (x < y);
+}
+
+static int32 compareKey8(uint32 len, uint8 *a, uint8 *b){
+	uint64 x, y;
+	memcpy(&x, a, sizeof(x));
+	memcpy(&y, b, sizeof(y));
+	x = KEY_WORD(64, x);
+	y = KEY_WORD(64, y);
+	return (x > y) - (x < y);
+}
+
+static int32 compareKeyBytes(uint32 len, uint8 *a, uint8 *b){
+	return memcmp(a, b, len);
+}
+
+KeyCompare getKeyCompare(uint32 len){
+	switch(len){
+	case 1:
+		return compareKey1;
+	case 2:
+		return compareKey2;
+	case 4:
+		return compareKey4;
+	case 8:
+		return compareKey8;
+	default:
+		return compareKeyBytes;
+	}
+}
+
 /*****************************************************************************
  * batchInsertToArray
  ******************************************************************************/